@@ -0,0 +1,99 @@
+#!/usr/bin/env python2
+# Copyright (c) 2017-2019 The USD Coin developers
+# Distributed under the MIT/X11 software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the address, spent and timestamp indexes as blocks are connected
+# and disconnected
+#
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import AuthServiceProxy, JSONRPCException
+from util import *
+
+COIN = 100000000
+
+class AddressIndexTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = []
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-addressindex", "-spentindex", "-timestampindex"]))
+        self.nodes.append(start_node(1, self.options.tmpdir))
+        connect_nodes(self.nodes[0], 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def output_index(self, txid, address):
+        tx = self.nodes[0].getrawtransaction(txid, 1)
+        for out in tx["vout"]:
+            if address in out["scriptPubKey"].get("addresses", []):
+                return out["n"]
+        raise AssertionError("no output to " + address)
+
+    def run_test(self):
+        # The indexes are off unless asked for
+        assert_raises(JSONRPCException, self.nodes[1].getaddressbalance, {"addresses": [self.nodes[1].getnewaddress()]})
+        assert_raises(JSONRPCException, self.nodes[1].getspentinfo, {"txid": "00" * 32, "index": 0})
+        assert_raises(JSONRPCException, self.nodes[1].getblockhashes, 2000000000, 0)
+
+        self.nodes[0].setgenerate(True, 30)
+        self.sync_all()
+
+        # Credit an address
+        address = self.nodes[1].getnewaddress()
+        query = {"addresses": [address]}
+        txid = self.nodes[0].sendtoaddress(address, 10)
+        self.nodes[0].setgenerate(True, 1)
+        self.sync_all()
+        n = self.output_index(txid, address)
+
+        balance = self.nodes[0].getaddressbalance(query)
+        assert_equal(balance["balance"], 10 * COIN)
+        assert_equal(balance["received"], 10 * COIN)
+        utxos = self.nodes[0].getaddressutxos(query)
+        assert_equal(len(utxos), 1)
+        assert_equal(utxos[0]["address"], address)
+        assert_equal(utxos[0]["txid"], txid)
+        assert_equal(utxos[0]["outputIndex"], n)
+        assert_equal(utxos[0]["satoshis"], 10 * COIN)
+        assert_equal(self.nodes[0].getaddresstxids(query), [txid])
+        assert_raises(JSONRPCException, self.nodes[0].getspentinfo, {"txid": txid, "index": n})
+
+        # Spend it
+        spendtxid = self.nodes[1].sendtoaddress(self.nodes[0].getnewaddress(), 5)
+        self.nodes[0].setgenerate(True, 1)
+        self.sync_all()
+        tip = self.nodes[0].getbestblockhash()
+        tiptime = self.nodes[0].getblock(tip)["time"]
+
+        assert_equal(self.nodes[0].getaddressbalance(query)["balance"], 0)
+        assert_equal(self.nodes[0].getaddressbalance(query)["received"], 10 * COIN)
+        assert_equal(self.nodes[0].getaddressutxos(query), [])
+        assert_equal(self.nodes[0].getaddresstxids(query), [txid, spendtxid])
+        spent = self.nodes[0].getspentinfo({"txid": txid, "index": n})
+        assert_equal(spent["txid"], spendtxid)
+        assert_equal(spent["height"], self.nodes[0].getblockcount())
+        assert(tip in self.nodes[0].getblockhashes(tiptime, tiptime))
+
+        # Disconnecting the spending block undoes its entries
+        self.nodes[0].invalidateblock(tip)
+        assert_equal(self.nodes[0].getaddressbalance(query)["balance"], 10 * COIN)
+        assert_equal(len(self.nodes[0].getaddressutxos(query)), 1)
+        assert_equal(self.nodes[0].getaddresstxids(query), [txid])
+        assert_raises(JSONRPCException, self.nodes[0].getspentinfo, {"txid": txid, "index": n})
+        assert(tip not in self.nodes[0].getblockhashes(tiptime, tiptime))
+
+        # And reconnecting it restores them
+        self.nodes[0].reconsiderblock(tip)
+        assert_equal(self.nodes[0].getbestblockhash(), tip)
+        assert_equal(self.nodes[0].getaddressbalance(query)["balance"], 0)
+        assert_equal(self.nodes[0].getspentinfo({"txid": txid, "index": n})["txid"], spendtxid)
+        assert(tip in self.nodes[0].getblockhashes(tiptime, tiptime))
+        print "Success"
+
+if __name__ == '__main__':
+    AddressIndexTest().main()
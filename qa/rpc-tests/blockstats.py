@@ -0,0 +1,78 @@
+#!/usr/bin/env python2
+# Copyright (c) 2017-2019 The USD Coin developers
+# Distributed under the MIT/X11 software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test getblockstats and getfeeinfo with the block stats index on, off, and
+# turned on without a reindex
+#
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import AuthServiceProxy, JSONRPCException
+from util import *
+from decimal import Decimal
+
+class BlockStatsTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = []
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-blockstatsindex"]))
+        self.nodes.append(start_node(1, self.options.tmpdir))
+        connect_nodes(self.nodes[0], 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def mine_transactions(self, count):
+        fees = Decimal(0)
+        for i in range(count):
+            txid = self.nodes[0].sendtoaddress(self.nodes[1].getnewaddress(), 1 + i)
+            fees -= self.nodes[0].gettransaction(txid)["fee"]
+        self.nodes[0].setgenerate(True, 1)
+        self.sync_all()
+        return fees
+
+    def compare_nodes(self, blocks):
+        # Both nodes agree, whether the stats come from the index or from disk
+        height = self.nodes[0].getblockcount()
+        for h in range(height + 1):
+            assert_equal(self.nodes[0].getblockstats(h), self.nodes[1].getblockstats(h))
+        assert_equal(self.nodes[0].getfeeinfo(blocks), self.nodes[1].getfeeinfo(blocks))
+
+    def run_test(self):
+        self.nodes[0].setgenerate(True, 30)
+        self.sync_all()
+        fees = self.mine_transactions(3)
+
+        tip = self.nodes[0].getbestblockhash()
+        stats = self.nodes[0].getblockstats(self.nodes[0].getblockcount())
+        assert_equal(stats["blockhash"], tip)
+        assert_equal(stats["txcount"], 3)
+        assert_equal(stats["totalfee"], fees)
+        assert(stats["minfeerate"] <= stats["feerate_percentiles"][2] <= stats["maxfeerate"])
+        assert_equal(self.nodes[0].getblockstats(tip), stats)
+        assert_equal(self.nodes[1].getblockstats(tip), stats)
+        assert_raises(JSONRPCException, self.nodes[0].getblockstats, self.nodes[0].getblockcount() + 1)
+
+        feeinfo = self.nodes[0].getfeeinfo(5)
+        assert_equal(feeinfo["txcount"], 3)
+        assert_equal(feeinfo["txbytes"], stats["txbytes"])
+        assert_equal(Decimal(feeinfo["ttlfee"]), fees)
+        assert_raises(JSONRPCException, self.nodes[0].getfeeinfo, self.nodes[0].getblockcount())
+        self.compare_nodes(5)
+
+        # Turning the index on later needs no reindex; older blocks are
+        # computed from disk and new ones are indexed
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-blockstatsindex"])
+        connect_nodes(self.nodes[0], 1)
+        self.mine_transactions(2)
+        self.compare_nodes(10)
+        assert_equal(self.nodes[1].getfeeinfo(10)["txcount"], 5)
+        print "Success"
+
+if __name__ == '__main__':
+    BlockStatsTest().main()
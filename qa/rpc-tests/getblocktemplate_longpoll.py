@@ -50,7 +50,7 @@ class GetBlockTemplateLPTest(BitcoinTestFramework):
     '''
 
     def run_test(self):
-        print "Warning: this test will take about 70 seconds in the best case. Be patient."
+        print "Warning: this test will take about 60 seconds in the best case. Be patient."
         self.nodes[0].setgenerate(True, 10)
         templat = self.nodes[0].getblocktemplate()
         longpollid = templat['longpollid']
@@ -78,14 +78,47 @@ class GetBlockTemplateLPTest(BitcoinTestFramework):
         thr.join(5)  # wait 5 seconds or until thread exits
         assert(not thr.is_alive())
 
-        # Test 4: test that introducing a new transaction into the mempool will terminate the longpoll
+        # Test 4: test that a transaction raising the template fees by more than
+        # the relay fee for 1 kB terminates the longpoll, without a new block
         thr = LongpollThread(self.nodes[0])
         thr.start()
-        # generate a random transaction and submit it
-        (txid, txhex, fee) = random_transaction(self.nodes, Decimal("1.1"), Decimal("0.0"), Decimal("0.001"), 20)
-        # after one minute, every 10 seconds the mempool is probed, so in 80 seconds it should have returned
-        thr.join(60 + 20)
+        tip = self.nodes[0].getbestblockhash()
+        (txid, txhex, fee) = random_transaction([self.nodes[0]], Decimal("1.1"), Decimal("0.001"), Decimal("0.001"), 20)
+        # the template is patched about a second after the transaction arrives
+        thr.join(10)
         assert(not thr.is_alive())
+        assert_equal(self.nodes[0].getbestblockhash(), tip)
+        assert(txid in [tx['hash'] for tx in self.nodes[0].getblocktemplate()['transactions']])
+
+        # Test 5: test that a transaction raising the fees by less than 10% and
+        # less than the relay fee for 1 kB does not terminate the longpoll
+        thr = LongpollThread(self.nodes[0])
+        thr.start()
+        random_transaction([self.nodes[0]], Decimal("1.1"), Decimal("0.00008"), Decimal("0.0"), 0)
+        thr.join(10)
+        assert(thr.is_alive())
+        self.nodes[0].setgenerate(True, 1)
+        thr.join(5)
+        assert(not thr.is_alive())
+
+        # Test 6: test that waiting longpolls are parked and do not hold on to
+        # the RPC threads, so more of them than there are threads all wait and
+        # other calls are still answered
+        stop_node(self.nodes[0], 0)
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-rpcthreads=1"])
+        connect_nodes_bi(self.nodes, 0, 1)
+        sync_blocks(self.nodes)
+        thrs = [LongpollThread(self.nodes[0]) for i in range(3)]
+        for thr in thrs:
+            thr.start()
+        time.sleep(5)
+        assert_equal(self.nodes[0].getblockcount(), self.nodes[1].getblockcount())
+        for thr in thrs:
+            assert(thr.is_alive())
+        self.nodes[1].setgenerate(True, 1)
+        for thr in thrs:
+            thr.join(10)
+            assert(not thr.is_alive())
 
 if __name__ == '__main__':
     GetBlockTemplateLPTest().main()
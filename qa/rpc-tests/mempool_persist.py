@@ -0,0 +1,64 @@
+#!/usr/bin/env python2
+# Copyright (c) 2017-2019 The USD Coin developers
+# Distributed under the MIT/X11 software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test that the mempool is saved at shutdown and reloaded at startup, and
+# that -persistmempool=0 turns this off, while the other node keeps
+# connecting blocks
+#
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import AuthServiceProxy, JSONRPCException
+from util import *
+import os.path
+import time
+
+class MempoolPersistTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = start_nodes(2, self.options.tmpdir)
+        connect_nodes(self.nodes[0], 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def wait_for_mempool(self, node, size):
+        for i in range(100):
+            if len(node.getrawmempool()) == size:
+                return
+            time.sleep(0.1)
+        assert_equal(len(node.getrawmempool()), size)
+
+    def run_test(self):
+        self.nodes[0].setgenerate(True, 30)
+        self.sync_all()
+        txids = [self.nodes[0].sendtoaddress(self.nodes[0].getnewaddress(), 1) for i in range(5)]
+        assert_equal(sorted(self.nodes[0].getrawmempool()), sorted(txids))
+
+        stop_nodes(self.nodes)
+        wait_bitcoinds()
+        assert(os.path.isfile(os.path.join(self.options.tmpdir, "node0", "regtest", "mempool.dat")))
+
+        # The reload runs in the background, with script check threads, while
+        # the other node mines blocks that the reloading node connects
+        self.nodes[0] = start_node(0, self.options.tmpdir, ["-par=4"])
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-persistmempool=0"])
+        connect_nodes(self.nodes[1], 0)
+        self.nodes[1].setgenerate(True, 5)
+        sync_blocks(self.nodes)
+        self.wait_for_mempool(self.nodes[0], 5)
+        assert_equal(sorted(self.nodes[0].getrawmempool()), sorted(txids))
+        assert_equal(len(self.nodes[1].getrawmempool()), 0)
+
+        # The reloaded transactions are mined as usual
+        self.nodes[0].setgenerate(True, 1)
+        sync_blocks(self.nodes)
+        assert_equal(len(self.nodes[0].getrawmempool()), 0)
+        print "Success"
+
+if __name__ == '__main__':
+    MempoolPersistTest().main()
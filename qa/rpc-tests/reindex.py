@@ -4,7 +4,8 @@
 # file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #
-# Test -reindex with CheckBlockIndex
+# Test -reindex (with one and with several reader threads) and
+# -reindex-chainstate with CheckBlockIndex
 #
 from test_framework import BitcoinTestFramework
 from bitcoinrpc.authproxy import AuthServiceProxy, JSONRPCException
@@ -22,12 +23,30 @@ class ReindexTest(BitcoinTestFramework):
         self.is_network_split = False
         self.nodes.append(start_node(0, self.options.tmpdir))
 
-    def run_test(self):
-        self.nodes[0].generate(3)
+    def restart_and_compare(self, extra_args, height, besthash, utxoinfo):
         stop_node(self.nodes[0], 0)
         wait_bitcoinds()
-        self.nodes[0]=start_node(0, self.options.tmpdir, ["-debug", "-reindex", "-checkblockindex=1"])
-        assert_equal(self.nodes[0].getblockcount(), 3)
+        self.nodes[0]=start_node(0, self.options.tmpdir, ["-debug", "-checkblockindex=1"] + extra_args)
+        assert_equal(self.nodes[0].getblockcount(), height)
+        assert_equal(self.nodes[0].getbestblockhash(), besthash)
+        assert_equal(self.nodes[0].gettxoutsetinfo()["muhash"], utxoinfo["muhash"])
+        assert_equal(self.nodes[0].gettxoutsetinfo(True)["hash_serialized"], utxoinfo["hash_serialized"])
+
+    def run_test(self):
+        # Enough blocks for the header hashing on reindex to fill whole
+        # batches of lanes as well as a partial one at the end of the file
+        self.nodes[0].setgenerate(True, 11)
+        height = self.nodes[0].getblockcount()
+        besthash = self.nodes[0].getbestblockhash()
+        utxoinfo = self.nodes[0].gettxoutsetinfo(True)
+
+        self.restart_and_compare(["-reindex", "-reindexthreads=1"], height, besthash, utxoinfo)
+        self.restart_and_compare(["-reindex", "-reindexthreads=4"], height, besthash, utxoinfo)
+        self.restart_and_compare(["-reindex-chainstate"], height, besthash, utxoinfo)
+
+        # The node keeps working after a chainstate rebuild
+        self.nodes[0].setgenerate(True, 1)
+        assert_equal(self.nodes[0].getblockcount(), height + 1)
         print "Success"
 
 if __name__ == '__main__':
@@ -0,0 +1,109 @@
+#!/usr/bin/env python2
+# Copyright (c) 2017-2019 The USD Coin developers
+# Distributed under the MIT/X11 software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test dumptxoutset and loadtxoutset: a round trip to a fresh node, and
+# snapshots with a wrong block hash or cut short
+#
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import AuthServiceProxy, JSONRPCException
+from util import *
+import hashlib
+import os
+import subprocess
+
+# Magic, version, network, base block hash and height
+HEADER_SIZE = 4 + 4 + 4 + 32 + 4
+
+def snapshot_hash(data):
+    return hashlib.sha256(hashlib.sha256(data).digest()).digest()[::-1].encode('hex')
+
+class TxOutSetSnapshotTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = start_nodes(2, self.options.tmpdir)
+        self.is_network_split = True
+
+    def write_snapshot(self, name, data):
+        path = os.path.join(self.options.tmpdir, name)
+        with open(path, 'wb') as f:
+            f.write(data)
+        return path, snapshot_hash(data)
+
+    def assert_load_fails(self, path, hash, message):
+        try:
+            self.nodes[1].loadtxoutset(path, hash)
+        except JSONRPCException as e:
+            assert message in e.error['message'], e.error['message']
+        else:
+            raise AssertionError("loadtxoutset accepted " + path)
+
+    def run_test(self):
+        self.nodes[0].setgenerate(True, 25)
+        besthash = self.nodes[0].getbestblockhash()
+        utxoinfo = self.nodes[0].gettxoutsetinfo()
+
+        dump = self.nodes[0].dumptxoutset("utxo.dat")
+        assert_equal(dump["bestblock"], besthash)
+        assert_equal(dump["height"], 25)
+        assert_equal(dump["coins"], utxoinfo["txouts"])
+        assert_raises(JSONRPCException, self.nodes[0].dumptxoutset, "utxo.dat")
+        with open(dump["path"], 'rb') as f:
+            data = f.read()
+        assert_equal(snapshot_hash(data), dump["hash"])
+
+        # The file must match the hash passed in
+        self.assert_load_fails(dump["path"], "00" * 32, "does not match the expected")
+
+        # A block index entry whose fields do not hash to its block hash
+        corrupt = bytearray(data)
+        corrupt[HEADER_SIZE] ^= 1
+        path, hash = self.write_snapshot("wronghash.dat", bytes(corrupt))
+        self.assert_load_fails(path, hash, "does not match its hash")
+
+        # A file cut short in the block index is rejected before anything changes
+        path, hash = self.write_snapshot("shortindex.dat", data[:HEADER_SIZE + 100])
+        self.assert_load_fails(path, hash, "invalid snapshot")
+        assert_equal(self.nodes[1].getblockcount(), 0)
+
+        # A file cut short in the unspent outputs fails part way through the
+        # load, which stops the node...
+        path, hash = self.write_snapshot("shortcoins.dat", data[:-10])
+        self.assert_load_fails(path, hash, "failed to load snapshot")
+        bitcoind_processes[1].wait()
+        del bitcoind_processes[1]
+
+        # ...and it refuses to start on the partial chainstate
+        datadir = os.path.join(self.options.tmpdir, "node1")
+        devnull = open(os.devnull, "w")
+        ret = subprocess.call([os.getenv("BITCOIND", "unitedstatedollarcryptod"), "-datadir="+datadir, "-discover=0"],
+                              stdout=devnull, stderr=devnull)
+        devnull.close()
+        assert ret != 0
+
+        # After a reindex the snapshot loads and matches the node it was taken from
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-reindex"])
+        assert_equal(self.nodes[1].getblockcount(), 0)
+        load = self.nodes[1].loadtxoutset(dump["path"], dump["hash"])
+        assert_equal(load["bestblock"], besthash)
+        assert_equal(load["height"], 25)
+        assert_equal(load["coins"], utxoinfo["txouts"])
+        assert_equal(self.nodes[1].getbestblockhash(), besthash)
+        assert_equal(self.nodes[1].gettxoutsetinfo()["muhash"], utxoinfo["muhash"])
+        self.assert_load_fails(dump["path"], dump["hash"], "fresh chainstate")
+
+        # The node carries on validating from the snapshot block
+        connect_nodes(self.nodes[1], 0)
+        self.nodes[0].setgenerate(True, 2)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[1].getbestblockhash(), self.nodes[0].getbestblockhash())
+        print "Success"
+
+if __name__ == '__main__':
+    TxOutSetSnapshotTest().main()
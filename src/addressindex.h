@@ -0,0 +1,149 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "crypto/common.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+
+/** Default for -addressindex */
+static const bool DEFAULT_ADDRESSINDEX = false;
+
+//! Kinds of address in the address index
+enum {
+    ADDRESS_TYPE_PUBKEYHASH = 1,
+    ADDRESS_TYPE_SCRIPTHASH = 2,
+};
+
+/**
+ * One credit to or debit from an address. Heights are serialized big-endian
+ * so that the entries of an address are iterated in block order.
+ * Value: the amount, negative for a debit.
+ */
+struct CAddressIndexKey {
+    unsigned char type;
+    uint160 hashBytes;
+    int blockHeight;
+    unsigned int txindex; //!< position of the transaction in its block
+    uint256 txhash;
+    unsigned int index; //!< output index for a credit, input index for a debit
+    bool spending;
+
+    CAddressIndexKey() : type(0), blockHeight(0), txindex(0), index(0), spending(false) {}
+    CAddressIndexKey(unsigned char typeIn, const uint160& hashBytesIn, int blockHeightIn, unsigned int txindexIn, const uint256& txhashIn, unsigned int indexIn, bool spendingIn)
+        : type(typeIn), hashBytes(hashBytesIn), blockHeight(blockHeightIn), txindex(txindexIn), txhash(txhashIn), index(indexIn), spending(spendingIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const { return 66; }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        unsigned char buf[4];
+        ::Serialize(s, type, nType, nVersion);
+        ::Serialize(s, hashBytes, nType, nVersion);
+        WriteBE32(buf, blockHeight);
+        s.write((const char*)buf, 4);
+        WriteBE32(buf, txindex);
+        s.write((const char*)buf, 4);
+        ::Serialize(s, txhash, nType, nVersion);
+        ::Serialize(s, index, nType, nVersion);
+        ::Serialize(s, spending, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        unsigned char buf[4];
+        ::Unserialize(s, type, nType, nVersion);
+        ::Unserialize(s, hashBytes, nType, nVersion);
+        s.read((char*)buf, 4);
+        blockHeight = ReadBE32(buf);
+        s.read((char*)buf, 4);
+        txindex = ReadBE32(buf);
+        ::Unserialize(s, txhash, nType, nVersion);
+        ::Unserialize(s, index, nType, nVersion);
+        ::Unserialize(s, spending, nType, nVersion);
+    }
+};
+
+/** Prefix of the address index entries of one address, optionally from a height on, to seek to. */
+struct CAddressIndexIteratorKey {
+    unsigned char type;
+    uint160 hashBytes;
+    bool fHeight;
+    int blockHeight;
+
+    CAddressIndexIteratorKey(unsigned char typeIn, const uint160& hashBytesIn) : type(typeIn), hashBytes(hashBytesIn), fHeight(false), blockHeight(0) {}
+    CAddressIndexIteratorKey(unsigned char typeIn, const uint160& hashBytesIn, int blockHeightIn) : type(typeIn), hashBytes(hashBytesIn), fHeight(true), blockHeight(blockHeightIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const { return fHeight ? 25 : 21; }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, type, nType, nVersion);
+        ::Serialize(s, hashBytes, nType, nVersion);
+        if (fHeight) {
+            unsigned char buf[4];
+            WriteBE32(buf, blockHeight);
+            s.write((const char*)buf, 4);
+        }
+    }
+};
+
+/**
+ * An unspent output paying to an address.
+ * Value: CAddressUnspentValue
+ */
+struct CAddressUnspentKey {
+    unsigned char type;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int index;
+
+    CAddressUnspentKey() : type(0), index(0) {}
+    CAddressUnspentKey(unsigned char typeIn, const uint160& hashBytesIn, const uint256& txhashIn, unsigned int indexIn)
+        : type(typeIn), hashBytes(hashBytesIn), txhash(txhashIn), index(indexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(type);
+        READWRITE(hashBytes);
+        READWRITE(txhash);
+        READWRITE(index);
+    }
+};
+
+struct CAddressUnspentValue {
+    CAmount satoshis;
+    CScript script;
+    int blockHeight;
+
+    //! A null value erases the entry when the index is updated
+    CAddressUnspentValue() : satoshis(-1), blockHeight(0) {}
+    CAddressUnspentValue(CAmount satoshisIn, const CScript& scriptIn, int blockHeightIn) : satoshis(satoshisIn), script(scriptIn), blockHeight(blockHeightIn) {}
+
+    bool IsNull() const { return satoshis == -1; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(satoshis);
+        READWRITE(script);
+        READWRITE(blockHeight);
+    }
+};
+
+#endif // BITCOIN_ADDRESSINDEX_H
@@ -0,0 +1,20 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/quark.h"
+#include "crypto/sha256.h"
+#include "util.h"
+
+int main(int argc, char** argv)
+{
+    SetupEnvironment();
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+
+    QuarkAutoDetect();
+    SHA256AutoDetect();
+
+    benchmark::BenchRunner::RunAll();
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/quark.h"
+#include "crypto/sha256.h"
+
+#include <vector>
+
+/* Number of bytes to hash per iteration */
+static const uint64_t BUFFER_SIZE = 1000 * 1000;
+
+/** A block header is the only Quark input that matters for throughput. */
+static const size_t HEADER_SIZE = 80;
+
+static void SHA256(benchmark::State& state)
+{
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE, 0);
+    while (state.KeepRunning())
+        CSHA256().Write(in.data(), in.size()).Finalize(hash);
+}
+
+/** A full level of merkle nodes, the shape SHA256D64 sees from BuildMerkleTree. */
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning())
+        SHA256D64(in.data(), in.data(), 1024);
+}
+
+static void QuarkHeaders(benchmark::State& state)
+{
+    std::vector<unsigned char> in(BUFFER_SIZE, 0);
+    unsigned char hash[QUARK_OUTPUT_SIZE];
+    while (state.KeepRunning()) {
+        for (size_t pos = 0; pos + HEADER_SIZE <= in.size(); pos += HEADER_SIZE) {
+            QuarkHash(&in[pos], HEADER_SIZE, hash);
+            in[pos] = hash[0];
+        }
+    }
+}
+
+static void QuarkHeadersLanes(benchmark::State& state)
+{
+    std::vector<unsigned char> in(BUFFER_SIZE, 0);
+    unsigned char hashes[QUARK_MAX_LANES][QUARK_OUTPUT_SIZE];
+    const unsigned char* pin[QUARK_MAX_LANES];
+    unsigned char* pout[QUARK_MAX_LANES];
+    const size_t nStride = HEADER_SIZE * QUARK_MAX_LANES;
+    while (state.KeepRunning()) {
+        for (size_t pos = 0; pos + nStride <= in.size(); pos += nStride) {
+            for (size_t i = 0; i < QUARK_MAX_LANES; i++) {
+                pin[i] = &in[pos + i * HEADER_SIZE];
+                pout[i] = hashes[i];
+            }
+            QuarkHashLanes(pin, HEADER_SIZE, pout, QUARK_MAX_LANES);
+            in[pos] = hashes[0][0];
+        }
+    }
+}
+
+BENCHMARK(SHA256);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(QuarkHeaders);
+BENCHMARK(QuarkHeadersLanes);
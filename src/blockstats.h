@@ -0,0 +1,79 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKSTATS_H
+#define BITCOIN_BLOCKSTATS_H
+
+#include "amount.h"
+#include "serialize.h"
+
+#include <stdint.h>
+
+/** Default for -blockstatsindex */
+static const bool DEFAULT_BLOCKSTATSINDEX = false;
+
+//! Fee rate percentiles of CBlockStats, weighted by transaction size
+static const int BLOCKSTATS_PERCENTILES[] = {10, 25, 50, 75, 90};
+static const int BLOCKSTATS_NUM_PERCENTILES = sizeof(BLOCKSTATS_PERCENTILES) / sizeof(BLOCKSTATS_PERCENTILES[0]);
+
+/**
+ * Statistics of one block, computed when it is connected.
+ * Transaction counts, sizes and fees leave out the coinbase and coinstake;
+ * fee rates are per 1000 bytes.
+ */
+class CBlockStats
+{
+public:
+    unsigned int nSize;
+    unsigned int nTxCount;
+    uint64_t nTxBytes;
+    CAmount nFees;
+    CAmount nMinFeeRate;
+    CAmount nMaxFeeRate;
+    CAmount vFeeRatePercentiles[BLOCKSTATS_NUM_PERCENTILES];
+    //! What the block creator kept: the stake or mining reward, including PoW fees
+    CAmount nStakeReward;
+    CAmount nMasternodePayment;
+    CAmount nBudgetPayment;
+
+    CBlockStats()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nSize = 0;
+        nTxCount = 0;
+        nTxBytes = 0;
+        nFees = 0;
+        nMinFeeRate = 0;
+        nMaxFeeRate = 0;
+        for (int i = 0; i < BLOCKSTATS_NUM_PERCENTILES; i++)
+            vFeeRatePercentiles[i] = 0;
+        nStakeReward = 0;
+        nMasternodePayment = 0;
+        nBudgetPayment = 0;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(VARINT(nSize));
+        READWRITE(VARINT(nTxCount));
+        READWRITE(VARINT(nTxBytes));
+        READWRITE(nFees);
+        READWRITE(nMinFeeRate);
+        READWRITE(nMaxFeeRate);
+        for (int i = 0; i < BLOCKSTATS_NUM_PERCENTILES; i++)
+            READWRITE(vFeeRatePercentiles[i]);
+        READWRITE(nStakeReward);
+        READWRITE(nMasternodePayment);
+        READWRITE(nBudgetPayment);
+    }
+};
+
+#endif // BITCOIN_BLOCKSTATS_H
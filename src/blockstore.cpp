@@ -0,0 +1,190 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstore.h"
+
+#include "main.h"
+#include "util.h"
+
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CBlockFileCache blockfilecache;
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    if (pdata)
+        munmap((void*)pdata, nSize);
+#endif
+}
+
+bool CMappedFile::Map(const boost::filesystem::path& path)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (p == MAP_FAILED) {
+        LogPrintf("Unable to map file %s\n", path.string());
+        return false;
+    }
+    pdata = (const char*)p;
+    nSize = st.st_size;
+    return true;
+#else
+    return false;
+#endif
+}
+
+CBlockFileCache::CBlockFileCache() : nMaxFiles(DEFAULT_MAX_MAPPED_FILES), nActiveFile(0)
+{
+}
+
+void CBlockFileCache::SetMaxFiles(size_t nMaxFilesIn)
+{
+    LOCK(cs);
+    nMaxFiles = nMaxFilesIn;
+    while (mapFiles.size() > nMaxFiles)
+        Evict(mapFiles.find(listRecent.back()));
+}
+
+void CBlockFileCache::SetActiveFile(int nFile)
+{
+    LOCK(cs);
+    nActiveFile = nFile;
+    Invalidate(nFile);
+}
+
+void CBlockFileCache::Evict(FileMap::iterator it)
+{
+    stats.nMappedBytes -= it->second.first->size();
+    listRecent.erase(it->second.second);
+    mapFiles.erase(it);
+}
+
+boost::shared_ptr<const CMappedFile> CBlockFileCache::Get(const CDiskBlockPos& pos, const char* prefix, uint64_t nEnd)
+{
+    LOCK(cs);
+    if (nMaxFiles == 0 || pos.nFile >= nActiveFile)
+        return boost::shared_ptr<const CMappedFile>();
+
+    FileKey key(prefix, pos.nFile);
+    FileMap::iterator it = mapFiles.find(key);
+    if (it != mapFiles.end()) {
+        if (it->second.first->size() >= nEnd) {
+            listRecent.splice(listRecent.begin(), listRecent, it->second.second);
+            stats.nHits++;
+            return it->second.first;
+        }
+        // Undo data can still be appended to older files; map the file again
+        Evict(it);
+    }
+
+    boost::shared_ptr<CMappedFile> pmap(new CMappedFile());
+    if (!pmap->Map(GetBlockPosFilename(pos, prefix)) || pmap->size() < nEnd)
+        return boost::shared_ptr<const CMappedFile>();
+    stats.nMaps++;
+
+    while (mapFiles.size() >= nMaxFiles) {
+        Evict(mapFiles.find(listRecent.back()));
+        stats.nEvictions++;
+    }
+    listRecent.push_front(key);
+    mapFiles.insert(std::make_pair(key, std::make_pair(pmap, listRecent.begin())));
+    stats.nMappedBytes += pmap->size();
+    return pmap;
+}
+
+void CBlockFileCache::Invalidate(int nFile)
+{
+    LOCK(cs);
+    const char* prefixes[] = {"blk", "rev"};
+    for (unsigned int i = 0; i < 2; i++) {
+        FileMap::iterator it = mapFiles.find(FileKey(prefixes[i], nFile));
+        if (it != mapFiles.end())
+            Evict(it);
+    }
+}
+
+void CBlockFileCache::CountFileOpen()
+{
+    LOCK(cs);
+    stats.nFileOpens++;
+}
+
+CBlockFileCacheStats CBlockFileCache::GetStats() const
+{
+    LOCK(cs);
+    CBlockFileCacheStats ret = stats;
+    ret.nMappedFiles = mapFiles.size();
+    ret.nMaxMappedFiles = nMaxFiles;
+    return ret;
+}
+
+CBlockFileReader::CBlockFileReader(const CDiskBlockPos& pos, const char* prefix, int nTypeIn, int nVersionIn) : nType(nTypeIn), nVersion(nVersionIn), strPrefix(prefix), nFile(pos.nFile), nReadPos(pos.nPos), file(NULL), fNull(false)
+{
+    if (pos.IsNull()) {
+        fNull = true;
+        return;
+    }
+    pmap = blockfilecache.Get(pos, prefix, nReadPos);
+    if (!pmap) {
+        blockfilecache.CountFileOpen();
+        file = (strPrefix == "rev") ? OpenUndoFile(pos, true) : OpenBlockFile(pos, true);
+        fNull = (file == NULL);
+    }
+}
+
+CBlockFileReader::~CBlockFileReader()
+{
+    if (file)
+        fclose(file);
+}
+
+CBlockFileReader& CBlockFileReader::read(char* pch, size_t nSize)
+{
+    if (fNull)
+        throw std::ios_base::failure("CBlockFileReader::read : file is not open");
+    if (file) {
+        if (fread(pch, 1, nSize, file) != nSize)
+            throw std::ios_base::failure(feof(file) ? "CBlockFileReader::read : end of file" : "CBlockFileReader::read : fread failed");
+    } else {
+        if (nReadPos + nSize > pmap->size()) {
+            // The file may have been appended to since it was mapped
+            pmap = blockfilecache.Get(CDiskBlockPos(nFile, nReadPos), strPrefix.c_str(), nReadPos + nSize);
+            if (!pmap) {
+                fNull = true;
+                throw std::ios_base::failure("CBlockFileReader::read : end of file");
+            }
+        }
+        memcpy(pch, pmap->data() + nReadPos, nSize);
+    }
+    nReadPos += nSize;
+    return (*this);
+}
+
+CBlockFileReader& CBlockFileReader::ignore(size_t nSize)
+{
+    if (fNull)
+        throw std::ios_base::failure("CBlockFileReader::ignore : file is not open");
+    if (file && fseek(file, nSize, SEEK_CUR))
+        throw std::ios_base::failure("CBlockFileReader::ignore : fseek failed");
+    nReadPos += nSize;
+    return (*this);
+}
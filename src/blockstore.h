@@ -0,0 +1,160 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKSTORE_H
+#define BITCOIN_BLOCKSTORE_H
+
+#include "serialize.h"
+#include "sync.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/shared_ptr.hpp>
+
+struct CDiskBlockPos;
+
+/** Default for -maxmappedfiles, the number of block and undo files kept memory-mapped */
+static const unsigned int DEFAULT_MAX_MAPPED_FILES = 32;
+
+/** A read-only memory mapping of a whole block or undo file. */
+class CMappedFile
+{
+private:
+    // Disallow copies
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+    const char* pdata;
+    size_t nSize;
+
+public:
+    CMappedFile() : pdata(NULL), nSize(0) {}
+    ~CMappedFile();
+
+    //! Map the file at path with its current size. Returns false if it cannot be mapped.
+    bool Map(const boost::filesystem::path& path);
+
+    const char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+};
+
+struct CBlockFileCacheStats {
+    size_t nMappedFiles;
+    size_t nMaxMappedFiles;
+    uint64_t nMappedBytes;
+    uint64_t nHits;     //!< reads served from an existing mapping
+    uint64_t nMaps;     //!< files mapped, including remaps of files that grew
+    uint64_t nEvictions;
+    uint64_t nFileOpens; //!< reads that fell back to opening the file
+
+    CBlockFileCacheStats() : nMappedFiles(0), nMaxMappedFiles(0), nMappedBytes(0), nHits(0), nMaps(0), nEvictions(0), nFileOpens(0) {}
+};
+
+/**
+ * Bounded, least-recently-used pool of read-only mappings of the blk?????.dat
+ * and rev?????.dat files. Files are mapped with the size they have when first
+ * read; a read past the end of a mapping (the file was appended to since)
+ * replaces it with a fresh one. The file currently being written to is never
+ * mapped, as it grows with every block.
+ */
+class CBlockFileCache
+{
+private:
+    typedef std::pair<std::string, int> FileKey;
+    typedef std::list<FileKey> FileList;
+    typedef std::map<FileKey, std::pair<boost::shared_ptr<CMappedFile>, FileList::iterator> > FileMap;
+
+    mutable CCriticalSection cs;
+    FileMap mapFiles;
+    FileList listRecent; //!< most recently used first
+    size_t nMaxFiles;
+    int nActiveFile;
+    CBlockFileCacheStats stats;
+
+    void Evict(FileMap::iterator it);
+
+public:
+    CBlockFileCache();
+
+    //! Set the maximum number of mapped files. Zero disables mapping.
+    void SetMaxFiles(size_t nMaxFilesIn);
+
+    //! Set the block file new blocks are appended to. It, and later files, are not mapped.
+    void SetActiveFile(int nFile);
+
+    /**
+     * Return a mapping of the file holding pos that covers at least nEnd bytes,
+     * or an empty pointer if the caller has to read the file itself.
+     */
+    boost::shared_ptr<const CMappedFile> Get(const CDiskBlockPos& pos, const char* prefix, uint64_t nEnd);
+
+    //! Drop the mappings of a file, e.g. before it is truncated or removed.
+    void Invalidate(int nFile);
+
+    //! Record a read that fell back to opening the file.
+    void CountFileOpen();
+
+    CBlockFileCacheStats GetStats() const;
+};
+
+extern CBlockFileCache blockfilecache;
+
+/**
+ * Read-only stream over a block or undo file, starting at a given position.
+ * Reads come straight from the shared mapping when the file is mapped, and
+ * from the file itself otherwise, so callers do not have to care which.
+ */
+class CBlockFileReader
+{
+private:
+    // Disallow copies
+    CBlockFileReader(const CBlockFileReader&);
+    CBlockFileReader& operator=(const CBlockFileReader&);
+
+    int nType;
+    int nVersion;
+
+    std::string strPrefix;
+    int nFile;
+    boost::shared_ptr<const CMappedFile> pmap;
+    uint64_t nReadPos; //!< offset in the file of the next byte to read
+    FILE* file;        //!< only used if the file is not mapped
+    bool fNull;
+
+public:
+    CBlockFileReader(const CDiskBlockPos& pos, const char* prefix, int nTypeIn, int nVersionIn);
+    ~CBlockFileReader();
+
+    //! Return true if the file could not be opened.
+    bool IsNull() const { return fNull; }
+
+    //
+    // Stream subset
+    //
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+
+    CBlockFileReader& read(char* pch, size_t nSize);
+
+    //! Skip nSize bytes ahead
+    CBlockFileReader& ignore(size_t nSize);
+
+    template <typename T>
+    CBlockFileReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        if (fNull)
+            throw std::ios_base::failure("CBlockFileReader::operator>> : file is not open");
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+#endif // BITCOIN_BLOCKSTORE_H
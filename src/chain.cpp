@@ -5,6 +5,10 @@
 
 #include "chain.h"
 
+#include "memusage.h"
+
+#include <new>
+
 using namespace std;
 
 /**
@@ -61,19 +65,24 @@ const CBlockIndex* CChain::FindFork(const CBlockIndex* pindex) const
     return pindex;
 }
 
-uint256 CBlockIndex::GetBlockTrust() const
+CBlockIndex* CBlockIndexArena::Allocate()
 {
-    uint256 bnTarget;
-    bnTarget.SetCompact(nBits);
-    if (bnTarget <= 0)
-        return 0;
-
-    if (IsProofOfStake()) {
-        // Return trust score as usual
-        return (uint256(1) << 256) / (bnTarget + 1);
-    } else {
-        // Calculate work amount for block
-        uint256 bnPoWTrust = ((~uint256(0) >> 20) / (bnTarget + 1));
-        return bnPoWTrust > 1 ? bnPoWTrust : 1;
+    if (nUsed == CHUNK_ENTRIES) {
+        vChunks.push_back(static_cast<CBlockIndex*>(::operator new(sizeof(CBlockIndex) * CHUNK_ENTRIES)));
+        nUsed = 0;
     }
-}
\ No newline at end of file
+    return new (vChunks.back() + nUsed++) CBlockIndex();
+}
+
+void CBlockIndexArena::Clear()
+{
+    BOOST_FOREACH (CBlockIndex* pchunk, vChunks)
+        ::operator delete(pchunk);
+    vChunks.clear();
+    nUsed = CHUNK_ENTRIES;
+}
+
+size_t CBlockIndexArena::DynamicMemoryUsage() const
+{
+    return memusage::MallocUsage(sizeof(CBlockIndex) * CHUNK_ENTRIES) * vChunks.size() + memusage::DynamicUsage(vChunks);
+}
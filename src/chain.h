@@ -99,6 +99,18 @@ enum BlockStatus {
     BLOCK_FAILED_MASK = BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 };
 
+/**
+ * Fields of a proof-of-stake block index entry that are only needed to write
+ * the entry back to disk. They are not kept in CBlockIndex, but read from the
+ * block tree database on demand (see ReadBlockIndexCold).
+ */
+struct CBlockIndexCold {
+    COutPoint prevoutStake;
+    unsigned int nStakeTime;
+
+    CBlockIndexCold() : nStakeTime(0) {}
+};
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -113,15 +125,9 @@ public:
     //! pointer to the index of the predecessor of this block
     CBlockIndex* pprev;
 
-    //! pointer to the index of the next block
-    CBlockIndex* pnext;
-
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;
 
-    //ppcoin: trust score of block chain
-    uint256 bnChainTrust;
-
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
@@ -157,12 +163,7 @@ public:
     };
 
     // proof-of-stake specific fields
-    uint256 GetBlockTrust() const;
     uint64_t nStakeModifier;             // hash modifier for proof-of-stake
-    unsigned int nStakeModifierChecksum; // checksum of index; in-memeory only
-    COutPoint prevoutStake;
-    unsigned int nStakeTime;
-    uint256 hashProofOfStake;
     int64_t nMint;
     int64_t nMoneySupply;
 
@@ -176,6 +177,8 @@ public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
+    unsigned int nStakeModifierChecksum; // checksum of index; in-memeory only
+
     void SetNull()
     {
         phashBlock = NULL;
@@ -196,8 +199,6 @@ public:
         nFlags = 0;
         nStakeModifier = 0;
         nStakeModifierChecksum = 0;
-        prevoutStake.SetNull();
-        nStakeTime = 0;
 
         nVersion = 0;
         hashMerkleRoot = uint256();
@@ -221,23 +222,8 @@ public:
         nBits = block.nBits;
         nNonce = block.nNonce;
 
-        //Proof of Stake
-        bnChainTrust = uint256();
-        nMint = 0;
-        nMoneySupply = 0;
-        nFlags = 0;
-        nStakeModifier = 0;
-        nStakeModifierChecksum = 0;
-        hashProofOfStake = uint256();
-
-        if (block.IsProofOfStake()) {
+        if (block.IsProofOfStake())
             SetProofOfStake();
-            prevoutStake = block.vtx[1].vin[0].prevout;
-            nStakeTime = block.nTime;
-        } else {
-            prevoutStake.SetNull();
-            nStakeTime = 0;
-        }
     }
 
     CDiskBlockPos GetBlockPos() const
@@ -395,16 +381,25 @@ class CDiskBlockIndex : public CBlockIndex
 public:
     uint256 hashPrev;
     uint256 hashNext;
+    COutPoint prevoutStake;
+    unsigned int nStakeTime;
 
     CDiskBlockIndex()
     {
         hashPrev = uint256();
         hashNext = uint256();
+        nStakeTime = 0;
     }
 
-    explicit CDiskBlockIndex(CBlockIndex* pindex) : CBlockIndex(*pindex)
+    //! Marshal an entry. For proof-of-stake entries this reads the cold fields with ReadBlockIndexCold (cs_main must be held).
+    explicit CDiskBlockIndex(const CBlockIndex* pindex);
+
+    CBlockIndexCold GetCold() const
     {
-        hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        CBlockIndexCold cold;
+        cold.prevoutStake = prevoutStake;
+        cold.nStakeTime = nStakeTime;
+        return cold;
     }
 
     ADD_SERIALIZE_METHODS;
@@ -436,7 +431,6 @@ public:
         } else {
             const_cast<CDiskBlockIndex*>(this)->prevoutStake.SetNull();
             const_cast<CDiskBlockIndex*>(this)->nStakeTime = 0;
-            const_cast<CDiskBlockIndex*>(this)->hashProofOfStake = uint256();
         }
 
         // block header
@@ -473,6 +467,38 @@ public:
     }
 };
 
+/**
+ * Allocates block index entries in large chunks. Entries are never freed one
+ * by one, only all together, which saves the overhead of an allocation per
+ * entry and keeps neighbouring entries close in memory.
+ */
+class CBlockIndexArena
+{
+private:
+    // Disallow copies
+    CBlockIndexArena(const CBlockIndexArena&);
+    CBlockIndexArena& operator=(const CBlockIndexArena&);
+
+    std::vector<CBlockIndex*> vChunks;
+    size_t nUsed; //!< entries handed out from the last chunk
+
+public:
+    static const size_t CHUNK_ENTRIES = 4096;
+
+    CBlockIndexArena() : nUsed(CHUNK_ENTRIES) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    //! Return a new, default-constructed entry.
+    CBlockIndex* Allocate();
+
+    //! Free all entries at once.
+    void Clear();
+
+    //! Number of entries handed out.
+    size_t size() const { return vChunks.empty() ? 0 : (vChunks.size() - 1) * CHUNK_ENTRIES + nUsed; }
+    size_t DynamicMemoryUsage() const;
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain
 {
@@ -109,6 +109,7 @@ public:
         nTargetTimespan = 24 * 60 * 60; // Unitedstatedollarcrypto: 1 day
         nTargetSpacing = 1 * 60;  // Unitedstatedollarcrypto: 1 minutes
         nMaturity = 10;
+        nPruneAfterHeight = 100000;
         nMasternodeCountDrift = 20;
         nMaxMoneyOut = 1000000000 * COIN;
 
@@ -206,6 +207,7 @@ public:
         nLastPOWBlock1 = 999;
         nLastPOWBlock2 = 1000;
         nMaturity = 15;
+        nPruneAfterHeight = 1000;
         nMasternodeCountDrift = 4;
         nModifierUpdateBlock = 1;
         nMaxMoneyOut = 1000000000 * COIN;
@@ -286,6 +288,7 @@ public:
 
         hashGenesisBlock = genesis.GetHash();
         nDefaultPort = 3181;
+        nPruneAfterHeight = 1000;
         assert(hashGenesisBlock == uint256("0x0d3c3e84d7eaefd7a0c1cd2598954ef985c943202cf54f8985411a9ddee95a20"));
         assert(genesis.hashMerkleRoot == uint256("0xd23f46bbb0110697cefc7cb10889ef8167e8912d4cf9f64891d2e0ebd92ee1f4"));
 
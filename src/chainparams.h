@@ -78,6 +78,8 @@ public:
     int LAST_POW_BLOCK1() const { return nLastPOWBlock1; }
     int LAST_POW_BLOCK2() const { return nLastPOWBlock2; }
     int COINBASE_MATURITY() const { return nMaturity; }
+    /** Height below which block files are never pruned */
+    int PruneAfterHeight() const { return nPruneAfterHeight; }
     int ModifierUpgradeBlock() const { return nModifierUpdateBlock; }
     CAmount MaxMoneyOut() const { return nMaxMoneyOut; }
     /** The masternode count that we will allow the see-saw reward payments to be off by */
@@ -119,6 +121,7 @@ protected:
     int nLastPOWBlock2;
     int nMasternodeCountDrift;
     int nMaturity;
+    int nPruneAfterHeight;
     int nModifierUpdateBlock;
     CAmount nMaxMoneyOut;
     int nMinerThreads;
@@ -127,6 +127,13 @@ private:
     }
 
 public:
+    /**
+     * Held by the CCheckQueueControl using the queue, as more than one thread may verify in parallel.
+     * Lock order: cs_main before ControlMutex. ConnectBlock holds cs_main while its control is in
+     * scope, so any other user must not take cs_main until its control is destroyed.
+     */
+    boost::mutex ControlMutex;
+
     //! Create a new check queue
     CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
 
@@ -184,6 +191,7 @@ public:
     {
         // passed queue is supposed to be unused, or NULL
         if (pqueue != NULL) {
+            pqueue->ControlMutex.lock();
             bool isIdle = pqueue->IsIdle();
             assert(isIdle);
         }
@@ -208,6 +216,8 @@ public:
     {
         if (!fDone)
             Wait();
+        if (pqueue != NULL)
+            pqueue->ControlMutex.unlock();
     }
 };
 
@@ -0,0 +1,284 @@
+// Copyright (c) 2017-2020 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "crypto/sha512.h"
+
+#include <assert.h>
+#include <limits>
+#include <string.h>
+
+namespace
+{
+typedef Num3072::limb_t limb_t;
+typedef Num3072::double_limb_t double_limb_t;
+const int LIMB_SIZE = Num3072::LIMB_SIZE;
+const int LIMBS = Num3072::LIMBS;
+/** 2^3072 - 1103717, the largest 3072-bit safe prime, is the modulus. */
+const limb_t MAX_PRIME_DIFF = 1103717;
+
+/** Extract the lowest limb of [c0,c1,c2] into n, and shift the number right by one limb. */
+inline void extract3(limb_t& c0, limb_t& c1, limb_t& c2, limb_t& n)
+{
+    n = c0;
+    c0 = c1;
+    c1 = c2;
+    c2 = 0;
+}
+
+/** [c0,c1] = a * b */
+inline void mul(limb_t& c0, limb_t& c1, const limb_t& a, const limb_t& b)
+{
+    double_limb_t t = (double_limb_t)a * b;
+    c1 = t >> LIMB_SIZE;
+    c0 = t;
+}
+
+/** [c0,c1,c2] += n * [d0,d1,d2]. c2 is 0 initially. */
+inline void mulnadd3(limb_t& c0, limb_t& c1, limb_t& c2, limb_t& d0, limb_t& d1, limb_t& d2, const limb_t& n)
+{
+    double_limb_t t = (double_limb_t)d0 * n + c0;
+    c0 = t;
+    t >>= LIMB_SIZE;
+    t += (double_limb_t)d1 * n + c1;
+    c1 = t;
+    t >>= LIMB_SIZE;
+    c2 = t + d2 * n;
+}
+
+/** [c0,c1] *= n */
+inline void muln2(limb_t& c0, limb_t& c1, const limb_t& n)
+{
+    double_limb_t t = (double_limb_t)c0 * n;
+    c0 = t;
+    t >>= LIMB_SIZE;
+    t += (double_limb_t)c1 * n;
+    c1 = t;
+}
+
+/** [c0,c1,c2] += a * b */
+inline void muladd3(limb_t& c0, limb_t& c1, limb_t& c2, const limb_t& a, const limb_t& b)
+{
+    double_limb_t t = (double_limb_t)a * b;
+    limb_t th = t >> LIMB_SIZE;
+    limb_t tl = t;
+
+    c0 += tl;
+    th += (c0 < tl) ? 1 : 0;
+    c1 += th;
+    c2 += (c1 < th) ? 1 : 0;
+}
+
+/** [c0,c1] += a, then extract the lowest limb of [c0,c1] into n and shift the number right by one limb. */
+inline void addnextract2(limb_t& c0, limb_t& c1, const limb_t& a, limb_t& n)
+{
+    limb_t c2 = 0;
+
+    c0 += a;
+    if (c0 < a) {
+        c1 += 1;
+        // c1 overflowed
+        if (c1 == 0)
+            c2 = 1;
+    }
+
+    n = c0;
+    c0 = c1;
+    c1 = c2;
+}
+} // anon namespace
+
+Num3072::Num3072(const unsigned char data[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        if (sizeof(limb_t) == 4)
+            limbs[i] = ReadLE32(data + 4 * i);
+        else
+            limbs[i] = ReadLE64(data + 8 * i);
+    }
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i)
+        limbs[i] = 0;
+}
+
+/** Whether the number is at least the modulus. It is always below 2^3072. */
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= std::numeric_limits<limb_t>::max() - MAX_PRIME_DIFF)
+        return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != std::numeric_limits<limb_t>::max())
+            return false;
+    }
+    return true;
+}
+
+/** Subtract the modulus, i.e. add MAX_PRIME_DIFF modulo 2^3072. */
+void Num3072::FullReduce()
+{
+    limb_t c0 = MAX_PRIME_DIFF;
+    limb_t c1 = 0;
+    for (int i = 0; i < LIMBS; ++i)
+        addnextract2(c0, c1, limbs[i], limbs[i]);
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    limb_t c0 = 0, c1 = 0, c2 = 0;
+    Num3072 tmp;
+
+    // Compute limbs 0..N-2 of this*a into tmp, including one reduction: the
+    // limbs above 3072 bits are folded back in multiplied by MAX_PRIME_DIFF.
+    for (int j = 0; j < LIMBS - 1; ++j) {
+        limb_t d0 = 0, d1 = 0, d2 = 0;
+        mul(d0, d1, limbs[1 + j], a.limbs[LIMBS + j - (1 + j)]);
+        for (int i = 2 + j; i < LIMBS; ++i)
+            muladd3(d0, d1, d2, limbs[i], a.limbs[LIMBS + j - i]);
+        mulnadd3(c0, c1, c2, d0, d1, d2, MAX_PRIME_DIFF);
+        for (int i = 0; i < j + 1; ++i)
+            muladd3(c0, c1, c2, limbs[i], a.limbs[j - i]);
+        extract3(c0, c1, c2, tmp.limbs[j]);
+    }
+
+    // Compute limb N-1 of this*a into tmp
+    assert(c2 == 0);
+    for (int i = 0; i < LIMBS; ++i)
+        muladd3(c0, c1, c2, limbs[i], a.limbs[LIMBS - 1 - i]);
+    extract3(c0, c1, c2, tmp.limbs[LIMBS - 1]);
+
+    // Fold the carry back in for a second reduction
+    muln2(c0, c1, MAX_PRIME_DIFF);
+    for (int j = 0; j < LIMBS; ++j)
+        addnextract2(c0, c1, tmp.limbs[j], limbs[j]);
+
+    assert(c1 == 0);
+    assert(c0 == 0 || c0 == 1);
+
+    // Up to two more reductions if the result is still at least the modulus
+    // or overflowed 2^3072
+    if (IsOverflow())
+        FullReduce();
+    if (c0)
+        FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // By Fermat's little theorem the inverse is this^(p-2). The exponent,
+    // 2^3072 - 1103719, is processed four bits at a time.
+    Num3072 table[16];
+    for (int i = 1; i < 16; ++i) {
+        table[i] = table[i - 1];
+        table[i].Multiply(*this);
+    }
+
+    Num3072 out;
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        limb_t e = (i == 0) ? std::numeric_limits<limb_t>::max() - (MAX_PRIME_DIFF + 1) : std::numeric_limits<limb_t>::max();
+        for (int shift = LIMB_SIZE - 4; shift >= 0; shift -= 4) {
+            for (int k = 0; k < 4; ++k)
+                out.Multiply(out);
+            out.Multiply(table[(e >> shift) & 15]);
+        }
+    }
+    return out;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    if (IsOverflow())
+        FullReduce();
+
+    Num3072 inv;
+    if (a.IsOverflow()) {
+        Num3072 b = a;
+        b.FullReduce();
+        inv = b.GetInverse();
+    } else {
+        inv = a.GetInverse();
+    }
+
+    Multiply(inv);
+    if (IsOverflow())
+        FullReduce();
+}
+
+void Num3072::ToBytes(unsigned char out[BYTE_SIZE]) const
+{
+    Num3072 reduced = *this;
+    if (reduced.IsOverflow())
+        reduced.FullReduce();
+    for (int i = 0; i < LIMBS; ++i) {
+        if (sizeof(limb_t) == 4)
+            WriteLE32(out + 4 * i, reduced.limbs[i]);
+        else
+            WriteLE64(out + 8 * i, reduced.limbs[i]);
+    }
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    // Expand the SHA512 of the element to 3072 bits with SHA512 in counter mode
+    unsigned char seed[CSHA512::OUTPUT_SIZE];
+    CSHA512().Write(data, len).Finalize(seed);
+    unsigned char bytes[Num3072::BYTE_SIZE];
+    for (unsigned char i = 0; i < Num3072::BYTE_SIZE / CSHA512::OUTPUT_SIZE; i++)
+        CSHA512().Write(seed, sizeof(seed)).Write(&i, 1).Finalize(bytes + i * CSHA512::OUTPUT_SIZE);
+    return Num3072(bytes);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char out[32])
+{
+    numerator.Divide(denominator);
+    denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out);
+}
+
+void MuHash3072::ToBytes(unsigned char out[SERIALIZED_SIZE]) const
+{
+    numerator.ToBytes(out);
+    denominator.ToBytes(out + Num3072::BYTE_SIZE);
+}
+
+void MuHash3072::FromBytes(const unsigned char in[SERIALIZED_SIZE])
+{
+    numerator = Num3072(in);
+    denominator = Num3072(in + Num3072::BYTE_SIZE);
+}
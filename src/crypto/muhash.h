@@ -0,0 +1,86 @@
+// Copyright (c) 2017-2020 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A 3072-bit number modulo the prime 2^3072 - 1103717. */
+class Num3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+
+#ifdef __SIZEOF_INT128__
+    typedef unsigned __int128 double_limb_t;
+    typedef uint64_t limb_t;
+    static const int LIMBS = 48;
+    static const int LIMB_SIZE = 64;
+#else
+    typedef uint64_t double_limb_t;
+    typedef uint32_t limb_t;
+    static const int LIMBS = 96;
+    static const int LIMB_SIZE = 32;
+#endif
+    limb_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    //! Read a little-endian number. The result may be larger than the modulus.
+    explicit Num3072(const unsigned char data[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    //! Write the fully reduced number, little-endian
+    void ToBytes(unsigned char out[BYTE_SIZE]) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+    Num3072 GetInverse() const;
+};
+
+/**
+ * Order-independent hash of a set of byte strings, as proposed in "A New
+ * Paradigm for Collision-free Hashing: Incrementality at Reduced Cost"
+ * (Bellare, Micciancio, 1997). Every element is hashed to a number modulo a
+ * 3072-bit prime; the set hash is the product of those numbers, so elements
+ * can be added and removed in any order, and the hashes of disjoint sets
+ * combined by multiplying them.
+ *
+ * Removals are kept as a separate denominator, so that the single modular
+ * inversion is only done when the hash is finalized.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static const size_t SERIALIZED_SIZE = 2 * Num3072::BYTE_SIZE;
+
+    //! The hash of the empty set
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    //! Add or remove all the elements of another set
+    MuHash3072& operator*=(const MuHash3072& mul);
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    //! Get the 32-byte hash of the set
+    void Finalize(unsigned char out[32]);
+
+    //! The internal state, for storage
+    void ToBytes(unsigned char out[SERIALIZED_SIZE]) const;
+    void FromBytes(const unsigned char in[SERIALIZED_SIZE]);
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -0,0 +1,259 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/quark.h"
+
+#include "crypto/sph_blake.h"
+#include "crypto/sph_bmw.h"
+#include "crypto/sph_groestl.h"
+#include "crypto/sph_jh.h"
+#include "crypto/sph_keccak.h"
+#include "crypto/sph_skein.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#ifdef ENABLE_AVX2
+namespace quark_avx2
+{
+void Blake512(unsigned char* const out[4], const unsigned char* const in[4], size_t len);
+void Jh512_64(unsigned char* const out[4], const unsigned char* const in[4]);
+void Keccak512_64(unsigned char* const out[4], const unsigned char* const in[4]);
+void Skein512_64(unsigned char* const out[4], const unsigned char* const in[4]);
+}
+#endif
+
+// Internal implementation code.
+namespace
+{
+/** Largest input the vector BLAKE-512 kernel accepts (a single padded block). */
+static const size_t BLAKE_MAX_LANE_INPUT = 111;
+
+/** Freshly initialised contexts; copying one is cheaper than running the init functions. */
+struct CQuarkContexts {
+    sph_blake512_context blake;
+    sph_bmw512_context bmw;
+    sph_groestl512_context groestl;
+    sph_jh512_context jh;
+    sph_keccak512_context keccak;
+    sph_skein512_context skein;
+
+    CQuarkContexts()
+    {
+        sph_blake512_init(&blake);
+        sph_bmw512_init(&bmw);
+        sph_groestl512_init(&groestl);
+        sph_jh512_init(&jh);
+        sph_keccak512_init(&keccak);
+        sph_skein512_init(&skein);
+    }
+};
+
+/** Function-local so that it is ready for block hashes computed during static initialisation. */
+const CQuarkContexts& Contexts()
+{
+    static const CQuarkContexts contexts;
+    return contexts;
+}
+
+void Blake(const unsigned char* in, size_t len, unsigned char* out)
+{
+    sph_blake512_context ctx = Contexts().blake;
+    sph_blake512(&ctx, in, len);
+    sph_blake512_close(&ctx, out);
+}
+
+void Blake64(const unsigned char* in, unsigned char* out)
+{
+    Blake(in, 64, out);
+}
+
+void Bmw(const unsigned char* in, unsigned char* out)
+{
+    sph_bmw512_context ctx = Contexts().bmw;
+    sph_bmw512(&ctx, in, 64);
+    sph_bmw512_close(&ctx, out);
+}
+
+void Groestl(const unsigned char* in, unsigned char* out)
+{
+    sph_groestl512_context ctx = Contexts().groestl;
+    sph_groestl512(&ctx, in, 64);
+    sph_groestl512_close(&ctx, out);
+}
+
+void Jh(const unsigned char* in, unsigned char* out)
+{
+    sph_jh512_context ctx = Contexts().jh;
+    sph_jh512(&ctx, in, 64);
+    sph_jh512_close(&ctx, out);
+}
+
+void Keccak(const unsigned char* in, unsigned char* out)
+{
+    sph_keccak512_context ctx = Contexts().keccak;
+    sph_keccak512(&ctx, in, 64);
+    sph_keccak512_close(&ctx, out);
+}
+
+void Skein(const unsigned char* in, unsigned char* out)
+{
+    sph_skein512_context ctx = Contexts().skein;
+    sph_skein512(&ctx, in, 64);
+    sph_skein512_close(&ctx, out);
+}
+
+/** The branch steps of the chain are selected by bit 3 of the previous digest. */
+bool inline Branch(const unsigned char* digest) { return (digest[0] & 8) != 0; }
+
+typedef void (*StepFn)(const unsigned char* in, unsigned char* out);
+typedef void (*Step4Fn)(unsigned char* const out[4], const unsigned char* const in[4]);
+typedef void (*Blake4Fn)(unsigned char* const out[4], const unsigned char* const in[4], size_t len);
+
+/** Vector kernels; left NULL unless QuarkAutoDetect() finds support for them. */
+Blake4Fn Blake4 = NULL;
+Step4Fn Jh4 = NULL;
+Step4Fn Keccak4 = NULL;
+Step4Fn Skein4 = NULL;
+
+void Blake64x4(unsigned char* const out[4], const unsigned char* const in[4])
+{
+    Blake4(out, in, 64);
+}
+
+/**
+ * Apply one 64-byte step to the lanes whose branch bit equals fBranch (or to
+ * every lane if fAll). Two or more such lanes go through the vector kernel in
+ * one call, padding unused slots with a duplicate of the first lane.
+ */
+void Step(StepFn scalar, Step4Fn vec, unsigned char (*in)[64], unsigned char (*out)[64], size_t nLanes, bool fAll, bool fBranch)
+{
+    size_t lanes[QUARK_MAX_LANES];
+    size_t n = 0;
+    for (size_t i = 0; i < nLanes; i++)
+        if (fAll || Branch(in[i]) == fBranch)
+            lanes[n++] = i;
+
+    if (vec != NULL && n >= 2) {
+        unsigned char scratch[64];
+        const unsigned char* pin[4];
+        unsigned char* pout[4];
+        for (size_t i = 0; i < 4; i++) {
+            pin[i] = i < n ? in[lanes[i]] : in[lanes[0]];
+            pout[i] = i < n ? out[lanes[i]] : scratch;
+        }
+        vec(pout, pin);
+    } else {
+        for (size_t i = 0; i < n; i++)
+            scalar(in[lanes[i]], out[lanes[i]]);
+    }
+}
+
+/** Hash up to QUARK_MAX_LANES messages. */
+void HashLanes(const unsigned char* const data[], size_t len, unsigned char* const hash[], size_t nLanes)
+{
+    unsigned char a[QUARK_MAX_LANES][64];
+    unsigned char b[QUARK_MAX_LANES][64];
+
+    if (Blake4 != NULL && nLanes >= 2 && len <= BLAKE_MAX_LANE_INPUT) {
+        unsigned char scratch[64];
+        const unsigned char* pin[4];
+        unsigned char* pout[4];
+        for (size_t i = 0; i < 4; i++) {
+            pin[i] = i < nLanes ? data[i] : data[0];
+            pout[i] = i < nLanes ? a[i] : scratch;
+        }
+        Blake4(pout, pin, len);
+    } else {
+        for (size_t i = 0; i < nLanes; i++)
+            Blake(data[i], len, a[i]);
+    }
+
+    Step(Bmw, NULL, a, b, nLanes, true, false);
+    Step(Groestl, NULL, b, a, nLanes, false, true);
+    Step(Skein, Skein4, b, a, nLanes, false, false);
+    Step(Groestl, NULL, a, b, nLanes, true, false);
+    Step(Jh, Jh4, b, a, nLanes, true, false);
+    Step(Blake64, Blake4 != NULL ? Blake64x4 : NULL, a, b, nLanes, false, true);
+    Step(Bmw, NULL, a, b, nLanes, false, false);
+    Step(Keccak, Keccak4, b, a, nLanes, true, false);
+    Step(Skein, Skein4, a, b, nLanes, true, false);
+    Step(Keccak, Keccak4, b, a, nLanes, false, true);
+    Step(Jh, Jh4, b, a, nLanes, false, false);
+
+    for (size_t i = 0; i < nLanes; i++)
+        memcpy(hash[i], a[i], QUARK_OUTPUT_SIZE);
+}
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+bool HaveAVX2()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    // The OS must save the YMM registers (OSXSAVE + AVX, XCR0 bits 1 and 2).
+    if ((ecx & (1 << 27)) == 0 || (ecx & (1 << 28)) == 0)
+        return false;
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6)
+        return false;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 5)) != 0;
+}
+#endif
+} // namespace
+
+void QuarkHash(const unsigned char* data, size_t len, unsigned char hash[QUARK_OUTPUT_SIZE])
+{
+    unsigned char a[64], b[64];
+
+    Blake(data, len, a);
+    Bmw(a, b);
+    if (Branch(b))
+        Groestl(b, a);
+    else
+        Skein(b, a);
+    Groestl(a, b);
+    Jh(b, a);
+    if (Branch(a))
+        Blake(a, 64, b);
+    else
+        Bmw(a, b);
+    Keccak(b, a);
+    Skein(a, b);
+    if (Branch(b))
+        Keccak(b, a);
+    else
+        Jh(b, a);
+
+    memcpy(hash, a, QUARK_OUTPUT_SIZE);
+}
+
+void QuarkHashLanes(const unsigned char* const data[], size_t len, unsigned char* const hash[], size_t nLanes)
+{
+    for (size_t i = 0; i < nLanes; i += QUARK_MAX_LANES) {
+        size_t n = nLanes - i < QUARK_MAX_LANES ? nLanes - i : QUARK_MAX_LANES;
+        HashLanes(data + i, len, hash + i, n);
+    }
+}
+
+std::string QuarkAutoDetect()
+{
+#if defined(ENABLE_AVX2) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+    if (HaveAVX2()) {
+        Blake4 = quark_avx2::Blake512;
+        Jh4 = quark_avx2::Jh512_64;
+        Keccak4 = quark_avx2::Keccak512_64;
+        Skein4 = quark_avx2::Skein512_64;
+        return "avx2(4way blake,jh,keccak,skein)";
+    }
+#endif
+    return "standard";
+}
@@ -0,0 +1,31 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_QUARK_H
+#define BITCOIN_CRYPTO_QUARK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/** Number of messages the vector kernels hash side by side. */
+static const size_t QUARK_MAX_LANES = 4;
+
+/** Size of a Quark digest (the first half of the final 512-bit hash). */
+static const size_t QUARK_OUTPUT_SIZE = 32;
+
+/** Compute the Quark hash of one message. */
+void QuarkHash(const unsigned char* data, size_t len, unsigned char hash[QUARK_OUTPUT_SIZE]);
+
+/**
+ * Compute the Quark hash of nLanes messages of equal length. Messages are
+ * processed QUARK_MAX_LANES at a time on the vector kernels selected by
+ * QuarkAutoDetect(); results are identical to calling QuarkHash() on each.
+ */
+void QuarkHashLanes(const unsigned char* const data[], size_t len, unsigned char* const hash[], size_t nLanes);
+
+/** Autodetect the best available Quark implementation. Returns its name. */
+std::string QuarkAutoDetect();
+
+#endif // BITCOIN_CRYPTO_QUARK_H
@@ -0,0 +1,443 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This file is compiled with -mavx2 and must only be entered after a runtime
+// check (see QuarkAutoDetect in quark.cpp).
+
+#ifdef ENABLE_AVX2
+
+#include "crypto/common.h"
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace quark_avx2
+{
+namespace
+{
+/** Four independent 64-bit lanes, one per message. */
+typedef __m256i v4;
+
+#define ROTR64(x, n) _mm256_or_si256(_mm256_srli_epi64((x), (n)), _mm256_slli_epi64((x), 64 - (n)))
+#define ROTL64(x, n) _mm256_or_si256(_mm256_slli_epi64((x), (n)), _mm256_srli_epi64((x), 64 - (n)))
+
+v4 inline K(uint64_t x) { return _mm256_set1_epi64x(x); }
+v4 inline Add(v4 x, v4 y) { return _mm256_add_epi64(x, y); }
+v4 inline Xor(v4 x, v4 y) { return _mm256_xor_si256(x, y); }
+
+/** Load 64-bit word i of each lane's message, little-endian. */
+v4 inline LoadLE(const unsigned char* const in[4], int i)
+{
+    return _mm256_set_epi64x(ReadLE64(in[3] + 8 * i), ReadLE64(in[2] + 8 * i), ReadLE64(in[1] + 8 * i), ReadLE64(in[0] + 8 * i));
+}
+
+void inline StoreLE(unsigned char* const out[4], int i, v4 x)
+{
+    uint64_t w[4];
+    _mm256_storeu_si256((__m256i*)w, x);
+    for (int l = 0; l < 4; l++)
+        WriteLE64(out[l] + 8 * i, w[l]);
+}
+
+void inline StoreBE(unsigned char* const out[4], int i, v4 x)
+{
+    uint64_t w[4];
+    _mm256_storeu_si256((__m256i*)w, x);
+    for (int l = 0; l < 4; l++)
+        WriteBE64(out[l] + 8 * i, w[l]);
+}
+
+/** BLAKE-512 (sph_blake512), one final block per lane. */
+namespace blake
+{
+const uint64_t IV[8] = {
+    0x6A09E667F3BCC908ull, 0xBB67AE8584CAA73Bull, 0x3C6EF372FE94F82Bull, 0xA54FF53A5F1D36F1ull,
+    0x510E527FADE682D1ull, 0x9B05688C2B3E6C1Full, 0x1F83D9ABFB41BD6Bull, 0x5BE0CD19137E2179ull};
+
+const uint64_t CB[16] = {
+    0x243F6A8885A308D3ull, 0x13198A2E03707344ull, 0xA4093822299F31D0ull, 0x082EFA98EC4E6C89ull,
+    0x452821E638D01377ull, 0xBE5466CF34E90C6Cull, 0xC0AC29B7C97C50DDull, 0x3F84D5B5B5470917ull,
+    0x9216D5D98979FB1Bull, 0xD1310BA698DFB5ACull, 0x2FFD72DBD01ADFB7ull, 0xB8E1AFED6A267E96ull,
+    0xBA7C9045F12C7F99ull, 0x24A19947B3916CF7ull, 0x0801F2E2858EFC16ull, 0x636920D871574E69ull};
+
+const unsigned char SIGMA[10][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0}};
+
+void inline G(v4& a, v4& b, v4& c, v4& d, const v4* m, const unsigned char* s, int i)
+{
+    const __m256i rot16 = _mm256_setr_epi8(
+        2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+        2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+    a = Add(Add(a, b), Xor(m[s[2 * i]], K(CB[s[2 * i + 1]])));
+    d = _mm256_shuffle_epi32(Xor(d, a), 0xB1);
+    c = Add(c, d);
+    b = ROTR64(Xor(b, c), 25);
+    a = Add(Add(a, b), Xor(m[s[2 * i + 1]], K(CB[s[2 * i]])));
+    d = _mm256_shuffle_epi8(Xor(d, a), rot16);
+    c = Add(c, d);
+    b = ROTR64(Xor(b, c), 11);
+}
+} // namespace blake
+
+/** Skein-512-512 (sph_skein512), fixed 64-byte input. */
+namespace skein
+{
+const uint64_t IV[8] = {
+    0x4903ADFF749C51CEull, 0x0D95DE399746DF03ull, 0x8FD1934127C79BCEull, 0x9A255629FF352CB1ull,
+    0x5DB62599DF6CA7B0ull, 0xEABE394CA9D5C3F4ull, 0x991112C71A75B523ull, 0xAE18A40B660FCC33ull};
+
+#define SKEIN_MIX(x0, x1, rc) \
+    do {                      \
+        x0 = Add(x0, x1);     \
+        x1 = Xor(ROTL64(x1, rc), x0); \
+    } while (0)
+
+#define SKEIN_ROUND(p0, p1, p2, p3, p4, p5, p6, p7, r0, r1, r2, r3) \
+    do {                                                            \
+        SKEIN_MIX(p0, p1, r0);                                      \
+        SKEIN_MIX(p2, p3, r1);                                      \
+        SKEIN_MIX(p4, p5, r2);                                      \
+        SKEIN_MIX(p6, p7, r3);                                      \
+    } while (0)
+
+#define SKEIN_8E(p)                                                                            \
+    do {                                                                                       \
+        SKEIN_ROUND(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], 46, 36, 19, 37);           \
+        SKEIN_ROUND(p[2], p[1], p[4], p[7], p[6], p[5], p[0], p[3], 33, 27, 14, 42);           \
+        SKEIN_ROUND(p[4], p[1], p[6], p[3], p[0], p[5], p[2], p[7], 17, 49, 36, 39);           \
+        SKEIN_ROUND(p[6], p[1], p[0], p[7], p[2], p[5], p[4], p[3], 44, 9, 54, 56);            \
+    } while (0)
+
+#define SKEIN_8O(p)                                                                            \
+    do {                                                                                       \
+        SKEIN_ROUND(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], 39, 30, 34, 24);           \
+        SKEIN_ROUND(p[2], p[1], p[4], p[7], p[6], p[5], p[0], p[3], 13, 50, 10, 17);           \
+        SKEIN_ROUND(p[4], p[1], p[6], p[3], p[0], p[5], p[2], p[7], 25, 29, 39, 43);           \
+        SKEIN_ROUND(p[6], p[1], p[0], p[7], p[2], p[5], p[4], p[3], 8, 35, 56, 22);            \
+    } while (0)
+
+/** One UBI block: h = E(h, t, m) ^ m. The tweak is the same for every lane. */
+void inline UBI(v4 h[8], const v4 m[8], uint64_t t0, uint64_t t1)
+{
+    v4 k[9];
+    k[8] = K(0x1BD11BDAA9FC1A22ull);
+    for (int i = 0; i < 8; i++) {
+        k[i] = h[i];
+        k[8] = Xor(k[8], h[i]);
+    }
+    const uint64_t t[3] = {t0, t1, t0 ^ t1};
+
+    v4 p[8];
+    for (int i = 0; i < 8; i++)
+        p[i] = m[i];
+
+    for (int s = 0; s <= 18; s++) {
+        for (int i = 0; i < 8; i++)
+            p[i] = Add(p[i], k[(s + i) % 9]);
+        p[5] = Add(p[5], K(t[s % 3]));
+        p[6] = Add(p[6], K(t[(s + 1) % 3]));
+        p[7] = Add(p[7], K(s));
+        if (s == 18)
+            break;
+        if (s & 1)
+            SKEIN_8O(p);
+        else
+            SKEIN_8E(p);
+    }
+
+    for (int i = 0; i < 8; i++)
+        h[i] = Xor(m[i], p[i]);
+}
+} // namespace skein
+
+/** Keccak-512 (sph_keccak512), fixed 64-byte input: a single permutation. */
+namespace keccak
+{
+const uint64_t RC[24] = {
+    0x0000000000000001ull, 0x0000000000008082ull, 0x800000000000808Aull, 0x8000000080008000ull,
+    0x000000000000808Bull, 0x0000000080000001ull, 0x8000000080008081ull, 0x8000000000008009ull,
+    0x000000000000008Aull, 0x0000000000000088ull, 0x0000000080008009ull, 0x000000008000000Aull,
+    0x000000008000808Bull, 0x800000000000008Bull, 0x8000000000008089ull, 0x8000000000008003ull,
+    0x8000000000008002ull, 0x8000000000000080ull, 0x000000000000800Aull, 0x800000008000000Aull,
+    0x8000000080008081ull, 0x8000000000008080ull, 0x0000000080000001ull, 0x8000000080008008ull};
+
+/** Rotation offsets, indexed by x + 5 * y. */
+const int RHO[25] = {
+    0, 1, 62, 28, 27,
+    36, 44, 6, 55, 20,
+    3, 10, 43, 25, 39,
+    41, 45, 15, 21, 8,
+    18, 2, 61, 56, 14};
+
+v4 inline RotL(v4 x, int n)
+{
+    return _mm256_or_si256(_mm256_sllv_epi64(x, K(n)), _mm256_srlv_epi64(x, K(64 - n)));
+}
+
+void inline Permute(v4 a[25])
+{
+    v4 b[25], c[5], d[5];
+    for (int r = 0; r < 24; r++) {
+        for (int x = 0; x < 5; x++)
+            c[x] = Xor(Xor(Xor(a[x], a[x + 5]), Xor(a[x + 10], a[x + 15])), a[x + 20]);
+        for (int x = 0; x < 5; x++)
+            d[x] = Xor(c[(x + 4) % 5], ROTL64(c[(x + 1) % 5], 1));
+        for (int y = 0; y < 25; y += 5)
+            for (int x = 0; x < 5; x++)
+                a[y + x] = Xor(a[y + x], d[x]);
+        for (int y = 0; y < 5; y++)
+            for (int x = 0; x < 5; x++)
+                b[y + 5 * ((2 * x + 3 * y) % 5)] = RotL(a[x + 5 * y], RHO[x + 5 * y]);
+        for (int y = 0; y < 25; y += 5)
+            for (int x = 0; x < 5; x++)
+                a[y + x] = Xor(b[y + x], _mm256_andnot_si256(b[y + (x + 1) % 5], b[y + (x + 2) % 5]));
+        a[0] = Xor(a[0], K(RC[r]));
+    }
+}
+} // namespace keccak
+
+/** JH-512 (sph_jh512), fixed 64-byte input, in the big-endian bitslice representation. */
+namespace jh
+{
+const uint64_t IV[16] = {
+    0x6FD14B963E00AA17ull, 0x636A2E057A15D543ull, 0x8A225E8D0C97EF0Bull, 0xE9341259F2B3C361ull,
+    0x891DA0C1536F801Eull, 0x2AA9056BEA2B6D80ull, 0x588ECCDB2075BAA6ull, 0xA90F3A76BAF83BF7ull,
+    0x0169E60541E34A69ull, 0x46B58A8E2E6FE65Aull, 0x1047A7D0C1843C24ull, 0x3B6E71B12D5AC199ull,
+    0xCF57F6EC9DB1F856ull, 0xA706887C5716B156ull, 0xE3C2FCDFE68517FBull, 0x545A4678CC8CDD4Bull};
+
+/** Round constants: even high, even low, odd high, odd low for each of the 42 rounds. */
+const uint64_t C[168] = {
+    0x72D5DEA2DF15F867ull, 0x7B84150AB7231557ull, 0x81ABD6904D5A87F6ull, 0x4E9F4FC5C3D12B40ull,
+    0xEA983AE05C45FA9Cull, 0x03C5D29966B2999Aull, 0x660296B4F2BB538Aull, 0xB556141A88DBA231ull,
+    0x03A35A5C9A190EDBull, 0x403FB20A87C14410ull, 0x1C051980849E951Dull, 0x6F33EBAD5EE7CDDCull,
+    0x10BA139202BF6B41ull, 0xDC786515F7BB27D0ull, 0x0A2C813937AA7850ull, 0x3F1ABFD2410091D3ull,
+    0x422D5A0DF6CC7E90ull, 0xDD629F9C92C097CEull, 0x185CA70BC72B44ACull, 0xD1DF65D663C6FC23ull,
+    0x976E6C039EE0B81Aull, 0x2105457E446CECA8ull, 0xEEF103BB5D8E61FAull, 0xFD9697B294838197ull,
+    0x4A8E8537DB03302Full, 0x2A678D2DFB9F6A95ull, 0x8AFE7381F8B8696Cull, 0x8AC77246C07F4214ull,
+    0xC5F4158FBDC75EC4ull, 0x75446FA78F11BB80ull, 0x52DE75B7AEE488BCull, 0x82B8001E98A6A3F4ull,
+    0x8EF48F33A9A36315ull, 0xAA5F5624D5B7F989ull, 0xB6F1ED207C5AE0FDull, 0x36CAE95A06422C36ull,
+    0xCE2935434EFE983Dull, 0x533AF974739A4BA7ull, 0xD0F51F596F4E8186ull, 0x0E9DAD81AFD85A9Full,
+    0xA7050667EE34626Aull, 0x8B0B28BE6EB91727ull, 0x47740726C680103Full, 0xE0A07E6FC67E487Bull,
+    0x0D550AA54AF8A4C0ull, 0x91E3E79F978EF19Eull, 0x8676728150608DD4ull, 0x7E9E5A41F3E5B062ull,
+    0xFC9F1FEC4054207Aull, 0xE3E41A00CEF4C984ull, 0x4FD794F59DFA95D8ull, 0x552E7E1124C354A5ull,
+    0x5BDF7228BDFE6E28ull, 0x78F57FE20FA5C4B2ull, 0x05897CEFEE49D32Eull, 0x447E9385EB28597Full,
+    0x705F6937B324314Aull, 0x5E8628F11DD6E465ull, 0xC71B770451B920E7ull, 0x74FE43E823D4878Aull,
+    0x7D29E8A3927694F2ull, 0xDDCB7A099B30D9C1ull, 0x1D1B30FB5BDC1BE0ull, 0xDA24494FF29C82BFull,
+    0xA4E7BA31B470BFFFull, 0x0D324405DEF8BC48ull, 0x3BAEFC3253BBD339ull, 0x459FC3C1E0298BA0ull,
+    0xE5C905FDF7AE090Full, 0x947034124290F134ull, 0xA271B701E344ED95ull, 0xE93B8E364F2F984Aull,
+    0x88401D63A06CF615ull, 0x47C1444B8752AFFFull, 0x7EBB4AF1E20AC630ull, 0x4670B6C5CC6E8CE6ull,
+    0xA4D5A456BD4FCA00ull, 0xDA9D844BC83E18AEull, 0x7357CE453064D1ADull, 0xE8A6CE68145C2567ull,
+    0xA3DA8CF2CB0EE116ull, 0x33E906589A94999Aull, 0x1F60B220C26F847Bull, 0xD1CEAC7FA0D18518ull,
+    0x32595BA18DDD19D3ull, 0x509A1CC0AAA5B446ull, 0x9F3D6367E4046BBAull, 0xF6CA19AB0B56EE7Eull,
+    0x1FB179EAA9282174ull, 0xE9BDF7353B3651EEull, 0x1D57AC5A7550D376ull, 0x3A46C2FEA37D7001ull,
+    0xF735C1AF98A4D842ull, 0x78EDEC209E6B6779ull, 0x41836315EA3ADBA8ull, 0xFAC33B4D32832C83ull,
+    0xA7403B1F1C2747F3ull, 0x5940F034B72D769Aull, 0xE73E4E6CD2214FFDull, 0xB8FD8D39DC5759EFull,
+    0x8D9B0C492B49EBDAull, 0x5BA2D74968F3700Dull, 0x7D3BAED07A8D5584ull, 0xF5A5E9F0E4F88E65ull,
+    0xA0B8A2F436103B53ull, 0x0CA8079E753EEC5Aull, 0x9168949256E8884Full, 0x5BB05C55F8BABC4Cull,
+    0xE3BB3B99F387947Bull, 0x75DAF4D6726B1C5Dull, 0x64AEAC28DC34B36Dull, 0x6C34A550B828DB71ull,
+    0xF861E2F2108D512Aull, 0xE3DB643359DD75FCull, 0x1CACBCF143CE3FA2ull, 0x67BBD13C02E843B0ull,
+    0x330A5BCA8829A175ull, 0x7F34194DB416535Cull, 0x923B94C30E794D1Eull, 0x797475D7B6EEAF3Full,
+    0xEAA8D4F7BE1A3921ull, 0x5CF47E094C232751ull, 0x26A32453BA323CD2ull, 0x44A3174A6DA6D5ADull,
+    0xB51D3EA6AFF2C908ull, 0x83593D98916B3C56ull, 0x4CF87CA17286604Dull, 0x46E23ECC086EC7F6ull,
+    0x2F9833B3B1BC765Eull, 0x2BD666A5EFC4E62Aull, 0x06F4B6E8BEC1D436ull, 0x74EE8215BCEF2163ull,
+    0xFDC14E0DF453C969ull, 0xA77D5AC406585826ull, 0x7EC1141606E0FA16ull, 0x7E90AF3D28639D3Full,
+    0xD2C9F2E3009BD20Cull, 0x5FAACE30B7D40C30ull, 0x742A5116F2E03298ull, 0x0DEB30D8E3CEF89Aull,
+    0x4BC59E7BB5F17992ull, 0xFF51E66E048668D3ull, 0x9B234D57E6966731ull, 0xCCE6A6F3170A7505ull,
+    0xB17681D913326CCEull, 0x3C175284F805A262ull, 0xF42BCBB378471547ull, 0xFF46548223936A48ull,
+    0x38DF58074E5E6565ull, 0xF2FC7C89FC86508Eull, 0x31702E44D00BCA86ull, 0xF04009A23078474Eull,
+    0x65A0EE39D1F73883ull, 0xF75EE937E42C3ABDull, 0x2197B2260113F86Full, 0xA344EDD1EF9FDEE7ull,
+    0x8BA0DF15762592D9ull, 0x3C85F7F612DC42BEull, 0xD8A7EC7CAB27B07Eull, 0x538D7DDAAA3EA8DEull,
+    0xAA25CE93BD0269D8ull, 0x5AF643FD1A7308F9ull, 0xC05FEFDA174A19A5ull, 0x974D66334CFD216Aull,
+    0x35B49831DB411570ull, 0xEA1E0FBBEDCD549Bull, 0x9AD063A151974072ull, 0xF6759DBF91476FE2ull};
+
+void inline Sb(v4& x0, v4& x1, v4& x2, v4& x3, v4 c)
+{
+    x3 = Xor(x3, K(~0ull));
+    x0 = Xor(x0, _mm256_andnot_si256(x2, c));
+    v4 tmp = Xor(c, _mm256_and_si256(x0, x1));
+    x0 = Xor(x0, _mm256_and_si256(x2, x3));
+    x3 = Xor(x3, _mm256_andnot_si256(x1, x2));
+    x1 = Xor(x1, _mm256_and_si256(x0, x2));
+    x2 = Xor(x2, _mm256_andnot_si256(x3, x0));
+    x0 = Xor(x0, _mm256_or_si256(x1, x3));
+    x3 = Xor(x3, _mm256_and_si256(x1, x2));
+    x1 = Xor(x1, _mm256_and_si256(tmp, x0));
+    x2 = Xor(x2, tmp);
+}
+
+void inline Lb(v4& x0, v4& x1, v4& x2, v4& x3, v4& x4, v4& x5, v4& x6, v4& x7)
+{
+    x4 = Xor(x4, x1);
+    x5 = Xor(x5, x2);
+    x6 = Xor(x6, Xor(x3, x0));
+    x7 = Xor(x7, x0);
+    x0 = Xor(x0, x5);
+    x1 = Xor(x1, x6);
+    x2 = Xor(x2, Xor(x7, x4));
+    x3 = Xor(x3, x4);
+}
+
+/** Swap adjacent n-bit groups selected by mask c; n = 32 and 64 are special-cased. */
+template <int n>
+void inline W(v4& h, v4& l, uint64_t c)
+{
+    if (n == 64) {
+        v4 t = h;
+        h = l;
+        l = t;
+    } else if (n == 32) {
+        h = _mm256_shuffle_epi32(h, 0xB1);
+        l = _mm256_shuffle_epi32(l, 0xB1);
+    } else {
+        const v4 m = K(c);
+        h = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(h, n), m), _mm256_slli_epi64(_mm256_and_si256(h, m), n));
+        l = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(l, n), m), _mm256_slli_epi64(_mm256_and_si256(l, m), n));
+    }
+}
+
+/** One round; x[2 * i] and x[2 * i + 1] are the high and low halves of state word i. */
+template <int n>
+void inline Round(v4 x[16], int r, uint64_t c)
+{
+    const uint64_t* rc = C + 4 * r;
+    Sb(x[0], x[4], x[8], x[12], K(rc[0]));
+    Sb(x[1], x[5], x[9], x[13], K(rc[1]));
+    Sb(x[2], x[6], x[10], x[14], K(rc[2]));
+    Sb(x[3], x[7], x[11], x[15], K(rc[3]));
+    Lb(x[0], x[4], x[8], x[12], x[2], x[6], x[10], x[14]);
+    Lb(x[1], x[5], x[9], x[13], x[3], x[7], x[11], x[15]);
+    W<n>(x[2], x[3], c);
+    W<n>(x[6], x[7], c);
+    W<n>(x[10], x[11], c);
+    W<n>(x[14], x[15], c);
+}
+
+void inline E8(v4 x[16])
+{
+    for (int r = 0; r < 42; r += 7) {
+        Round<1>(x, r, 0x5555555555555555ull);
+        Round<2>(x, r + 1, 0x3333333333333333ull);
+        Round<4>(x, r + 2, 0x0F0F0F0F0F0F0F0Full);
+        Round<8>(x, r + 3, 0x00FF00FF00FF00FFull);
+        Round<16>(x, r + 4, 0x0000FFFF0000FFFFull);
+        Round<32>(x, r + 5, 0);
+        Round<64>(x, r + 6, 0);
+    }
+}
+
+/** Compression function F8: absorb m into the first half, permute, absorb into the second. */
+void inline F8(v4 x[16], const v4 m[8])
+{
+    for (int i = 0; i < 8; i++)
+        x[i] = Xor(x[i], m[i]);
+    E8(x);
+    for (int i = 0; i < 8; i++)
+        x[8 + i] = Xor(x[8 + i], m[i]);
+}
+} // namespace jh
+} // namespace
+
+void Blake512(unsigned char* const out[4], const unsigned char* const in[4], size_t len)
+{
+    // Build the single padded block for each lane (len <= 111).
+    unsigned char block[4][128];
+    const uint64_t bits = len << 3;
+    for (int l = 0; l < 4; l++) {
+        memset(block[l], 0, sizeof(block[l]));
+        memcpy(block[l], in[l], len);
+        block[l][len] = 0x80;
+        block[l][111] |= 1;
+        WriteBE64(block[l] + 120, bits);
+    }
+
+    v4 m[16];
+    for (int i = 0; i < 16; i++)
+        m[i] = _mm256_set_epi64x(ReadBE64(block[3] + 8 * i), ReadBE64(block[2] + 8 * i), ReadBE64(block[1] + 8 * i), ReadBE64(block[0] + 8 * i));
+
+    v4 v[16];
+    for (int i = 0; i < 8; i++)
+        v[i] = K(blake::IV[i]);
+    for (int i = 0; i < 4; i++)
+        v[8 + i] = K(blake::CB[i]);
+    v[12] = K(bits ^ blake::CB[4]);
+    v[13] = K(bits ^ blake::CB[5]);
+    v[14] = K(blake::CB[6]);
+    v[15] = K(blake::CB[7]);
+
+    for (int r = 0; r < 16; r++) {
+        const unsigned char* s = blake::SIGMA[r % 10];
+        blake::G(v[0], v[4], v[8], v[12], m, s, 0);
+        blake::G(v[1], v[5], v[9], v[13], m, s, 1);
+        blake::G(v[2], v[6], v[10], v[14], m, s, 2);
+        blake::G(v[3], v[7], v[11], v[15], m, s, 3);
+        blake::G(v[0], v[5], v[10], v[15], m, s, 4);
+        blake::G(v[1], v[6], v[11], v[12], m, s, 5);
+        blake::G(v[2], v[7], v[8], v[13], m, s, 6);
+        blake::G(v[3], v[4], v[9], v[14], m, s, 7);
+    }
+
+    for (int i = 0; i < 8; i++)
+        StoreBE(out, i, Xor(K(blake::IV[i]), Xor(v[i], v[i + 8])));
+}
+
+void Keccak512_64(unsigned char* const out[4], const unsigned char* const in[4])
+{
+    v4 a[25];
+    for (int i = 0; i < 8; i++)
+        a[i] = LoadLE(in, i);
+    a[8] = K(0x8000000000000001ull);
+    for (int i = 9; i < 25; i++)
+        a[i] = _mm256_setzero_si256();
+    keccak::Permute(a);
+    for (int i = 0; i < 8; i++)
+        StoreLE(out, i, a[i]);
+}
+
+void Jh512_64(unsigned char* const out[4], const unsigned char* const in[4])
+{
+    v4 x[16], m[8];
+    for (int i = 0; i < 16; i++)
+        x[i] = K(jh::IV[i]);
+    for (int i = 0; i < 8; i++)
+        m[i] = _mm256_set_epi64x(ReadBE64(in[3] + 8 * i), ReadBE64(in[2] + 8 * i), ReadBE64(in[1] + 8 * i), ReadBE64(in[0] + 8 * i));
+    jh::F8(x, m);
+    // Padding block: 0x80, zeros, then the 128-bit message length in bits (512).
+    m[0] = K(0x8000000000000000ull);
+    for (int i = 1; i < 7; i++)
+        m[i] = _mm256_setzero_si256();
+    m[7] = K(512);
+    jh::F8(x, m);
+    for (int i = 0; i < 8; i++)
+        StoreBE(out, i, x[8 + i]);
+}
+
+void Skein512_64(unsigned char* const out[4], const unsigned char* const in[4])
+{
+    v4 h[8], m[8];
+    for (int i = 0; i < 8; i++) {
+        h[i] = K(skein::IV[i]);
+        m[i] = LoadLE(in, i);
+    }
+    // Message block (first and final), then the output block.
+    skein::UBI(h, m, 64, 480ull << 55);
+    for (int i = 0; i < 8; i++)
+        m[i] = _mm256_setzero_si256();
+    skein::UBI(h, m, 8, 510ull << 55);
+    for (int i = 0; i < 8; i++)
+        StoreLE(out, i, h[i]);
+}
+} // namespace quark_avx2
+
+#endif // ENABLE_AVX2
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,14 @@ public:
     CSHA256& Reset();
 };
 
+/** Autodetect the best available SHA256 implementation. Returns its name. */
+std::string SHA256AutoDetect();
+
+/**
+ * Compute the double-SHA256 of each of blocks consecutive 64-byte inputs,
+ * writing blocks consecutive 32-byte digests to output. Inputs are hashed
+ * several at a time on the vector kernels selected by SHA256AutoDetect().
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
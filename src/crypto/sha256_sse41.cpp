@@ -0,0 +1,183 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This file is compiled with -msse4.1 and must only be entered after a runtime
+// check (see SHA256AutoDetect in sha256.cpp).
+
+#ifdef ENABLE_SSE41
+
+#include "crypto/common.h"
+
+#include <immintrin.h>
+#include <stdint.h>
+
+namespace sha256d64_sse41
+{
+namespace
+{
+const uint32_t K[64] = {
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul, 0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul, 0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul, 0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul, 0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul, 0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul, 0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul,
+};
+
+/**
+ * Round constants plus the message schedule of the padding block that ends
+ * a 64-byte message. That block is the same for every input, so its
+ * schedule is computed once here instead of on every call.
+ */
+const uint32_t KPAD64[64] = {
+    0xc28a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf374ul,
+    0x649b69c1ul, 0xf0fe4786ul, 0x0fe1edc6ul, 0x240cf254ul, 0x4fe9346ful, 0x6cc984beul, 0x61b9411eul, 0x16f988faul,
+    0xf2c65152ul, 0xa88e5a6dul, 0xb019fc65ul, 0xb9d99ec7ul, 0x9a1231c3ul, 0xe70eeaa0ul, 0xfdb1232bul, 0xc7353eb0ul,
+    0x3069bad5ul, 0xcb976d5ful, 0x5a0f118ful, 0xdc1eeefdul, 0x0a35b689ul, 0xde0b7a04ul, 0x58f4ca9dul, 0xe15d5b16ul,
+    0x007f3e86ul, 0x37088980ul, 0xa507ea32ul, 0x6fab9537ul, 0x17406110ul, 0x0d8cd6f1ul, 0xcdaa3b6dul, 0xc0bbbe37ul,
+    0x83613bdaul, 0xdb48a363ul, 0x0b02e931ul, 0x6fd15ca7ul, 0x521afacaul, 0x31338431ul, 0x6ed41a95ul, 0x6d437890ul,
+    0xc39c91f2ul, 0x9eccabbdul, 0xb5c9a0e6ul, 0x532fb63cul, 0xd2c741c6ul, 0x07237ea3ul, 0xa4954b68ul, 0x4c191d76ul,
+};
+
+__m128i inline KS(uint32_t x) { return _mm_set1_epi32(x); }
+__m128i inline Add(__m128i x, __m128i y) { return _mm_add_epi32(x, y); }
+__m128i inline Add(__m128i x, __m128i y, __m128i z) { return Add(Add(x, y), z); }
+__m128i inline Add(__m128i x, __m128i y, __m128i z, __m128i w) { return Add(Add(x, y), Add(z, w)); }
+__m128i inline Xor(__m128i x, __m128i y) { return _mm_xor_si128(x, y); }
+__m128i inline Xor(__m128i x, __m128i y, __m128i z) { return Xor(Xor(x, y), z); }
+__m128i inline Or(__m128i x, __m128i y) { return _mm_or_si128(x, y); }
+__m128i inline And(__m128i x, __m128i y) { return _mm_and_si128(x, y); }
+__m128i inline ShR(__m128i x, int n) { return _mm_srli_epi32(x, n); }
+__m128i inline ShL(__m128i x, int n) { return _mm_slli_epi32(x, n); }
+
+__m128i inline Ch(__m128i x, __m128i y, __m128i z) { return Xor(z, And(x, Xor(y, z))); }
+__m128i inline Maj(__m128i x, __m128i y, __m128i z) { return Or(And(x, y), And(z, Or(x, y))); }
+__m128i inline Sigma0(__m128i x) { return Xor(Or(ShR(x, 2), ShL(x, 30)), Or(ShR(x, 13), ShL(x, 19)), Or(ShR(x, 22), ShL(x, 10))); }
+__m128i inline Sigma1(__m128i x) { return Xor(Or(ShR(x, 6), ShL(x, 26)), Or(ShR(x, 11), ShL(x, 21)), Or(ShR(x, 25), ShL(x, 7))); }
+__m128i inline sigma0(__m128i x) { return Xor(Or(ShR(x, 7), ShL(x, 25)), Or(ShR(x, 18), ShL(x, 14)), ShR(x, 3)); }
+__m128i inline sigma1(__m128i x) { return Xor(Or(ShR(x, 17), ShL(x, 15)), Or(ShR(x, 19), ShL(x, 13)), ShR(x, 10)); }
+
+/** One round of SHA-256; k is the round constant plus the message word. */
+void inline Round(__m128i a, __m128i b, __m128i c, __m128i& d, __m128i e, __m128i f, __m128i g, __m128i& h, __m128i k)
+{
+    __m128i t1 = Add(h, Sigma1(e), Ch(e, f, g), k);
+    __m128i t2 = Add(Sigma0(a), Maj(a, b, c));
+    d = Add(d, t1);
+    h = Add(t1, t2);
+}
+
+/** Eight rounds starting at round r, taking k + w for round r + j from kw(j). */
+#define ROUNDS8(kw)                                  \
+    do {                                             \
+        Round(a, b, c, d, e, f, g, h, kw(0));        \
+        Round(h, a, b, c, d, e, f, g, kw(1));        \
+        Round(g, h, a, b, c, d, e, f, kw(2));        \
+        Round(f, g, h, a, b, c, d, e, kw(3));        \
+        Round(e, f, g, h, a, b, c, d, kw(4));        \
+        Round(d, e, f, g, h, a, b, c, kw(5));        \
+        Round(c, d, e, f, g, h, a, b, kw(6));        \
+        Round(b, c, d, e, f, g, h, a, kw(7));        \
+    } while (0)
+
+/** Compress one block per lane into s, expanding the message schedule in w. */
+void inline Transform(__m128i s[8], __m128i w[16])
+{
+    __m128i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int r = 0; r < 64; r += 8) {
+        if (r >= 16) {
+            for (int j = r; j < r + 8; j++)
+                w[j & 15] = Add(w[j & 15], sigma1(w[(j + 14) & 15]), w[(j + 9) & 15], sigma0(w[(j + 1) & 15]));
+        }
+#define KW(j) Add(KS(K[r + (j)]), w[(r + (j)) & 15])
+        ROUNDS8(KW);
+#undef KW
+    }
+    s[0] = Add(s[0], a);
+    s[1] = Add(s[1], b);
+    s[2] = Add(s[2], c);
+    s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e);
+    s[5] = Add(s[5], f);
+    s[6] = Add(s[6], g);
+    s[7] = Add(s[7], h);
+}
+
+/** Compress the fixed padding block of a 64-byte message into s. */
+void inline TransformPad64(__m128i s[8])
+{
+    __m128i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int r = 0; r < 64; r += 8) {
+#define KW(j) KS(KPAD64[r + (j)])
+        ROUNDS8(KW);
+#undef KW
+    }
+    s[0] = Add(s[0], a);
+    s[1] = Add(s[1], b);
+    s[2] = Add(s[2], c);
+    s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e);
+    s[5] = Add(s[5], f);
+    s[6] = Add(s[6], g);
+    s[7] = Add(s[7], h);
+}
+
+void inline Initialize(__m128i s[8])
+{
+    s[0] = KS(0x6a09e667ul);
+    s[1] = KS(0xbb67ae85ul);
+    s[2] = KS(0x3c6ef372ul);
+    s[3] = KS(0xa54ff53aul);
+    s[4] = KS(0x510e527ful);
+    s[5] = KS(0x9b05688cul);
+    s[6] = KS(0x1f83d9abul);
+    s[7] = KS(0x5be0cd19ul);
+}
+
+/** Load the big-endian word at offset of each of the four 64-byte inputs. */
+__m128i inline Read(const unsigned char* in, int offset)
+{
+    return _mm_set_epi32(ReadBE32(in + 192 + offset), ReadBE32(in + 128 + offset), ReadBE32(in + 64 + offset), ReadBE32(in + offset));
+}
+
+/** Store each lane of x as a big-endian word at offset of its 32-byte output. */
+void inline Write(unsigned char* out, int offset, __m128i x)
+{
+    WriteBE32(out + offset, _mm_extract_epi32(x, 0));
+    WriteBE32(out + 32 + offset, _mm_extract_epi32(x, 1));
+    WriteBE32(out + 64 + offset, _mm_extract_epi32(x, 2));
+    WriteBE32(out + 96 + offset, _mm_extract_epi32(x, 3));
+}
+
+} // namespace
+
+void Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    __m128i s[8], w[16];
+
+    // First hash: the 64-byte message, then its padding block.
+    Initialize(s);
+    for (int i = 0; i < 16; i++)
+        w[i] = Read(in, 4 * i);
+    Transform(s, w);
+    TransformPad64(s);
+
+    // Second hash: the 32-byte digest with its padding in a single block.
+    for (int i = 0; i < 8; i++)
+        w[i] = s[i];
+    w[8] = KS(0x80000000ul);
+    for (int i = 9; i < 15; i++)
+        w[i] = KS(0);
+    w[15] = KS(0x100);
+    Initialize(s);
+    Transform(s, w);
+
+    for (int i = 0; i < 8; i++)
+        Write(out, 4 * i, s[i]);
+}
+} // namespace sha256d64_sse41
+
+#endif // ENABLE_SSE41
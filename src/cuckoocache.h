@@ -0,0 +1,252 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include "uint256.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/**
+ * Fixed-size, memory-bounded set of 256-bit keys, stored in a cuckoo hash
+ * table where every key has eight candidate slots. Keys must already be
+ * uniformly distributed (e.g. salted hashes): the slots are taken straight
+ * from the key's eight 32-bit words.
+ *
+ * Contains() takes no lock and may run concurrently with other Contains()
+ * calls and with one Insert(). Slots are read and written word by word
+ * through atomics, so a reader racing a writer sees a mix of an old and a new
+ * key; that mix only compares equal to the key looked up if one of them
+ * already shares 64-bit words with it, which for salted hashes does not
+ * happen in practice. A key moved by Insert() may briefly be missed, which
+ * costs the caller a recomputation and nothing else.
+ *
+ * Insert() and Setup() must be serialized by the caller.
+ *
+ * Eviction is generational. Keys inserted since the last generation change
+ * are flagged as current; once enough of them are live, the generation
+ * advances and keys from two generations back become eligible to be
+ * overwritten. Keys erased through Contains(..., true) are eligible at once.
+ */
+class CCuckooCache
+{
+private:
+    /** One table slot, accessed word by word so readers never race writers. */
+    struct Slot {
+        std::atomic<uint64_t> w[4];
+    };
+
+    std::unique_ptr<Slot[]> table;
+    uint32_t nSize;
+
+    /** Bit i is set if slot i may be overwritten. Shared with readers. */
+    std::unique_ptr<std::atomic<uint8_t>[]> vCollect;
+
+    /** Slots written or refreshed in the current generation. Writers only. */
+    std::vector<bool> vEpoch;
+
+    /** Inserts left before the next (linear-time) generation check. */
+    uint32_t nEpochHeuristicCounter;
+
+    /** Number of live current-generation slots that triggers a new generation. */
+    uint32_t nEpochSize;
+
+    /** Maximum number of displacements per insert before the last key is dropped. */
+    uint8_t nDepthLimit;
+
+    static void Load(const Slot& slot, uint64_t w[4])
+    {
+        for (int i = 0; i < 4; i++)
+            w[i] = slot.w[i].load(std::memory_order_relaxed);
+    }
+
+    static void Store(Slot& slot, const uint64_t w[4])
+    {
+        for (int i = 0; i < 4; i++)
+            slot.w[i].store(w[i], std::memory_order_relaxed);
+    }
+
+    static bool Equal(const uint64_t a[4], const uint64_t b[4])
+    {
+        return a[0] == b[0] && a[1] == b[1] && a[2] == b[2] && a[3] == b[3];
+    }
+
+    /** Map each 32-bit word of the key to a slot, without a modulo. */
+    void ComputeSlots(const uint64_t w[4], uint32_t locs[8]) const
+    {
+        for (int i = 0; i < 8; i++) {
+            uint32_t h = (uint32_t)(w[i / 2] >> (32 * (i % 2)));
+            locs[i] = (uint32_t)(((uint64_t)h * (uint64_t)nSize) >> 32);
+        }
+    }
+
+    bool IsCollectable(uint32_t i) const
+    {
+        return (vCollect[i >> 3].load(std::memory_order_relaxed) >> (i & 7)) & 1;
+    }
+
+    void SetCollectable(uint32_t i)
+    {
+        vCollect[i >> 3].fetch_or((uint8_t)(1 << (i & 7)), std::memory_order_relaxed);
+    }
+
+    void Keep(uint32_t i)
+    {
+        vCollect[i >> 3].fetch_and((uint8_t)~(1 << (i & 7)), std::memory_order_relaxed);
+    }
+
+    /**
+     * Advance the generation once enough of the current one is live. Counting
+     * is linear in the table size, so it only runs after an estimate of the
+     * number of inserts it takes to fill a generation.
+     */
+    void EpochCheck()
+    {
+        if (nEpochHeuristicCounter != 0) {
+            --nEpochHeuristicCounter;
+            return;
+        }
+        uint32_t nUnused = 0;
+        for (uint32_t i = 0; i < nSize; i++)
+            nUnused += vEpoch[i] && !IsCollectable(i);
+        if (nUnused >= nEpochSize) {
+            for (uint32_t i = 0; i < nSize; i++) {
+                if (vEpoch[i])
+                    vEpoch[i] = false;
+                else
+                    SetCollectable(i);
+            }
+            nEpochHeuristicCounter = nEpochSize;
+        } else {
+            nEpochHeuristicCounter = std::max(1u, std::max(nEpochSize / 16, nEpochSize - std::min(nEpochSize, nUnused)));
+        }
+    }
+
+public:
+    CCuckooCache() : nSize(0), nEpochHeuristicCounter(0), nEpochSize(0), nDepthLimit(0) {}
+
+    /**
+     * Size the table to fit in nBytes, dropping all keys. Setup(0) disables
+     * the cache. Returns the number of slots.
+     */
+    uint32_t Setup(size_t nBytes)
+    {
+        size_t nSlots = std::min(nBytes / sizeof(Slot), (size_t)UINT32_MAX);
+        nSize = 0;
+        table.reset();
+        vCollect.reset();
+        vEpoch.clear();
+        if (nSlots == 0)
+            return 0;
+
+        table.reset(new Slot[nSlots]);
+        vCollect.reset(new std::atomic<uint8_t>[(nSlots + 7) / 8]);
+        static const uint64_t zero[4] = {0, 0, 0, 0};
+        for (size_t i = 0; i < nSlots; i++)
+            Store(table[i], zero);
+        for (size_t i = 0; i < (nSlots + 7) / 8; i++)
+            vCollect[i].store(0xff, std::memory_order_relaxed);
+        vEpoch.assign(nSlots, false);
+        nSize = nSlots;
+        nEpochSize = std::max((uint32_t)1, (uint32_t)((uint64_t)nSize * 45 / 100));
+        nEpochHeuristicCounter = nEpochSize;
+        nDepthLimit = 0;
+        while (nDepthLimit < 32 && ((uint64_t)2 << nDepthLimit) <= nSize)
+            nDepthLimit++;
+        nDepthLimit = std::max((uint8_t)1, nDepthLimit);
+        return nSize;
+    }
+
+    /** Add a key, displacing others along its cuckoo path if needed. */
+    void Insert(const uint256& key)
+    {
+        if (nSize == 0)
+            return;
+        EpochCheck();
+
+        uint64_t e[4];
+        memcpy(e, key.begin(), sizeof(e));
+        uint32_t locs[8];
+        ComputeSlots(e, locs);
+
+        // Already present: make sure it is kept and counts as current.
+        for (int i = 0; i < 8; i++) {
+            uint64_t w[4];
+            Load(table[locs[i]], w);
+            if (Equal(w, e)) {
+                Keep(locs[i]);
+                vEpoch[locs[i]] = true;
+                return;
+            }
+        }
+
+        uint32_t nLastLoc = nSize;
+        bool fLastEpoch = true;
+        for (uint8_t depth = 0; depth < nDepthLimit; ++depth) {
+            for (int i = 0; i < 8; i++) {
+                if (!IsCollectable(locs[i]))
+                    continue;
+                Store(table[locs[i]], e);
+                Keep(locs[i]);
+                vEpoch[locs[i]] = fLastEpoch;
+                return;
+            }
+
+            // Displace the occupant of the slot after the one we came from,
+            // so that two keys do not keep swapping the same slot.
+            int next = 0;
+            for (int i = 0; i < 8; i++) {
+                if (locs[i] == nLastLoc) {
+                    next = (i + 1) & 7;
+                    break;
+                }
+            }
+            nLastLoc = locs[next];
+            uint64_t displaced[4];
+            Load(table[nLastLoc], displaced);
+            Store(table[nLastLoc], e);
+            memcpy(e, displaced, sizeof(e));
+            bool fEpoch = fLastEpoch;
+            fLastEpoch = vEpoch[nLastLoc];
+            vEpoch[nLastLoc] = fEpoch;
+
+            ComputeSlots(e, locs);
+        }
+        // The key still in hand at the depth limit is dropped.
+    }
+
+    /**
+     * Whether key is in the table. If fErase, a hit marks its slot as free
+     * to overwrite (the key stays visible until then).
+     */
+    bool Contains(const uint256& key, bool fErase)
+    {
+        if (nSize == 0)
+            return false;
+        uint64_t e[4];
+        memcpy(e, key.begin(), sizeof(e));
+        uint32_t locs[8];
+        ComputeSlots(e, locs);
+        for (int i = 0; i < 8; i++) {
+            uint64_t w[4];
+            Load(table[locs[i]], w);
+            if (Equal(w, e)) {
+                if (fErase)
+                    SetCollectable(locs[i]);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t Size() const { return nSize; }
+};
+
+#endif // BITCOIN_CUCKOOCACHE_H
@@ -4,9 +4,12 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <atomic>
+
 #include <boost/assign/list_of.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include "checkqueue.h"
 #include "db.h"
 #include "kernel.h"
 #include "script/interpreter.h"
@@ -21,6 +24,9 @@ bool fTestNet = false; //Params().NetworkID() == CBaseChainParams::TESTNET;
 // Set to 3-hour for production network and 20-minute for test network
 unsigned int nModifierInterval;
 int nStakeTargetSpacing = 60;
+int nStakeKernelThreads = 0;
+double dStakeHashesPerSec = 0.0;
+uint64_t nStakeHashesLast = 0;
 unsigned int getIntervalVersion(bool fTestNet)
 {
     if (fTestNet)
@@ -240,14 +246,109 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
     return true;
 }
 
+CStakeModifierCache stakeModifierCache;
+
+void CStakeModifierCache::Resolve(int nHeightFrom, int nHeightModifier, uint64_t nStakeModifier, int64_t nTimeModifier)
+{
+    if ((int)vEntries.size() <= nHeightModifier)
+        vEntries.resize(nHeightModifier + 1);
+    CEntry& entryFrom = vEntries[nHeightFrom];
+    entryFrom.nHeightModifier = nHeightModifier;
+    entryFrom.nStakeModifier = nStakeModifier;
+    entryFrom.nTimeModifier = nTimeModifier;
+    CEntry& entryModifier = vEntries[nHeightModifier];
+    if (entryModifier.nLowestResolved < 0 || nHeightFrom < entryModifier.nLowestResolved)
+        entryModifier.nLowestResolved = nHeightFrom;
+}
+
+bool CStakeModifierCache::Get(int nHeightFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime) const
+{
+    LOCK(cs);
+    if (nHeightFrom < 0 || nHeightFrom >= (int)vEntries.size())
+        return false;
+    const CEntry& entry = vEntries[nHeightFrom];
+    if (entry.nHeightModifier < 0)
+        return false;
+
+    nStakeModifier = entry.nStakeModifier;
+    nStakeModifierHeight = entry.nHeightModifier;
+    nStakeModifierTime = entry.nTimeModifier;
+    return true;
+}
+
+void CStakeModifierCache::Set(int nHeightFrom, int nHeightModifier, uint64_t nStakeModifier, int64_t nTimeModifier)
+{
+    LOCK(cs);
+    assert(nHeightFrom < nHeightModifier);
+    Resolve(nHeightFrom, nHeightModifier, nStakeModifier, nTimeModifier);
+}
+
+void CStakeModifierCache::BlockConnected(const CBlockIndex* pindex)
+{
+    LOCK(cs);
+    int nHeight = pindex->nHeight;
+    if ((int)vEntries.size() <= nHeight)
+        vEntries.resize(nHeight + 1);
+    if (nFirstPending < 0)
+        nFirstPending = nHeight;
+    if (!pindex->GeneratedStakeModifier())
+        return;
+
+    // the new modifier serves every pending height whose selection interval has elapsed
+    int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
+    for (int nHeightFrom = nFirstPending; nHeightFrom < nHeight; nHeightFrom++) {
+        if (vEntries[nHeightFrom].nHeightModifier >= 0)
+            continue;
+        const CBlockIndex* pindexFrom = chainActive[nHeightFrom];
+        if (pindexFrom && pindex->GetBlockTime() >= pindexFrom->GetBlockTime() + nStakeModifierSelectionInterval)
+            Resolve(nHeightFrom, nHeight, pindex->nStakeModifier, pindex->GetBlockTime());
+    }
+    while (nFirstPending < nHeight && vEntries[nFirstPending].nHeightModifier >= 0)
+        nFirstPending++;
+}
+
+void CStakeModifierCache::BlockDisconnected(const CBlockIndex* pindex)
+{
+    LOCK(cs);
+    int nHeight = pindex->nHeight;
+    if (nHeight >= (int)vEntries.size())
+        return;
+
+    // heights resolved by the disconnected block become pending again
+    int nLowestResolved = vEntries[nHeight].nLowestResolved;
+    if (nLowestResolved >= 0) {
+        for (int nHeightFrom = nLowestResolved; nHeightFrom < nHeight; nHeightFrom++) {
+            if (vEntries[nHeightFrom].nHeightModifier == nHeight)
+                vEntries[nHeightFrom].nHeightModifier = -1;
+        }
+        if (nFirstPending >= 0)
+            nFirstPending = std::min(nFirstPending, nLowestResolved);
+    }
+    vEntries.resize(nHeight);
+    if (nFirstPending > nHeight)
+        nFirstPending = nHeight;
+}
+
+void CStakeModifierCache::Clear()
+{
+    LOCK(cs);
+    vEntries.clear();
+    nFirstPending = -1;
+}
+
+size_t CStakeModifierCache::Size() const
+{
+    LOCK(cs);
+    return vEntries.size();
+}
+
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
-bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+bool FindKernelStakeModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime)
 {
     nStakeModifier = 0;
-    if (!mapBlockIndex.count(hashBlockFrom))
-        return error("GetKernelStakeModifier() : block not indexed");
-    const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
+    if (!pindexFrom)
+        return error("FindKernelStakeModifier() : block not indexed");
     nStakeModifierHeight = pindexFrom->nHeight;
     nStakeModifierTime = pindexFrom->GetBlockTime();
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
@@ -272,11 +373,79 @@ bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int
     return true;
 }
 
-uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom)
+bool GetKernelStakeModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+{
+    AssertLockHeld(cs_main);
+    if (!pindexFrom)
+        return error("GetKernelStakeModifier() : block not indexed");
+    if (chainActive[pindexFrom->nHeight] == pindexFrom &&
+        stakeModifierCache.Get(pindexFrom->nHeight, nStakeModifier, nStakeModifierHeight, nStakeModifierTime))
+        return true;
+
+    if (!FindKernelStakeModifier(pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime))
+        return false;
+    if (chainActive[pindexFrom->nHeight] == pindexFrom)
+        stakeModifierCache.Set(pindexFrom->nHeight, nStakeModifierHeight, nStakeModifier, nStakeModifierTime);
+    return true;
+}
+
+// Get the output being staked and the index of the block that contains it.
+// The coins database already records the height of every unspent output, so
+// the kernel metadata (block hash, height and time) comes from the in-memory
+// block index instead of reading the previous transaction and its block from
+// disk. A block on a fork may stake an output that the active chain spent
+// after the fork point; that one is found among the recently spent outputs
+// kept in memory. Anything else falls back to GetTransaction.
+bool GetKernelInput(const COutPoint& prevout, const CBlockIndex* pindexPrev, CTxOut& txoutPrev, const CBlockIndex*& pindexFrom)
+{
+    pindexFrom = NULL;
+    {
+        LOCK(cs_main);
+        const Coin& coin = pcoinsTip->AccessCoin(prevout);
+        if (!coin.IsSpent() && coin.nHeight > 0 && (int)coin.nHeight <= chainActive.Height()) {
+            txoutPrev = coin.out;
+            pindexFrom = chainActive[coin.nHeight];
+            return true;
+        }
+
+        const CBlockIndex* pindexFork = pindexPrev ? chainActive.FindFork(pindexPrev) : NULL;
+        Coin coinSpent;
+        if (pindexFork && pindexFork != chainActive.Tip() && GetCoinSpentAfterFork(prevout, pindexFork, coinSpent) &&
+            (int)coinSpent.nHeight <= pindexFork->nHeight) {
+            txoutPrev = coinSpent.out;
+            pindexFrom = chainActive[coinSpent.nHeight];
+            return true;
+        }
+    }
+
+    uint256 hashBlock;
+    CTransaction txPrev;
+    if (!GetTransaction(prevout.hash, txPrev, hashBlock, true))
+        return error("GetKernelInput() : INFO: read txPrev failed");
+    if (prevout.n >= txPrev.vout.size())
+        return error("GetKernelInput() : prevout %s out of range", prevout.ToString());
+
+    LOCK(cs_main);
+    BlockMap::iterator it = mapBlockIndex.find(hashBlock);
+    if (it == mapBlockIndex.end())
+        return error("GetKernelInput() : read block failed");
+
+    txoutPrev = txPrev.vout[prevout.n];
+    pindexFrom = it->second;
+    return true;
+}
+
+CStakeKernel::CStakeKernel(uint64_t nStakeModifier, unsigned int nTimeBlockFrom, const COutPoint& prevout) : ssPrefix(SER_GETHASH, 0)
 {
     // USD Coin will hash in the transaction hash and the index number in order to make sure each hash is unique
-    ss << nTimeBlockFrom << prevoutIndex << prevoutHash << nTimeTx;
-    return Hash(ss.begin(), ss.end());
+    ssPrefix << nStakeModifier << nTimeBlockFrom << prevout.n << prevout.hash;
+}
+
+uint256 CStakeKernel::GetHash(unsigned int nTimeTx) const
+{
+    CHashWriter ss(ssPrefix);
+    ss << nTimeTx;
+    return ss.GetHash();
 }
 
 //test hash vs target
@@ -290,11 +459,13 @@ bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTarget
 }
 
 //instead of looping outside and reinitializing variables many times, we will give a nTimeTx and also search interval so that we can do all the hashing here
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockIndex* pindexFrom, int64_t nValueIn, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
 {
+    if (!pindexFrom)
+        return error("CheckStakeKernelHash() : null pindexFrom");
+
     //assign new variables to make it easier to read
-    int64_t nValueIn = txPrev.vout[prevout.n].nValue;
-    unsigned int nTimeBlockFrom = blockFrom.GetBlockTime();
+    unsigned int nTimeBlockFrom = pindexFrom->GetBlockTime();
 
     if (nTimeTx < nTimeBlockFrom) // Transaction timestamp violation
         return error("CheckStakeKernelHash() : nTime violation");
@@ -310,18 +481,17 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
     uint64_t nStakeModifier = 0;
     int nStakeModifierHeight = 0;
     int64_t nStakeModifierTime = 0;
-    if (!GetKernelStakeModifier(blockFrom.GetHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake)) {
+    if (!GetKernelStakeModifier(pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake)) {
         LogPrintf("CheckStakeKernelHash(): failed to get kernel stake modifier \n");
         return false;
     }
 
-    //create data stream once instead of repeating it in the loop
-    CDataStream ss(SER_GETHASH, 0);
-    ss << nStakeModifier;
+    //hash the constant part of the kernel once instead of repeating it in the loop
+    CStakeKernel kernel(nStakeModifier, nTimeBlockFrom, prevout);
 
     //if wallet is simply checking to make sure a hash is valid
     if (fCheck) {
-        hashProofOfStake = stakeHash(nTimeTx, ss, prevout.n, prevout.hash, nTimeBlockFrom);
+        hashProofOfStake = kernel.GetHash(nTimeTx);
         return stakeTargetHit(hashProofOfStake, nValueIn, bnTargetPerCoinDay);
     }
 
@@ -337,7 +507,7 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
 
         //hash this iteration
         nTryTime = nTimeTx + nHashDrift - i;
-        hashProofOfStake = stakeHash(nTryTime, ss, prevout.n, prevout.hash, nTimeBlockFrom);
+        hashProofOfStake = kernel.GetHash(nTryTime);
 
         // if stake hash does not meet the target then continue to next iteration
         if (!stakeTargetHit(hashProofOfStake, nValueIn, bnTargetPerCoinDay))
@@ -350,8 +520,8 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
             LogPrintf("CheckStakeKernelHash() : using modifier %s at height=%d timestamp=%s for block from height=%d timestamp=%s\n",
                 boost::lexical_cast<std::string>(nStakeModifier).c_str(), nStakeModifierHeight,
                 DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nStakeModifierTime).c_str(),
-                mapBlockIndex[blockFrom.GetHash()]->nHeight,
-                DateTimeStrFormat("%Y-%m-%d %H:%M:%S", blockFrom.GetBlockTime()).c_str());
+                pindexFrom->nHeight,
+                DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nTimeBlockFrom).c_str());
             LogPrintf("CheckStakeKernelHash() : pass protocol=%s modifier=%s nTimeBlockFrom=%u prevoutHash=%s nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n",
                 "0.3",
                 boost::lexical_cast<std::string>(nStakeModifier).c_str(),
@@ -366,6 +536,176 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
     return fSuccess;
 }
 
+namespace {
+// Bumped on every tip change; a search started on an older tip gives up
+std::atomic<unsigned int> nTipChanges(0);
+
+// State shared by the checks of one FindStakeKernel call
+struct CStakeSearch {
+    CCriticalSection cs;
+    unsigned int nTipChangesStart;
+    bool fStop;
+    bool fFound;
+    size_t nFound;
+    unsigned int nTimeFound;
+    uint256 hashProofOfStake;
+    uint64_t nHashes;
+
+    CStakeSearch(unsigned int nTipChangesStartIn) : nTipChangesStart(nTipChangesStartIn), fStop(false), fFound(false), nFound(0), nTimeFound(0), hashProofOfStake(0), nHashes(0) {}
+};
+
+/**
+ * Searches the kernel of one candidate. Returns false to make the queue skip
+ * the remaining candidates once a kernel is found or the tip has changed.
+ * Does not touch the chain; the candidate carries its stake modifier.
+ */
+class CStakeKernelCheck
+{
+private:
+    CStakeSearch* search;
+    const CStakeCandidate* candidate;
+    size_t nIndex;
+    unsigned int nBits;
+    unsigned int nTimeTx;
+    unsigned int nHashDrift;
+    int64_t nTimeMin;
+
+public:
+    CStakeKernelCheck() : search(NULL), candidate(NULL), nIndex(0), nBits(0), nTimeTx(0), nHashDrift(0), nTimeMin(0) {}
+    CStakeKernelCheck(CStakeSearch* searchIn, const CStakeCandidate* candidateIn, size_t nIndexIn, unsigned int nBitsIn, unsigned int nTimeTxIn, unsigned int nHashDriftIn, int64_t nTimeMinIn) : search(searchIn), candidate(candidateIn), nIndex(nIndexIn), nBits(nBitsIn), nTimeTx(nTimeTxIn), nHashDrift(nHashDriftIn), nTimeMin(nTimeMinIn) {}
+
+    bool operator()();
+
+    void swap(CStakeKernelCheck& check)
+    {
+        std::swap(search, check.search);
+        std::swap(candidate, check.candidate);
+        std::swap(nIndex, check.nIndex);
+        std::swap(nBits, check.nBits);
+        std::swap(nTimeTx, check.nTimeTx);
+        std::swap(nHashDrift, check.nHashDrift);
+        std::swap(nTimeMin, check.nTimeMin);
+    }
+};
+
+bool CStakeKernelCheck::operator()()
+{
+    {
+        LOCK(search->cs);
+        //new block came in, stop every worker
+        if (nTipChanges != search->nTipChangesStart)
+            search->fStop = true;
+        if (search->fStop)
+            return false;
+    }
+
+    if (!candidate->fStakeModifier)
+        return true;
+
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+    unsigned int nTimeBlockFrom = candidate->pindexFrom->GetBlockTime();
+    CStakeKernel kernel(candidate->nStakeModifier, nTimeBlockFrom, candidate->prevout);
+
+    uint64_t nHashes = 0;
+    for (unsigned int i = 0; i < nHashDrift; i++) {
+        unsigned int nTryTime = nTimeTx + nHashDrift - i;
+        // Transaction timestamp violation
+        if (nTryTime < nTimeBlockFrom)
+            continue;
+        uint256 hashProofOfStake = kernel.GetHash(nTryTime);
+        nHashes++;
+        if (!stakeTargetHit(hashProofOfStake, candidate->nValueIn, bnTargetPerCoinDay))
+            continue;
+
+        // kernel found, but it would not pass the time requirements
+        if (nTryTime <= nTimeMin)
+            break;
+
+        LOCK(search->cs);
+        search->nHashes += nHashes;
+        if (!search->fStop) {
+            search->fStop = true;
+            search->fFound = true;
+            search->nFound = nIndex;
+            search->nTimeFound = nTryTime;
+            search->hashProofOfStake = hashProofOfStake;
+        }
+        return false;
+    }
+
+    LOCK(search->cs);
+    search->nHashes += nHashes;
+    return true;
+}
+} // anon namespace
+
+static CCheckQueue<CStakeKernelCheck> stakekernelqueue(16);
+
+void ThreadStakeKernelCheck()
+{
+    RenameThread("unitedstatedollarcrypto-stakech");
+    stakekernelqueue.Thread();
+}
+
+void StakeKernelTipChanged()
+{
+    nTipChanges++;
+}
+
+bool FindStakeKernel(unsigned int nBits, std::vector<CStakeCandidate>& vCandidates, unsigned int nTimeTx, unsigned int nHashDrift, int64_t nTimeMin, size_t& nFound, unsigned int& nTimeFound, uint256& hashProofOfStake)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    unsigned int nTipChangesStart;
+    {
+        // The workers cannot walk the chain, as it may change under them
+        LOCK(cs_main);
+        nTipChangesStart = nTipChanges;
+        BOOST_FOREACH (CStakeCandidate& candidate, vCandidates) {
+            int nStakeModifierHeight = 0;
+            int64_t nStakeModifierTime = 0;
+            candidate.fStakeModifier = GetKernelStakeModifier(candidate.pindexFrom, candidate.nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false);
+        }
+    }
+    CStakeSearch search(nTipChangesStart);
+
+    std::vector<CStakeKernelCheck> vChecks;
+    vChecks.reserve(vCandidates.size());
+    for (size_t i = 0; i < vCandidates.size(); i++)
+        vChecks.push_back(CStakeKernelCheck(&search, &vCandidates[i], i, nBits, nTimeTx, nHashDrift, nTimeMin));
+
+    if (nStakeKernelThreads) {
+        CCheckQueueControl<CStakeKernelCheck> control(&stakekernelqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        BOOST_FOREACH (CStakeKernelCheck& check, vChecks)
+            if (!check())
+                break;
+    }
+
+    int64_t nTimeElapsed = GetTimeMicros() - nTimeStart;
+    nStakeHashesLast = search.nHashes;
+    if (nTimeElapsed > 0)
+        dStakeHashesPerSec = 1000000.0 * search.nHashes / nTimeElapsed;
+    LogPrint("bench", "FindStakeKernel: %u candidates, %u hashes in %.2fms (%.0f hashes/s)\n",
+        (unsigned int)vCandidates.size(), (unsigned int)search.nHashes, nTimeElapsed * 0.001, dStakeHashesPerSec);
+
+    {
+        LOCK(cs_main);
+        mapHashedBlocks.clear();
+        mapHashedBlocks[chainActive.Tip()->nHeight] = GetTime(); //store a time stamp of when we last hashed on this block
+    }
+
+    if (!search.fFound)
+        return false;
+
+    nFound = search.nFound;
+    nTimeFound = search.nTimeFound;
+    hashProofOfStake = search.hashProofOfStake;
+    return true;
+}
+
 // Check kernel hash target and coinstake signature
 bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
 {
@@ -376,31 +716,26 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
     // Kernel (input 0) must match the stake hash target per coin age (nBits)
     const CTxIn& txin = tx.vin[0];
 
-    // First try finding the previous transaction in database
-    uint256 hashBlock;
-    CTransaction txPrev;
-    if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true))
-        return error("CheckProofOfStake() : INFO: read txPrev failed");
+    // Look up the staked output and the block it was confirmed in
+    const CBlockIndex* pindexPrev = NULL;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+        if (mi != mapBlockIndex.end())
+            pindexPrev = mi->second;
+    }
+    CTxOut txoutPrev;
+    const CBlockIndex* pindexFrom = NULL;
+    if (!GetKernelInput(txin.prevout, pindexPrev, txoutPrev, pindexFrom))
+        return error("CheckProofOfStake() : INFO: failed to find kernel input");
 
     //verify signature and script
-    if (!VerifyScript(txin.scriptSig, txPrev.vout[txin.prevout.n].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0)))
+    if (!VerifyScript(txin.scriptSig, txoutPrev.scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0)))
         return error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx.GetHash().ToString().c_str());
 
-    CBlockIndex* pindex = NULL;
-    BlockMap::iterator it = mapBlockIndex.find(hashBlock);
-    if (it != mapBlockIndex.end())
-        pindex = it->second;
-    else
-        return error("CheckProofOfStake() : read block failed");
-
-    // Read block header
-    CBlock blockprev;
-    if (!ReadBlockFromDisk(blockprev, pindex->GetBlockPos()))
-        return error("CheckProofOfStake(): INFO: failed to find block");
-
     unsigned int nInterval = 0;
     unsigned int nTime = block.nTime;
-    if (!CheckStakeKernelHash(block.nBits, blockprev, txPrev, txin.prevout, nTime, nInterval, true, hashProofOfStake, fDebug))
+    if (!CheckStakeKernelHash(block.nBits, pindexFrom, txoutPrev.nValue, txin.prevout, nTime, nInterval, true, hashProofOfStake, fDebug))
         return error("CheckProofOfStake() : INFO: check kernel failed on coinstake %s, hashProof=%s \n", tx.GetHash().ToString().c_str(), hashProofOfStake.ToString().c_str()); // may occur during initial download or if behind on block chain sync
 
     return true;
@@ -414,14 +749,14 @@ bool CheckCoinStakeTimestamp(int64_t nTimeBlock, int64_t nTimeTx)
 }
 
 // Get stake modifier checksum
-unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex)
+unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex, const uint256& hashProofOfStake)
 {
     assert(pindex->pprev || pindex->GetBlockHash() == Params().HashGenesisBlock());
     // Hash previous checksum with flags, hashProofOfStake and nStakeModifier
     CDataStream ss(SER_GETHASH, 0);
     if (pindex->pprev)
         ss << pindex->pprev->nStakeModifierChecksum;
-    ss << pindex->nFlags << pindex->hashProofOfStake << pindex->nStakeModifier;
+    ss << pindex->nFlags << hashProofOfStake << pindex->nStakeModifier;
     uint256 hashChecksum = Hash(ss.begin(), ss.end());
     hashChecksum >>= (256 - 32);
     return hashChecksum.Get64();
@@ -14,18 +14,113 @@ static const unsigned int MODIFIER_INTERVAL_TESTNET = 60;
 extern unsigned int nModifierInterval;
 extern unsigned int getIntervalVersion(bool fTestNet);
 
+// Stake kernel search threads (0 = auto, <0 = leave that many cores free)
+static const int DEFAULT_STAKE_KERNEL_THREADS = 0;
+static const int MAX_STAKE_KERNEL_THREADS = 16;
+extern int nStakeKernelThreads;
+extern double dStakeHashesPerSec;
+extern uint64_t nStakeHashesLast;
+
 // MODIFIER_INTERVAL_RATIO:
 // ratio of group interval length between the last group and the first group
 static const int MODIFIER_INTERVAL_RATIO = 3;
 
+/**
+ * Height-indexed cache of kernel stake modifiers on the active chain.
+ * For every block height it records the stake modifier, with the height and
+ * time of the block that generated it, used to hash kernels of coins
+ * confirmed at that height, so GetKernelStakeModifier does not need to walk
+ * the chain forward and lookups never touch chainActive. Pending heights are
+ * resolved as new tips are connected and reset on disconnect.
+ */
+class CStakeModifierCache
+{
+private:
+    struct CEntry {
+        // height of the block providing the kernel modifier, -1 if unresolved
+        int nHeightModifier;
+        // lowest height resolved by the block at this height, -1 if none
+        int nLowestResolved;
+        uint64_t nStakeModifier;
+        int64_t nTimeModifier;
+
+        CEntry() : nHeightModifier(-1), nLowestResolved(-1), nStakeModifier(0), nTimeModifier(0) {}
+    };
+
+    mutable CCriticalSection cs;
+    std::vector<CEntry> vEntries;
+    // first height not yet resolved while following connected tips, -1 until tracking starts
+    int nFirstPending;
+
+    void Resolve(int nHeightFrom, int nHeightModifier, uint64_t nStakeModifier, int64_t nTimeModifier);
+
+public:
+    CStakeModifierCache() : nFirstPending(-1) {}
+
+    bool Get(int nHeightFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime) const;
+    void Set(int nHeightFrom, int nHeightModifier, uint64_t nStakeModifier, int64_t nTimeModifier);
+    void BlockConnected(const CBlockIndex* pindex);
+    void BlockDisconnected(const CBlockIndex* pindex);
+    void Clear();
+    size_t Size() const;
+};
+
+extern CStakeModifierCache stakeModifierCache;
+
 // Compute the hash modifier for proof-of-stake
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 
+// Get the stake modifier used for kernels of coins confirmed in pindexFrom; requires cs_main
+bool GetKernelStakeModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake);
+// Same as GetKernelStakeModifier but always walks the active chain, bypassing the cache
+bool FindKernelStakeModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime);
+
+/**
+ * Kernel hash of one staked output. The modifier, block time and prevout
+ * part of the preimage is hashed into a prefix state once; every timestamp
+ * tried only appends nTimeTx to a copy of that state.
+ */
+class CStakeKernel
+{
+private:
+    CHashWriter ssPrefix;
+
+public:
+    CStakeKernel(uint64_t nStakeModifier, unsigned int nTimeBlockFrom, const COutPoint& prevout);
+    uint256 GetHash(unsigned int nTimeTx) const;
+};
+
+// A wallet output considered for staking
+struct CStakeCandidate {
+    COutPoint prevout;
+    const CBlockIndex* pindexFrom;
+    int64_t nValueIn;
+    // Set by FindStakeKernel under cs_main; candidates without a modifier yet are skipped
+    bool fStakeModifier;
+    uint64_t nStakeModifier;
+
+    CStakeCandidate(const COutPoint& prevoutIn, const CBlockIndex* pindexFromIn, int64_t nValueInIn) : prevout(prevoutIn), pindexFrom(pindexFromIn), nValueIn(nValueInIn), fStakeModifier(false), nStakeModifier(0) {}
+};
+
+// Search the kernels of all candidates over nHashDrift timestamps, spread across the
+// stake kernel threads. Stops at the first kernel newer than nTimeMin or on a new tip.
+// The stake modifiers are looked up first, under cs_main; the threads only hash.
+bool FindStakeKernel(unsigned int nBits, std::vector<CStakeCandidate>& vCandidates, unsigned int nTimeTx, unsigned int nHashDrift, int64_t nTimeMin, size_t& nFound, unsigned int& nTimeFound, uint256& hashProofOfStake);
+
+// Called whenever the active chain tip changes, to stop a running FindStakeKernel
+void StakeKernelTipChanged();
+
+// Run instances of this in threads to search stake kernels in parallel
+void ThreadStakeKernelCheck();
+
 // Check whether stake kernel meets hash target
 // Sets hashProofOfStake on success return
-uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom);
 bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay);
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockIndex* pindexFrom, int64_t nValueIn, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+
+// Get the staked output and the index of the block containing it, as seen by a block on top of
+// pindexPrev, reading from disk only for outputs already spent on the active chain
+bool GetKernelInput(const COutPoint& prevout, const CBlockIndex* pindexPrev, CTxOut& txoutPrev, const CBlockIndex*& pindexFrom);
 
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
@@ -35,7 +130,7 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake);
 bool CheckCoinStakeTimestamp(int64_t nTimeBlock, int64_t nTimeTx);
 
 // Get stake modifier checksum
-unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex);
+unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex, const uint256& hashProofOfStake);
 
 // Check stake modifier hard checkpoints
 bool CheckStakeModifierCheckpoints(int nHeight, unsigned int nStakeModifierChecksum);
@@ -31,8 +31,17 @@ class CLevelDBBatch
 
 private:
     leveldb::WriteBatch batch;
+    size_t nSizeEstimate;
 
 public:
+    CLevelDBBatch() : nSizeEstimate(0) {}
+
+    void Clear()
+    {
+        batch.Clear();
+        nSizeEstimate = 0;
+    }
+
     template <typename K, typename V>
     void Write(const K& key, const V& value)
     {
@@ -47,6 +56,7 @@ public:
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
 
         batch.Put(slKey, slValue);
+        nSizeEstimate += ssKey.size() + ssValue.size();
     }
 
     template <typename K>
@@ -58,7 +68,11 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
+        nSizeEstimate += ssKey.size();
     }
+
+    //! Rough size of the queued changes, in bytes.
+    size_t SizeEstimate() const { return nSizeEstimate; }
 };
 
 class CLevelDBWrapper
@@ -163,6 +177,18 @@ public:
         return WriteBatch(batch, true);
     }
 
+    //! Compact the key range [begin, end], e.g. after erasing most of it.
+    template <typename K>
+    void CompactRange(const K& begin, const K& end)
+    {
+        CDataStream ssBegin(SER_DISK, CLIENT_VERSION), ssEnd(SER_DISK, CLIENT_VERSION);
+        ssBegin << begin;
+        ssEnd << end;
+        leveldb::Slice slBegin(&ssBegin[0], ssBegin.size());
+        leveldb::Slice slEnd(&ssEnd[0], ssEnd.size());
+        pdb->CompactRange(&slBegin, &slEnd);
+    }
+
     // not exactly clean encapsulation, but it's easiest for now
     leveldb::Iterator* NewIterator()
     {
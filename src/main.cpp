@@ -10,17 +10,22 @@
 
 #include "addrman.h"
 #include "alert.h"
+#include "blockstore.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
 #include "init.h"
 #include "kernel.h"
 #include "masternode-budget.h"
 #include "masternode-payments.h"
 #include "masternodeman.h"
+#include "memusage.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "pow.h"
+#include "script/sigcache.h"
 #include "spork.h"
 #include "sporkdb.h"
 #include "swifttx.h"
@@ -60,8 +65,10 @@ using namespace std;
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+CBlockIndexArena blockindexarena;
 map<uint256, uint256> mapProofOfStake;
 set<pair<COutPoint, unsigned int> > setStakeSeen;
+map<const CBlockIndex*, CBlockIndexCold> mapBlockIndexCold;
 map<unsigned int, unsigned int> mapHashedBlocks;
 CChain chainActive;
 CBlockIndex* pindexBestHeader = NULL;
@@ -69,12 +76,20 @@ int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nPrefetchThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = true;
+bool fAddressIndex = DEFAULT_ADDRESSINDEX;
+bool fSpentIndex = DEFAULT_SPENTINDEX;
+bool fTimestampIndex = DEFAULT_TIMESTAMPINDEX;
+bool fBlockStatsIndex = DEFAULT_BLOCKSTATSINDEX;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+bool fHavePruned = false;
+bool fPruneMode = false;
+uint64_t nPruneTarget = 0;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 
 unsigned int nStakeMinAge = 60 * 60;
@@ -144,6 +159,11 @@ multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
 CCriticalSection cs_LastBlockFile;
 std::vector<CBlockFileInfo> vinfoBlockFile;
 int nLastBlockFile = 0;
+/** Global flag to indicate we should check to see if there are
+ *  block/undo files that should be deleted.  Set on startup
+ *  or if we allocate more file space when we're in prune mode
+ */
+bool fCheckForPruning = false;
 
 /**
      * Every received block is assigned a unique and increasing identifier, so we
@@ -180,6 +200,16 @@ set<CBlockIndex*> setDirtyBlockIndex;
 
 /** Dirty block file entries. */
 set<int> setDirtyFileInfo;
+
+/**
+ * Outputs spent by the active chain blocks within GetPruneMargin() of the tip,
+ * as they were before the spend, with the height of the spending block. All
+ * blocks from nRecentlySpentFrom (-1 if none) up to the tip are covered.
+ * Protected by cs_main.
+ */
+map<COutPoint, pair<int, Coin> > mapRecentlySpent;
+map<int, vector<COutPoint> > mapRecentlySpentByHeight;
+int nRecentlySpentFrom = -1;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -516,7 +546,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                 // We consider the chain that this peer is on invalid.
                 return;
             }
-            if (pindex->nStatus & BLOCK_HAVE_DATA) {
+            if (pindex->nStatus & BLOCK_HAVE_DATA || chainActive.Contains(pindex)) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
@@ -877,11 +907,10 @@ int GetInputAge(CTxIn& vin)
         CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
-        const CCoins* coins = view.AccessCoins(vin.prevout.hash);
+        const Coin& coin = view.AccessCoin(vin.prevout);
 
-        if (coins) {
-            if (coins->nHeight < 0) return 0;
-            return (chainActive.Tip()->nHeight + 1) - coins->nHeight;
+        if (!coin.IsSpent()) {
+            return (chainActive.Tip()->nHeight + 1) - (int)coin.nHeight;
         } else
             return -1;
     }
@@ -951,19 +980,16 @@ bool GetCoinAge(const CTransaction& tx, const unsigned int nTxTime, uint64_t& nC
             continue;
         }
 
-        // Read block header
-        CBlockHeader prevblock = pindex->GetBlockHeader();
-
-        if (prevblock.nTime + nStakeMinAge > nTxTime)
+        if (pindex->nTime + nStakeMinAge > nTxTime)
             continue; // only count coins meeting min age requirement
 
-        if (nTxTime < prevblock.nTime) {
+        if (nTxTime < pindex->nTime) {
             LogPrintf("GetCoinAge: Timestamp Violation: txtime less than txPrev.nTime");
             return false; // Transaction timestamp violation
         }
 
         int64_t nValueIn = txPrev.vout[txin.prevout.n].nValue;
-        bnCentSecond += uint256(nValueIn) * (nTxTime - prevblock.nTime);
+        bnCentSecond += uint256(nValueIn) * (nTxTime - pindex->nTime);
     }
 
     uint256 bnCoinDay = bnCentSecond / COIN / (24 * 60 * 60);
@@ -1078,10 +1104,10 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 
     if (fAllowFree) {
         // There is a free transaction area in blocks created by most miners,
-        // * If we are relaying we allow transactions up to DEFAULT_BLOCK_PRIORITY_SIZE - 1000
+        // * If we are relaying we allow transactions up to FREE_TX_AREA_SIZE - 1000
         //   to be considered to fall into this category. We don't want to encourage sending
         //   multiple transactions instead of one big transaction to avoid fees.
-        if (nBytes < (DEFAULT_BLOCK_PRIORITY_SIZE - 1000))
+        if (nBytes < (FREE_TX_AREA_SIZE - 1000))
             nMinFee = 0;
     }
 
@@ -1091,7 +1117,17 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+/** Expire mempool transactions older than age seconds, then evict the cheapest packages until the pool fits in limit bytes */
+static void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
+
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee, bool ignoreFees)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1159,14 +1195,16 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
             view.SetBackend(viewMemPool);
 
             // do we already have it?
-            if (view.HaveCoins(hash))
-                return false;
+            for (size_t out = 0; out < tx.vout.size(); out++) {
+                if (view.HaveCoin(COutPoint(hash, out)))
+                    return false;
+            }
 
             // do all inputs exist?
-            // Note that this does not check for the presence of actual outputs (see the next check for that),
-            // only helps filling in pfMissingInputs (to determine missing vs spent).
+            // Note that this does not distinguish between missing and already
+            // spent outputs; both are reported through pfMissingInputs.
             for (const CTxIn txin : tx.vin) {
-                if (!view.HaveCoins(txin.prevout.hash)) {
+                if (!view.HaveCoin(txin.prevout)) {
                     if (pfMissingInputs)
                         *pfMissingInputs = true;
                     return false;
@@ -1208,7 +1246,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         CAmount nFees = nValueIn - nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height());
         unsigned int nSize = entry.GetTxSize();
 
         if (!ignoreFees) {
@@ -1218,6 +1256,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                                         hash.ToString(), nFees, txMinFee),
                     REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+            CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+            if (mempoolRejectFee > 0 && nFees < mempoolRejectFee)
+                return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d",
+                                        hash.ToString(), nFees, mempoolRejectFee),
+                    REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
             // Require that free transactions have sufficient priority to be mined in the next block.
             if (GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
                 return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
@@ -1252,6 +1296,20 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                 hash.ToString(),
                 nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
 
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+        std::string errString;
+        {
+            LOCK(pool.cs);
+            if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+                return state.DoS(0, error("AcceptToMemoryPool : too long mempool chain for %s: %s", hash.ToString(), errString),
+                    REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true)) {
@@ -1267,12 +1325,22 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true)) {
+        //
+        // The flags of the current tip are added so that the script execution
+        // cache records this transaction under the flags the next block will
+        // most likely be connected with.
+        unsigned int nBlockFlags = MANDATORY_SCRIPT_VERIFY_FLAGS | GetBlockScriptFlags(chainActive.Tip());
+        if (!CheckInputs(tx, state, view, true, nBlockFlags, true)) {
             return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
 
         // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        pool.addUnchecked(hash, entry, setAncestors);
+
+        // Trim the mempool and check whether this transaction was trimmed
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -1280,6 +1348,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
     return true;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fRejectInsaneFee, ignoreFees);
+}
+
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee)
 {
     AssertLockHeld(cs_main);
@@ -1343,14 +1416,16 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
             view.SetBackend(viewMemPool);
 
             // do we already have it?
-            if (view.HaveCoins(hash))
-                return false;
+            for (size_t out = 0; out < tx.vout.size(); out++) {
+                if (view.HaveCoin(COutPoint(hash, out)))
+                    return false;
+            }
 
             // do all inputs exist?
-            // Note that this does not check for the presence of actual outputs (see the next check for that),
-            // only helps filling in pfMissingInputs (to determine missing vs spent).
+            // Note that this does not distinguish between missing and already
+            // spent outputs; both are reported through pfMissingInputs.
             for (const CTxIn txin : tx.vin) {
-                if (!view.HaveCoins(txin.prevout.hash)) {
+                if (!view.HaveCoin(txin.prevout)) {
                     if (pfMissingInputs)
                         *pfMissingInputs = true;
                     return false;
@@ -1404,6 +1479,12 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
                                     hash.ToString(), nFees, txMinFee),
                 REJECT_INSUFFICIENTFEE, "insufficient fee");
 
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (mempoolRejectFee > 0 && nFees < mempoolRejectFee)
+            return state.DoS(0, error("AcceptableInputs : mempool min fee not met %s, %d < %d",
+                                    hash.ToString(), nFees, mempoolRejectFee),
+                REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
         // Require that free transactions have sufficient priority to be mined in the next block.
         if (GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
@@ -1482,13 +1563,13 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
         if (fTxIndex) {
             CDiskTxPos postx;
             if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                CBlockFileReader file(postx, "blk", SER_DISK, CLIENT_VERSION);
                 if (file.IsNull())
                     return error("%s: OpenBlockFile failed", __func__);
                 CBlockHeader header;
                 try {
                     file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                    file.ignore(postx.nTxOffset);
                     file >> txOut;
                 } catch (std::exception& e) {
                     return error("%s : Deserialize or I/O error - %s", __func__, e.what());
@@ -1506,10 +1587,9 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
             int nHeight = -1;
             {
-                CCoinsViewCache& view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
+                const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+                if (!coin.IsSpent())
+                    nHeight = coin.nHeight;
             }
             if (nHeight > 0)
                 pindexSlow = chainActive[nHeight];
@@ -1532,6 +1612,100 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
     return false;
 }
 
+/** Record the outputs spent by a block connected to the active chain, and forget those past the prune margin. */
+static void RecentlySpentConnected(const CBlock& block, const CBlockUndo& blockundo, int nHeight)
+{
+    AssertLockHeld(cs_main);
+    vector<COutPoint>& vSpent = mapRecentlySpentByHeight[nHeight];
+    for (unsigned int i = 0; i < blockundo.vtxundo.size(); i++) {
+        const CTransaction& tx = block.vtx[i + 1];
+        const CTxUndo& txundo = blockundo.vtxundo[i];
+        for (unsigned int j = 0; j < tx.vin.size() && j < txundo.vprevout.size(); j++) {
+            vSpent.push_back(tx.vin[j].prevout);
+            mapRecentlySpent[tx.vin[j].prevout] = make_pair(nHeight, txundo.vprevout[j]);
+        }
+    }
+    if (nRecentlySpentFrom < 0)
+        nRecentlySpentFrom = nHeight;
+
+    int nKeepFrom = nHeight - (int)GetPruneMargin() + 1;
+    while (!mapRecentlySpentByHeight.empty() && mapRecentlySpentByHeight.begin()->first < nKeepFrom) {
+        map<int, vector<COutPoint> >::iterator it = mapRecentlySpentByHeight.begin();
+        BOOST_FOREACH (const COutPoint& outpoint, it->second) {
+            map<COutPoint, pair<int, Coin> >::iterator itSpent = mapRecentlySpent.find(outpoint);
+            if (itSpent != mapRecentlySpent.end() && itSpent->second.first == it->first)
+                mapRecentlySpent.erase(itSpent);
+        }
+        mapRecentlySpentByHeight.erase(it);
+    }
+    nRecentlySpentFrom = std::max(nRecentlySpentFrom, nKeepFrom);
+}
+
+/** Forget the outputs spent by a block disconnected from the active chain. */
+static void RecentlySpentDisconnected(int nHeight)
+{
+    AssertLockHeld(cs_main);
+    map<int, vector<COutPoint> >::iterator it = mapRecentlySpentByHeight.find(nHeight);
+    if (it != mapRecentlySpentByHeight.end()) {
+        BOOST_FOREACH (const COutPoint& outpoint, it->second) {
+            map<COutPoint, pair<int, Coin> >::iterator itSpent = mapRecentlySpent.find(outpoint);
+            if (itSpent != mapRecentlySpent.end() && itSpent->second.first == nHeight)
+                mapRecentlySpent.erase(itSpent);
+        }
+        mapRecentlySpentByHeight.erase(it);
+    }
+    if (nRecentlySpentFrom > nHeight)
+        nRecentlySpentFrom = nHeight;
+}
+
+static void ClearRecentlySpent()
+{
+    mapRecentlySpent.clear();
+    mapRecentlySpentByHeight.clear();
+    nRecentlySpentFrom = -1;
+}
+
+bool LoadRecentlySpentCoins()
+{
+    LOCK(cs_main);
+    ClearRecentlySpent();
+    if (chainActive.Tip() == NULL)
+        return true;
+
+    int nHeightFrom = std::max(1, chainActive.Height() - (int)GetPruneMargin() + 1);
+    for (CBlockIndex* pindex = chainActive[nHeightFrom]; pindex; pindex = chainActive.Next(pindex)) {
+        CBlock block;
+        CBlockUndo blockUndo;
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (!ReadBlockFromDisk(block, pindex) || pos.IsNull() || !blockUndo.ReadFromDisk(pos, pindex->pprev->GetBlockHash()) ||
+            blockUndo.vtxundo.size() + 1 != block.vtx.size()) {
+            ClearRecentlySpent();
+            return error("%s : failed to read block %s or its undo data", __func__, pindex->GetBlockHash().ToString());
+        }
+        RecentlySpentConnected(block, blockUndo, pindex->nHeight);
+    }
+    return true;
+}
+
+bool GetCoinSpentAfterFork(const COutPoint& outpoint, const CBlockIndex* pindexFork, Coin& coin)
+{
+    LOCK(cs_main);
+    if (pindexFork == NULL || chainActive[pindexFork->nHeight] != pindexFork)
+        return false;
+    // Forks from deeper blocks are rejected anyway
+    if (chainActive.Height() - pindexFork->nHeight >= (int)GetPruneMargin())
+        return false;
+    if (nRecentlySpentFrom < 0 || pindexFork->nHeight + 1 < nRecentlySpentFrom)
+        return false;
+
+    map<COutPoint, pair<int, Coin> >::const_iterator it = mapRecentlySpent.find(outpoint);
+    if (it == mapRecentlySpent.end() || it->second.first <= pindexFork->nHeight)
+        return false;
+    coin = it->second.second;
+    // Undo data written by older versions may lack the height
+    return coin.nHeight > 0;
+}
+
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -1564,7 +1738,7 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     block.SetNull();
 
     // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    CBlockFileReader filein(pos, "blk", SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("ReadBlockFromDisk : OpenBlockFile failed");
 
@@ -1595,6 +1769,57 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos)
+{
+    block.clear();
+
+    // The block is preceded by the network magic and its size, see WriteBlockToDisk
+    if (pos.nPos < 8)
+        return error("%s : invalid block position %d:%u", __func__, pos.nFile, pos.nPos);
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - 8);
+
+    // Open history file to read
+    CBlockFileReader filein(posHeader, "blk", SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : OpenBlockFile failed", __func__);
+
+    try {
+        MessageStartChars pchMessageStart;
+        unsigned int nSize;
+        filein >> FLATDATA(pchMessageStart) >> nSize;
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE))
+            return error("%s : block magic mismatch at %d:%u", __func__, pos.nFile, pos.nPos);
+        if (nSize > MAX_BLOCK_SIZE)
+            return error("%s : block size %u too large at %d:%u", __func__, nSize, pos.nFile, pos.nPos);
+        block.resize(nSize);
+        filein.read((char*)begin_ptr(block), nSize);
+    } catch (std::exception& e) {
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex)
+{
+    if (!ReadRawBlockFromDisk(block, pindex->GetBlockPos()))
+        return false;
+
+    // Only the header is parsed, to make sure the file holds the block we expect
+    CBlockHeader header;
+    try {
+        CDataStream ssHeader((const char*)begin_ptr(block), (const char*)end_ptr(block), SER_DISK, CLIENT_VERSION);
+        ssHeader >> header;
+    } catch (std::exception& e) {
+        return error("%s : Deserialize error - %s", __func__, e.what());
+    }
+    if (header.GetHash() != pindex->GetBlockHash()) {
+        LogPrintf("%s : block=%s index=%s\n", __func__, header.GetHash().ToString().c_str(), pindex->GetBlockHash().ToString().c_str());
+        return error("ReadRawBlockFromDisk(vector&, CBlockIndex*) : GetHash() doesn't match index");
+    }
+    return true;
+}
+
 
 double ConvertBitsToDouble(unsigned int nBits)
 {
@@ -1616,6 +1841,11 @@ double ConvertBitsToDouble(unsigned int nBits)
 }
 
 int64_t GetBlockValue(int nHeight)
+{
+    return GetBlockValue(nHeight, chainActive.Tip()->nMoneySupply);
+}
+
+int64_t GetBlockValue(int nHeight, int64_t nMoneySupply)
 {
     int64_t nSubsidy = 0;
    
@@ -1629,8 +1859,6 @@ int64_t GetBlockValue(int nHeight)
     }   
 
     // Check if we reached the coin max supply.
-    int64_t nMoneySupply = chainActive.Tip()->nMoneySupply;
-
     if (nMoneySupply + nSubsidy >= Params().MaxMoneyOut())
         nSubsidy = ( Params().MaxMoneyOut() - nMoneySupply ) * COIN;
 
@@ -1803,14 +2031,214 @@ void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCach
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-            txundo.vprevout.push_back(CTxInUndo());
-            bool ret = inputs.ModifyCoins(txin.prevout.hash)->Spend(txin.prevout, txundo.vprevout.back());
-            assert(ret);
+            txundo.vprevout.push_back(Coin());
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
     }
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
+}
+
+/** The address index type and hash of the address an output pays to, or 0 if it does not pay to a single address. */
+static unsigned char GetAddressIndexType(const CScript& scriptPubKey, uint160& hashBytes)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(scriptPubKey, dest))
+        return 0;
+    if (const CKeyID* keyID = boost::get<CKeyID>(&dest)) {
+        hashBytes = *keyID;
+        return ADDRESS_TYPE_PUBKEYHASH;
+    }
+    if (const CScriptID* scriptID = boost::get<CScriptID>(&dest)) {
+        hashBytes = *scriptID;
+        return ADDRESS_TYPE_SCRIPTHASH;
+    }
+    return 0;
+}
+
+/**
+ * Add the entries connecting a transaction creates in the address and spent
+ * indexes. The outputs it spends must still be in view.
+ */
+static void IndexConnectedTx(CChainIndexUpdate& update, const CTransaction& tx, unsigned int nTxIndex, const CCoinsViewCache& view, int nHeight)
+{
+    const uint256& txhash = tx.GetHash();
+    if (!tx.IsCoinBase()) {
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            const COutPoint& prevout = tx.vin[j].prevout;
+            const Coin& coin = view.AccessCoin(prevout);
+            uint160 hashBytes;
+            unsigned char type = GetAddressIndexType(coin.out.scriptPubKey, hashBytes);
+            if (fAddressIndex && type) {
+                update.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, nHeight, nTxIndex, txhash, j, true), -coin.out.nValue));
+                update.vAddressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, prevout.hash, prevout.n), CAddressUnspentValue()));
+            }
+            if (fSpentIndex)
+                update.vSpentIndex.push_back(std::make_pair(CSpentIndexKey(prevout.hash, prevout.n), CSpentIndexValue(txhash, j, nHeight, coin.out.nValue, type, hashBytes)));
+        }
+    }
+    if (fAddressIndex) {
+        for (unsigned int k = 0; k < tx.vout.size(); k++) {
+            const CTxOut& out = tx.vout[k];
+            uint160 hashBytes;
+            unsigned char type = GetAddressIndexType(out.scriptPubKey, hashBytes);
+            if (!type)
+                continue;
+            update.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(type, hashBytes, nHeight, nTxIndex, txhash, k, false), out.nValue));
+            update.vAddressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight)));
+        }
+    }
+}
+
+/** Undo the index entries of a transaction that is being disconnected, with the outputs it spent from its undo data. */
+static void IndexDisconnectedTx(CChainIndexUpdate& update, const CTransaction& tx, unsigned int nTxIndex, const CTxUndo* ptxundo, int nHeight)
+{
+    const uint256& txhash = tx.GetHash();
+    if (fAddressIndex) {
+        for (unsigned int k = 0; k < tx.vout.size(); k++) {
+            uint160 hashBytes;
+            unsigned char type = GetAddressIndexType(tx.vout[k].scriptPubKey, hashBytes);
+            if (!type)
+                continue;
+            update.vAddressIndexErase.push_back(CAddressIndexKey(type, hashBytes, nHeight, nTxIndex, txhash, k, false));
+            update.vAddressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, txhash, k), CAddressUnspentValue()));
+        }
+    }
+    if (tx.IsCoinBase() || !ptxundo || ptxundo->vprevout.size() != tx.vin.size())
+        return;
+    for (unsigned int j = 0; j < tx.vin.size(); j++) {
+        const COutPoint& prevout = tx.vin[j].prevout;
+        const Coin& coin = ptxundo->vprevout[j];
+        uint160 hashBytes;
+        unsigned char type = GetAddressIndexType(coin.out.scriptPubKey, hashBytes);
+        if (fAddressIndex && type) {
+            update.vAddressIndexErase.push_back(CAddressIndexKey(type, hashBytes, nHeight, nTxIndex, txhash, j, true));
+            update.vAddressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(type, hashBytes, prevout.hash, prevout.n), CAddressUnspentValue(coin.out.nValue, coin.out.scriptPubKey, coin.nHeight)));
+        }
+        if (fSpentIndex)
+            update.vSpentIndex.push_back(std::make_pair(CSpentIndexKey(prevout.hash, prevout.n), CSpentIndexValue()));
+    }
+}
+
+/** Remove the outputs a connected transaction spent from the running totals, and add the ones it created. */
+static void UpdateTxOutSetDigest(CTxOutSetDigest& digest, const CTransaction& tx, const CTxUndo& txundo, int nHeight)
+{
+    for (unsigned int j = 0; j < txundo.vprevout.size(); j++)
+        digest.Remove(tx.vin[j].prevout, txundo.vprevout[j]);
+    for (size_t o = 0; o < tx.vout.size(); o++) {
+        if (!tx.vout[o].scriptPubKey.IsUnspendable())
+            digest.Add(COutPoint(tx.GetHash(), o), Coin(tx.vout[o], nHeight, tx.IsCoinBase(), tx.IsCoinStake()));
+    }
+}
+
+/** The masternode payment a block pays, as filled in by FillBlockPayee. */
+static CAmount GetMasternodePaymentDue(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (!pindex->pprev)
+        return 0;
+    return GetMasternodePayment(pindex->pprev->nHeight, GetBlockValue(pindex->pprev->nHeight, pindex->pprev->nMoneySupply));
+}
+
+/**
+ * Compute the statistics of a block, taking the values of the spent outputs
+ * from its undo data. Outputs of the coinbase or coinstake that do not pay the
+ * block creator are the masternode payment, or the budget payment of a
+ * superblock when larger than the masternode payment due.
+ */
+static void ComputeBlockStats(const CBlock& block, const CBlockUndo& blockundo, CAmount nMasternodePaymentDue, CBlockStats& stats)
+{
+    stats.SetNull();
+    stats.nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+
+    std::vector<std::pair<CAmount, unsigned int> > vFeeRates;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        CAmount nValueIn = 0;
+        if (i > 0) {
+            BOOST_FOREACH (const Coin& coin, blockundo.vtxundo[i - 1].vprevout)
+                nValueIn += coin.out.nValue;
+        }
+
+        if (tx.IsCoinBase() || tx.IsCoinStake()) {
+            // The coinbase of a proof-of-stake block pays nothing
+            if (tx.IsCoinBase() && block.IsProofOfStake())
+                continue;
+            // The creator is paid to the script of the first output that is not
+            // the empty marker of a coinstake
+            const CScript& scriptCreator = tx.vout[tx.IsCoinStake() ? 1 : 0].scriptPubKey;
+            CAmount nPayments = 0;
+            BOOST_FOREACH (const CTxOut& txout, tx.vout) {
+                if (txout.IsEmpty() || txout.scriptPubKey == scriptCreator)
+                    continue;
+                if (txout.nValue > nMasternodePaymentDue)
+                    stats.nBudgetPayment += txout.nValue;
+                else
+                    stats.nMasternodePayment += txout.nValue;
+                nPayments += txout.nValue;
+            }
+            stats.nStakeReward = tx.GetValueOut() - nValueIn - nPayments;
+            continue;
+        }
+
+        unsigned int nTxSize = tx.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION);
+        CAmount nFee = nValueIn - tx.GetValueOut();
+        stats.nTxCount++;
+        stats.nTxBytes += nTxSize;
+        stats.nFees += nFee;
+        vFeeRates.push_back(std::make_pair(CFeeRate(nFee, nTxSize).GetFeePerK(), nTxSize));
+    }
+
+    if (vFeeRates.empty())
+        return;
+    std::sort(vFeeRates.begin(), vFeeRates.end());
+    stats.nMinFeeRate = vFeeRates.front().first;
+    stats.nMaxFeeRate = vFeeRates.back().first;
+
+    // The fee rate paid by the byte at each percentile of the transaction bytes
+    uint64_t nBytes = 0;
+    int nPercentile = 0;
+    for (unsigned int i = 0; i < vFeeRates.size() && nPercentile < BLOCKSTATS_NUM_PERCENTILES; i++) {
+        nBytes += vFeeRates[i].second;
+        while (nPercentile < BLOCKSTATS_NUM_PERCENTILES && nBytes * 100 >= stats.nTxBytes * BLOCKSTATS_PERCENTILES[nPercentile])
+            stats.vFeeRatePercentiles[nPercentile++] = vFeeRates[i].first;
+    }
+}
+
+bool GetBlockStats(const CBlockIndex* pindex, CBlockStats& stats)
+{
+    if (fBlockStatsIndex && pblocktree->ReadBlockStats(pindex->GetBlockHash(), stats))
+        return true;
+
+    // Only the file positions and the payment due need cs_main, as pruning
+    // clears the positions. The reads check the block hash and the undo
+    // checksum, so a block pruned meanwhile fails cleanly.
+    CDiskBlockPos posBlock, posUndo;
+    CAmount nMasternodePaymentDue;
+    {
+        LOCK(cs_main);
+        posBlock = pindex->GetBlockPos();
+        posUndo = pindex->GetUndoPos();
+        nMasternodePaymentDue = GetMasternodePaymentDue(pindex);
+    }
+
+    CBlock block;
+    if (posBlock.IsNull() || !ReadBlockFromDisk(block, posBlock) || block.GetHash() != pindex->GetBlockHash())
+        return error("%s : failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+
+    // The genesis block has no undo data, and only its unspendable coinbase
+    CBlockUndo blockundo;
+    if (pindex->pprev) {
+        if (posUndo.IsNull())
+            return error("%s : no undo data for block %s", __func__, pindex->GetBlockHash().ToString());
+        if (!blockundo.ReadFromDisk(posUndo, pindex->pprev->GetBlockHash()))
+            return error("%s : failed to read undo data for block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    ComputeBlockStats(block, blockundo, nMasternodePaymentDue, stats);
+    return true;
 }
 
 bool CScriptCheck::operator()()
@@ -1822,6 +2250,54 @@ bool CScriptCheck::operator()()
     return true;
 }
 
+/**
+ * Transactions whose scripts all passed with a given set of flags, so that a
+ * block does not verify again what the mempool verified when the transaction
+ * was accepted. Entries are SHA256(nonce || txid || flags), truncating the
+ * nonce so that the preimage fits in a single SHA256 block. Inserts are
+ * serialized by cs_main.
+ */
+static CCuckooCache scriptExecutionCache;
+static uint256 scriptExecutionCacheNonce(GetRandHash());
+static const size_t SCRIPT_CACHE_NONCE_SIZE = 55 - sizeof(unsigned int) - 32;
+
+/** Transactions that did and did not skip script checks through the cache (guarded by cs_main). */
+static uint64_t nScriptCacheHits = 0;
+static uint64_t nScriptCacheMisses = 0;
+
+static uint256 GetScriptExecutionCacheEntry(const CTransaction& tx, unsigned int flags)
+{
+    uint256 hashCacheEntry;
+    CSHA256().Write(scriptExecutionCacheNonce.begin(), SCRIPT_CACHE_NONCE_SIZE).Write(tx.GetHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+    return hashCacheEntry;
+}
+
+void InitScriptExecutionCache()
+{
+    // -maxsigcachesize is split evenly between this cache and the signature cache.
+    int64_t nMaxSizeMiB = std::max((int64_t)0, std::min(GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE), MAX_MAX_SIG_CACHE_SIZE));
+    size_t nMaxCacheSize = ((size_t)nMaxSizeMiB << 20) / 2;
+    LOCK(cs_main);
+    uint32_t nEntries = scriptExecutionCache.Setup(nMaxCacheSize);
+    LogPrintf("Using %u MiB for script execution cache, able to store %u elements\n", nMaxCacheSize >> 20, nEntries);
+}
+
+unsigned int GetBlockScriptFlags(const CBlockIndex* pindex)
+{
+    // BIP16 didn't become active until Apr 1 2012
+    int64_t nBIP16SwitchTime = 1333238400;
+    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks, when 75% of the network has upgraded:
+    if (pindex->nVersion >= 3 && CBlockIndex::IsSuperMajority(3, pindex->pprev, Params().EnforceBlockUpgradeMajority())) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    return flags;
+}
+
 bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck>* pvChecks)
 {
     if (!tx.IsCoinBase()) {
@@ -1841,20 +2317,20 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
         CAmount nFees = 0;
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             const COutPoint& prevout = tx.vin[i].prevout;
-            const CCoins* coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase() || coins->IsCoinStake()) {
-                if (nSpendHeight - coins->nHeight < Params().COINBASE_MATURITY())
+            if (coin.IsCoinBase() || coin.IsCoinStake()) {
+                if (nSpendHeight - (int)coin.nHeight < Params().COINBASE_MATURITY())
                     return state.Invalid(
-                        error("CheckInputs() : tried to spend coinbase at depth %d, coinstake=%d", nSpendHeight - coins->nHeight, coins->IsCoinStake()),
+                        error("CheckInputs() : tried to spend coinbase at depth %d, coinstake=%d", nSpendHeight - (int)coin.nHeight, coin.IsCoinStake()),
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, error("CheckInputs() : txin values out of range"),
                     REJECT_INVALID, "bad-txns-inputvalues-outofrange");
         }
@@ -1890,13 +2366,24 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // Skip transactions whose scripts already passed with these flags.
+            // A hit while connecting a block (!cacheStore) frees the entry,
+            // as that transaction will not be checked again.
+            uint256 hashCacheEntry = GetScriptExecutionCacheEntry(tx, flags);
+            AssertLockHeld(cs_main);
+            if (scriptExecutionCache.Contains(hashCacheEntry, !cacheStore)) {
+                nScriptCacheHits++;
+                return true;
+            }
+            nScriptCacheMisses++;
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint& prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1908,7 +2395,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i,
+                        CScriptCheck check(coin.out, tx, i,
                             flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1923,12 +2410,45 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
                     return state.DoS(100, false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
                 }
             }
+
+            // Only record the transaction once every script has actually run;
+            // queued checks have not.
+            if (cacheStore && !pvChecks)
+                scriptExecutionCache.Insert(hashCacheEntry);
         }
     }
 
     return true;
 }
 
+/**
+ * Restore the UTXO in a Coin at a given COutPoint.
+ * Undo data written by older versions only carries the height and coinbase
+ * flags for the last output of a transaction that was spent; for the others
+ * they are recovered from a sibling output that is still unspent.
+ * @return false if the undo data did not apply cleanly.
+ */
+static bool ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
+{
+    bool fClean = true;
+
+    if (view.HaveCoin(out))
+        fClean = error("%s : undo data overwriting existing output", __func__);
+    if (undo.nHeight == 0) {
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (!alternate.IsSpent()) {
+            undo.nHeight = alternate.nHeight;
+            undo.fCoinBase = alternate.fCoinBase;
+            undo.fCoinStake = alternate.fCoinStake;
+        } else {
+            return error("%s : undo data adding output to missing transaction", __func__);
+        }
+    }
+    view.AddCoin(out, std::move(undo), !fClean);
+
+    return fClean;
+}
+
 bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
 {
     if (pindex->GetBlockHash() != view.GetBestBlock())
@@ -1939,6 +2459,8 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         *pfClean = false;
 
     bool fClean = true;
+    CTxOutSetDigest digest;
+    bool fDigest = view.GetTxOutSetDigest(digest);
 
     CBlockUndo blockUndo;
     CDiskBlockPos pos = pindex->GetUndoPos();
@@ -1951,65 +2473,60 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         return error("DisconnectBlock() : block and undo data inconsistent");
 
     // undo transactions in reverse order
+    CChainIndexUpdate indexupdate;
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction& tx = block.vtx[i];
         uint256 hash = tx.GetHash();
 
-        // Check that all outputs are available and match the outputs in the block itself
-        // exactly. Note that transactions with only provably unspendable outputs won't
-        // have outputs available even in the block itself, so we handle that case
-        // specially with outsEmpty.
-        {
-            CCoins outsEmpty;
-            CCoinsModifier outs = view.ModifyCoins(hash);
-            outs->ClearUnspendable();
-
-            CCoins outsBlock(tx, pindex->nHeight);
-            // The CCoins serialization does not serialize negative numbers.
-            // No network rules currently depend on the version here, so an inconsistency is harmless
-            // but it must be corrected before txout nversion ever influences a network rule.
-            if (outsBlock.nVersion < 0)
-                outs->nVersion = outsBlock.nVersion;
-            if (*outs != outsBlock)
-                fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
+        if (!pfClean && (fAddressIndex || fSpentIndex))
+            IndexDisconnectedTx(indexupdate, tx, i, i > 0 ? &blockUndo.vtxundo[i - 1] : NULL, pindex->nHeight);
 
-            // remove outputs
-            outs->Clear();
+        // Check that all outputs are available and match the outputs in the block itself
+        // exactly.
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (is_spent && fDigest)
+                    digest.Remove(out, coin);
+                if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != (int)coin.nHeight ||
+                    tx.IsCoinBase() != coin.IsCoinBase() || tx.IsCoinStake() != coin.IsCoinStake()) {
+                    fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
+                }
+            }
         }
 
         // restore inputs
         if (!tx.IsCoinBase()) { // not coinbases because they dont have traditional inputs
-            const CTxUndo& txundo = blockUndo.vtxundo[i - 1];
+            CTxUndo& txundo = blockUndo.vtxundo[i - 1];
             if (txundo.vprevout.size() != tx.vin.size())
                 return error("DisconnectBlock() : transaction and undo data inconsistent - txundo.vprevout.siz=%d tx.vin.siz=%d", txundo.vprevout.size(), tx.vin.size());
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint& out = tx.vin[j].prevout;
-                const CTxInUndo& undo = txundo.vprevout[j];
-                CCoinsModifier coins = view.ModifyCoins(out.hash);
-                if (undo.nHeight != 0) {
-                    // undo data contains height: this is the last output of the prevout tx being spent
-                    if (!coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data overwriting existing transaction");
-                    coins->Clear();
-                    coins->fCoinBase = undo.fCoinBase;
-                    coins->nHeight = undo.nHeight;
-                    coins->nVersion = undo.nVersion;
-                } else {
-                    if (coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data adding output to missing transaction");
+                if (!ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out)) {
+                    fClean = false;
+                } else if (fDigest) {
+                    const Coin& coin = view.AccessCoin(out);
+                    if (!coin.IsSpent())
+                        digest.Add(out, coin);
                 }
-                if (coins->IsAvailable(out.n))
-                    fClean = fClean && error("DisconnectBlock() : undo data overwriting existing output");
-                if (coins->vout.size() < out.n + 1)
-                    coins->vout.resize(out.n + 1);
-                coins->vout[out.n] = undo.txout;
             }
         }
     }
 
+    // The totals can only be trusted if the undo data applied cleanly
+    if (fDigest && fClean) {
+        digest.hashBlock = pindex->pprev->GetBlockHash();
+        view.SetTxOutSetDigest(digest);
+    }
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
+    if (!indexupdate.IsEmpty() && !pblocktree->WriteChainIndexes(indexupdate))
+        return AbortNode("Failed to write address index");
+
     if (pfClean) {
         *pfClean = fClean;
         return true;
@@ -2051,38 +2568,270 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
-static int64_t nTimeVerify = 0;
-static int64_t nTimeConnect = 0;
-static int64_t nTimeIndex = 0;
-static int64_t nTimeCallbacks = 0;
-static int64_t nTimeTotal = 0;
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+//! Transactions read from mempool.dat whose scripts are checked together
+static const unsigned int MEMPOOL_LOAD_BATCH_SIZE = 256;
 
-bool IsProofOfWorkPeriod(int nHeight) {
-    if (nHeight <= Params().LAST_POW_BLOCK1()) {
-        return true;
+/**
+ * Verify the scripts of a batch of transactions on the script check threads,
+ * without holding cs_main while they run. If all pass, the transactions are
+ * recorded in the script execution cache under the flags AcceptToMemoryPool
+ * uses, so accepting them afterwards skips their scripts. Transactions that
+ * spend outputs of earlier ones in the batch are checked against those.
+ */
+static void CheckMempoolBatchScripts(const std::vector<CTransaction>& vtx)
+{
+    if (nScriptCheckThreads == 0)
+        return;
+
+    std::vector<CScriptCheck> vChecks;
+    std::vector<uint256> vCacheEntries;
+    {
+        LOCK2(cs_main, mempool.cs);
+        unsigned int nBlockFlags = MANDATORY_SCRIPT_VERIFY_FLAGS | GetBlockScriptFlags(chainActive.Tip());
+        unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS | nBlockFlags;
+        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        CCoinsViewCache view(&viewMemPool);
+        BOOST_FOREACH (const CTransaction& tx, vtx) {
+            CValidationState state;
+            if (tx.IsCoinBase() || tx.IsCoinStake() || !view.HaveInputs(tx))
+                continue;
+            std::vector<CScriptCheck> vTxChecks;
+            if (!CheckInputs(tx, state, view, true, flags, true, &vTxChecks))
+                continue;
+            BOOST_FOREACH (CScriptCheck& check, vTxChecks) {
+                vChecks.push_back(CScriptCheck());
+                check.swap(vChecks.back());
+            }
+            vCacheEntries.push_back(GetScriptExecutionCacheEntry(tx, STANDARD_SCRIPT_VERIFY_FLAGS));
+            vCacheEntries.push_back(GetScriptExecutionCacheEntry(tx, nBlockFlags));
+            CTxUndo txundo;
+            UpdateCoins(tx, state, view, txundo, MEMPOOL_HEIGHT);
+        }
     }
-    if (nHeight > Params().LAST_POW_BLOCK2() - Params().LAST_POW_BLOCK1() && nHeight <= Params().LAST_POW_BLOCK2()) {
-        return true;
+
+    // An invalid transaction fails the whole batch; AcceptToMemoryPool then checks each one.
+    // The control must be released before taking cs_main, see ControlMutex.
+    {
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        control.Add(vChecks);
+        if (!control.Wait())
+            return;
     }
-    return false;
+
+    LOCK(cs_main);
+    BOOST_FOREACH (const uint256& hashCacheEntry, vCacheEntries)
+        scriptExecutionCache.Insert(hashCacheEntry);
 }
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fAlreadyChecked)
+static void LoadMempoolBatch(const std::vector<CTransaction>& vtx, const std::vector<int64_t>& vTime, int64_t& nCount, int64_t& nFailed)
 {
-    AssertLockHeld(cs_main);
-    // Check it again in case a previous version let a bad block in
-    if (!fAlreadyChecked && !CheckBlock(block, state, !fJustCheck, !fJustCheck))
+    CheckMempoolBatchScripts(vtx);
+    for (unsigned int i = 0; i < vtx.size(); i++) {
+        CValidationState state;
+        LOCK(cs_main);
+        if (AcceptToMemoryPoolWithTime(mempool, state, vtx[i], true, NULL, vTime[i]))
+            ++nCount;
+        else
+            ++nFailed;
+    }
+}
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
         return false;
+    }
 
-    // verify that the view's current state corresponds to the previous block
-    uint256 hashPrevBlock = pindex->pprev == NULL ? uint256(0) : pindex->pprev->GetBlockHash();
-    if (hashPrevBlock != view.GetBestBlock())
-        LogPrintf("%s: hashPrev=%s view=%s\n", __func__, hashPrevBlock.ToString().c_str(), view.GetBestBlock().ToString().c_str());
+    int64_t nStart = GetTimeMillis();
+    int64_t nCount = 0;
+    int64_t nSkipped = 0;
+    int64_t nFailed = 0;
+    int64_t nNow = GetTime();
+
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return false;
+
+        // Deltas go in first, so that entries are added with them
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+        uint64_t nEntries;
+        file >> nEntries;
+        std::vector<CTransaction> vtx;
+        std::vector<int64_t> vTime;
+        while (nEntries--) {
+            CTransaction tx;
+            int64_t nTime;
+            file >> tx;
+            file >> nTime;
+
+            if (nTime + nExpiryTimeout > nNow) {
+                vtx.push_back(tx);
+                vTime.push_back(nTime);
+            } else {
+                ++nSkipped;
+            }
+
+            if (vtx.size() == MEMPOOL_LOAD_BATCH_SIZE || (nEntries == 0 && !vtx.empty())) {
+                boost::this_thread::interruption_point();
+                LoadMempoolBatch(vtx, vTime, nCount, nFailed);
+                vtx.clear();
+                vTime.clear();
+            }
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired (%dms)\n", nCount, nFailed, nSkipped, GetTimeMillis() - nStart);
+    return true;
+}
+
+void DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    // The entries are written out under the lock rather than copied, as this runs at shutdown
+    LOCK(mempool.cs);
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas = mempool.mapDeltas;
+    std::vector<std::pair<uint64_t, const CTxMemPoolEntry*> > vEntries;
+    // Parents before children, so that they can be accepted again in order
+    vEntries.reserve(mempool.mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::const_iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+        vEntries.push_back(std::make_pair(mi->GetCountWithAncestors(), &(*mi)));
+    std::sort(vEntries.begin(), vEntries.end());
+
+    try {
+        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "wb");
+        if (!filestr)
+            return;
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t nVersion = MEMPOOL_DUMP_VERSION;
+        file << nVersion;
+        file << mapDeltas;
+        file << (uint64_t)vEntries.size();
+        for (unsigned int i = 0; i < vEntries.size(); i++) {
+            file << vEntries[i].second->GetTx();
+            file << vEntries[i].second->GetTime();
+        }
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
+        LogPrintf("Dumped %u mempool transactions in %gs\n", vEntries.size(), (GetTimeMicros() - nStart) * 0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+    }
+}
+
+bool CCoinsPrefetch::operator()()
+{
+    if (!pview->GetCoin(prevout, *pcoin))
+        pcoin->Clear();
+    return true;
+}
+
+static CCheckQueue<CCoinsPrefetch> coinsprefetchqueue(16);
+
+void ThreadCoinsPrefetch()
+{
+    RenameThread("unitedstatedollarcrypto-prefetch");
+    coinsprefetchqueue.Thread();
+}
+
+/**
+ * Load the coins spent by a block into pcoinsTip before it is connected.
+ * Inputs that are not cached yet are read from the coins database by the
+ * prefetch threads in parallel, so ConnectBlock does not have to fault them
+ * in one at a time. Outputs created by the block itself are skipped.
+ */
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!nPrefetchThreads)
+        return;
+
+    std::set<uint256> setBlockTxids;
+    BOOST_FOREACH (const CTransaction& tx, block.vtx)
+        setBlockTxids.insert(tx.GetHash());
+
+    std::vector<COutPoint> vMissing;
+    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            if (setBlockTxids.count(txin.prevout.hash) || pcoinsTip->HaveCoinInCache(txin.prevout))
+                continue;
+            vMissing.push_back(txin.prevout);
+        }
+    }
+    if (vMissing.empty())
+        return;
+
+    std::vector<Coin> vCoins(vMissing.size());
+    {
+        const CCoinsView* pbase = pcoinsTip->GetBackend();
+        std::vector<CCoinsPrefetch> vReads;
+        vReads.reserve(vMissing.size());
+        for (unsigned int i = 0; i < vMissing.size(); i++)
+            vReads.push_back(CCoinsPrefetch(pbase, vMissing[i], &vCoins[i]));
+
+        CCheckQueueControl<CCoinsPrefetch> control(&coinsprefetchqueue);
+        control.Add(vReads);
+        control.Wait();
+    }
+
+    for (unsigned int i = 0; i < vMissing.size(); i++)
+        pcoinsTip->PrimeCoin(vMissing[i], std::move(vCoins[i]));
+}
+
+static int64_t nTimeVerify = 0;
+static int64_t nTimeConnect = 0;
+static int64_t nTimeIndex = 0;
+static int64_t nTimeCallbacks = 0;
+static int64_t nTimeTotal = 0;
+
+bool IsProofOfWorkPeriod(int nHeight) {
+    if (nHeight <= Params().LAST_POW_BLOCK1()) {
+        return true;
+    }
+    if (nHeight > Params().LAST_POW_BLOCK2() - Params().LAST_POW_BLOCK1() && nHeight <= Params().LAST_POW_BLOCK2()) {
+        return true;
+    }
+    return false;
+}
+
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fAlreadyChecked, CBlockUndo* pblockundo)
+{
+    AssertLockHeld(cs_main);
+    // Check it again in case a previous version let a bad block in
+    if (!fAlreadyChecked && !CheckBlock(block, state, !fJustCheck, !fJustCheck))
+        return false;
+
+    // verify that the view's current state corresponds to the previous block
+    uint256 hashPrevBlock = pindex->pprev == NULL ? uint256(0) : pindex->pprev->GetBlockHash();
+    if (hashPrevBlock != view.GetBestBlock())
+        LogPrintf("%s: hashPrev=%s view=%s\n", __func__, hashPrevBlock.ToString().c_str(), view.GetBestBlock().ToString().c_str());
     assert(hashPrevBlock == view.GetBestBlock());
 
     // Special case for the genesis block, skipping connection of its transactions
     // (its coinbase is unspendable)
     if (block.GetHash() == Params().HashGenesisBlock()) {
+        CTxOutSetDigest digest;
+        digest.hashBlock = pindex->GetBlockHash();
+        view.SetTxOutSetDigest(digest);
         view.SetBestBlock(pindex->GetBlockHash());
         return true;
     }
@@ -2112,29 +2861,30 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     bool fEnforceBIP30 = !pindex->phashBlock; // Enforce on CreateNewBlock invocations which don't have a hash.
     if (fEnforceBIP30) {
         BOOST_FOREACH (const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
-                    REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                    return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
+                        REJECT_INVALID, "bad-txns-BIP30");
+            }
         }
     }
 
-    // BIP16 didn't become active until Apr 1 2012
-    int64_t nBIP16SwitchTime = 1333238400;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
+    unsigned int flags = GetBlockScriptFlags(pindex);
+    bool fStrictPayToScriptHash = (flags & SCRIPT_VERIFY_P2SH) != 0;
 
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+    CBlockUndo blockundo;
 
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks, when 75% of the network has upgraded:
-    if (block.nVersion >= 3 && CBlockIndex::IsSuperMajority(3, pindex->pprev, Params().EnforceBlockUpgradeMajority())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
+    // Running totals of the unspent outputs, if they are known for the previous block
+    CTxOutSetDigest digest;
+    bool fDigest = view.GetTxOutSetDigest(digest);
 
-    CBlockUndo blockundo;
+    CChainIndexUpdate indexupdate;
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
+    uint64_t nScriptCacheHitsStart = nScriptCacheHits;
+    uint64_t nScriptCacheMissesStart = nScriptCacheMisses;
     CAmount nFees = 0;
     int nInputs = 0;
     unsigned int nSigOps = 0;
@@ -2173,18 +2923,38 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 nFees += view.GetValueIn(tx) - tx.GetValueOut();
             nValueIn += view.GetValueIn(tx);
 
+            // Only blocks checked without being connected (CreateNewBlock)
+            // leave their transactions in the script execution cache.
             std::vector<CScriptCheck> vChecks;
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fJustCheck, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
         }
         nValueOut += tx.GetValueOut();
 
+        if (fDigest && tx.IsCoinBase()) {
+            // A duplicate coinbase replaces the outputs of the earlier one
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                COutPoint out(tx.GetHash(), o);
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent())
+                    digest.Remove(out, coin);
+            }
+        }
+
+        if (fAddressIndex || fSpentIndex)
+            IndexConnectedTx(indexupdate, tx, i, view, pindex->nHeight);
+        // Kept outside the block files, which may be pruned before the budget is decided
+        if (!fJustCheck && IsBudgetCollateralTx(tx))
+            indexupdate.vBudgetCollateral.push_back(std::make_pair(pindex->GetBlockHash(), tx));
+
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
         }
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        if (fDigest)
+            UpdateTxOutSetDigest(digest, tx, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
@@ -2197,10 +2967,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)))
         return error("Connect() : WriteBlockIndex for pindex failed");
+    mapBlockIndexCold.erase(pindex);
 
     int64_t nTime1 = GetTimeMicros();
     nTimeConnect += nTime1 - nTimeStart;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs - 1), nTimeConnect * 0.000001);
+    uint64_t nCacheHits = nScriptCacheHits - nScriptCacheHitsStart;
+    uint64_t nCacheLookups = nCacheHits + nScriptCacheMisses - nScriptCacheMissesStart;
+    LogPrint("bench", "      - Script cache: %u/%u txs already verified (%.1f%%) [%.1f%% overall]\n", nCacheHits, nCacheLookups, nCacheLookups ? 100.0 * nCacheHits / nCacheLookups : 0.0,
+        nScriptCacheHits + nScriptCacheMisses ? 100.0 * nScriptCacheHits / (nScriptCacheHits + nScriptCacheMisses) : 0.0);
 
     //PoW phase redistributed fees to miner. PoS stage destroys fees.
     CAmount nExpectedMint = GetBlockValue(pindex->pprev->nHeight);
@@ -2245,7 +3020,21 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort("Failed to write transaction index");
 
+    if (fTimestampIndex)
+        indexupdate.vTimestampIndex.push_back(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash()));
+    if (fBlockStatsIndex) {
+        CBlockStats stats;
+        ComputeBlockStats(block, blockundo, GetMasternodePaymentDue(pindex), stats);
+        indexupdate.vBlockStats.push_back(std::make_pair(pindex->GetBlockHash(), stats));
+    }
+    if (!indexupdate.IsEmpty() && !pblocktree->WriteChainIndexes(indexupdate))
+        return state.Abort("Failed to write block indexes");
+
     // add this block to the view's block chain
+    if (fDigest) {
+        digest.hashBlock = pindex->GetBlockHash();
+        view.SetTxOutSetDigest(digest);
+    }
     view.SetBestBlock(pindex->GetBlockHash());
 
     int64_t nTime3 = GetTimeMicros();
@@ -2261,10 +3050,131 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     nTimeCallbacks += nTime4 - nTime3;
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime4 - nTime3), nTimeCallbacks * 0.000001);
 
+    if (pblockundo)
+        pblockundo->vtxundo.swap(blockundo.vtxundo);
     return true;
 }
 
+uint64_t CalculateCurrentUsage()
+{
+    uint64_t retval = 0;
+    BOOST_FOREACH (const CBlockFileInfo& file, vinfoBlockFile) {
+        retval += file.nSize + file.nUndoSize;
+    }
+    return retval;
+}
+
+/** Mark one block file as pruned: forget the data and undo positions of its blocks. */
+static void PruneOneBlockFile(const int fileNumber)
+{
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        CBlockIndex* pindex = it->second;
+        if (pindex->nFile == fileNumber) {
+            pindex->nStatus &= ~BLOCK_HAVE_DATA;
+            pindex->nStatus &= ~BLOCK_HAVE_UNDO;
+            pindex->nFile = 0;
+            pindex->nDataPos = 0;
+            pindex->nUndoPos = 0;
+            setDirtyBlockIndex.insert(pindex);
+
+            // Prune from mapBlocksUnlinked -- any block we prune would have
+            // to be downloaded again in order to consider its chain, at which
+            // point it would be considered as a candidate for
+            // mapBlocksUnlinked or setBlockIndexCandidates.
+            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex->pprev);
+            while (range.first != range.second) {
+                std::multimap<CBlockIndex*, CBlockIndex*>::iterator itUnlinked = range.first;
+                range.first++;
+                if (itUnlinked->second == pindex) {
+                    mapBlocksUnlinked.erase(itUnlinked);
+                }
+            }
+        }
+    }
+
+    vinfoBlockFile[fileNumber].SetNull();
+    setDirtyFileInfo.insert(fileNumber);
+}
+
+void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
+{
+    for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
+        CDiskBlockPos pos(*it, 0);
+        // Drop any mapping of the files before they go away
+        blockfilecache.Invalidate(*it);
+        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
+        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+        LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
+    }
+}
+
+unsigned int GetPruneMargin()
+{
+    unsigned int nMargin = MIN_BLOCKS_TO_KEEP;
+    nMargin = std::max(nMargin, (unsigned int)GetArg("-maxreorg", Params().MaxReorganizationDepth()) + 1);
+    nMargin = std::max(nMargin, (unsigned int)Params().COINBASE_MATURITY() + 1);
+    return nMargin;
+}
+
+/**
+ * Calculate the block/rev files that should be deleted to remain under target
+ *
+ * Block files are pruned oldest first, as long as they do not contain blocks
+ * within GetPruneMargin() of the tip. The files are only marked as pruned
+ * here; the caller unlinks them after the block index has been written.
+ */
+static void FindFilesToPrune(std::set<int>& setFilesToPrune)
+{
+    LOCK2(cs_main, cs_LastBlockFile);
+    if (chainActive.Tip() == NULL || nPruneTarget == 0) {
+        return;
+    }
+    if (chainActive.Tip()->nHeight <= Params().PruneAfterHeight()) {
+        return;
+    }
+
+    unsigned int nMargin = GetPruneMargin();
+    if ((unsigned int)chainActive.Tip()->nHeight <= nMargin)
+        return;
+    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - nMargin;
+    uint64_t nCurrentUsage = CalculateCurrentUsage();
+    // We don't check to prune until after we've allocated new space for files
+    // So we should leave a buffer under our target to account for another allocation
+    // before the next pruning.
+    uint64_t nBuffer = BLOCKFILE_CHUNK_SIZE + UNDOFILE_CHUNK_SIZE;
+    uint64_t nBytesToPrune;
+    int count = 0;
+
+    if (nCurrentUsage + nBuffer >= nPruneTarget) {
+        for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
+            nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
+
+            if (vinfoBlockFile[fileNumber].nSize == 0)
+                continue;
+
+            if (nCurrentUsage + nBuffer < nPruneTarget) // are we below our target?
+                break;
+
+            // don't prune files that could have a block within the margin of the main chain's tip but keep scanning
+            if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+                continue;
+
+            PruneOneBlockFile(fileNumber);
+            // Queue up the files for removal
+            setFilesToPrune.insert(fileNumber);
+            nCurrentUsage -= nBytesToPrune;
+            count++;
+        }
+    }
+
+    LogPrint("prune", "Prune: target=%dMiB actual=%dMiB diff=%dMiB max_prune_height=%d removed %d blk/rev pairs\n",
+        nPruneTarget / 1024 / 1024, nCurrentUsage / 1024 / 1024,
+        ((int64_t)nPruneTarget - (int64_t)nCurrentUsage) / 1024 / 1024,
+        nLastBlockWeCanPrune, count);
+}
+
 enum FlushStateMode {
+    FLUSH_STATE_NONE,
     FLUSH_STATE_IF_NEEDED,
     FLUSH_STATE_PERIODIC,
     FLUSH_STATE_ALWAYS
@@ -2272,23 +3182,42 @@ enum FlushStateMode {
 
 /**
  * Update the on-disk chain state.
- * The caches and indexes are flushed if either they're too large, forceWrite is set, or
- * fast is not set and it's been a while since the last write.
+ * The caches and indexes are flushed depending on the mode we're called with
+ * if they're too large, if it's been a while since the last write,
+ * or always and in all cases if we're in prune mode and are deleting files.
  */
 bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
 {
-    LOCK(cs_main);
+    LOCK2(cs_main, cs_LastBlockFile);
     static int64_t nLastWrite = 0;
+    std::set<int> setFilesToPrune;
+    bool fFlushForPrune = false;
     try {
-        if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
-            (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
-            // Typical CCoins structures on disk are around 100 bytes in size.
+        if (fPruneMode && fCheckForPruning && !fReindex) {
+            FindFilesToPrune(setFilesToPrune);
+            fCheckForPruning = false;
+            if (!setFilesToPrune.empty()) {
+                fFlushForPrune = true;
+                if (!fHavePruned) {
+                    pblocktree->WriteFlag("prunedblockfiles", true);
+                    fHavePruned = true;
+                }
+            }
+        }
+        size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+        // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
+        bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0 / 9) > nCoinCacheUsage;
+        // The cache is over the limit, we have to write now.
+        bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize > nCoinCacheUsage;
+        // It's been a while since we wrote the block index and chain state to disk.
+        bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000;
+        if (mode == FLUSH_STATE_ALWAYS || fCacheLarge || fCacheCritical || fPeriodicWrite || fFlushForPrune) {
+            // Typical Coin structures on disk are around 48 bytes in size.
             // Pushing a new one to the database can cause it to be written
             // twice (once in the log, and once in the tables). This is already
             // an overestimation, as most will delete an existing entry or
             // overwrite one. Still, use a conservative safety factor of 2.
-            if (!CheckDiskSpace(100 * 2 * 2 * pcoinsTip->GetCacheSize()))
+            if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // First make sure all block and undo data is flushed to disk.
             FlushBlockFile();
@@ -2308,12 +3237,16 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                 if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(*it))) {
                     return state.Abort("Failed to write to block index");
                 }
+                mapBlockIndexCold.erase(*it);
                 setDirtyBlockIndex.erase(it++);
             }
             pblocktree->Sync();
             // Finally flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
                 return state.Abort("Failed to write to coin database");
+            // Only remove the files once the index no longer points into them.
+            if (fFlushForPrune)
+                UnlinkPrunedFiles(setFilesToPrune);
             // Update best block in wallet (so we can detect restored wallets).
             if (mode != FLUSH_STATE_IF_NEEDED) {
                 g_signals.SetBestChain(chainActive.GetLocator());
@@ -2332,19 +3265,27 @@ void FlushStateToDisk()
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+void PruneAndFlush()
+{
+    CValidationState state;
+    fCheckForPruning = true;
+    FlushStateToDisk(state, FLUSH_STATE_NONE);
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex* pindexNew)
 {
     chainActive.SetTip(pindexNew);
+    StakeKernelTipChanged();
 
     // New best block
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utxo)\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-        Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+        Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -2403,6 +3344,8 @@ bool static DisconnectTip(CValidationState& state)
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
+    stakeModifierCache.BlockDisconnected(pindexDelete);
+    RecentlySpentDisconnected(pindexDelete->nHeight);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
@@ -2412,6 +3355,7 @@ bool static DisconnectTip(CValidationState& state)
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2438,14 +3382,19 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
             return state.Abort("Failed to read block");
         pblock = &block;
     }
+    int64_t nTimeRead = GetTimeMicros();
+    nTimeReadFromDisk += nTimeRead - nTime1;
+    LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTimeRead - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    PrefetchBlockInputs(*pblock);
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros();
-    nTimeReadFromDisk += nTime2 - nTime1;
+    nTimePrefetch += nTime2 - nTimeRead;
     int64_t nTime3;
-    LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    CBlockUndo blockundo;
+    LogPrint("bench", "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTime2 - nTimeRead) * 0.001, nTimePrefetch * 0.000001);
     {
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, fAlreadyChecked);
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, fAlreadyChecked, &blockundo);
         g_signals.BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2478,6 +3427,8 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    stakeModifierCache.BlockConnected(pindexNew);
+    RecentlySpentConnected(*pblock, blockundo, pindexNew->nHeight);
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     BOOST_FOREACH (const CTransaction& tx, txConflicted) {
@@ -2861,18 +3812,20 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockindexarena.Allocate();
+    *pindexNew = CBlockIndex(block);
+    if (block.IsProofOfStake()) {
+        CBlockIndexCold& cold = mapBlockIndexCold[pindexNew];
+        cold.prevoutStake = block.vtx[1].vin[0].prevout;
+        cold.nStakeTime = block.nTime;
+        setStakeSeen.insert(make_pair(cold.prevoutStake, cold.nStakeTime));
+    }
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
     BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
 
-    //mark as PoS seen
-    if (pindexNew->IsProofOfStake())
-        setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-
     pindexNew->phashBlock = &((*mi).first);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end()) {
@@ -2880,21 +3833,16 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
         pindexNew->BuildSkip();
 
-        //update previous block pointer
-        pindexNew->pprev->pnext = pindexNew;
-
-        // ppcoin: compute chain trust score
-        pindexNew->bnChainTrust = (pindexNew->pprev ? pindexNew->pprev->bnChainTrust : 0) + pindexNew->GetBlockTrust();
-
         // ppcoin: compute stake entropy bit for stake modifier
         if (!pindexNew->SetStakeEntropyBit(pindexNew->GetStakeEntropyBit()))
             LogPrintf("AddToBlockIndex() : SetStakeEntropyBit() failed \n");
 
         // ppcoin: record proof-of-stake hash value
+        uint256 hashProofOfStake;
         if (pindexNew->IsProofOfStake()) {
             if (!mapProofOfStake.count(hash))
                 LogPrintf("AddToBlockIndex() : hashProofOfStake not found in map \n");
-            pindexNew->hashProofOfStake = mapProofOfStake[hash];
+            hashProofOfStake = mapProofOfStake[hash];
         }
 
         // ppcoin: compute stake modifier
@@ -2903,7 +3851,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
             LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
         pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
-        pindexNew->nStakeModifierChecksum = GetStakeModifierChecksum(pindexNew);
+        pindexNew->nStakeModifierChecksum = GetStakeModifierChecksum(pindexNew, hashProofOfStake);
         if (!CheckStakeModifierCheckpoints(pindexNew->nHeight, pindexNew->nStakeModifierChecksum))
             LogPrintf("AddToBlockIndex() : Rejected by stake modifier checkpoint height=%d, modifier=%s \n", pindexNew->nHeight, boost::lexical_cast<std::string>(nStakeModifier));
     }
@@ -2912,10 +3860,6 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
     if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
         pindexBestHeader = pindexNew;
 
-    //update previous block pointer
-    if (pindexNew->nHeight)
-        pindexNew->pprev->pnext = pindexNew;
-
     setDirtyBlockIndex.insert(pindexNew);
 
     return pindexNew;
@@ -2991,6 +3935,8 @@ bool FindBlockPos(CValidationState& state, CDiskBlockPos& pos, unsigned int nAdd
         pos.nPos = vinfoBlockFile[nFile].nSize;
     }
 
+    if (nLastBlockFile != (int)nFile)
+        blockfilecache.SetActiveFile(nFile);
     nLastBlockFile = nFile;
     vinfoBlockFile[nFile].AddBlock(nHeight, nTime);
     if (fKnown)
@@ -3002,6 +3948,8 @@ bool FindBlockPos(CValidationState& state, CDiskBlockPos& pos, unsigned int nAdd
         unsigned int nOldChunks = (pos.nPos + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         if (nNewChunks > nOldChunks) {
+            if (fPruneMode)
+                fCheckForPruning = true;
             if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
                 FILE* file = OpenBlockFile(pos);
                 if (file) {
@@ -3032,6 +3980,8 @@ bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigne
     unsigned int nOldChunks = (pos.nPos + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     unsigned int nNewChunks = (nNewSize + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     if (nNewChunks > nOldChunks) {
+        if (fPruneMode)
+            fCheckForPruning = true;
         if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
             FILE* file = OpenUndoFile(pos);
             if (file) {
@@ -3075,7 +4025,11 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
-        uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
+        std::vector<uint256> vLeaves;
+        vLeaves.reserve(block.vtx.size());
+        for (unsigned int i = 0; i < block.vtx.size(); i++)
+            vLeaves.push_back(block.vtx[i].GetHash());
+        uint256 hashMerkleRoot2 = ComputeMerkleRoot(vLeaves, &mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
             return state.DoS(100, error("CheckBlock() : hashMerkleRoot mismatch"),
                 REJECT_INVALID, "bad-txnmrklroot", true);
@@ -3187,6 +4141,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     return true;
 }
 
+static int64_t nTimeCheckKernel = 0;
+
 bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
 {
     if (pindexPrev == NULL)
@@ -3211,7 +4167,13 @@ bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
         uint256 hashProofOfStake;
         uint256 hash = block.GetHash();
 
-        if(!CheckProofOfStake(block, hashProofOfStake)) {
+        int64_t nTimeStart = GetTimeMicros();
+        bool fKernelValid = CheckProofOfStake(block, hashProofOfStake);
+        int64_t nTimeKernel = GetTimeMicros() - nTimeStart;
+        nTimeCheckKernel += nTimeKernel;
+        LogPrint("bench", "  - Check stake kernel: %.2fms [%.2fs]\n", nTimeKernel * 0.001, nTimeCheckKernel * 0.000001);
+
+        if(!fKernelValid) {
             LogPrintf("WARNING: ProcessBlock(): check proof-of-stake failed for block %s\n", hash.ToString().c_str());
             return false;
         }
@@ -3643,6 +4605,46 @@ boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos& pos, const char
     return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
 }
 
+bool ReadBlockIndexCold(const CBlockIndex* pindex, CBlockIndexCold& cold)
+{
+    AssertLockHeld(cs_main);
+    map<const CBlockIndex*, CBlockIndexCold>::const_iterator it = mapBlockIndexCold.find(pindex);
+    if (it != mapBlockIndexCold.end()) {
+        cold = it->second;
+        return true;
+    }
+    CDiskBlockIndex diskindex;
+    if (!pblocktree || !pblocktree->ReadBlockIndex(pindex->GetBlockHash(), diskindex))
+        return error("%s : block index entry %s not found", __func__, pindex->GetBlockHash().ToString());
+    cold = diskindex.GetCold();
+    return true;
+}
+
+CDiskBlockIndex::CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex)
+{
+    hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+    nStakeTime = 0;
+    if (IsProofOfStake()) {
+        CBlockIndexCold cold;
+        if (!ReadBlockIndexCold(pindex, cold))
+            throw runtime_error("CDiskBlockIndex() : cannot read block index entry");
+        prevoutStake = cold.prevoutStake;
+        nStakeTime = cold.nStakeTime;
+    }
+}
+
+CBlockIndexMemoryUsage GetBlockIndexMemoryUsage()
+{
+    AssertLockHeld(cs_main);
+    CBlockIndexMemoryUsage usage;
+    usage.nEntries = mapBlockIndex.size();
+    usage.nArenaBytes = blockindexarena.DynamicMemoryUsage();
+    usage.nMapBytes = memusage::DynamicUsage(mapBlockIndex);
+    usage.nColdEntries = mapBlockIndexCold.size();
+    usage.nColdBytes = memusage::DynamicUsage(mapBlockIndexCold);
+    return usage;
+}
+
 CBlockIndex* InsertBlockIndex(uint256 hash)
 {
     if (hash == 0)
@@ -3654,15 +4656,9 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockindexarena.Allocate();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
 
-    //mark as PoS seen
-    if (pindexNew->IsProofOfStake())
-        setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
@@ -3670,12 +4666,22 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
 
 bool static LoadBlockIndexDB(string& strError)
 {
+    // A UTXO snapshot load that did not finish leaves a partial coin database
+    bool fLoadingTxOutSet = false;
+    pblocktree->ReadFlag("txoutsetloading", fLoadingTxOutSet);
+    if (fLoadingTxOutSet) {
+        strError = "Loading a UTXO snapshot was interrupted, restart with -reindex";
+        return false;
+    }
+
+    int64_t nTimeStart = GetTimeMillis();
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
+    int64_t nTimeGuts = GetTimeMillis();
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
+    // Calculate nChainWork, unless it was loaded with the block index snapshot
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     for (const PAIRTYPE(uint256, CBlockIndex*) & item : mapBlockIndex) {
@@ -3685,8 +4691,11 @@ bool static LoadBlockIndexDB(string& strError)
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
     BOOST_FOREACH (const PAIRTYPE(int, CBlockIndex*) & item, vSortedByHeight) {
         CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
-        if (pindex->nStatus & BLOCK_HAVE_DATA) {
+        if (pindex->nChainWork == 0)
+            pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        // We can link the chain of blocks for which we've received transactions at some point.
+        // Pruned nodes may have deleted the block.
+        if (pindex->nTx > 0) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
@@ -3707,9 +4716,11 @@ bool static LoadBlockIndexDB(string& strError)
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    int64_t nTimeChain = GetTimeMillis();
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
+    blockfilecache.SetActiveFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
     LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
     for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
@@ -3740,6 +4751,14 @@ bool static LoadBlockIndexDB(string& strError)
             return false;
         }
     }
+    int64_t nTimeFiles = GetTimeMillis();
+    LogPrintf("%s: block index %dms, chain %dms, block files %dms\n", __func__,
+        nTimeGuts - nTimeStart, nTimeChain - nTimeGuts, nTimeFiles - nTimeChain);
+
+    // Check whether we have ever pruned block & undo files
+    pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
+    if (fHavePruned)
+        LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
     //Check if the shutdown procedure was followed on last client exit
     bool fLastShutdownWasPrepared = true;
@@ -3747,7 +4766,7 @@ bool static LoadBlockIndexDB(string& strError)
     LogPrintf("%s: Last shutdown was prepared: %s\n", __func__, fLastShutdownWasPrepared);
 
     //Check for inconsistency with block file info and internal state
-    if (!fLastShutdownWasPrepared && !GetBoolArg("-forcestart", false) && !GetBoolArg("-reindex", false)) {
+    if (!fLastShutdownWasPrepared && !GetBoolArg("-forcestart", false) && !GetBoolArg("-reindex", false) && !GetBoolArg("-reindex-chainstate", false)) {
         unsigned int nHeightLastBlockFile = vinfoBlockFile[nLastBlockFile].nHeightLast + 1;
         if (vSortedByHeight.size() > nHeightLastBlockFile && pcoinsTip->GetBestBlock() != vSortedByHeight[nHeightLastBlockFile].second->GetBlockHash()) {
             //The database is in a state where a block has been accepted and written to disk, but the
@@ -3821,6 +4840,13 @@ bool static LoadBlockIndexDB(string& strError)
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have the address, spent and timestamp indexes
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    pblocktree->ReadFlag("spentindex", fSpentIndex);
+    pblocktree->ReadFlag("timestampindex", fTimestampIndex);
+    LogPrintf("LoadBlockIndexDB(): address index %s, spent index %s, timestamp index %s\n",
+        fAddressIndex ? "enabled" : "disabled", fSpentIndex ? "enabled" : "disabled", fTimestampIndex ? "enabled" : "disabled");
+
     // If this is written true before the next client init, then we know the shutdown process failed
     pblocktree->WriteFlag("shutdown", false);
 
@@ -3873,6 +4899,11 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height() - nCheckDepth)
             break;
+        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, only go back as far as we have data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -3890,7 +4921,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -3930,8 +4961,11 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
 void UnloadBlockIndex()
 {
     mapBlockIndex.clear();
+    mapBlockIndexCold.clear();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    stakeModifierCache.Clear();
+    ClearRecentlySpent();
     pindexBestInvalid = NULL;
 }
 
@@ -3944,6 +4978,287 @@ bool LoadBlockIndex(string& strError)
 }
 
 
+namespace
+{
+const char TXOUTSET_SNAPSHOT_MAGIC[4] = {'u', 't', 'x', 'o'};
+
+//! Size of the chunks a UTXO snapshot is written and hashed in
+const size_t TXOUTSET_SNAPSHOT_CHUNK = 1 << 20;
+
+void WriteTxOutSetChunk(CAutoFile& fileout, CHashWriter& hasher, CDataStream& ss)
+{
+    if (ss.empty())
+        return;
+    fileout.write(&ss[0], ss.size());
+    hasher.write(&ss[0], ss.size());
+    ss.clear();
+}
+
+/** Read one block index entry of a UTXO snapshot and check that it extends the chain read so far. */
+void ReadTxOutSetIndexEntry(CAutoFile& filein, int nHeight, uint256& hashPrev, uint256& hash, CDiskBlockIndex& diskindex)
+{
+    filein >> hash >> diskindex;
+    if (diskindex.GetBlockHash() != hash)
+        throw std::runtime_error("block index entry does not match its hash " + hash.ToString());
+    if (diskindex.nHeight != nHeight || diskindex.hashPrev != hashPrev)
+        throw std::runtime_error("block index entries do not form a chain");
+    if (nHeight == 0 && hash != Params().HashGenesisBlock())
+        throw std::runtime_error("snapshot is for a different genesis block");
+    if (nHeight > 0 && diskindex.nTx == 0)
+        throw std::runtime_error("block index entry without transactions");
+    hashPrev = hash;
+}
+
+/** Read the header of a UTXO snapshot, leaving the file at the first block index entry. */
+void ReadTxOutSetHeader(CAutoFile& filein, CTxOutSetSnapshotInfo& info)
+{
+    char pchMagic[sizeof(TXOUTSET_SNAPSHOT_MAGIC)];
+    unsigned char pchMessageStart[MESSAGE_START_SIZE];
+    int nVersion;
+    filein.read(pchMagic, sizeof(pchMagic));
+    filein >> nVersion;
+    filein.read((char*)pchMessageStart, sizeof(pchMessageStart));
+    filein >> info.hashBlock >> info.nHeight;
+    if (memcmp(pchMagic, TXOUTSET_SNAPSHOT_MAGIC, sizeof(pchMagic)) || nVersion != TXOUTSET_SNAPSHOT_VERSION)
+        throw std::runtime_error("not a UTXO snapshot of a supported version");
+    if (memcmp(pchMessageStart, Params().MessageStart(), sizeof(pchMessageStart)))
+        throw std::runtime_error("snapshot is for a different network");
+    if (info.nHeight <= 0)
+        throw std::runtime_error("snapshot is at the genesis block");
+}
+} // anon namespace
+
+bool DumpTxOutSet(const boost::filesystem::path& path, CTxOutSetSnapshotInfo& info, std::string& strError)
+{
+    if (boost::filesystem::exists(path)) {
+        strError = path.string() + " already exists";
+        return false;
+    }
+    boost::filesystem::path pathTmp = path.string() + ".incomplete";
+    CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        strError = "unable to open " + pathTmp.string();
+        return false;
+    }
+
+    CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    info = CTxOutSetSnapshotInfo();
+    try {
+        boost::scoped_ptr<CCoinsViewCursor> pcursor;
+        std::vector<uint256> vHashes;
+        {
+            LOCK(cs_main);
+            FlushStateToDisk();
+            pcursor.reset(pcoinsTip->Cursor());
+            BlockMap::iterator mi = pcursor ? mapBlockIndex.find(pcursor->GetBestBlock()) : mapBlockIndex.end();
+            if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second))
+                throw std::runtime_error("the coin database is not at a block of the active chain");
+            info.hashBlock = mi->first;
+            info.nHeight = mi->second->nHeight;
+
+            ss.write(TXOUTSET_SNAPSHOT_MAGIC, sizeof(TXOUTSET_SNAPSHOT_MAGIC));
+            ss << TXOUTSET_SNAPSHOT_VERSION;
+            ss.write((const char*)Params().MessageStart(), MESSAGE_START_SIZE);
+            ss << info.hashBlock << info.nHeight;
+
+            vHashes.reserve(info.nHeight + 1);
+            for (int nHeight = 0; nHeight <= info.nHeight; nHeight++)
+                vHashes.push_back(chainActive[nHeight]->GetBlockHash());
+        }
+
+        // The active chain up to the base block, with the stake modifiers
+        // and money supply needed to validate the blocks that follow it. The
+        // flush above wrote every entry to the block tree, so they are read
+        // from there without holding cs_main.
+        BOOST_FOREACH (const uint256& hash, vHashes) {
+            CDiskBlockIndex diskindex;
+            if (!pblocktree->ReadBlockIndex(hash, diskindex))
+                throw std::runtime_error("unable to read block index entry " + hash.ToString());
+            ss << hash << diskindex;
+            if (ss.size() >= TXOUTSET_SNAPSHOT_CHUNK)
+                WriteTxOutSetChunk(fileout, hasher, ss);
+        }
+
+        // The cursor reads a snapshot of the coin database, so the rest does
+        // not hold up the node.
+        for (; pcursor->Valid(); pcursor->Next()) {
+            COutPoint outpoint;
+            Coin coin;
+            if (!pcursor->GetKey(outpoint) || !pcursor->GetValue(coin))
+                throw std::runtime_error("unable to read the coin database");
+            ss << outpoint << coin;
+            info.nCoins++;
+            if (ss.size() >= TXOUTSET_SNAPSHOT_CHUNK)
+                WriteTxOutSetChunk(fileout, hasher, ss);
+        }
+        WriteTxOutSetChunk(fileout, hasher, ss);
+    } catch (const std::exception& e) {
+        fileout.fclose();
+        boost::filesystem::remove(pathTmp);
+        strError = e.what();
+        return false;
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+    if (!RenameOver(pathTmp, path)) {
+        strError = "unable to rename " + pathTmp.string();
+        return false;
+    }
+    info.hashSnapshot = hasher.GetHash();
+    LogPrintf("Wrote UTXO snapshot at block %s (height %d), %u outputs, hash %s\n",
+        info.hashBlock.ToString(), info.nHeight, info.nCoins, info.hashSnapshot.ToString());
+    return true;
+}
+
+bool LoadTxOutSet(const boost::filesystem::path& path, const uint256& hashExpected, CTxOutSetSnapshotInfo& info, std::string& strError)
+{
+    int64_t nStart = GetTimeMillis();
+    info = CTxOutSetSnapshotInfo();
+
+    // Check the whole file against the hash the operator supplied before
+    // anything is changed.
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull()) {
+            strError = "unable to open " + path.string();
+            return false;
+        }
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        std::vector<char> vBuf(TXOUTSET_SNAPSHOT_CHUNK);
+        size_t nRead;
+        while ((nRead = fread(&vBuf[0], 1, vBuf.size(), filein.Get())) > 0)
+            hasher.write(&vBuf[0], nRead);
+        if (ferror(filein.Get())) {
+            strError = "unable to read " + path.string();
+            return false;
+        }
+        info.hashSnapshot = hasher.GetHash();
+        if (info.hashSnapshot != hashExpected) {
+            strError = strprintf("snapshot hash %s does not match the expected %s", info.hashSnapshot.ToString(), hashExpected.ToString());
+            return false;
+        }
+    }
+    int64_t nTimeHashed = GetTimeMillis();
+
+    LOCK(cs_main);
+    if (fReindex || fImporting || chainActive.Height() != 0 || pcoinsTip->GetBestBlock() != chainActive.Tip()->GetBlockHash()) {
+        strError = "a snapshot can only be loaded into a fresh chainstate, with nothing but the genesis block connected";
+        return false;
+    }
+    if (fAddressIndex || fSpentIndex || fTimestampIndex) {
+        strError = "the address, spent and timestamp indexes cannot be built from a snapshot; disable them first";
+        return false;
+    }
+
+    // Check the header and the block index entries without applying them
+    try {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            throw std::runtime_error("unable to open " + path.string());
+        ReadTxOutSetHeader(filein, info);
+        uint256 hashPrev, hash;
+        for (int nHeight = 0; nHeight <= info.nHeight; nHeight++) {
+            CDiskBlockIndex diskindex;
+            ReadTxOutSetIndexEntry(filein, nHeight, hashPrev, hash, diskindex);
+        }
+        if (hash != info.hashBlock)
+            throw std::runtime_error("block index entries do not end at the base block");
+    } catch (const std::exception& e) {
+        strError = strprintf("invalid snapshot: %s", e.what());
+        return false;
+    }
+
+    // Until the load completes the coin database is neither empty nor at a
+    // block, so startup refuses to use it while this flag is set.
+    if (!pblocktree->WriteFlag("txoutsetloading", true) || !pblocktree->Sync()) {
+        strError = "unable to write to the block tree database";
+        return false;
+    }
+
+    try {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            throw std::runtime_error("unable to open " + path.string());
+        ReadTxOutSetHeader(filein, info);
+
+        // The block index up to the base block. The blocks themselves are not
+        // available, as if they had been pruned.
+        uint256 hashPrev, hash;
+        CBlockIndex* pindexPrev = chainActive.Genesis();
+        for (int nHeight = 0; nHeight <= info.nHeight; nHeight++) {
+            CDiskBlockIndex diskindex;
+            ReadTxOutSetIndexEntry(filein, nHeight, hashPrev, hash, diskindex);
+            if (nHeight == 0)
+                continue;
+            diskindex.nStatus = BLOCK_VALID_SCRIPTS;
+            diskindex.nFile = 0;
+            diskindex.nDataPos = 0;
+            diskindex.nUndoPos = 0;
+            CBlockIndex* pindex = InsertDiskBlockIndex(hash, diskindex);
+            pindex->nChainWork = pindexPrev->nChainWork + GetBlockProof(*pindex);
+            pindex->nChainTx = pindexPrev->nChainTx + pindex->nTx;
+            pindex->BuildSkip();
+            if (pindex->IsProofOfStake())
+                mapBlockIndexCold[pindex] = diskindex.GetCold();
+            setDirtyBlockIndex.insert(pindex);
+            pindexPrev = pindex;
+        }
+        int64_t nTimeIndex = GetTimeMillis();
+
+        // The unspent outputs, written to the coin database in large batches
+        CTxOutSetDigest digest;
+        digest.hashBlock = info.hashBlock;
+        while (true) {
+            // Stop at the end of the file, without a position that would not
+            // fit in a long on 32-bit builds
+            int ch = fgetc(filein.Get());
+            if (ch == EOF)
+                break;
+            ungetc(ch, filein.Get());
+            COutPoint outpoint;
+            Coin coin;
+            filein >> outpoint >> coin;
+            if (coin.IsSpent() || (int)coin.nHeight > info.nHeight)
+                throw std::runtime_error("invalid unspent output " + outpoint.ToString());
+            if (!coin.out.scriptPubKey.IsUnspendable())
+                digest.Add(outpoint, coin);
+            pcoinsTip->AddCoin(outpoint, std::move(coin), false);
+            info.nCoins++;
+            if (pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage && !pcoinsTip->Flush())
+                throw std::runtime_error("unable to write to the coin database");
+        }
+        pcoinsTip->SetTxOutSetDigest(digest);
+        pcoinsTip->SetBestBlock(info.hashBlock);
+        if (!pcoinsTip->Flush())
+            throw std::runtime_error("unable to write to the coin database");
+        int64_t nTimeCoins = GetTimeMillis();
+
+        chainActive.SetTip(pindexPrev);
+        setBlockIndexCandidates.insert(pindexPrev);
+        PruneBlockIndexCandidates();
+        if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexPrev->nChainWork)
+            pindexBestHeader = pindexPrev;
+        fHavePruned = true;
+        pblocktree->WriteFlag("prunedblockfiles", true);
+        nLocalServices &= ~NODE_NETWORK;
+        CValidationState state;
+        if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+            throw std::runtime_error("unable to write the block index");
+        if (!pblocktree->WriteFlag("txoutsetloading", false) || !pblocktree->Sync())
+            throw std::runtime_error("unable to write to the block tree database");
+
+        LogPrintf("Loaded UTXO snapshot at block %s (height %d), %u outputs: hash %dms, block index %dms, coins %dms\n",
+            info.hashBlock.ToString(), info.nHeight, info.nCoins, nTimeHashed - nStart, nTimeIndex - nTimeHashed, nTimeCoins - nTimeIndex);
+    } catch (const std::exception& e) {
+        // The block index and coin database have been partly updated
+        strError = strprintf("failed to load snapshot: %s", e.what());
+        return AbortNode(strError + ", restart with -reindex");
+    }
+    uiInterface.NotifyBlockTip(info.hashBlock);
+    return true;
+}
+
 bool InitBlockIndex()
 {
     LOCK(cs_main);
@@ -3954,10 +5269,17 @@ bool InitBlockIndex()
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", true);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
+    fSpentIndex = GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
+    pblocktree->WriteFlag("spentindex", fSpentIndex);
+    fTimestampIndex = GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
+    pblocktree->WriteFlag("timestampindex", fTimestampIndex);
     LogPrintf("Initializing databases...\n");
 
-    // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
-    if (!fReindex) {
+    // Only add the genesis block if not reindexing (in which case we reuse the one already on disk),
+    // and if the block index does not have it already (-reindex-chainstate keeps the block index)
+    if (!fReindex && !mapBlockIndex.count(Params().HashGenesisBlock())) {
         try {
             CBlock& block = const_cast<CBlock&>(Params().GenesisBlock());
             // Start new block file
@@ -3984,18 +5306,80 @@ bool InitBlockIndex()
 }
 
 
-bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
+namespace
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+/** Map of disk positions for blocks with unknown parent (only used for reindex) */
+std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
 
-    int nLoaded = 0;
+/** A block found while scanning a block file. */
+struct CImportedBlock {
+    CBlock block;
+    uint256 hash;
+    CDiskBlockPos pos;  //!< position of the block data; null for files outside the blocks directory
+    unsigned int nSize; //!< serialized size
+};
+
+/** Receives the blocks found by ScanBlockFile, in file order. */
+class CImportedBlockSink
+{
+public:
+    virtual ~CImportedBlockSink() {}
+    //! Take a block. Returning false stops the scan.
+    virtual bool Push(const boost::shared_ptr<CImportedBlock>& pblock) = 0;
+};
+
+/**
+ * Hash the headers of the scanned blocks in batch together, on the
+ * multi-lane Quark kernels, and push the blocks to sink in order. The batch
+ * is emptied. Returns false if the sink stopped the scan.
+ */
+bool HashAndPushBlocks(std::vector<boost::shared_ptr<CImportedBlock> >& batch, CImportedBlockSink& sink, int64_t& nTimeHash)
+{
+    if (batch.empty())
+        return true;
+
+    int64_t nTimeStart = GetTimeMicros();
+    const unsigned char* pin[QUARK_MAX_LANES];
+    unsigned char* pout[QUARK_MAX_LANES];
+    for (size_t i = 0; i < batch.size(); i++) {
+        // Same bytes as CBlockHeader::GetHash()
+        pin[i] = (const unsigned char*)BEGIN(batch[i]->block.nVersion);
+        pout[i] = batch[i]->hash.begin();
+    }
+    QuarkHashLanes(pin, (const unsigned char*)END(batch[0]->block.nNonce) - pin[0], pout, batch.size());
+    nTimeHash += GetTimeMicros() - nTimeStart;
+
+    std::vector<boost::shared_ptr<CImportedBlock> > blocks;
+    blocks.swap(batch);
+    for (size_t i = 0; i < blocks.size(); i++) {
+        try {
+            if (!sink.Push(blocks[i]))
+                return false;
+        } catch (const std::exception& e) {
+            LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+/**
+ * Scan a file laid out like blk?????.dat (message start, size, block) and
+ * push every block found to sink. Garbage between blocks is skipped. nFile
+ * is the number of the block file, or -1 for an external file. Blocks are
+ * pushed in groups of up to QUARK_MAX_LANES, whose headers are hashed
+ * together. Returns the number of bytes scanned.
+ */
+uint64_t ScanBlockFile(FILE* fileIn, int nFile, CImportedBlockSink& sink, int64_t& nTimeHash)
+{
+    uint64_t nRewind = 0;
+    std::vector<boost::shared_ptr<CImportedBlock> > batch;
+    batch.reserve(QUARK_MAX_LANES);
+    bool fContinue = true;
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE, MAX_BLOCK_SIZE + 8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        nRewind = blkdat.GetPos();
+        while (fContinue && !blkdat.eof()) {
             boost::this_thread::interruption_point();
 
             blkdat.SetPos(nRewind);
@@ -4021,66 +5405,306 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
             try {
                 // read block
                 uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
+                boost::shared_ptr<CImportedBlock> pimported(new CImportedBlock());
+                if (nFile >= 0)
+                    pimported->pos = CDiskBlockPos(nFile, nBlockPos);
+                pimported->nSize = nSize;
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
+                blkdat >> pimported->block;
                 nRewind = blkdat.GetPos();
 
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                        block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
+                batch.push_back(pimported);
+                if (batch.size() == QUARK_MAX_LANES)
+                    fContinue = HashAndPushBlocks(batch, sink, nTimeHash);
+            } catch (const std::exception& e) {
+                LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+        if (fContinue)
+            HashAndPushBlocks(batch, sink, nTimeHash);
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+    return nRewind;
+}
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+/**
+ * Process a block read from a block file, unless it is known already, and
+ * then any blocks seen earlier that were waiting for it as their parent.
+ * Returns false if processing hit an error that should stop the import.
+ */
+bool ProcessImportedBlock(CImportedBlock& imported, int& nLoaded)
+{
+    CBlock& block = imported.block;
+    const uint256& hash = imported.hash;
+    CDiskBlockPos* dbp = imported.pos.IsNull() ? NULL : &imported.pos;
+
+    // detect out of order blocks, and store them for later
+    if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+            block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second)) {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, NULL, &block, &it->second)) {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                    }
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        CValidationState state;
+        if (ProcessNewBlock(state, NULL, &block, dbp))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Recursively process earlier encountered successors of this block
+    deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            CBlock blockChild;
+            if (ReadBlockFromDisk(blockChild, it->second)) {
+                LogPrintf("%s: Processing out of order child %s of %s\n", __func__, blockChild.GetHash().ToString(),
+                    head.ToString());
+                CValidationState dummy;
+                if (ProcessNewBlock(dummy, NULL, &blockChild, &it->second)) {
+                    nLoaded++;
+                    queue.push_back(blockChild.GetHash());
                 }
-            } catch (std::exception& e) {
-                LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+        }
+    }
+    return true;
+}
+
+/** Processes blocks as soon as they are scanned, on the scanning thread. */
+class CDirectImportSink : public CImportedBlockSink
+{
+public:
+    int nLoaded;
+
+    CDirectImportSink() : nLoaded(0) {}
+
+    bool Push(const boost::shared_ptr<CImportedBlock>& pblock)
+    {
+        return ProcessImportedBlock(*pblock, nLoaded);
+    }
+};
+} // anon namespace
+
+bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    CDirectImportSink sink;
+    int64_t nTimeHash = 0;
+    ScanBlockFile(fileIn, dbp ? (int)dbp->nFile : -1, sink, nTimeHash);
+    if (sink.nLoaded > 0)
+        LogPrintf("Loaded %i blocks from external file in %dms\n", sink.nLoaded, GetTimeMillis() - nStart);
+    return sink.nLoaded > 0;
+}
+
+namespace
+{
+/** Bytes of scanned blocks a reader may queue for one file before it waits for the importing thread */
+static const uint64_t MAX_QUEUED_IMPORT_BYTES = 32 * 1024 * 1024;
+
+/**
+ * The -reindex pipeline. Reader threads each take the next blk?????.dat file,
+ * scan it, deserialize its blocks (which also hashes their transactions) and
+ * hash their headers QUARK_MAX_LANES at a time. Scanned blocks are queued per file, and the
+ * importing thread takes them file by file, in the order they were written,
+ * so blocks reach ProcessNewBlock in the same order as with a single reader.
+ * Each queue is bounded, so readers that get ahead wait rather than holding
+ * whole files in memory.
+ */
+class CBlockFileImporter
+{
+private:
+    struct CFileQueue {
+        std::deque<boost::shared_ptr<CImportedBlock> > blocks;
+        uint64_t nQueuedBytes;
+        bool fDone;    //!< the reader has scanned the whole file
+        bool fMissing; //!< there is no such file
+
+        CFileQueue() : nQueuedBytes(0), fDone(false), fMissing(false) {}
+    };
+
+    CWaitableCriticalSection mutex;
+    CConditionVariable condQueued;   //!< a reader queued a block or finished a file
+    CConditionVariable condConsumed; //!< the importing thread took a block
+    std::map<int, CFileQueue> mapQueues;
+    int nNextFile; //!< next file for a reader to take
+    bool fNoMoreFiles;
+    bool fStop;
+
+    /** Queues the blocks of one file; runs on the reader thread. */
+    class CQueueSink : public CImportedBlockSink
+    {
+    public:
+        CBlockFileImporter& importer;
+        int nFile;
+        CQueueSink(CBlockFileImporter& importerIn, int nFileIn) : importer(importerIn), nFile(nFileIn) {}
+        bool Push(const boost::shared_ptr<CImportedBlock>& pblock) { return importer.Push(nFile, pblock); }
+    };
+
+    bool Push(int nFile, const boost::shared_ptr<CImportedBlock>& pblock)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CFileQueue& queue = mapQueues[nFile];
+        while (!fStop && queue.nQueuedBytes > 0 && queue.nQueuedBytes + pblock->nSize > MAX_QUEUED_IMPORT_BYTES)
+            condConsumed.wait(lock);
+        if (fStop)
+            return false;
+        queue.blocks.push_back(pblock);
+        queue.nQueuedBytes += pblock->nSize;
+        condQueued.notify_all();
+        return true;
+    }
+
+public:
+    //! Reader statistics, summed over all reader threads
+    uint64_t nBytesScanned;
+    int64_t nTimeScan; //!< reading and deserializing, excluding waits for the importing thread
+    int64_t nTimeHash;
+
+    CBlockFileImporter() : nNextFile(0), fNoMoreFiles(false), fStop(false), nBytesScanned(0), nTimeScan(0), nTimeHash(0) {}
+
+    void ReaderThread()
+    {
+        RenameThread("unitedstatedollarcrypto-blkread");
+        while (true) {
+            int nFile;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (fStop || fNoMoreFiles)
+                    return;
+                nFile = nNextFile++;
+                mapQueues[nFile];
+            }
+
+            CDiskBlockPos pos(nFile, 0);
+            FILE* file = NULL;
+            if (boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
+                file = OpenBlockFile(pos, true); // An error is logged in OpenBlockFile
+            if (!file) {
+                // No block files left to reindex
+                boost::unique_lock<boost::mutex> lock(mutex);
+                mapQueues[nFile].fMissing = true;
+                fNoMoreFiles = true;
+                condQueued.notify_all();
+                return;
+            }
+
+            CQueueSink sink(*this, nFile);
+            int64_t nTimeHashFile = 0;
+            int64_t nTimeStart = GetTimeMicros();
+            uint64_t nBytes = ScanBlockFile(file, nFile, sink, nTimeHashFile);
+            int64_t nTimeTotal = GetTimeMicros() - nTimeStart;
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            mapQueues[nFile].fDone = true;
+            nBytesScanned += nBytes;
+            nTimeScan += nTimeTotal - nTimeHashFile;
+            nTimeHash += nTimeHashFile;
+            condQueued.notify_all();
         }
-    } catch (std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
     }
-    if (nLoaded > 0)
-        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+
+    //! Wait until it is known whether block file nFile exists.
+    bool HaveFile(int nFile)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fStop && (mapQueues.count(nFile) == 0 || (mapQueues[nFile].blocks.empty() && !mapQueues[nFile].fDone && !mapQueues[nFile].fMissing)))
+            condQueued.wait(lock);
+        return !fStop && !mapQueues[nFile].fMissing;
+    }
+
+    //! Take the next block of file nFile. Returns false once the file has been read completely.
+    bool Next(int nFile, boost::shared_ptr<CImportedBlock>& pblock)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CFileQueue& queue = mapQueues[nFile];
+        while (!fStop && queue.blocks.empty() && !queue.fDone)
+            condQueued.wait(lock);
+        if (fStop || queue.blocks.empty()) {
+            mapQueues.erase(nFile);
+            return false;
+        }
+        pblock = queue.blocks.front();
+        queue.blocks.pop_front();
+        queue.nQueuedBytes -= pblock->nSize;
+        condConsumed.notify_all();
+        return true;
+    }
+
+    void Stop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+        condQueued.notify_all();
+        condConsumed.notify_all();
+    }
+};
+} // anon namespace
+
+bool ReindexBlockFiles(int nThreads)
+{
+    int64_t nStart = GetTimeMicros();
+    CBlockFileImporter importer;
+    boost::thread_group readers;
+    for (int i = 0; i < std::max(nThreads, 1); i++)
+        readers.create_thread(boost::bind(&CBlockFileImporter::ReaderThread, &importer));
+
+    int nLoaded = 0;
+    uint64_t nBytesProcessed = 0;
+    int64_t nTimeProcess = 0;
+    try {
+        bool fContinue = true;
+        for (int nFile = 0; fContinue && importer.HaveFile(nFile); nFile++) {
+            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+            boost::shared_ptr<CImportedBlock> pblock;
+            while (importer.Next(nFile, pblock)) {
+                boost::this_thread::interruption_point();
+                int64_t nTimeStart = GetTimeMicros();
+                try {
+                    fContinue = ProcessImportedBlock(*pblock, nLoaded);
+                } catch (const std::exception& e) {
+                    LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
+                }
+                nTimeProcess += GetTimeMicros() - nTimeStart;
+                nBytesProcessed += pblock->nSize;
+                if (!fContinue)
+                    break;
+            }
+        }
+    } catch (const boost::thread_interrupted&) {
+        importer.Stop();
+        readers.interrupt_all();
+        readers.join_all();
+        throw;
+    }
+    importer.Stop();
+    readers.join_all();
+
+    int64_t nTimeTotal = GetTimeMicros() - nStart;
+    LogPrintf("Reindexed %i blocks (%.2fMB) in %.2fs with %d reader threads\n", nLoaded, nBytesProcessed * 0.000001, nTimeTotal * 0.000001, std::max(nThreads, 1));
+    LogPrint("bench", "    - Scan and deserialize: %.2fMB in %.2fs thread time (%.2fMB/s per thread)\n",
+        importer.nBytesScanned * 0.000001, importer.nTimeScan * 0.000001, importer.nTimeScan ? importer.nBytesScanned / (double)importer.nTimeScan : 0.0);
+    LogPrint("bench", "    - Hash headers: %.2fMB in %.2fs thread time (%.2fMB/s per thread)\n",
+        importer.nBytesScanned * 0.000001, importer.nTimeHash * 0.000001, importer.nTimeHash ? importer.nBytesScanned / (double)importer.nTimeHash : 0.0);
+    LogPrint("bench", "    - Process blocks: %.2fMB in %.2fs (%.2fMB/s)\n",
+        nBytesProcessed * 0.000001, nTimeProcess * 0.000001, nTimeProcess ? nBytesProcessed / (double)nTimeProcess : 0.0);
+    LogPrint("bench", "    - Overall: %.2fMB/s\n", nTimeTotal ? nBytesProcessed / (double)nTimeTotal : 0.0);
     return nLoaded > 0;
 }
 
@@ -4095,8 +5719,9 @@ void static CheckBlockIndex()
     // During a reindex, we read the genesis block and call CheckBlockIndex before ActivateBestChain,
     // so we have the genesis block in mapBlockIndex but no active chain.  (A few of the tests when
     // iterating the block tree require that chainActive has been initialized.)
+    // With -reindex-chainstate the whole block index is loaded before the chain is connected again.
     if (chainActive.Height() < 0) {
-        assert(mapBlockIndex.size() <= 1);
+        assert(mapBlockIndex.size() <= 1 || GetBoolArg("-reindex-chainstate", false));
         return;
     }
 
@@ -4120,6 +5745,7 @@ void static CheckBlockIndex()
     int nHeight = 0;
     CBlockIndex* pindexFirstInvalid = NULL;         // Oldest ancestor of pindex which is invalid.
     CBlockIndex* pindexFirstMissing = NULL;         // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
+    CBlockIndex* pindexFirstNeverProcessed = NULL;  // Oldest ancestor of pindex for which nTx == 0.
     CBlockIndex* pindexFirstNotTreeValid = NULL;    // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = NULL;   // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
@@ -4127,6 +5753,7 @@ void static CheckBlockIndex()
         nNodes++;
         if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
         if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
@@ -4137,12 +5764,21 @@ void static CheckBlockIndex()
             assert(pindex->GetBlockHash() == Params().HashGenesisBlock()); // Genesis block's hash must match.
             assert(pindex == chainActive.Genesis());                       // The current active chain's genesis block must be this block.
         }
-        // HAVE_DATA is equivalent to VALID_TRANSACTIONS and equivalent to nTx > 0 (we stored the number of transactions in the block)
-        assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
-        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0));
+        // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
+        // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
+        if (!fHavePruned) {
+            // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
+            assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+            assert(pindexFirstMissing == pindexFirstNeverProcessed);
+        } else {
+            // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
+            if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
+        }
+        if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
+        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0); // nSequenceId can't be set for blocks that aren't linked
-        // All parents having data is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstMissing != NULL) == (pindex->nChainTx == 0));                                             // nChainTx == 0 is used to signal that all parent block's transaction data is available.
+        // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
+        assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0));                                      // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
         assert(pindex->nHeight == nHeight);                                                                          // nHeight must be consistent.
         assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork);                            // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight)));                                // The pskip pointer must point back for all but the first 2 blocks.
@@ -4154,11 +5790,20 @@ void static CheckBlockIndex()
             // Checks for not-invalid blocks.
             assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
         }
-        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstMissing == NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block sorts at least as good as the current tip and is valid, it must be in setBlockIndexCandidates.
-                assert(setBlockIndexCandidates.count(pindex));
+        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstNeverProcessed == NULL) {
+            if (pindexFirstInvalid == NULL) {
+                // If this block sorts at least as good as the current tip and
+                // is valid and we have all data for its parents, it must be in
+                // setBlockIndexCandidates.  chainActive.Tip() must also be there
+                // even if some data has been pruned.
+                if (pindexFirstMissing == NULL || pindex == chainActive.Tip()) {
+                    assert(setBlockIndexCandidates.count(pindex));
+                }
+                // If some parent is missing, then it could be that this block was in
+                // setBlockIndexCandidates but had to be removed because of the missing data.
+                // In this case it must be in mapBlocksUnlinked -- see test below.
             }
-        } else { // If this block sorts worse than the current tip, it cannot be in setBlockIndexCandidates.
+        } else { // If this block sorts worse than the current tip or some ancestor's block has never been seen, it cannot be in setBlockIndexCandidates.
             assert(setBlockIndexCandidates.count(pindex) == 0);
         }
         // Check whether this block is in mapBlocksUnlinked.
@@ -4172,12 +5817,28 @@ void static CheckBlockIndex()
             }
             rangeUnlinked.first++;
         }
-        if (pindex->pprev && pindex->nStatus & BLOCK_HAVE_DATA && pindexFirstMissing != NULL) {
-            if (pindexFirstInvalid == NULL) { // If this block has block data available, some parent doesn't, and has no invalid parents, it must be in mapBlocksUnlinked.
-                assert(foundInUnlinked);
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed != NULL && pindexFirstInvalid == NULL) {
+            // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
+            assert(foundInUnlinked);
+        }
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA)) assert(!foundInUnlinked); // Can't be in mapBlocksUnlinked if we don't HAVE_DATA
+        if (pindexFirstMissing == NULL) assert(!foundInUnlinked);          // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) {
+            // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
+            assert(fHavePruned); // We must have pruned.
+            // This block may have entered mapBlocksUnlinked if:
+            //  - it has a descendant that at some point had more work than the
+            //    tip, and
+            //  - we tried switching to that descendant but were missing
+            //    data for some intermediate block between chainActive and the
+            //    tip.
+            // So if this block is itself better than chainActive.Tip() and it wasn't in
+            // setBlockIndexCandidates, then it must be in mapBlocksUnlinked.
+            if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && setBlockIndexCandidates.count(pindex) == 0) {
+                if (pindexFirstInvalid == NULL) {
+                    assert(foundInUnlinked);
+                }
             }
-        } else { // If this block does not have block data available, or all parents do, it cannot be in mapBlocksUnlinked.
-            assert(!foundInUnlinked);
         }
         // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
         // End: actual consistency checks.
@@ -4197,6 +5858,7 @@ void static CheckBlockIndex()
             // If pindex was the first with a certain property, unset the corresponding variable.
             if (pindex == pindexFirstInvalid) pindexFirstInvalid = NULL;
             if (pindex == pindexFirstMissing) pindexFirstMissing = NULL;
+            if (pindex == pindexFirstNeverProcessed) pindexFirstNeverProcessed = NULL;
             if (pindex == pindexFirstNotTreeValid) pindexFirstNotTreeValid = NULL;
             if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = NULL;
             if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = NULL;
@@ -4292,7 +5954,8 @@ bool static AlreadyHave(const CInv& inv)
         bool txInMap = false;
         txInMap = mempool.exists(inv.hash);
         return txInMap || mapOrphanTransactions.count(inv.hash) ||
-               pcoinsTip->HaveCoins(inv.hash);
+               pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
+               pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
     }
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
@@ -4382,16 +6045,21 @@ void static ProcessGetData(CNode* pfrom)
                         }
                     }
                 }
-                // Don't send not-validated blocks
+                // Pruned nodes may have deleted the block, so check whether
+                // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    if (inv.type == MSG_BLOCK) {
+                        // Blocks are stored in network format, so their bytes go out as they are
+                        std::vector<unsigned char> vchBlock;
+                        if (!ReadRawBlockFromDisk(vchBlock, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("block", CFlatData(vchBlock));
+                    } else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -5733,7 +7401,7 @@ bool CBlockUndo::WriteToDisk(CDiskBlockPos& pos, const uint256& hashBlock)
 bool CBlockUndo::ReadFromDisk(const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+    CBlockFileReader filein(pos, "rev", SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
 
@@ -5769,10 +7437,8 @@ public:
     ~CMainCleanup()
     {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockindexarena.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
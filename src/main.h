@@ -14,7 +14,9 @@
 #endif
 
 #include "bignum.h"
+#include "addressindex.h"
 #include "amount.h"
+#include "blockstats.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "coins.h"
@@ -25,8 +27,10 @@
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "spentindex.h"
 #include "sync.h"
 #include "tinyformat.h"
+#include "timestampindex.h"
 #include "txmempool.h"
 #include "uint256.h"
 #include "undo.h"
@@ -42,6 +46,7 @@
 #include <utility>
 #include <vector>
 
+#include <boost/filesystem/path.hpp>
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
@@ -60,7 +65,9 @@ struct CNodeStateStats;
 static const unsigned int DEFAULT_BLOCK_MAX_SIZE = 750000;
 static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 /** Default for -blockprioritysize, maximum space for zero/low-fee transactions **/
-static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 50000;
+static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 0;
+/** Size of the free transaction area that relay policy assumes miners keep **/
+static const unsigned int FREE_TX_AREA_SIZE = 50000;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
 /** The maximum size for transactions we're willing to relay/mine */
@@ -71,6 +78,20 @@ static const unsigned int MAX_BLOCK_SIGOPS = MAX_BLOCK_SIZE / 50;
 static const unsigned int MAX_P2SH_SIGOPS = 15;
 /** The maximum number of sigops we're willing to relay/mine in a single tx */
 static const unsigned int MAX_TX_SIGOPS = MAX_BLOCK_SIGOPS / 5;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** The maximum size of a blk?????.dat file (since 0.8) */
@@ -87,6 +108,14 @@ static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads reading block inputs from the coins database ahead of ConnectBlock */
+static const int MAX_PREFETCH_THREADS = 16;
+/** -parprefetch default (number of coins prefetch threads including the validation thread, 0 or 1 = disabled) */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** Maximum number of threads reading block files during -reindex */
+static const int MAX_REINDEX_THREADS = 16;
+/** -reindexthreads default (number of threads reading block files during -reindex) */
+static const int DEFAULT_REINDEX_THREADS = 2;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -101,6 +130,10 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
+/** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned.
+ *  This covers the undo data needed for reorganisations and the window the stake modifier
+ *  and the coinstake maturity rules look back over. */
+static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 
@@ -126,6 +159,7 @@ extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
+extern CBlockIndexArena blockindexarena;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern const std::string strMessageMagic;
@@ -135,10 +169,15 @@ extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern int nPrefetchThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fSpentIndex;
+extern bool fTimestampIndex;
+extern bool fBlockStatsIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 
@@ -153,6 +192,8 @@ extern int64_t nReserveBalance;
 extern std::map<uint256, int64_t> mapRejectedBlocks;
 extern std::map<unsigned int, unsigned int> mapHashedBlocks;
 extern std::set<std::pair<COutPoint, unsigned int> > setStakeSeen;
+/** Stake fields of proof-of-stake entries that have not been written to the block tree yet */
+extern std::map<const CBlockIndex*, CBlockIndexCold> mapBlockIndexCold;
 
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex* pindexBestHeader;
@@ -160,6 +201,26 @@ extern CBlockIndex* pindexBestHeader;
 /** Minimum disk space required - used in CheckDiskSpace() */
 static const uint64_t nMinDiskSpace = 52428800;
 
+/** Pruning-related variables and constants */
+/** True if any block files have ever been pruned. */
+extern bool fHavePruned;
+/** True if we're running in -prune mode. */
+extern bool fPruneMode;
+/** Number of MiB of block files that we're trying to stay below. */
+extern uint64_t nPruneTarget;
+/** Require that user allocate at least 550MB for block & undo files (blk???.dat and rev???.dat)
+ *  At 1MB per block, 288 blocks = 288MB.
+ *  Add 15% for Undo data = 331MB
+ *  Add 20% for Orphan block rate = 397MB
+ *  We want the low water mark after pruning to be at least 397 MB and since we prune in
+ *  full block file chunks, we need the high water mark which triggers the prune to be
+ *  one 128MB block file + added 15% undo data = 147MB greater for a total of 545MB
+ *  Setting the target to > than 550MB will make it likely we can respect the target. */
+static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 550 * 1024 * 1024;
+
+/** Version of the UTXO snapshot files written by dumptxoutset */
+static const int TXOUTSET_SNAPSHOT_VERSION = 1;
+
 /** Register a wallet to receive updates from core */
 void RegisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister a wallet from core */
@@ -196,6 +257,8 @@ FILE* OpenUndoFile(const CDiskBlockPos& pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos& pos, const char* prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp = NULL);
+/** Import the blk?????.dat files for -reindex, reading them with nThreads threads */
+bool ReindexBlockFiles(int nThreads);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
@@ -215,6 +278,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the coins prefetch thread */
+void ThreadCoinsPrefetch();
 
 // ***TODO*** probably not the right place for these 2
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -226,6 +291,15 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(std::string strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransaction& tx, uint256& hashBlock, bool fAllowSlow = false);
+/**
+ * Find an output spent by one of the active chain blocks above pindexFork, as
+ * it was before the spend. The outputs spent within GetPruneMargin() of the
+ * tip are kept in memory, so this never reads block files and still works in
+ * prune mode.
+ */
+bool GetCoinSpentAfterFork(const COutPoint& outpoint, const CBlockIndex* pindexFork, Coin& coin);
+/** Fill the outputs spent within GetPruneMargin() of the tip from the undo data, at startup */
+bool LoadRecentlySpentCoins();
 /** Find the best known block, and make it the tip of the block chain */
 
 bool DisconnectBlocksAndReprocess(int blocks);
@@ -237,9 +311,37 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
 
 bool ActivateBestChain(CValidationState& state, CBlock* pblock = NULL, bool fAlreadyChecked = false);
 CAmount GetBlockValue(int nHeight);
+/** Block value at nHeight given the money supply before it, independent of the active chain */
+CAmount GetBlockValue(int nHeight, CAmount nMoneySupply);
 
 /** Create a new block index entry for a given block hash */
 CBlockIndex* InsertBlockIndex(uint256 hash);
+/** Look up the fields of a block index entry kept out of memory, from the entries not yet written or the block tree */
+bool ReadBlockIndexCold(const CBlockIndex* pindex, CBlockIndexCold& cold);
+
+struct CBlockIndexMemoryUsage {
+    size_t nEntries;
+    size_t nArenaBytes;  //!< the entries themselves
+    size_t nMapBytes;    //!< mapBlockIndex
+    size_t nColdEntries; //!< entries whose cold fields are still in memory
+    size_t nColdBytes;
+};
+
+/** Memory used by the block index */
+CBlockIndexMemoryUsage GetBlockIndexMemoryUsage();
+struct CTxOutSetSnapshotInfo {
+    uint256 hashBlock; //!< block the snapshot was taken at
+    int nHeight;
+    uint64_t nCoins;
+    uint256 hashSnapshot; //!< double-SHA256 of the whole file
+
+    CTxOutSetSnapshotInfo() : nHeight(0), nCoins(0) {}
+};
+
+/** Write the unspent outputs at the tip, and the block index up to it, to a snapshot file */
+bool DumpTxOutSet(const boost::filesystem::path& path, CTxOutSetSnapshotInfo& info, std::string& strError);
+/** Bootstrap a fresh chainstate from a snapshot file, if its hash matches hashExpected */
+bool LoadTxOutSet(const boost::filesystem::path& path, const uint256& hashExpected, CTxOutSetSnapshotInfo& info, std::string& strError);
 /** Abort with a message */
 bool AbortNode(const std::string& msg, const std::string& userMessage = "");
 /** Get statistics from node state */
@@ -248,11 +350,35 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Prune block files and flush state to disk. */
+void PruneAndFlush();
+/** Calculate the amount of disk space the block & undo files currently use */
+uint64_t CalculateCurrentUsage();
+/**
+ * Number of blocks below the tip whose files are never pruned: at least
+ * MIN_BLOCKS_TO_KEEP, the deepest reorganisation we accept (which needs the
+ * undo data) and coinbase maturity. The outputs spent this close to the tip
+ * are also kept in memory, see GetCoinSpentAfterFork.
+ */
+unsigned int GetPruneMargin();
+/**
+ *  Actually unlink the specified files
+ */
+void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool ignoreFees = false);
 
+/** As AcceptToMemoryPool, but with the time the transaction entered the pool given, e.g. when reloading it */
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee = false, bool ignoreFees = false);
+
+/** Dump the mempool to disk, as mempool.dat in the data directory */
+void DumpMempool();
+
+/** Load the mempool from disk, checking the scripts of its transactions in parallel */
+bool LoadMempool();
+
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false);
 
 int GetInputAge(CTxIn& vin);
@@ -342,6 +468,12 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
  */
 bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck>* pvChecks = NULL);
 
+/** Size the script execution cache from -maxsigcachesize. */
+void InitScriptExecutionCache();
+
+/** Script verification flags for the transactions of the block at pindex. */
+unsigned int GetBlockScriptFlags(const CBlockIndex* pindex);
+
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
 
@@ -399,8 +531,8 @@ private:
 
 public:
     CScriptCheck() : ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) : scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-                                                                                                                                ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) : scriptPubKey(outIn.scriptPubKey),
+                                                                                                                             ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
 
     bool operator()();
 
@@ -417,11 +549,42 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing one read of a block input from the coins database,
+ * performed by a prefetch thread. The result is stored in *pcoin, which is
+ * left spent if the output does not exist.
+ */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsView* pview;
+    COutPoint prevout;
+    Coin* pcoin;
+
+public:
+    CCoinsPrefetch() : pview(NULL), pcoin(NULL) {}
+    CCoinsPrefetch(const CCoinsView* viewIn, const COutPoint& prevoutIn, Coin* pcoinIn) : pview(viewIn), prevout(prevoutIn), pcoin(pcoinIn) {}
+
+    bool operator()();
+
+    void swap(CCoinsPrefetch& check)
+    {
+        std::swap(pview, check.pview);
+        std::swap(prevout, check.prevout);
+        std::swap(pcoin, check.pcoin);
+    }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read the serialized bytes of a block without deserializing it, e.g. to relay it */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex);
+/** Get the statistics of a block, from the block stats index or else computed from its block and undo data. Does not need cs_main. */
+bool GetBlockStats(const CBlockIndex* pindex, CBlockStats& stats);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -429,7 +592,9 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
+ *  of problems. Note that in any case, coins may be modified. The address and spent indexes
+ *  are only updated when pfClean is not provided, as that is used to check blocks without
+ *  disconnecting them for good. */
 bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
 
 /** Reprocess a number of blocks to try and get on the correct chain again **/
@@ -439,7 +604,7 @@ bool DisconnectBlocksAndReprocess(int blocks);
 bool IsProofOfWorkPeriod(int nHeight);
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck, bool fAlreadyChecked = false);
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck, bool fAlreadyChecked = false, CBlockUndo* pblockundo = NULL);
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
@@ -14,6 +14,7 @@
 #include "masternodeconfig.h"
 #include "masternode.h"
 #include "masternodeman.h"
+#include "txdb.h"
 #include "util.h"
 #include "wallet.h"
 
@@ -38,11 +39,33 @@ int GetBudgetPaymentCycleBlocks()
     return 144; //ten times per day
 }
 
+bool IsBudgetCollateralTx(const CTransaction& tx)
+{
+    if (tx.vout.empty() || tx.nLockTime != 0)
+        return false;
+    BOOST_FOREACH (const CTxOut& o, tx.vout) {
+        // OP_RETURN followed by the 32 byte proposal or budget hash
+        if (o.scriptPubKey.size() == 34 && o.scriptPubKey[0] == OP_RETURN && o.scriptPubKey[1] == 32 &&
+            o.nValue >= std::min(PROPOSAL_FEE_TX, BUDGET_FEE_TX))
+            return true;
+    }
+    return false;
+}
+
+// Look up a collateral transaction, from the block database if its block has been pruned
+static bool GetBudgetCollateral(const uint256& txid, CTransaction& tx, uint256& hashBlock)
+{
+    if (GetTransaction(txid, tx, hashBlock, true))
+        return true;
+    LOCK(cs_main);
+    return pblocktree->ReadBudgetCollateral(txid, tx, hashBlock);
+}
+
 bool IsBudgetCollateralValid(uint256 nTxCollateralHash, uint256 nExpectedHash, std::string& strError, int64_t& nTime, int& nConf)
 {
     CTransaction txCollateral;
     uint256 nBlockHash;
-    if (!GetTransaction(nTxCollateralHash, txCollateral, nBlockHash, true)) {
+    if (!GetBudgetCollateral(nTxCollateralHash, txCollateral, nBlockHash)) {
         strError = strprintf("Can't find collateral tx %s", txCollateral.ToString());
         LogPrint("masternode","CBudgetProposalBroadcast::IsBudgetCollateralValid - %s\n", strError);
         return false;
@@ -204,7 +227,7 @@ void CBudgetManager::SubmitFinalBudget()
     CTransaction txCollateral;
     uint256 nBlockHash;
 
-    if (!GetTransaction(txidCollateral, txCollateral, nBlockHash, true)) {
+    if (!GetBudgetCollateral(txidCollateral, txCollateral, nBlockHash)) {
         LogPrint("masternode","CBudgetManager::SubmitFinalBudget - Can't find collateral tx %s", txidCollateral.ToString());
         return;
     }
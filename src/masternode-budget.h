@@ -44,6 +44,8 @@ void DumpBudgets();
 // Define amount of blocks in budget payment cycle
 int GetBudgetPaymentCycleBlocks();
 
+//Whether the transaction may be the collateral of a budget proposal/finalized budget
+bool IsBudgetCollateralTx(const CTransaction& tx);
 //Check the collateral transaction for the budget proposal/finalized budget
 bool IsBudgetCollateralValid(uint256 nTxCollateralHash, uint256 nExpectedHash, std::string& strError, int64_t& nTime, int& nConf);
 
@@ -52,6 +52,15 @@ bool CMasternodeSigner::IsVinAssociatedWithPubkey(CTxIn& vin, CPubKey& pubkey)
     CScript payee2;
     payee2 = GetScriptForDestination(pubkey.GetID());
 
+    // The collateral is normally unspent, in which case the coins view has it
+    // without reading the transaction from the block files.
+    {
+        LOCK(cs_main);
+        const Coin& coin = pcoinsTip->AccessCoin(vin.prevout);
+        if (!coin.IsSpent() && coin.out.nValue == MASTERNODE_COLLATERAL * COIN && coin.out.scriptPubKey == payee2)
+            return true;
+    }
+
     CTransaction txVin;
     uint256 hash;
     if (GetTransaction(vin.prevout.hash, txVin, hash, true)) {
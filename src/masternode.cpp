@@ -620,13 +620,16 @@ bool CMasternodeBroadcast::CheckInputsAndAdd(int& nDoS)
 
     // verify that sig time is legit in past
     // should be at least not earlier than block when 1000 USD tx got MASTERNODE_MIN_CONFIRMATIONS
-    uint256 hashBlock = 0;
-    CTransaction tx2;
-    GetTransaction(vin.prevout.hash, tx2, hashBlock, true);
-    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
-    if (mi != mapBlockIndex.end() && (*mi).second) {
-        CBlockIndex* pMNIndex = (*mi).second;                                                        // block for 1000 PIVX tx -> 1 confirmation
-        CBlockIndex* pConfIndex = chainActive[pMNIndex->nHeight + MASTERNODE_MIN_CONFIRMATIONS - 1]; // block where tx got MASTERNODE_MIN_CONFIRMATIONS
+    // The collateral is unspent, so its height comes from the coins view rather
+    // than from reading the transaction out of a (possibly pruned) block file.
+    CBlockIndex* pConfIndex = NULL; // block where tx got MASTERNODE_MIN_CONFIRMATIONS
+    {
+        LOCK(cs_main);
+        const Coin& coin = pcoinsTip->AccessCoin(vin.prevout);
+        if (!coin.IsSpent())
+            pConfIndex = chainActive[coin.nHeight + MASTERNODE_MIN_CONFIRMATIONS - 1];
+    }
+    if (pConfIndex) {
         if (pConfIndex->GetBlockTime() > sigTime) {
             LogPrint("masternode","mnb - Bad sigTime %d for Masternode %s (%i conf block is at %d)\n",
                 sigTime, vin.prevout.hash.ToString(), MASTERNODE_MIN_CONFIRMATIONS, pConfIndex->GetBlockTime());
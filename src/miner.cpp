@@ -17,6 +17,7 @@
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "timedata.h"
+#include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #ifdef ENABLE_WALLET
@@ -25,8 +26,12 @@
 #include "masternode-payments.h"
 #include "spork.h"
 
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index_container.hpp>
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
+
+#include <limits>
 
 using namespace std;
 
@@ -37,51 +42,375 @@ using namespace std;
 
 //
 // Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// transactions in the memory pool. The pool tracks, for every entry, the size
+// and fees of the entry together with its unconfirmed ancestors, and keeps its
+// entries sorted by that ancestor fee rate. CreateNewBlock walks that index
+// and adds each entry as a package with its ancestors. Once a transaction is
+// in the block, its descendants are scored without it; they are kept with
+// their updated package size and fees in a CTxMemPoolModifiedEntry.
 //
-class COrphan
+struct CTxMemPoolModifiedEntry {
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+
+    explicit CTxMemPoolModifiedEntry(CTxMemPool::txiter entry) : iter(entry),
+                                                                  nSizeWithAncestors(entry->GetSizeWithAncestors()),
+                                                                  nModFeesWithAncestors(entry->GetModFeesWithAncestors()) {}
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator()(const CTxMemPoolModifiedEntry& entry) const
+    {
+        return entry.iter;
+    }
+};
+
+//! Highest ancestor fee rate first, as CompareTxMemPoolEntryByAncestorFee
+class CompareModifiedEntry
 {
 public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+    bool operator()(const CTxMemPoolModifiedEntry& a, const CTxMemPoolModifiedEntry& b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2)
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        return f1 > f2;
+    }
+};
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CTxMemPool::CompareIteratorByHash>,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry> > >
+    indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion {
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator()(CTxMemPoolModifiedEntry& e)
     {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
     }
+
+    CTxMemPool::txiter iter;
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
-int64_t nLastCoinStakeSearchInterval = 0;
+//! The block being assembled by CreateNewBlock
+struct CBlockAssembly {
+    CBlockTemplate* pblocktemplate;
+    CCoinsViewCache& view;
+    int nHeight;
+    unsigned int nBlockMaxSize;
+    bool fPrintPriority;
+
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+    CTxMemPool::setEntries inBlock;
+    //! Entries whose ancestors are partly in the block, with the remaining package size and fees
+    indexed_modified_transaction_set mapModifiedTx;
+
+    CBlockAssembly(CBlockTemplate* pblocktemplateIn, CCoinsViewCache& viewIn, int nHeightIn, unsigned int nBlockMaxSizeIn)
+        : pblocktemplate(pblocktemplateIn), view(viewIn), nHeight(nHeightIn), nBlockMaxSize(nBlockMaxSizeIn),
+          nBlockSize(1000), nBlockTx(0), nBlockSigOps(100), nFees(0)
+    {
+        fPrintPriority = GetBoolArg("-printpriority", false);
+    }
+};
+
+//! Transactions that depend on one in the block are now cheaper to add
+static void UpdatePackagesForAdded(CBlockAssembly& assembly, CTxMemPool::txiter iter)
+{
+    assembly.mapModifiedTx.erase(iter);
+    CTxMemPool::setEntries setDescendants;
+    mempool.CalculateDescendants(iter, setDescendants);
+    BOOST_FOREACH (CTxMemPool::txiter descendantIt, setDescendants) {
+        if (assembly.inBlock.count(descendantIt))
+            continue;
+        modtxiter mit = assembly.mapModifiedTx.find(descendantIt);
+        if (mit == assembly.mapModifiedTx.end()) {
+            CTxMemPoolModifiedEntry modEntry(descendantIt);
+            modEntry.nSizeWithAncestors -= iter->GetTxSize();
+            modEntry.nModFeesWithAncestors -= iter->GetModifiedFee();
+            assembly.mapModifiedTx.insert(modEntry);
+        } else {
+            assembly.mapModifiedTx.modify(mit, update_for_parent_inclusion(iter));
+        }
+    }
+}
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+/**
+ * Check a mempool transaction against the block and the coins spent so far,
+ * and add it if it fits. The in-mempool descendants of an added transaction
+ * have their package scores updated in mapModifiedTx.
+ */
+static bool AddToBlock(CBlockAssembly& assembly, CTxMemPool::txiter iter)
 {
-    bool byFee;
+    const CTransaction& tx = iter->GetTx();
+    if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, assembly.nHeight))
+        return false;
+
+    // Size limits
+    unsigned int nTxSize = iter->GetTxSize();
+    if (assembly.nBlockSize + nTxSize >= assembly.nBlockMaxSize)
+        return false;
+
+    // Legacy limits on sigOps:
+    unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+    if (assembly.nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    if (!assembly.view.HaveInputs(tx))
+        return false;
+
+    CAmount nTxFees = assembly.view.GetValueIn(tx) - tx.GetValueOut();
+
+    nTxSigOps += GetP2SHSigOpCount(tx, assembly.view);
+    if (assembly.nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    CValidationState state;
+    if (!CheckInputs(tx, state, assembly.view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        return false;
+
+    CTxUndo txundo;
+    UpdateCoins(tx, state, assembly.view, txundo, assembly.nHeight);
+
+    // Added
+    assembly.pblocktemplate->block.vtx.push_back(tx);
+    assembly.pblocktemplate->vTxFees.push_back(nTxFees);
+    assembly.pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+    assembly.nBlockSize += nTxSize;
+    ++assembly.nBlockTx;
+    assembly.nBlockSigOps += nTxSigOps;
+    assembly.nFees += nTxFees;
+    assembly.inBlock.insert(iter);
+
+    if (assembly.fPrintPriority) {
+        LogPrintf("priority %.1f fee %s txid %s\n",
+            iter->GetPriority(assembly.nHeight), CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
+    }
 
+    UpdatePackagesForAdded(assembly, iter);
+    return true;
+}
+
+//! Sort a package so that parents come before their children
+class CompareTxIterByAncestorCount
+{
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
+// The priority area is filled by coin age priority, which depends on the height
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+class TxCoinAgePriorityCompare
+{
+public:
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b) const
     {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
+        if (a.first == b.first)
+            return CTxMemPool::CompareIteratorByHash()(b.second, a.second); // Reverse order to make sort less than
+        return a.first < b.first;
+    }
+};
+
+/** Fill the first nBlockPrioritySize bytes of the block with the highest priority transactions. */
+static void AddPriorityTxs(CBlockAssembly& assembly, unsigned int nBlockPrioritySize)
+{
+    if (nBlockPrioritySize == 0)
+        return;
+
+    vector<TxCoinAgePriority> vecPriority;
+    vecPriority.reserve(mempool.mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi) {
+        double dPriority = mi->GetPriority(assembly.nHeight);
+        CAmount dummy;
+        mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+    }
+
+    TxCoinAgePriorityCompare comparer;
+    std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+
+    // Children wait here until all their in-mempool parents are in the block
+    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+    while (!vecPriority.empty()) {
+        // Take highest priority transaction off the priority queue:
+        double dPriority = vecPriority.front().first;
+        CTxMemPool::txiter iter = vecPriority.front().second;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        vecPriority.pop_back();
+
+        // The rest of the block is sorted by fee once past the priority size
+        // or we run out of high-priority transactions
+        if (assembly.nBlockSize + iter->GetTxSize() >= nBlockPrioritySize || !AllowFree(dPriority))
+            break;
+
+        bool fWaiting = false;
+        BOOST_FOREACH (CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter)) {
+            if (!assembly.inBlock.count(parent)) {
+                waitPriMap.insert(std::make_pair(iter, dPriority));
+                fWaiting = true;
+                break;
+            }
+        }
+        if (fWaiting || !AddToBlock(assembly, iter))
+            continue;
+
+        // Give the waiting children of this transaction another go
+        BOOST_FOREACH (CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter)) {
+            std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator wpiter = waitPriMap.find(child);
+            if (wpiter != waitPriMap.end()) {
+                vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                waitPriMap.erase(wpiter);
+            }
+        }
+    }
+}
+
+/**
+ * Add the rest of the mempool by ancestor fee rate, each transaction together
+ * with its ancestors that are not in the block yet. Stops at transactions
+ * paying less than the relay fee once the block has reached nBlockMinSize.
+ */
+static void AddPackageTxs(CBlockAssembly& assembly, unsigned int nBlockMinSize)
+{
+    CTxMemPool::setEntries failedTx;
+    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+
+    // Give up once the block is nearly full and nothing fits any more
+    const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
+    int64_t nConsecutiveFailed = 0;
+
+    while (mi != mempool.mapTx.get<ancestor_score>().end() || !assembly.mapModifiedTx.empty()) {
+        // Entries in mapModifiedTx are scored there instead
+        if (mi != mempool.mapTx.get<ancestor_score>().end()) {
+            CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+            if (assembly.mapModifiedTx.count(it) || assembly.inBlock.count(it) || failedTx.count(it)) {
+                ++mi;
+                continue;
+            }
+        }
+
+        // Take the better of the next mapTx entry and the best modified entry
+        bool fUsingModified = false;
+        CTxMemPool::txiter iter;
+        modtxscoreiter modit = assembly.mapModifiedTx.get<ancestor_score>().begin();
+        if (mi == mempool.mapTx.get<ancestor_score>().end()) {
+            iter = modit->iter;
+            fUsingModified = true;
         } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+            iter = mempool.mapTx.project<0>(mi);
+            if (modit != assembly.mapModifiedTx.get<ancestor_score>().end() &&
+                CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                ++mi;
+            }
+        }
+
+        uint64_t nPackageSize = iter->GetSizeWithAncestors();
+        CAmount nPackageFees = iter->GetModFeesWithAncestors();
+        if (fUsingModified) {
+            nPackageSize = modit->nSizeWithAncestors;
+            nPackageFees = modit->nModFeesWithAncestors;
+        }
+
+        // Everything after this pays less
+        if (nPackageFees < ::minRelayTxFee.GetFee(nPackageSize) && assembly.nBlockSize >= nBlockMinSize)
+            break;
+
+        if (assembly.nBlockSize + nPackageSize >= assembly.nBlockMaxSize) {
+            if (fUsingModified) {
+                assembly.mapModifiedTx.get<ancestor_score>().erase(modit);
+                failedTx.insert(iter);
+            }
+            if (++nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && assembly.nBlockSize > assembly.nBlockMaxSize - 4000)
+                break;
+            continue;
+        }
+
+        CTxMemPool::setEntries setAncestors;
+        mempool.CalculateMemPoolAncestors(*iter, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        vector<CTxMemPool::txiter> vPackage;
+        vPackage.push_back(iter);
+        BOOST_FOREACH (CTxMemPool::txiter ancestorIt, setAncestors) {
+            if (!assembly.inBlock.count(ancestorIt))
+                vPackage.push_back(ancestorIt);
+        }
+        std::sort(vPackage.begin(), vPackage.end(), CompareTxIterByAncestorCount());
+
+        bool fPackageAdded = true;
+        BOOST_FOREACH (CTxMemPool::txiter packageIt, vPackage) {
+            if (!AddToBlock(assembly, packageIt)) {
+                // Neither this transaction nor anything spending it can be added
+                assembly.mapModifiedTx.erase(packageIt);
+                failedTx.insert(packageIt);
+                fPackageAdded = false;
+                break;
+            }
+        }
+        if (!fPackageAdded) {
+            assembly.mapModifiedTx.erase(iter);
+            failedTx.insert(iter);
+            ++nConsecutiveFailed;
+            continue;
         }
+        nConsecutiveFailed = 0;
     }
-};
+}
+
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+int64_t nLastCoinStakeSearchInterval = 0;
+int64_t nLastCoinStakeSearchTime = 0;
+static CStakeSearchWindow stakeSearchWindow;
+
+int64_t CStakeSearchWindow::GetInterval(const CBlockIndex* pindexPrev, int64_t nSearchTime, int64_t nHashDrift) const
+{
+    if (pindexPrev != pindexLast)
+        return nHashDrift;
+    return std::max((int64_t)0, std::min(nHashDrift, nSearchTime - nTimeLast));
+}
+
+void CStakeSearchWindow::Searched(const CBlockIndex* pindexPrev, int64_t nSearchTime)
+{
+    pindexLast = pindexPrev;
+    nTimeLast = nSearchTime;
+}
+
+void CStakeSearchWindow::Reset()
+{
+    pindexLast = NULL;
+}
 
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
@@ -92,6 +421,22 @@ void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
         pblock->nBits = GetNextWorkRequired(pindexPrev, pblock);
 }
 
+//! Largest block you're willing to create
+static unsigned int GetBlockMaxSize()
+{
+    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
+    return std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE - 1000), nBlockMaxSize));
+}
+
+//! Minimum block size you want to create; block will be filled with free transactions
+//! until there are no more or the block reaches this size
+static unsigned int GetBlockMinSize(unsigned int nBlockMaxSize)
+{
+    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+    return std::min(nBlockMaxSize, nBlockMinSize);
+}
+
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake)
 {
     CReserveKey reservekey(pwallet);
@@ -124,8 +469,6 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
     pblocktemplate->vTxSigOps.push_back(-1); // updated at end
 
     // ppcoin: if coinstake available add coinstake tx
-    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime(); // only initialized at startup
-
     if (fProofOfStake) {
         boost::this_thread::interruption_point();
         pblock->nTime = GetAdjustedTime();
@@ -134,36 +477,35 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         CMutableTransaction txCoinStake;
         int64_t nSearchTime = pblock->nTime; // search to current time
         bool fStakeFound = false;
-        if (nSearchTime >= nLastCoinStakeSearchTime) {
-            unsigned int nTxNewTime = 0;
-            if (pwallet->CreateCoinStake(*pwallet, pblock->nBits, nSearchTime - nLastCoinStakeSearchTime, txCoinStake, nTxNewTime)) {
-                pblock->nTime = nTxNewTime;
-                pblock->vtx[0].vout[0].SetEmpty();
-                pblock->vtx.push_back(CTransaction(txCoinStake));
-                fStakeFound = true;
-            }
-            nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
+        int64_t nSearchInterval = stakeSearchWindow.GetInterval(pindexPrev, nSearchTime, pwallet->nHashDrift);
+        unsigned int nTxNewTime = nSearchTime;
+        if (pwallet->CreateCoinStake(*pwallet, pblock->nBits, nSearchInterval, txCoinStake, nTxNewTime)) {
+            pblock->nTime = nTxNewTime;
+            pblock->vtx[0].vout[0].SetEmpty();
+            pblock->vtx.push_back(CTransaction(txCoinStake));
+            fStakeFound = true;
+        }
+        // CreateCoinStake clears the interval when it returns before searching,
+        // in which case the window is searched again on the next call
+        if (nSearchInterval > 0) {
+            nLastCoinStakeSearchInterval = nSearchInterval;
             nLastCoinStakeSearchTime = nSearchTime;
+            stakeSearchWindow.Searched(pindexPrev, nSearchTime);
         }
 
         if (!fStakeFound)
             return NULL;
     }
 
-    // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
-    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE - 1000), nBlockMaxSize));
+    unsigned int nBlockMaxSize = GetBlockMaxSize();
 
     // How much of the block should be dedicated to high-priority transactions,
-    // included regardless of the fees they pay
+    // included regardless of the fees they pay. Off by default, since ranking
+    // them means computing the priority of the whole mempool for every template.
     unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
     nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
 
-    // Minimum block size you want to create; block will be filled with free transactions
-    // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
-    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+    unsigned int nBlockMinSize = GetBlockMinSize(nBlockMaxSize);
 
     // Collect memory pool transactions into the block
     CAmount nFees = 0;
@@ -175,175 +517,13 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         const int nHeight = pindexPrev->nHeight + 1;
         CCoinsViewCache view(pcoinsTip);
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            for (const CTxIn& txin : tx.vin) {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        vector<CBigNum> vBlockSerials;
-        vector<CBigNum> vTxSerials;
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS;
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
-
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            for (const CBigNum bnSerial : vTxSerials)
-                vBlockSerials.emplace_back(bnSerial);
+        CBlockAssembly assembly(pblocktemplate.get(), view, nHeight, nBlockMaxSize);
+        AddPriorityTxs(assembly, nBlockPrioritySize);
+        AddPackageTxs(assembly, nBlockMinSize);
 
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                BOOST_FOREACH (COrphan* porphan, mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        uint64_t nBlockSize = assembly.nBlockSize;
+        uint64_t nBlockTx = assembly.nBlockTx;
+        nFees = assembly.nFees;
 
         if (!fProofOfStake) {
             //Masternode and general budget payments
@@ -385,6 +565,55 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
     return pblocktemplate.release();
 }
 
+bool UpdateNewBlock(CBlockTemplate* pblocktemplate)
+{
+    CBlock* pblock = &pblocktemplate->block;
+    if (pblock->IsProofOfStake())
+        return false;
+
+    unsigned int nBlockMaxSize = GetBlockMaxSize();
+    unsigned int nBlockMinSize = GetBlockMinSize(nBlockMaxSize);
+
+    LOCK2(cs_main, mempool.cs);
+
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    if (pblock->hashPrevBlock != pindexPrev->GetBlockHash())
+        return false;
+    const int nHeight = pindexPrev->nHeight + 1;
+    CCoinsViewCache view(pcoinsTip);
+
+    // Replay the transactions already in the block. Their scripts were
+    // checked when it was assembled and the tip has not moved since.
+    CBlockAssembly assembly(pblocktemplate, view, nHeight, nBlockMaxSize);
+    for (unsigned int i = 1; i < pblock->vtx.size(); i++) {
+        const CTransaction& tx = pblock->vtx[i];
+        CValidationState state;
+        CTxUndo txundo;
+        UpdateCoins(tx, state, view, txundo, nHeight);
+
+        assembly.nBlockSize += ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        ++assembly.nBlockTx;
+        assembly.nBlockSigOps += pblocktemplate->vTxSigOps[i];
+        assembly.nFees += pblocktemplate->vTxFees[i];
+        // Transactions that left the mempool since are still valid in the block
+        CTxMemPool::txiter it = mempool.mapTx.find(tx.GetHash());
+        if (it != mempool.mapTx.end())
+            assembly.inBlock.insert(it);
+    }
+    BOOST_FOREACH (CTxMemPool::txiter it, assembly.inBlock)
+        UpdatePackagesForAdded(assembly, it);
+
+    unsigned int nBlockTxBefore = assembly.nBlockTx;
+    AddPackageTxs(assembly, nBlockMinSize);
+    if (assembly.nBlockTx == nBlockTxBefore)
+        return false;
+
+    pblocktemplate->vTxFees[0] = -assembly.nFees;
+    nLastBlockTx = assembly.nBlockTx;
+    nLastBlockSize = assembly.nBlockSize;
+    return true;
+}
+
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -458,66 +687,165 @@ bool fGenerateBitcoins = false;
 
 // ***TODO*** that part changed in bitcoin, we are using a mix with old one here for now
 
-void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
+//////////////////////////////////////////////////////////////////////////////
+//
+// Stake minter
+//
+// Between kernel searches the minter sleeps until something can change their
+// outcome: a new tip, a change to the wallet's coins, the wallet being locked or
+// unlocked, or the next timestamp opening up for a kernel. Only the lack of
+// peers, which has no event, is polled.
+//
+
+static CWaitableCriticalSection csStakeMinter;
+static CConditionVariable cvStakeMinter;
+static bool fStakeMinterWake = false;
+static bool fStakeWalletChanged = false;
+//! The last tip notified and when, until the minter first searches on it
+static uint256 hashStakeTip;
+static int64_t nStakeTipTimeMicros = 0;
+static std::vector<uint64_t> vStakeLatencyCounts(STAKE_LATENCY_NUM_BUCKETS, 0);
+
+static void StakeMinterTipChanged(const uint256& hashNewTip)
 {
-    LogPrintf("UnitedstatedollarcryptoMiner started\n");
-    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-    RenameThread("unitedstatedollarcrypto-miner");
+    boost::unique_lock<boost::mutex> lock(csStakeMinter);
+    hashStakeTip = hashNewTip;
+    nStakeTipTimeMicros = GetTimeMicros();
+    fStakeMinterWake = true;
+    cvStakeMinter.notify_all();
+}
 
-    // Each thread has its own key and counter
+static void StakeMinterWalletChanged()
+{
+    boost::unique_lock<boost::mutex> lock(csStakeMinter);
+    fStakeWalletChanged = true;
+    fStakeMinterWake = true;
+    cvStakeMinter.notify_all();
+}
+
+static void StakeMinterTransactionChanged(CWallet* wallet, const uint256& hashTx, ChangeType status)
+{
+    StakeMinterWalletChanged();
+}
+
+static void StakeMinterStatusChanged(CCryptoKeyStore* wallet)
+{
+    StakeMinterWalletChanged();
+}
+
+//! Sleep for at most nMilliseconds, or until one of the events above
+static void WaitForStakeEvent(int64_t nMilliseconds)
+{
+    boost::unique_lock<boost::mutex> lock(csStakeMinter);
+    if (!fStakeMinterWake)
+        cvStakeMinter.timed_wait(lock, boost::posix_time::milliseconds(nMilliseconds));
+}
+
+//! Tips notified while the minter cannot stake are not timed
+static void ForgetStakeTip()
+{
+    boost::unique_lock<boost::mutex> lock(csStakeMinter);
+    hashStakeTip.SetNull();
+}
+
+//! Count the time from the notification of a tip to the first kernel search on it
+static void RecordStakeLatency(const CBlockIndex* pindex)
+{
+    boost::unique_lock<boost::mutex> lock(csStakeMinter);
+    if (hashStakeTip != pindex->GetBlockHash())
+        return;
+    hashStakeTip.SetNull();
+
+    vStakeLatencyCounts[GetStakeLatencyBucket((GetTimeMicros() - nStakeTipTimeMicros) / 1000)]++;
+}
+
+int GetStakeLatencyBucket(int64_t nLatencyMs)
+{
+    int nBucket = 0;
+    while (nBucket < STAKE_LATENCY_NUM_BUCKETS - 1 && nLatencyMs >= STAKE_LATENCY_BUCKETS_MS[nBucket])
+        nBucket++;
+    return nBucket;
+}
+
+std::vector<uint64_t> GetStakeLatencyHistogram()
+{
+    boost::unique_lock<boost::mutex> lock(csStakeMinter);
+    return vStakeLatencyCounts;
+}
+
+static void StakeMinter(CWallet* pwallet)
+{
     CReserveKey reservekey(pwallet);
     unsigned int nExtraNonce = 0;
 
     //control the amount of times the client will check for mintable coins
-    static bool fMintableCoins = false;
-    static int nMintableLastCheck = 0;
-
-    while (fGenerateBitcoins || fProofOfStake) {
-        if (fProofOfStake && (GetTime() - nMintableLastCheck > 5 * 60)) // 5 minute check time
-        {
-            nMintableLastCheck = GetTime();
-            fMintableCoins = pwallet->MintableCoins();
-        }
+    bool fMintableCoins = false;
+    int64_t nMintableLastCheck = 0;
+
+    //the tip of the last kernel search, and the adjusted time at which the next timestamp opens on it
+    const CBlockIndex* pindexSearched = NULL;
+    int64_t nNextSearch = 0;
+
+    uiInterface.NotifyBlockTip.connect(StakeMinterTipChanged);
+    pwallet->NotifyTransactionChanged.connect(StakeMinterTransactionChanged);
+    pwallet->NotifyStatusChanged.connect(StakeMinterStatusChanged);
+
+    try {
+        while (true) {
+            bool fWalletChanged;
+            {
+                boost::unique_lock<boost::mutex> lock(csStakeMinter);
+                fWalletChanged = fStakeWalletChanged;
+                fStakeWalletChanged = false;
+                fStakeMinterWake = false;
+            }
+
+            if (fWalletChanged || GetTime() - nMintableLastCheck > 5 * 60) { // 5 minute check time
+                nMintableLastCheck = GetTime();
+                fMintableCoins = pwallet->MintableCoins();
+            }
+            if (fWalletChanged) {
+                // Coins that were not searched yet may have come in
+                pindexSearched = NULL;
+                stakeSearchWindow.Reset();
+            }
 
-        if (fProofOfStake) {
-            if (IsProofOfWorkPeriod(chainActive.Tip()->nHeight + 1)) {
-                MilliSleep(5000);
+            CBlockIndex* pindexPrev = chainActive.Tip();
+            if (!pindexPrev || IsProofOfWorkPeriod(pindexPrev->nHeight + 1)) {
+                ForgetStakeTip();
+                WaitForStakeEvent(60 * 1000);
                 continue;
             }
 
-            if (chainActive.Tip()->nTime < Params().GenesisBlock().nTime || vNodes.empty() || pwallet->IsLocked() || !fMintableCoins || nReserveBalance >= pwallet->GetBalance()) {
+            if (pindexPrev->nTime < Params().GenesisBlock().nTime || vNodes.empty() || pwallet->IsLocked() || !fMintableCoins || nReserveBalance >= pwallet->GetBalance()) {
                 nLastCoinStakeSearchInterval = 0;
-                MilliSleep(30000);
+                ForgetStakeTip();
+                WaitForStakeEvent(30 * 1000);
                 continue;
             }
 
-            if (mapHashedBlocks.count(chainActive.Tip()->nHeight)) //search our map of hashed blocks, see if bestblock has been hashed yet
-            {
-                if (GetTime() - mapHashedBlocks[chainActive.Tip()->nHeight] < max(pwallet->nHashInterval, (unsigned int)1)) // wait half of the nHashDrift with max wait of 3 minutes
-                {
-                    MilliSleep(30000);
-                    continue;
-                }
+            // Search on a new tip at once, otherwise when the next timestamp opens.
+            // No timestamp up to the tip's is accepted.
+            int64_t nSearchAt = pindexPrev->nTime + 1;
+            if (pindexPrev == pindexSearched)
+                nSearchAt = std::max(nSearchAt, nNextSearch);
+            int64_t nWait = (nSearchAt - GetTimeOffset()) * 1000 - GetTimeMillis();
+            if (nWait > 0) {
+                WaitForStakeEvent(nWait);
+                continue;
             }
-        }
 
-        //
-        // Create new block
-        //
-        unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        if (!pindexPrev)
-            continue;
+            RecordStakeLatency(pindexPrev);
+            pindexSearched = pindexPrev;
+            nNextSearch = GetAdjustedTime() + 1;
 
-        unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey, pwallet, fProofOfStake));
-        if (!pblocktemplate.get())
-            continue;
+            unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey, pwallet, true));
+            if (!pblocktemplate.get())
+                continue;
 
-        CBlock* pblock = &pblocktemplate->block;
-        IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
+            CBlock* pblock = &pblocktemplate->block;
+            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
 
-        //Stake miner main
-        if (fProofOfStake) {
             LogPrintf("CPUMiner : proof-of-stake block found %s \n", pblock->GetHash().ToString().c_str());
 
             if (!pblock->SignBlock(*pwallet)) {
@@ -529,9 +857,45 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
             SetThreadPriority(THREAD_PRIORITY_NORMAL);
             ProcessBlockFound(pblock, *pwallet, reservekey);
             SetThreadPriority(THREAD_PRIORITY_LOWEST);
+        }
+    } catch (...) {
+        pwallet->NotifyStatusChanged.disconnect(StakeMinterStatusChanged);
+        pwallet->NotifyTransactionChanged.disconnect(StakeMinterTransactionChanged);
+        uiInterface.NotifyBlockTip.disconnect(StakeMinterTipChanged);
+        throw;
+    }
+}
+
+void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
+{
+    LogPrintf("UnitedstatedollarcryptoMiner started\n");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("unitedstatedollarcrypto-miner");
+
+    if (fProofOfStake) {
+        StakeMinter(pwallet);
+        return;
+    }
+
+    // Each thread has its own key and counter
+    CReserveKey reservekey(pwallet);
+    unsigned int nExtraNonce = 0;
+
+    while (fGenerateBitcoins) {
+        //
+        // Create new block
+        //
+        unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        if (!pindexPrev)
+            continue;
 
+        unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey, pwallet, false));
+        if (!pblocktemplate.get())
             continue;
-        }
+
+        CBlock* pblock = &pblocktemplate->block;
+        IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
 
         LogPrintf("Running UnitedstatedollarcryptoMiner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
             ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
@@ -6,7 +6,9 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <vector>
 
 class CBlock;
 class CBlockHeader;
@@ -22,6 +24,11 @@ void GenerateBitcoins(bool fGenerate, CWallet* pwallet, int nThreads);
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake);
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfStake);
+/**
+ * Append the mempool transactions that fit to a proof-of-work block from CreateNewBlock,
+ * without assembling it again. Returns whether any were added.
+ */
+bool UpdateNewBlock(CBlockTemplate* pblocktemplate);
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 /** Check mined block */
@@ -29,6 +36,36 @@ void UpdateTime(CBlockHeader* block, const CBlockIndex* pindexPrev);
 
 void BitcoinMiner(CWallet* pwallet, bool fProofOfStake);
 
+/**
+ * The timestamps the kernel search has hashed on the current tip. A search at
+ * nSearchTime covers (nSearchTime, nSearchTime + nHashDrift]; the next one on
+ * the same tip only needs the newest timestamps, those that opened since.
+ */
+class CStakeSearchWindow
+{
+private:
+    const CBlockIndex* pindexLast;
+    int64_t nTimeLast;
+
+public:
+    CStakeSearchWindow() : pindexLast(NULL), nTimeLast(0) {}
+
+    //! Number of the newest timestamps to hash at nSearchTime on pindexPrev, 0 if they all were
+    int64_t GetInterval(const CBlockIndex* pindexPrev, int64_t nSearchTime, int64_t nHashDrift) const;
+    //! Record a search that ran on pindexPrev at nSearchTime
+    void Searched(const CBlockIndex* pindexPrev, int64_t nSearchTime);
+    //! Hash the whole window again on the next search
+    void Reset();
+};
+
+//! Upper bounds, in milliseconds, of the buckets of GetStakeLatencyHistogram; a last bucket holds the rest
+static const int64_t STAKE_LATENCY_BUCKETS_MS[] = {10, 50, 100, 500, 1000, 5000, 30000};
+static const int STAKE_LATENCY_NUM_BUCKETS = sizeof(STAKE_LATENCY_BUCKETS_MS) / sizeof(STAKE_LATENCY_BUCKETS_MS[0]) + 1;
+/** How long the stake minter took from a new tip to its first kernel search on it, as counts per bucket */
+std::vector<uint64_t> GetStakeLatencyHistogram();
+/** The GetStakeLatencyHistogram bucket of a latency */
+int GetStakeLatencyBucket(int64_t nLatencyMs);
+
 extern double dHashesPerSec;
 extern int64_t nHPSTimerStart;
 
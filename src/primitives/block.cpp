@@ -6,6 +6,7 @@
 
 #include "primitives/block.h"
 
+#include "crypto/sha256.h"
 #include "hash.h"
 #include "script/standard.h"
 #include "script/sign.h"
@@ -18,6 +19,40 @@ uint256 CBlockHeader::GetHash() const
     return HashQuark(BEGIN(nVersion), END(nNonce));
 }
 
+namespace
+{
+/**
+ * Hash one level of a merkle tree: the nSize nodes at in become the
+ * (nSize + 1) / 2 nodes of the next level at out, pairing the last node with
+ * itself if nSize is odd. out may equal in. Returns whether the level ends in
+ * two identical nodes (see CBlock::BuildMerkleTree).
+ */
+bool HashMerkleLevel(const uint256* in, int nSize, uint256* out)
+{
+    bool mutated = (nSize % 2 == 0) && in[nSize - 2] == in[nSize - 1];
+    uint256 last[2];
+    if (nSize % 2)
+        last[0] = last[1] = in[nSize - 1];
+    SHA256D64(out[0].begin(), in[0].begin(), nSize / 2);
+    if (nSize % 2)
+        SHA256D64(out[nSize / 2].begin(), last[0].begin(), 1);
+    return mutated;
+}
+} // namespace
+
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* fMutated)
+{
+    bool mutated = false;
+    for (int nSize = hashes.size(); nSize > 1; nSize = (nSize + 1) / 2) {
+        if (HashMerkleLevel(&hashes[0], nSize, &hashes[0]))
+            mutated = true;
+    }
+    if (fMutated) {
+        *fMutated = mutated;
+    }
+    return (hashes.empty() ? uint256() : hashes[0]);
+}
+
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
 {
     /* WARNING! If you're reading this because you're learning about crypto
@@ -63,15 +98,11 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     bool mutated = false;
     for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
-        {
-            int i2 = std::min(i+1, nSize-1);
-            if (i2 == i + 1 && i2 + 1 == nSize && vMerkleTree[j+i] == vMerkleTree[j+i2]) {
-                // Two identical hashes at the end of the list at a particular level.
-                mutated = true;
-            }
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+        // Each level is hashed in one SHA256D64 call over its adjacent pairs.
+        vMerkleTree.resize(j + nSize + (nSize + 1) / 2);
+        if (HashMerkleLevel(&vMerkleTree[j], nSize, &vMerkleTree[j + nSize])) {
+            // Two identical hashes at the end of the list at a particular level.
+            mutated = true;
         }
         j += nSize;
     }
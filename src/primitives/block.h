@@ -164,6 +164,12 @@ public:
 };
 
 
+/**
+ * Compute the merkle root of a list of leaf hashes without keeping the
+ * intermediate levels. Same tree and mutation check as CBlock::BuildMerkleTree.
+ */
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated = NULL);
+
 /** Describes a place in the block chain to another node such that if the
  * other node doesn't have the same branch, it can find a recent common trunk.
  * The further back it is, the further before the fork it may be.
@@ -104,7 +104,9 @@ static bool rest_block(AcceptedConnection* conn,
     if (!ParseHashStr(hashStr, hash))
         throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    // Only JSON needs the deserialized block; the other formats are the bytes on disk
     CBlock block;
+    std::vector<unsigned char> vchBlock;
     CBlockIndex* pblockindex = NULL;
     {
         LOCK(cs_main);
@@ -112,22 +114,23 @@ static bool rest_block(AcceptedConnection* conn,
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
 
         pblockindex = mapBlockIndex[hash];
-        if (!ReadBlockFromDisk(block, pblockindex))
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw RESTERR(HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
+
+        bool fRead = (rf == RF_JSON) ? ReadBlockFromDisk(block, pblockindex) : ReadRawBlockFromDisk(vchBlock, pblockindex);
+        if (!fRead)
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
-
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
+        string binaryBlock(vchBlock.begin(), vchBlock.end());
         conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryBlock.size(), "application/octet-stream") << binaryBlock << std::flush;
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        string strHex = HexStr(vchBlock.begin(), vchBlock.end()) + "\n";
         conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
         return true;
     }
@@ -6,10 +6,12 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "base58.h"
+#include "blockstore.h"
 #include "checkpoints.h"
 #include "clientversion.h"
 #include "main.h"
 #include "rpcserver.h"
+#include "script/sigcache.h"
 #include "sync.h"
 #include "txdb.h"
 #include "util.h"
@@ -90,7 +92,7 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
 }
 
 
-UniValue blockHeaderToJSON(const CBlock& block, const CBlockIndex* blockindex)
+UniValue blockHeaderToJSON(const CBlockHeader& block, const CBlockIndex* blockindex)
 {
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("version", block.nVersion));
@@ -169,6 +171,13 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"modifiedfee\" : n,      (numeric) transaction fee with fee deltas used for mining priority\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) modified fees of in-mempool descendants (including this one)\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) modified fees of in-mempool ancestors (including this one)\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -184,9 +193,8 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     if (fVerbose) {
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH (const PAIRTYPE(uint256, CTxMemPoolEntry) & entry, mempool.mapTx) {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+        BOOST_FOREACH (const CTxMemPoolEntry& e, mempool.mapTx) {
+            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
@@ -194,6 +202,13 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", ValueFromAmount(e.GetModFeesWithDescendants())));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", ValueFromAmount(e.GetModFeesWithAncestors())));
             const CTransaction& tx = e.GetTx();
             set<string> setDepends;
             BOOST_FOREACH (const CTxIn& txin, tx.vin) {
@@ -243,6 +258,46 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
     return pblockindex->GetBlockHash().GetHex();
 }
 
+UniValue getblockhashes(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "getblockhashes high low\n"
+            "\nReturns the hashes of the blocks in the best chain with a timestamp in a range (requires -timestampindex).\n"
+            "\nArguments:\n"
+            "1. high         (numeric, required) The newest block timestamp\n"
+            "2. low          (numeric, required) The oldest block timestamp\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"hash\"         (string) The block hash\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getblockhashes", "1231614698 1231024505") + HelpExampleRpc("getblockhashes", "1231614698, 1231024505"));
+
+    if (!fTimestampIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Timestamp index not enabled, restart with -timestampindex -reindex");
+
+    int64_t nHigh = params[0].get_int64();
+    int64_t nLow = params[1].get_int64();
+    if (nLow < 0 || nHigh < nLow || nHigh > std::numeric_limits<unsigned int>::max())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid timestamp range");
+
+    std::vector<uint256> vHashes;
+    if (!pblocktree->ReadTimestampIndex(nHigh, nLow, vHashes))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the timestamp index");
+
+    // Blocks that were disconnected keep their entry
+    LOCK(cs_main);
+    UniValue result(UniValue::VARR);
+    BOOST_FOREACH (const uint256& hash, vHashes) {
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second))
+            result.push_back(hash.GetHex());
+    }
+    return result;
+}
+
 UniValue getblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -288,19 +343,23 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
-    if (!ReadBlockFromDisk(block, pblockindex))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
     if (!fVerbose) {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        // The block file already holds the serialized block
+        std::vector<unsigned char> vchBlock;
+        if (!ReadRawBlockFromDisk(vchBlock, pblockindex))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        return HexStr(vchBlock.begin(), vchBlock.end());
     }
 
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pblockindex))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
     return blockToJSON(block, pblockindex);
 }
 
@@ -335,18 +394,17 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
+    LOCK(cs_main);
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (!ReadBlockFromDisk(block, pblockindex))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    // The header comes from the block index, so this works for pruned blocks too
+    CBlockHeader block = pblockindex->GetBlockHeader();
 
     if (!fVerbose) {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block.GetBlockHeader();
+        ssBlock << block;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
         return strHex;
     }
@@ -356,26 +414,48 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( full_scan )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "The totals and set hash are kept up to date as blocks are connected, so this returns at once,\n"
+            "unless they are not known yet (e.g. after an upgrade) or full_scan is set.\n"
+            "\nArguments:\n"
+            "1. full_scan      (boolean, optional, default=false) Scan the whole coin database, to check the running totals.\n"
+            "                  This may take some time.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions, only with a full scan\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash, only with a full scan\n"
+            "  \"muhash\": \"hash\",     (string) The order-independent hash of the set\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"digest_matches\": true|false   (boolean) Whether the running totals match the scan, only with a full scan\n"
             "}\n"
             "\nExamples:\n" +
-            HelpExampleCli("gettxoutsetinfo", "") + HelpExampleRpc("gettxoutsetinfo", ""));
+            HelpExampleCli("gettxoutsetinfo", "") + HelpExampleCli("gettxoutsetinfo", "true") + HelpExampleRpc("gettxoutsetinfo", ""));
+
+    bool fFullScan = params.size() > 0 && params[0].get_bool();
 
     UniValue ret(UniValue::VOBJ);
 
+    LOCK(cs_main);
+    CTxOutSetDigest digest;
+    bool fDigest = pcoinsTip->GetTxOutSetDigest(digest);
+    if (fDigest && !fFullScan) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(digest.hashBlock);
+        ret.push_back(Pair("height", mi == mapBlockIndex.end() ? -1 : (int64_t)mi->second->nHeight));
+        ret.push_back(Pair("bestblock", digest.hashBlock.GetHex()));
+        ret.push_back(Pair("txouts", (int64_t)digest.nTransactionOutputs));
+        ret.push_back(Pair("bytes_serialized", (int64_t)digest.nSerializedSize));
+        ret.push_back(Pair("muhash", digest.GetHash().GetHex()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(digest.nTotalAmount)));
+        return ret;
+    }
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (pcoinsTip->GetStats(stats)) {
@@ -385,7 +465,18 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
         ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        ret.push_back(Pair("muhash", stats.digest.GetHash().GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        if (fDigest) {
+            ret.push_back(Pair("digest_matches", digest.hashBlock == stats.hashBlock &&
+                                                     digest.nTransactionOutputs == stats.nTransactionOutputs &&
+                                                     digest.nSerializedSize == stats.nSerializedSize &&
+                                                     digest.nTotalAmount == stats.nTotalAmount &&
+                                                     digest.GetHash() == stats.digest.GetHash()));
+        } else {
+            // Start keeping the totals from here on
+            pcoinsTip->SetTxOutSetDigest(stats.digest);
+        }
     }
     return ret;
 }
@@ -415,7 +506,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -434,33 +524,33 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out))
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return NullUniValue;
     }
-    if (n < 0 || (unsigned int)n >= coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex* pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -503,7 +593,9 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"bestblockhash\": \"...\", (string) the hash of the currently best block\n"
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
-            "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"chainwork\": \"xxxx\",    (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
+            "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored (only present if pruning is enabled)\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getblockchaininfo", "") + HelpExampleRpc("getblockchaininfo", ""));
@@ -516,6 +608,14 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("difficulty", (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress", Checkpoints::GuessVerificationProgress(chainActive.Tip())));
     obj.push_back(Pair("chainwork", chainActive.Tip()->nChainWork.GetHex()));
+    obj.push_back(Pair("pruned", fPruneMode));
+    if (fPruneMode) {
+        CBlockIndex* block = chainActive.Tip();
+        while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
+            block = block->pprev;
+
+        obj.push_back(Pair("pruneheight", block->nHeight));
+    }
     return obj;
 }
 
@@ -617,12 +717,90 @@ UniValue getchaintips(const UniValue& params, bool fHelp)
     return res;
 }
 
+UniValue getblockstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getblockstats hash_or_height\n"
+            "\nReturns fee and reward statistics of a block. They are read from the block stats index (-blockstatsindex)\n"
+            "when enabled, or else computed from the block and its undo data.\n"
+            "Transaction counts, sizes and fees leave out the coinbase and coinstake; fee rates are per kB.\n"
+            "\nArguments:\n"
+            "1. hash_or_height     (string or numeric, required) The block hash, or the height of a block in the best chain\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blockhash\": \"hash\",        (string) The block hash\n"
+            "  \"height\": n,                (numeric) The block height\n"
+            "  \"time\": n,                  (numeric) The block time\n"
+            "  \"size\": n,                  (numeric) The block size\n"
+            "  \"txcount\": n,               (numeric) The number of transactions\n"
+            "  \"txbytes\": n,               (numeric) The total size of the transactions\n"
+            "  \"totalfee\": x.xxx,          (numeric) The total fee\n"
+            "  \"avgfeerate\": x.xxx,        (numeric) The average fee rate\n"
+            "  \"minfeerate\": x.xxx,        (numeric) The lowest fee rate\n"
+            "  \"maxfeerate\": x.xxx,        (numeric) The highest fee rate\n"
+            "  \"feerate_percentiles\": [    (array) The fee rates at the 10th, 25th, 50th, 75th and 90th percentile of the transaction bytes\n"
+            "    x.xxx, ...\n"
+            "  ],\n"
+            "  \"stakereward\": x.xxx,       (numeric) The stake or mining reward kept by the block creator\n"
+            "  \"masternodepayment\": x.xxx, (numeric) The masternode payment\n"
+            "  \"budgetpayment\": x.xxx      (numeric) The budget payment\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getblockstats", "1000") + HelpExampleRpc("getblockstats", "1000"));
+
+    CBlockIndex* pblockindex = NULL;
+    {
+        LOCK(cs_main);
+        int32_t nHeight;
+        if (params[0].isNum() || ParseInt32(params[0].get_str(), &nHeight)) {
+            if (params[0].isNum())
+                nHeight = params[0].get_int();
+            if (nHeight < 0 || nHeight > chainActive.Height())
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+            pblockindex = chainActive[nHeight];
+        } else {
+            uint256 hash = ParseHashV(params[0], "hash_or_height");
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
+            if (mi == mapBlockIndex.end())
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+            pblockindex = mi->second;
+        }
+    }
+
+    CBlockStats stats;
+    if (!GetBlockStats(pblockindex, stats))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Can't read block stats (block or undo data not available)");
+
+    UniValue percentiles(UniValue::VARR);
+    for (int i = 0; i < BLOCKSTATS_NUM_PERCENTILES; i++)
+        percentiles.push_back(ValueFromAmount(stats.vFeeRatePercentiles[i]));
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("blockhash", pblockindex->GetBlockHash().GetHex()));
+    ret.push_back(Pair("height", pblockindex->nHeight));
+    ret.push_back(Pair("time", pblockindex->GetBlockTime()));
+    ret.push_back(Pair("size", (int)stats.nSize));
+    ret.push_back(Pair("txcount", (int)stats.nTxCount));
+    ret.push_back(Pair("txbytes", (int64_t)stats.nTxBytes));
+    ret.push_back(Pair("totalfee", ValueFromAmount(stats.nFees)));
+    ret.push_back(Pair("avgfeerate", ValueFromAmount(CFeeRate(stats.nFees, stats.nTxBytes).GetFeePerK())));
+    ret.push_back(Pair("minfeerate", ValueFromAmount(stats.nMinFeeRate)));
+    ret.push_back(Pair("maxfeerate", ValueFromAmount(stats.nMaxFeeRate)));
+    ret.push_back(Pair("feerate_percentiles", percentiles));
+    ret.push_back(Pair("stakereward", ValueFromAmount(stats.nStakeReward)));
+    ret.push_back(Pair("masternodepayment", ValueFromAmount(stats.nMasternodePayment)));
+    ret.push_back(Pair("budgetpayment", ValueFromAmount(stats.nBudgetPayment)));
+    return ret;
+}
+
 UniValue getfeeinfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
         throw runtime_error(
                 "getfeeinfo blocks\n"
                         "\nReturns details of transaction fees over the last n blocks.\n"
+                        "Aggregated from the block stats index when -blockstatsindex is enabled (see getblockstats).\n"
                         "\nArguments:\n"
                         "1. blocks     (int, required) the number of blocks to get transaction data from\n"
                         "\nResult:\n"
@@ -637,48 +815,31 @@ UniValue getfeeinfo(const UniValue& params, bool fHelp)
                 HelpExampleCli("getfeeinfo", "5") + HelpExampleRpc("getfeeinfo", "5"));
 
 
-    int nBlocks = params[0].get_int();
-    int nBestHeight = chainActive.Height();
-    int nStartHeight = nBestHeight - nBlocks;
-    if (nBlocks < 0 || nStartHeight <= 0)
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "invalid start height");
+    // Only the list of blocks is taken under cs_main; the stats may have to
+    // be read from disk
+    std::vector<const CBlockIndex*> vBlocks;
+    {
+        LOCK(cs_main);
+        int nBlocks = params[0].get_int();
+        int nBestHeight = chainActive.Height();
+        int nStartHeight = nBestHeight - nBlocks;
+        if (nBlocks < 0 || nStartHeight <= 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "invalid start height");
+        vBlocks.reserve(nBlocks + 1);
+        for (int i = nStartHeight; i <= nBestHeight; i++)
+            vBlocks.push_back(chainActive[i]);
+    }
 
     CAmount nFees = 0;
     int64_t nBytes = 0;
     int64_t nTotal = 0;
-    for (int i = nStartHeight; i <= nBestHeight; i++) {
-        CBlockIndex* pindex = chainActive[i];
-        CBlock block;
-        if (!ReadBlockFromDisk(block, pindex))
-            throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read block from disk");
-
-        CAmount nValueIn = 0;
-        CAmount nValueOut = 0;
-        for (const CTransaction& tx : block.vtx) {
-            if (tx.IsCoinBase() || tx.IsCoinStake())
-                continue;
-
-            for (unsigned int j = 0; j < tx.vin.size(); j++) {
-                COutPoint prevout = tx.vin[j].prevout;
-                CTransaction txPrev;
-                uint256 hashBlock;
-                if(!GetTransaction(prevout.hash, txPrev, hashBlock, true))
-                    throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read tx from disk");
-                nValueIn += txPrev.vout[prevout.n].nValue;
-            }
-
-            for (unsigned int j = 0; j < tx.vout.size(); j++) {
-                nValueOut += tx.vout[j].nValue;
-            }
-
-            nFees += nValueIn - nValueOut;
-            nBytes += tx.GetSerializeSize(SER_NETWORK, CLIENT_VERSION);
-            nTotal++;
-        }
-
-        pindex = chainActive.Next(pindex);
-        if (!pindex)
-            break;
+    BOOST_FOREACH (const CBlockIndex* pindex, vBlocks) {
+        CBlockStats stats;
+        if (!GetBlockStats(pindex, stats))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read block stats");
+        nFees += stats.nFees;
+        nBytes += stats.nTxBytes;
+        nTotal += stats.nTxCount;
     }
 
     UniValue ret(UniValue::VOBJ);
@@ -702,6 +863,9 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getmempoolinfo", "") + HelpExampleRpc("getmempoolinfo", ""));
@@ -709,10 +873,212 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("size", (int64_t)mempool.size()));
     ret.push_back(Pair("bytes", (int64_t)mempool.GetTotalTxSize()));
+    ret.push_back(Pair("usage", (int64_t)mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t)maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+
+    return ret;
+}
+
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns details on the signature verification cache.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"size\": xxxxx                (numeric) Number of signatures the cache can hold\n"
+            "  \"hits\": xxxxx                (numeric) Signature checks answered from the cache since startup\n"
+            "  \"misses\": xxxxx              (numeric) Signature checks that were not in the cache\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getsigcacheinfo", "") + HelpExampleRpc("getsigcacheinfo", ""));
+
+    SignatureCacheStats stats;
+    GetSignatureCacheStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("size", (int64_t)stats.nEntries));
+    ret.push_back(Pair("hits", (int64_t)stats.nHits));
+    ret.push_back(Pair("misses", (int64_t)stats.nMisses));
+
+    return ret;
+}
+
+UniValue getcoinscacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcoinscacheinfo\n"
+            "\nReturns details on the in-memory unspent transaction output cache.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"outputs\": xxxxx             (numeric) Number of cached transaction outputs\n"
+            "  \"usage\": xxxxx               (numeric) Estimated heap memory used by the cache, in bytes\n"
+            "  \"limit\": xxxxx               (numeric) Usage above which the cache is flushed to disk (see -dbcache), in bytes\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getcoinscacheinfo", "") + HelpExampleRpc("getcoinscacheinfo", ""));
+
+    LOCK(cs_main);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("outputs", (int64_t)pcoinsTip->GetCacheSize()));
+    ret.push_back(Pair("usage", (int64_t)pcoinsTip->DynamicMemoryUsage()));
+    ret.push_back(Pair("limit", (int64_t)nCoinCacheUsage));
+
+    return ret;
+}
+
+UniValue getblockfilecacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockfilecacheinfo\n"
+            "\nReturns details on the memory-mapped block and undo files used to read blocks.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"mapped_files\": xxxxx       (numeric) Number of files currently mapped\n"
+            "  \"max_mapped_files\": xxxxx   (numeric) Maximum number of mapped files (see -maxmappedfiles)\n"
+            "  \"mapped_bytes\": xxxxx       (numeric) Total size of the current mappings, in bytes\n"
+            "  \"hits\": xxxxx               (numeric) Reads served from an existing mapping\n"
+            "  \"maps\": xxxxx               (numeric) Files mapped, including files mapped again after growing\n"
+            "  \"evictions\": xxxxx          (numeric) Mappings dropped to stay within the limit\n"
+            "  \"file_opens\": xxxxx         (numeric) Reads that had to open the file instead\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getblockfilecacheinfo", "") + HelpExampleRpc("getblockfilecacheinfo", ""));
+
+    CBlockFileCacheStats stats = blockfilecache.GetStats();
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("mapped_files", (int64_t)stats.nMappedFiles));
+    ret.push_back(Pair("max_mapped_files", (int64_t)stats.nMaxMappedFiles));
+    ret.push_back(Pair("mapped_bytes", (int64_t)stats.nMappedBytes));
+    ret.push_back(Pair("hits", (int64_t)stats.nHits));
+    ret.push_back(Pair("maps", (int64_t)stats.nMaps));
+    ret.push_back(Pair("evictions", (int64_t)stats.nEvictions));
+    ret.push_back(Pair("file_opens", (int64_t)stats.nFileOpens));
 
     return ret;
 }
 
+UniValue getblockindexinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockindexinfo\n"
+            "\nReturns the memory used by the in-memory block index.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx                (numeric) Number of block index entries\n"
+            "  \"entry_size\": xxxxx             (numeric) Size of one entry, in bytes\n"
+            "  \"entry_bytes\": xxxxx            (numeric) Memory allocated for the entries\n"
+            "  \"map_bytes\": xxxxx              (numeric) Memory used by the hash map from block hash to entry\n"
+            "  \"cold_entries\": xxxxx           (numeric) Entries whose rarely used fields are held until written to disk\n"
+            "  \"cold_bytes\": xxxxx             (numeric) Memory used by those fields\n"
+            "  \"bytes_per_entry\": xxxxx        (numeric) Total memory used per entry\n"
+            "  \"bytes_per_entry_with_cold\": xx (numeric) Memory per entry if the rarely used fields were kept in memory\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getblockindexinfo", "") + HelpExampleRpc("getblockindexinfo", ""));
+
+    LOCK(cs_main);
+    CBlockIndexMemoryUsage usage = GetBlockIndexMemoryUsage();
+    size_t nTotal = usage.nArenaBytes + usage.nMapBytes + usage.nColdBytes;
+    double dPerEntry = usage.nEntries ? (double)nTotal / usage.nEntries : 0;
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", (int64_t)usage.nEntries));
+    ret.push_back(Pair("entry_size", (int64_t)sizeof(CBlockIndex)));
+    ret.push_back(Pair("entry_bytes", (int64_t)usage.nArenaBytes));
+    ret.push_back(Pair("map_bytes", (int64_t)usage.nMapBytes));
+    ret.push_back(Pair("cold_entries", (int64_t)usage.nColdEntries));
+    ret.push_back(Pair("cold_bytes", (int64_t)usage.nColdBytes));
+    ret.push_back(Pair("bytes_per_entry", dPerEntry));
+    ret.push_back(Pair("bytes_per_entry_with_cold", dPerEntry + sizeof(CBlockIndexCold)));
+
+    return ret;
+}
+
+static boost::filesystem::path GetTxOutSetSnapshotPath(const UniValue& param)
+{
+    boost::filesystem::path path(param.get_str());
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    return path;
+}
+
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"filename\"\n"
+            "\nWrites the unspent transaction outputs at the current tip, with the block index up to it,\n"
+            "to a snapshot file another node can be bootstrapped from with loadtxoutset.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) the file to write, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bestblock\": \"hash\",  (string) the block the snapshot was taken at\n"
+            "  \"height\": n,          (numeric) its height\n"
+            "  \"coins\": n,           (numeric) the number of unspent outputs written\n"
+            "  \"path\": \"path\",       (string) the file written\n"
+            "  \"hash\": \"hash\"        (string) the hash of the file, to pass to loadtxoutset\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("dumptxoutset", "\"utxo.dat\"") + HelpExampleRpc("dumptxoutset", "\"utxo.dat\""));
+
+    boost::filesystem::path path = GetTxOutSetSnapshotPath(params[0]);
+    CTxOutSetSnapshotInfo info;
+    std::string strError;
+    if (!DumpTxOutSet(path, info, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("bestblock", info.hashBlock.GetHex()));
+    ret.push_back(Pair("height", info.nHeight));
+    ret.push_back(Pair("coins", (int64_t)info.nCoins));
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("hash", info.hashSnapshot.GetHex()));
+    return ret;
+}
+
+UniValue loadtxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "loadtxoutset \"filename\" \"hash\"\n"
+            "\nBootstraps a node that has only the genesis block from a snapshot written by dumptxoutset.\n"
+            "The node continues validating from the snapshot block, and does not serve the blocks before it.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) the snapshot file, relative to the data directory unless absolute\n"
+            "2. \"hash\"        (string, required) the expected hash of the file, as returned by dumptxoutset\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bestblock\": \"hash\",  (string) the block the snapshot was taken at, now the tip\n"
+            "  \"height\": n,          (numeric) its height\n"
+            "  \"coins\": n            (numeric) the number of unspent outputs loaded\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"hash\"") + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"hash\""));
+
+    boost::filesystem::path path = GetTxOutSetSnapshotPath(params[0]);
+    uint256 hashExpected = ParseHashV(params[1], "hash");
+    CTxOutSetSnapshotInfo info;
+    std::string strError;
+    if (!LoadTxOutSet(path, hashExpected, info, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("bestblock", info.hashBlock.GetHex()));
+    ret.push_back(Pair("height", info.nHeight));
+    ret.push_back(Pair("coins", (int64_t)info.nCoins));
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -49,6 +49,12 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"getbalance", 1},
         {"getbalance", 2},
         {"getblockhash", 0},
+        {"getblockhashes", 0},
+        {"getblockhashes", 1},
+        {"getaddressbalance", 0},
+        {"getaddressutxos", 0},
+        {"getaddresstxids", 0},
+        {"getspentinfo", 0},
         {"move", 2},
         {"move", 3},
         {"sendfrom", 2},
@@ -82,6 +88,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"signrawtransaction", 2},
         {"sendrawtransaction", 1},
         {"sendrawtransaction", 2},
+        {"gettxoutsetinfo", 0},
         {"gettxout", 1},
         {"gettxout", 2},
         {"lockunspent", 0},
@@ -15,6 +15,7 @@
 #include "net.h"
 #include "pow.h"
 #include "rpcserver.h"
+#include "ui_interface.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
 #include "db.h"
@@ -299,6 +300,202 @@ static UniValue BIP22ValidationResult(const CValidationState& state)
     return "valid?";
 }
 
+/**
+ * getblocktemplate keeps one template, keyed by the tip and the mempool's count
+ * of transaction updates. New mempool transactions are appended to it; it is only
+ * assembled from scratch on a new tip, or when it is older than
+ * GBT_REASSEMBLE_INTERVAL seconds, so that better-paying transactions can take
+ * the place of those already in it. Protected by cs_main.
+ */
+static const int64_t GBT_REASSEMBLE_INTERVAL = 30;
+static CBlockIndex* pindexTemplate = NULL;
+static unsigned int nTemplateTransactionsUpdated = 0;
+static int64_t nTemplateAssembled = 0;
+static CBlockTemplate* pblocktemplateCached = NULL;
+//! The "transactions" of the template, extended as transactions are appended
+static UniValue templateTransactions(UniValue::VARR);
+
+/**
+ * Long polls are answered on a new tip, or once the template fees have grown by
+ * LONGPOLL_FEE_INCREASE_PERCENT (and at least the relay fee of 1kB) over those of
+ * the template the caller has.
+ */
+static const int64_t LONGPOLL_FEE_INCREASE_PERCENT = 10;
+static CCriticalSection cs_blockTemplateLongPoll;
+static uint256 hashLongPollTip;
+static CAmount nLongPollFees = 0;
+static bool fLongPollUpdateQueued = false;
+
+//! Add the transactions that are not in templateTransactions yet
+static void AppendTemplateTransactions()
+{
+    map<uint256, int64_t> setTxIndex;
+    int i = 0;
+    BOOST_FOREACH (const CTransaction& tx, pblocktemplateCached->block.vtx) {
+        uint256 txHash = tx.GetHash();
+        setTxIndex[txHash] = i++;
+
+        // templateTransactions leaves out the coinbase
+        if (tx.IsCoinBase() || (size_t)(i - 1) <= templateTransactions.size())
+            continue;
+
+        UniValue entry(UniValue::VOBJ);
+
+        entry.push_back(Pair("data", EncodeHexTx(tx)));
+
+        entry.push_back(Pair("hash", txHash.GetHex()));
+
+        UniValue deps(UniValue::VARR);
+        BOOST_FOREACH (const CTxIn& in, tx.vin) {
+            if (setTxIndex.count(in.prevout.hash))
+                deps.push_back(setTxIndex[in.prevout.hash]);
+        }
+        entry.push_back(Pair("depends", deps));
+
+        int index_in_template = i - 1;
+        entry.push_back(Pair("fee", pblocktemplateCached->vTxFees[index_in_template]));
+        entry.push_back(Pair("sigops", pblocktemplateCached->vTxSigOps[index_in_template]));
+
+        templateTransactions.push_back(entry);
+    }
+}
+
+/** Bring the cached template up to date with the tip and the mempool */
+static void UpdateBlockTemplateCache()
+{
+    AssertLockHeld(cs_main);
+    CBlockIndex* pindexTip = chainActive.Tip();
+    unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    if (pblocktemplateCached && pindexTemplate == pindexTip && nTemplateTransactionsUpdated == nTransactionsUpdated)
+        return;
+
+    if (pblocktemplateCached && pindexTemplate == pindexTip && GetTime() - nTemplateAssembled < GBT_REASSEMBLE_INTERVAL) {
+        nTemplateTransactionsUpdated = nTransactionsUpdated;
+        if (UpdateNewBlock(pblocktemplateCached))
+            AppendTemplateTransactions();
+    } else {
+        // Clear pindexTemplate so future calls make a new block, despite any failures from here on
+        pindexTemplate = NULL;
+        if (pblocktemplateCached) {
+            delete pblocktemplateCached;
+            pblocktemplateCached = NULL;
+        }
+
+        // Store the mempool state before CreateNewBlock, to avoid races
+        nTemplateTransactionsUpdated = nTransactionsUpdated;
+        nTemplateAssembled = GetTime();
+
+        CScript scriptDummy = CScript() << OP_TRUE;
+        pblocktemplateCached = CreateNewBlock(scriptDummy, pwalletMain, false);
+        if (!pblocktemplateCached)
+            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+
+        // Need to update only after we know CreateNewBlock succeeded
+        pindexTemplate = pindexTip;
+        templateTransactions = UniValue(UniValue::VARR);
+        AppendTemplateTransactions();
+    }
+
+    LOCK(cs_blockTemplateLongPoll);
+    hashLongPollTip = pindexTemplate->GetBlockHash();
+    nLongPollFees = -pblocktemplateCached->vTxFees[0];
+}
+
+//! Format: <hashBestChain><template fees>
+static void ParseLongPollId(const std::string& strId, uint256& hashWatchedChain, CAmount& nFeesWatched)
+{
+    hashWatchedChain.SetHex(strId.substr(0, 64));
+    nFeesWatched = strId.size() > 64 ? atoi64(strId.substr(64)) : 0;
+}
+
+static bool LongPollWaiting(const uint256& hashWatchedChain, CAmount nFeesWatched)
+{
+    CAmount nFeeIncrease = std::max(nFeesWatched * LONGPOLL_FEE_INCREASE_PERCENT / 100, ::minRelayTxFee.GetFee(1000));
+    LOCK(cs_blockTemplateLongPoll);
+    return hashWatchedChain == hashLongPollTip && nLongPollFees < nFeesWatched + nFeeIncrease;
+}
+
+//! The RPCLongPollWaitFn of getblocktemplate
+static bool GetBlockTemplateWaiting(const UniValue& params)
+{
+    if (params.size() == 0 || !params[0].isObject())
+        return false;
+    const UniValue& lpval = find_value(params[0].get_obj(), "longpollid");
+    if (!lpval.isStr())
+        return false;
+
+    uint256 hashWatchedChain;
+    CAmount nFeesWatched;
+    ParseLongPollId(lpval.get_str(), hashWatchedChain, nFeesWatched);
+    return LongPollWaiting(hashWatchedChain, nFeesWatched);
+}
+
+//! Patch the template with what arrived in the mempool, then answer the long polls that can be
+static void UpdateBlockTemplateLongPoll()
+{
+    {
+        LOCK(cs_blockTemplateLongPoll);
+        fLongPollUpdateQueued = false;
+    }
+    try {
+        LOCK(cs_main);
+        if (!IsInitialBlockDownload())
+            UpdateBlockTemplateCache();
+    } catch (const UniValue& objError) {
+        LogPrint("rpc", "%s: %s\n", __func__, find_value(objError, "message").get_str());
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    RPCNotifyLongPoll("getblocktemplate");
+}
+
+//! Runs UpdateBlockTemplateLongPoll shortly, once getblocktemplate has been used
+static void QueueBlockTemplateUpdate()
+{
+    LOCK(cs_blockTemplateLongPoll);
+    if (fLongPollUpdateQueued || hashLongPollTip.IsNull() || !IsRPCRunning())
+        return;
+    fLongPollUpdateQueued = true;
+    RPCRunLater("getblocktemplate", UpdateBlockTemplateLongPoll, 1);
+}
+
+static void BlockTemplateTipChanged(const uint256& hashNewTip)
+{
+    {
+        // Wake the long polls even if no template can be made on the new tip
+        LOCK(cs_blockTemplateLongPoll);
+        if (!hashLongPollTip.IsNull())
+            hashLongPollTip = hashNewTip;
+    }
+    QueueBlockTemplateUpdate();
+}
+
+class CBlockTemplateNotifier : public CValidationInterface
+{
+protected:
+    virtual void SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+    {
+        // Transactions entering or leaving the mempool
+        if (!pblock)
+            QueueBlockTemplateUpdate();
+    }
+};
+
+static CBlockTemplateNotifier blockTemplateNotifier;
+
+void InitRPCMining()
+{
+    RPCRegisterLongPoll("getblocktemplate", GetBlockTemplateWaiting);
+    RegisterValidationInterface(&blockTemplateNotifier);
+    uiInterface.NotifyBlockTip.connect(BlockTemplateTipChanged);
+}
+
+void ShutdownRPCMining()
+{
+    uiInterface.NotifyBlockTip.disconnect(BlockTemplateTipChanged);
+    UnregisterValidationInterface(&blockTemplateNotifier);
+}
+
 UniValue getblocktemplate(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -315,7 +512,8 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             "       \"capabilities\":[       (array, optional) A list of strings\n"
             "           \"support\"           (string) client side supported feature, 'longpoll', 'coinbasetxn', 'coinbasevalue', 'proposal', 'serverlist', 'workid'\n"
             "           ,...\n"
-            "         ]\n"
+            "         ],\n"
+            "       \"longpollid\":\"id\"   (string, optional) wait until the chain tip changes or the template fees rise well above those of the template with this id\n"
             "     }\n"
             "\n"
 
@@ -342,6 +540,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             "  },\n"
             "  \"coinbasevalue\" : n,               (numeric) maximum allowable input to coinbase transaction, including the generation award and transaction fees (in uapr)\n"
             "  \"coinbasetxn\" : { ... },           (json object) information for coinbase transaction\n"
+            "  \"longpollid\" : \"xxxx\",           (string) id of this template, to send back for long polling\n"
             "  \"target\" : \"xxxx\",               (string) The hash target\n"
             "  \"mintime\" : xxx,                   (numeric) The minimum timestamp appropriate for next block time in seconds since epoch (Jan 1 1970 GMT)\n"
             "  \"mutable\" : [                      (array of string) list of ways the block template may be changed \n"
@@ -419,24 +618,19 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     if (IsInitialBlockDownload())
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "USD Coin is downloading blocks...");
 
-    static unsigned int nTransactionsUpdatedLast;
-
     if (!lpval.isNull()) {
-        // Wait to respond until either the best block changes, OR a minute has passed and there are more transactions
+        // Calls over HTTP were parked by the RPC server while they had to wait;
+        // others, like batched calls, wait here
         uint256 hashWatchedChain;
-        boost::system_time checktxtime;
-        unsigned int nTransactionsUpdatedLastLP;
+        CAmount nFeesWatched;
 
+        UpdateBlockTemplateCache();
         if (lpval.isStr()) {
-            // Format: <hashBestChain><nTransactionsUpdatedLast>
-            std::string lpstr = lpval.get_str();
-
-            hashWatchedChain.SetHex(lpstr.substr(0, 64));
-            nTransactionsUpdatedLastLP = atoi64(lpstr.substr(64));
+            ParseLongPollId(lpval.get_str(), hashWatchedChain, nFeesWatched);
         } else {
             // NOTE: Spec does not specify behaviour for non-string longpollid, but this makes testing easier
             hashWatchedChain = chainActive.Tip()->GetBlockHash();
-            nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
+            nFeesWatched = -pblocktemplateCached->vTxFees[0];
         }
 
 // Release the wallet and main lock while waiting
@@ -446,17 +640,9 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 #endif
         LEAVE_CRITICAL_SECTION(cs_main);
         {
-            checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
-
             boost::unique_lock<boost::mutex> lock(csBestBlock);
-            while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning()) {
-                if (!cvBlockChange.timed_wait(lock, checktxtime)) {
-                    // Timeout: Check transactions for update
-                    if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
-                        break;
-                    checktxtime += boost::posix_time::seconds(10);
-                }
-            }
+            while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && LongPollWaiting(hashWatchedChain, nFeesWatched) && IsRPCRunning())
+                cvBlockChange.timed_wait(lock, boost::get_system_time() + boost::posix_time::seconds(10));
         }
         ENTER_CRITICAL_SECTION(cs_main);
 #ifdef ENABLE_WALLET
@@ -469,34 +655,9 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
     }
 
-    // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5)) {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the chainActive.Tip() used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-
-        // Create new block
-        if (pblocktemplate) {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
-        }
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = CreateNewBlock(scriptDummy, pwalletMain, false);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-    }
-    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
+    UpdateBlockTemplateCache();
+    CBlockIndex* pindexPrev = pindexTemplate;
+    CBlock* pblock = &pblocktemplateCached->block; // pointer for convenience
 
     // Update nTime
     UpdateTime(pblock, pindexPrev);
@@ -504,36 +665,6 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 
     UniValue aCaps(UniValue::VARR); aCaps.push_back("proposal");
 
-    UniValue transactions(UniValue::VARR);
-    map<uint256, int64_t> setTxIndex;
-    int i = 0;
-    BOOST_FOREACH (CTransaction& tx, pblock->vtx) {
-        uint256 txHash = tx.GetHash();
-        setTxIndex[txHash] = i++;
-
-        if (tx.IsCoinBase())
-            continue;
-
-        UniValue entry(UniValue::VOBJ);
-
-        entry.push_back(Pair("data", EncodeHexTx(tx)));
-
-        entry.push_back(Pair("hash", txHash.GetHex()));
-
-        UniValue deps(UniValue::VARR);
-        BOOST_FOREACH (const CTxIn& in, tx.vin) {
-            if (setTxIndex.count(in.prevout.hash))
-                deps.push_back(setTxIndex[in.prevout.hash]);
-        }
-        entry.push_back(Pair("depends", deps));
-
-        int index_in_template = i - 1;
-        entry.push_back(Pair("fee", pblocktemplate->vTxFees[index_in_template]));
-        entry.push_back(Pair("sigops", pblocktemplate->vTxSigOps[index_in_template]));
-
-        transactions.push_back(entry);
-    }
-
     UniValue aux(UniValue::VOBJ);
     aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
 
@@ -552,10 +683,10 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     result.push_back(Pair("capabilities", aCaps));
     result.push_back(Pair("version", pblock->nVersion));
     result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
-    result.push_back(Pair("transactions", transactions));
+    result.push_back(Pair("transactions", templateTransactions));
     result.push_back(Pair("coinbaseaux", aux));
     result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].GetValueOut()));
-    result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
+    result.push_back(Pair("longpollid", pindexPrev->GetBlockHash().GetHex() + i64tostr(-pblocktemplateCached->vTxFees[0])));
     result.push_back(Pair("target", hashTarget.GetHex()));
     result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast() + 1));
     result.push_back(Pair("mutable", aMutable));
@@ -676,6 +807,7 @@ UniValue estimatefee(const UniValue& params, bool fHelp)
             "\n"
             "-1.0 is returned if not enough transactions and\n"
             "blocks have been observed to make an estimate.\n"
+            "The estimate is at least the minimum fee of the mempool.\n"
             "\nExample:\n" +
             HelpExampleCli("estimatefee", "6"));
 
@@ -689,6 +821,9 @@ UniValue estimatefee(const UniValue& params, bool fHelp)
     if (feeRate == CFeeRate(0))
         return -1.0;
 
+    // A full mempool does not take transactions below its minimum fee
+    feeRate = std::max(feeRate, mempool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000));
+
     return ValueFromAmount(feeRate.GetFeePerK());
 }
 
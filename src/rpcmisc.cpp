@@ -8,13 +8,16 @@
 #include "base58.h"
 #include "clientversion.h"
 #include "init.h"
+#include "kernel.h"
 #include "main.h"
 #include "masternode-sync.h"
+#include "miner.h"
 #include "net.h"
 #include "netbase.h"
 #include "rpcserver.h"
 #include "spork.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
 #include "wallet.h"
@@ -466,6 +469,259 @@ UniValue verifymessage(const UniValue& params, bool fHelp)
     return (pubkey.GetID() == keyID);
 }
 
+static bool GetAddressIndexKey(const std::string& strAddress, unsigned char& type, uint160& hashBytes)
+{
+    CTxDestination dest = CBitcoinAddress(strAddress).Get();
+    if (const CKeyID* keyID = boost::get<CKeyID>(&dest)) {
+        type = ADDRESS_TYPE_PUBKEYHASH;
+        hashBytes = *keyID;
+        return true;
+    }
+    if (const CScriptID* scriptID = boost::get<CScriptID>(&dest)) {
+        type = ADDRESS_TYPE_SCRIPTHASH;
+        hashBytes = *scriptID;
+        return true;
+    }
+    return false;
+}
+
+static std::string GetAddressFromIndexKey(unsigned char type, const uint160& hashBytes)
+{
+    if (type == ADDRESS_TYPE_SCRIPTHASH)
+        return CBitcoinAddress(CScriptID(hashBytes)).ToString();
+    return CBitcoinAddress(CKeyID(hashBytes)).ToString();
+}
+
+/** Parse either a single address string or an object with an "addresses" array. */
+static void GetAddressesFromParams(const UniValue& params, vector<pair<unsigned char, uint160> >& vAddresses)
+{
+    vector<string> vStrAddresses;
+    if (params[0].isStr()) {
+        vStrAddresses.push_back(params[0].get_str());
+    } else if (params[0].isObject()) {
+        const UniValue& addresses = find_value(params[0].get_obj(), "addresses");
+        if (!addresses.isArray())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Addresses is expected to be an array");
+        for (unsigned int i = 0; i < addresses.size(); i++)
+            vStrAddresses.push_back(addresses[i].get_str());
+    } else {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Expected an address or an object with addresses");
+    }
+
+    BOOST_FOREACH (const string& strAddress, vStrAddresses) {
+        unsigned char type;
+        uint160 hashBytes;
+        if (!GetAddressIndexKey(strAddress, type, hashBytes))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address: " + strAddress);
+        vAddresses.push_back(make_pair(type, hashBytes));
+    }
+}
+
+static bool CompareUnspentHeight(const pair<CAddressUnspentKey, CAddressUnspentValue>& a, const pair<CAddressUnspentKey, CAddressUnspentValue>& b)
+{
+    return a.second.blockHeight < b.second.blockHeight;
+}
+
+UniValue getaddressbalance(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance \"address\"|{\"addresses\":[\"address\",...]}\n"
+            "\nReturns the balance of one or more addresses in the best chain (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"       (string) An address\n"
+            "   or\n"
+            "   {\n"
+            "     \"addresses\": [\"address\",...]  (array of strings) The addresses\n"
+            "   }\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\": n,     (numeric) The current balance in satoshis\n"
+            "  \"received\": n     (numeric) The total amount received in satoshis, including change\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"UZzaoweEKZzNj3TVymC5PEufJvg7PynJfJ\"]}'") +
+            HelpExampleRpc("getaddressbalance", "{\"addresses\": [\"UZzaoweEKZzNj3TVymC5PEufJvg7PynJfJ\"]}"));
+
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, restart with -addressindex -reindex");
+
+    vector<pair<unsigned char, uint160> > vAddresses;
+    GetAddressesFromParams(params, vAddresses);
+
+    CAmount nBalance = 0;
+    CAmount nReceived = 0;
+    for (vector<pair<unsigned char, uint160> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); ++it) {
+        vector<pair<CAddressIndexKey, CAmount> > vAddressIndex;
+        if (!pblocktree->ReadAddressIndex(it->first, it->second, vAddressIndex))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the address index");
+        for (vector<pair<CAddressIndexKey, CAmount> >::const_iterator entry = vAddressIndex.begin(); entry != vAddressIndex.end(); ++entry) {
+            nBalance += entry->second;
+            if (entry->second > 0)
+                nReceived += entry->second;
+        }
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("balance", nBalance));
+    result.push_back(Pair("received", nReceived));
+    return result;
+}
+
+UniValue getaddressutxos(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos \"address\"|{\"addresses\":[\"address\",...]}\n"
+            "\nReturns the unspent outputs of one or more addresses in the best chain (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"       (string) An address\n"
+            "   or\n"
+            "   {\n"
+            "     \"addresses\": [\"address\",...]  (array of strings) The addresses\n"
+            "   }\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\": \"address\",  (string) The address\n"
+            "    \"txid\": \"hash\",        (string) The transaction id\n"
+            "    \"outputIndex\": n,      (numeric) The output index\n"
+            "    \"script\": \"hex\",       (string) The output script\n"
+            "    \"satoshis\": n,         (numeric) The output value in satoshis\n"
+            "    \"height\": n            (numeric) The height of the block that created the output\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"UZzaoweEKZzNj3TVymC5PEufJvg7PynJfJ\"]}'") +
+            HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"UZzaoweEKZzNj3TVymC5PEufJvg7PynJfJ\"]}"));
+
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, restart with -addressindex -reindex");
+
+    vector<pair<unsigned char, uint160> > vAddresses;
+    GetAddressesFromParams(params, vAddresses);
+
+    vector<pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspentOutputs;
+    for (vector<pair<unsigned char, uint160> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); ++it) {
+        if (!pblocktree->ReadAddressUnspentIndex(it->first, it->second, vUnspentOutputs))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the address index");
+    }
+    std::stable_sort(vUnspentOutputs.begin(), vUnspentOutputs.end(), CompareUnspentHeight);
+
+    UniValue result(UniValue::VARR);
+    for (vector<pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = vUnspentOutputs.begin(); it != vUnspentOutputs.end(); ++it) {
+        UniValue output(UniValue::VOBJ);
+        output.push_back(Pair("address", GetAddressFromIndexKey(it->first.type, it->first.hashBytes)));
+        output.push_back(Pair("txid", it->first.txhash.GetHex()));
+        output.push_back(Pair("outputIndex", (int)it->first.index));
+        output.push_back(Pair("script", HexStr(it->second.script.begin(), it->second.script.end())));
+        output.push_back(Pair("satoshis", it->second.satoshis));
+        output.push_back(Pair("height", it->second.blockHeight));
+        result.push_back(output);
+    }
+    return result;
+}
+
+UniValue getaddresstxids(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddresstxids \"address\"|{\"addresses\":[\"address\",...],\"start\":n,\"end\":n}\n"
+            "\nReturns the ids of the transactions that credit or debit one or more addresses, in block order (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"       (string) An address\n"
+            "   or\n"
+            "   {\n"
+            "     \"addresses\": [\"address\",...]  (array of strings) The addresses\n"
+            "     \"start\": n                    (numeric, optional) The first block height\n"
+            "     \"end\": n                      (numeric, optional) The last block height\n"
+            "   }\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"txid\"  (string) The transaction id\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"UZzaoweEKZzNj3TVymC5PEufJvg7PynJfJ\"]}'") +
+            HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"UZzaoweEKZzNj3TVymC5PEufJvg7PynJfJ\"]}"));
+
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, restart with -addressindex -reindex");
+
+    vector<pair<unsigned char, uint160> > vAddresses;
+    GetAddressesFromParams(params, vAddresses);
+
+    int nStart = 0;
+    int nEnd = 0;
+    if (params[0].isObject()) {
+        const UniValue& start = find_value(params[0].get_obj(), "start");
+        const UniValue& end = find_value(params[0].get_obj(), "end");
+        if (!start.isNull())
+            nStart = start.get_int();
+        if (!end.isNull())
+            nEnd = end.get_int();
+        if (nStart < 0 || nEnd < 0 || (nEnd > 0 && nEnd < nStart))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid start or end height");
+    }
+
+    // Ordered by height and position in the block; a transaction that touches
+    // several of the addresses, or one address several times, is listed once
+    set<pair<pair<int, unsigned int>, uint256> > setTxids;
+    for (vector<pair<unsigned char, uint160> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); ++it) {
+        vector<pair<CAddressIndexKey, CAmount> > vAddressIndex;
+        if (!pblocktree->ReadAddressIndex(it->first, it->second, vAddressIndex, nStart, nEnd))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the address index");
+        for (vector<pair<CAddressIndexKey, CAmount> >::const_iterator entry = vAddressIndex.begin(); entry != vAddressIndex.end(); ++entry)
+            setTxids.insert(make_pair(make_pair(entry->first.blockHeight, entry->first.txindex), entry->first.txhash));
+    }
+
+    UniValue result(UniValue::VARR);
+    for (set<pair<pair<int, unsigned int>, uint256> >::const_iterator it = setTxids.begin(); it != setTxids.end(); ++it)
+        result.push_back(it->second.GetHex());
+    return result;
+}
+
+UniValue getspentinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1 || !params[0].isObject())
+        throw runtime_error(
+            "getspentinfo {\"txid\":\"hash\",\"index\":n}\n"
+            "\nReturns the input that spends an output in the best chain (requires -spentindex).\n"
+            "\nArguments:\n"
+            "1. {\n"
+            "     \"txid\": \"hash\",  (string, required) The id of the transaction of the output\n"
+            "     \"index\": n       (numeric, required) The output index\n"
+            "   }\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\": \"hash\",  (string) The id of the spending transaction\n"
+            "  \"index\": n,      (numeric) The index of the spending input\n"
+            "  \"height\": n      (numeric) The height of the block of the spending transaction\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getspentinfo", "'{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}'") +
+            HelpExampleRpc("getspentinfo", "{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}"));
+
+    if (!fSpentIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Spent index not enabled, restart with -spentindex -reindex");
+
+    uint256 txid = ParseHashO(params[0].get_obj(), "txid");
+    const UniValue& index = find_value(params[0].get_obj(), "index");
+    if (!index.isNum() || index.get_int() < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid output index");
+
+    CSpentIndexValue value;
+    if (!pblocktree->ReadSpentIndex(CSpentIndexKey(txid, index.get_int()), value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("txid", value.txid.GetHex()));
+    result.push_back(Pair("index", (int)value.inputIndex));
+    result.push_back(Pair("height", value.blockHeight));
+    return result;
+}
+
 UniValue setmocktime(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -501,6 +757,14 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
             "  \"enoughcoins\": true|false,        (boolean) if available coins are greater than reserve balance\n"
             "  \"mnsync\": true|false,             (boolean) if masternode data is synced\n"
             "  \"staking status\": true|false,     (boolean) if the wallet is staking or not\n"
+            "  \"hashespersec\": n,                 (numeric) stake kernel hashes per second of the last search\n"
+            "  \"latency\": [                      (array) how long it took from a new tip to the first kernel search on it\n"
+            "    {\n"
+            "      \"maxms\": n,                     (numeric) upper bound of the bucket in milliseconds, absent for the last bucket\n"
+            "      \"count\": n                      (numeric) number of tips\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getstakingstatus", "") + HelpExampleRpc("getstakingstatus", ""));
@@ -521,6 +785,18 @@ UniValue getstakingstatus(const UniValue& params, bool fHelp)
     else if (mapHashedBlocks.count(chainActive.Tip()->nHeight - 1) && nLastCoinStakeSearchInterval)
         nStaking = true;
     obj.push_back(Pair("staking status", nStaking));
+    obj.push_back(Pair("hashespersec", (int64_t)dStakeHashesPerSec));
+
+    std::vector<uint64_t> vLatencyCounts = GetStakeLatencyHistogram();
+    UniValue latency(UniValue::VARR);
+    for (int i = 0; i < STAKE_LATENCY_NUM_BUCKETS; i++) {
+        UniValue bucket(UniValue::VOBJ);
+        if (i < STAKE_LATENCY_NUM_BUCKETS - 1)
+            bucket.push_back(Pair("maxms", STAKE_LATENCY_BUCKETS_MS[i]));
+        bucket.push_back(Pair("count", vLatencyCounts[i]));
+        latency.push_back(bucket);
+    }
+    obj.push_back(Pair("latency", latency));
 
     return obj;
 }
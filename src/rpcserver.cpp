@@ -43,6 +43,7 @@ static CCriticalSection cs_rpcWarmup;
 //! These are created by StartRPCThreads, destroyed in StopRPCThreads
 static asio::io_service* rpc_io_service = NULL;
 static map<string, boost::shared_ptr<deadline_timer> > deadlineTimers;
+static CCriticalSection cs_deadlineTimers;
 static ssl::context* rpc_ssl_context = NULL;
 static boost::thread_group* rpc_worker_group = NULL;
 static boost::asio::io_service::work* rpc_dummy_work = NULL;
@@ -280,18 +281,32 @@ static const CRPCCommand vRPCCommands[] =
         {"blockchain", "getblockcount", &getblockcount, true, false, false},
         {"blockchain", "getblock", &getblock, true, false, false},
         {"blockchain", "getblockhash", &getblockhash, true, false, false},
+        {"blockchain", "getblockhashes", &getblockhashes, true, false, false},
         {"blockchain", "getblockheader", &getblockheader, false, false, false},
+        {"blockchain", "getblockstats", &getblockstats, true, false, false},
         {"blockchain", "getchaintips", &getchaintips, true, false, false},
         {"blockchain", "getdifficulty", &getdifficulty, true, false, false},
         {"blockchain", "getfeeinfo", &getfeeinfo, true, false, false},
         {"blockchain", "getmempoolinfo", &getmempoolinfo, true, true, false},
         {"blockchain", "getrawmempool", &getrawmempool, true, false, false},
+        {"blockchain", "getspentinfo", &getspentinfo, true, false, false},
+        {"blockchain", "getsigcacheinfo", &getsigcacheinfo, true, true, false},
+        {"blockchain", "getcoinscacheinfo", &getcoinscacheinfo, true, false, false},
+        {"blockchain", "getblockfilecacheinfo", &getblockfilecacheinfo, true, false, false},
+        {"blockchain", "getblockindexinfo", &getblockindexinfo, true, false, false},
+        {"blockchain", "dumptxoutset", &dumptxoutset, true, false, false},
+        {"blockchain", "loadtxoutset", &loadtxoutset, true, false, false},
         {"blockchain", "gettxout", &gettxout, true, false, false},
         {"blockchain", "gettxoutsetinfo", &gettxoutsetinfo, true, false, false},
         {"blockchain", "invalidateblock", &invalidateblock, true, true, false},
         {"blockchain", "reconsiderblock", &reconsiderblock, true, true, false},
         {"blockchain", "verifychain", &verifychain, true, false, false},
 
+        /* Address index */
+        {"addressindex", "getaddressbalance", &getaddressbalance, true, false, false},
+        {"addressindex", "getaddressutxos", &getaddressutxos, true, false, false},
+        {"addressindex", "getaddresstxids", &getaddresstxids, true, false, false},
+
         /* Mining */
         {"mining", "getblocktemplate", &getblocktemplate, true, false, false},
         {"mining", "getmininginfo", &getmininginfo, true, false, false},
@@ -513,7 +528,8 @@ private:
     iostreams::stream<SSLIOStreamDevice<Protocol> > _stream;
 };
 
-void ServiceConnection(AcceptedConnection* conn);
+void ServiceConnection(boost::shared_ptr<AcceptedConnection> conn);
+static void DropParkedLongPolls();
 
 //! Forward declaration required for RPCListen
 template <typename Protocol, typename SocketAcceptorService>
@@ -575,8 +591,7 @@ static void RPCAcceptHandler(boost::shared_ptr<basic_socket_acceptor<Protocol, S
             conn->stream() << HTTPError(HTTP_FORBIDDEN, false) << std::flush;
         conn->close();
     } else {
-        ServiceConnection(conn.get());
-        conn->close();
+        ServiceConnection(conn);
     }
 }
 
@@ -760,12 +775,16 @@ void StopRPCThreads()
             LogPrintf("%s: Warning: %s when cancelling acceptor", __func__, ec.message());
     }
     rpc_acceptors.clear();
-    BOOST_FOREACH (const PAIRTYPE(std::string, boost::shared_ptr<deadline_timer>) & timer, deadlineTimers) {
-        timer.second->cancel(ec);
-        if (ec)
-            LogPrintf("%s: Warning: %s when cancelling timer", __func__, ec.message());
+    {
+        LOCK(cs_deadlineTimers);
+        BOOST_FOREACH (const PAIRTYPE(std::string, boost::shared_ptr<deadline_timer>) & timer, deadlineTimers) {
+            timer.second->cancel(ec);
+            if (ec)
+                LogPrintf("%s: Warning: %s when cancelling timer", __func__, ec.message());
+        }
+        deadlineTimers.clear();
     }
-    deadlineTimers.clear();
+    DropParkedLongPolls();
 
     DeleteAuthCookie();
 
@@ -817,6 +836,7 @@ void RPCRunHandler(const boost::system::error_code& err, boost::function<void(vo
 
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds)
 {
+    LOCK(cs_deadlineTimers);
     assert(rpc_io_service != NULL);
 
     if (deadlineTimers.count(name) == 0) {
@@ -869,6 +889,97 @@ void JSONRequest::parse(const UniValue& valRequest)
 }
 
 
+//! A long-polling call that had to wait, see RPCRegisterLongPoll
+struct LongPollRequest {
+    boost::shared_ptr<AcceptedConnection> conn;
+    JSONRequest jreq;
+    bool fRun;
+};
+
+static CCriticalSection cs_rpcLongPoll;
+static std::map<std::string, RPCLongPollWaitFn> mapLongPollMethods;
+static std::list<LongPollRequest> lParkedLongPolls;
+
+void RPCRegisterLongPoll(const std::string& strMethod, RPCLongPollWaitFn fnWait)
+{
+    LOCK(cs_rpcLongPoll);
+    mapLongPollMethods[strMethod] = fnWait;
+}
+
+/** Park a long-polling call if it has to wait. The connection is left open for the reply. */
+static bool ParkLongPoll(boost::shared_ptr<AcceptedConnection> conn, const JSONRequest& jreq, bool fRun)
+{
+    LOCK(cs_rpcLongPoll);
+    std::map<std::string, RPCLongPollWaitFn>::const_iterator it = mapLongPollMethods.find(jreq.strMethod);
+    if (it == mapLongPollMethods.end() || !fRPCRunning || !it->second(jreq.params))
+        return false;
+
+    LongPollRequest req;
+    req.conn = conn;
+    req.jreq = jreq;
+    req.fRun = fRun;
+    lParkedLongPolls.push_back(req);
+    return true;
+}
+
+/** Execute a parked call, reply and carry on serving its connection */
+static void ReplyLongPoll(LongPollRequest req)
+{
+    try {
+        UniValue result = tableRPC.execute(req.jreq.strMethod, req.jreq.params);
+        string strReply = JSONRPCReply(result, NullUniValue, req.jreq.id);
+        req.conn->stream() << HTTPReplyHeader(HTTP_OK, req.fRun, strReply.size()) << strReply << std::flush;
+    } catch (const UniValue& objError) {
+        ErrorReply(req.conn->stream(), objError, req.jreq.id);
+        req.conn->close();
+        return;
+    } catch (std::exception& e) {
+        ErrorReply(req.conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), req.jreq.id);
+        req.conn->close();
+        return;
+    }
+
+    if (req.fRun)
+        ServiceConnection(req.conn);
+    else
+        req.conn->close();
+}
+
+void RPCNotifyLongPoll(const std::string& strMethod)
+{
+    std::vector<LongPollRequest> vReady;
+    {
+        LOCK(cs_rpcLongPoll);
+        if (rpc_io_service == NULL || !fRPCRunning)
+            return;
+        std::map<std::string, RPCLongPollWaitFn>::const_iterator mi = mapLongPollMethods.find(strMethod);
+        if (mi == mapLongPollMethods.end())
+            return;
+        std::list<LongPollRequest>::iterator it = lParkedLongPolls.begin();
+        while (it != lParkedLongPolls.end()) {
+            if (it->jreq.strMethod == strMethod && !mi->second(it->jreq.params)) {
+                vReady.push_back(*it);
+                it = lParkedLongPolls.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Each reply goes to whichever RPC thread is free
+    BOOST_FOREACH (const LongPollRequest& req, vReady)
+        rpc_io_service->post(boost::bind(&ReplyLongPoll, req));
+}
+
+/** Close the connections of all parked calls, on shutdown */
+static void DropParkedLongPolls()
+{
+    LOCK(cs_rpcLongPoll);
+    BOOST_FOREACH (LongPollRequest& req, lParkedLongPolls)
+        req.conn->close();
+    lParkedLongPolls.clear();
+}
+
 static UniValue JSONRPCExecOne(const UniValue& req)
 {
     UniValue rpc_result(UniValue::VOBJ);
@@ -898,10 +1009,11 @@ static string JSONRPCExecBatch(const UniValue& vReq)
     return ret.write() + "\n";
 }
 
-static bool HTTPReq_JSONRPC(AcceptedConnection* conn,
+static bool HTTPReq_JSONRPC(boost::shared_ptr<AcceptedConnection> conn,
     string& strRequest,
     map<string, string>& mapHeaders,
-    bool fRun)
+    bool fRun,
+    bool& fParked)
 {
     // Check authorization
     if (mapHeaders.count("authorization") == 0) {
@@ -940,6 +1052,12 @@ static bool HTTPReq_JSONRPC(AcceptedConnection* conn,
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            // A long poll that has to wait is answered later by RPCNotifyLongPoll
+            if (ParkLongPoll(conn, jreq, fRun)) {
+                fParked = true;
+                return false;
+            }
+
             UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
 
             // Send reply
@@ -962,7 +1080,7 @@ static bool HTTPReq_JSONRPC(AcceptedConnection* conn,
     return true;
 }
 
-void ServiceConnection(AcceptedConnection* conn)
+void ServiceConnection(boost::shared_ptr<AcceptedConnection> conn)
 {
     bool fRun = true;
     while (fRun && !ShutdownRequested()) {
@@ -983,12 +1101,17 @@ void ServiceConnection(AcceptedConnection* conn)
 
         // Process via JSON-RPC API
         if (strURI == "/") {
-            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun))
+            bool fParked = false;
+            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun, fParked)) {
+                // The connection stays open for the reply to the parked call
+                if (fParked)
+                    return;
                 break;
+            }
 
             // Process via HTTP REST API
         } else if (strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false)) {
-            if (!HTTPReq_REST(conn, strURI, mapHeaders, fRun))
+            if (!HTTPReq_REST(conn.get(), strURI, mapHeaders, fRun))
                 break;
 
         } else {
@@ -996,6 +1119,7 @@ void ServiceConnection(AcceptedConnection* conn)
             break;
         }
     }
+    conn->close();
 }
 
 UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
@@ -79,6 +79,18 @@ void RPCTypeCheckObj(const UniValue& o,
  */
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds);
 
+/** Whether a call to a long-polling method has to wait, given its params */
+typedef bool (*RPCLongPollWaitFn)(const UniValue& params);
+
+/**
+ * Register a long-polling method. An HTTP call to it is parked while fnWait
+ * returns true for its params: it holds neither an RPC thread nor any lock
+ * until RPCNotifyLongPoll finds that it can be answered.
+ */
+void RPCRegisterLongPoll(const std::string& strMethod, RPCLongPollWaitFn fnWait);
+/** Answer the parked calls to strMethod that no longer have to wait */
+void RPCNotifyLongPoll(const std::string& strMethod);
+
 //! Convert boost::asio address to CNetAddr
 extern CNetAddr BoostAsioToCNetAddr(boost::asio::ip::address address);
 
@@ -236,9 +248,17 @@ extern UniValue settxfee(const UniValue& params, bool fHelp);
 extern UniValue getmempoolinfo(const UniValue& params, bool fHelp);
 extern UniValue getrawmempool(const UniValue& params, bool fHelp);
 extern UniValue getblockhash(const UniValue& params, bool fHelp);
+extern UniValue getblockhashes(const UniValue& params, bool fHelp);
 extern UniValue getblock(const UniValue& params, bool fHelp);
 extern UniValue getblockheader(const UniValue& params, bool fHelp);
+extern UniValue getblockstats(const UniValue& params, bool fHelp);
 extern UniValue getfeeinfo(const UniValue& params, bool fHelp);
+extern UniValue getsigcacheinfo(const UniValue& params, bool fHelp);
+extern UniValue getcoinscacheinfo(const UniValue& params, bool fHelp);
+extern UniValue getblockfilecacheinfo(const UniValue& params, bool fHelp);
+extern UniValue getblockindexinfo(const UniValue& params, bool fHelp);
+extern UniValue dumptxoutset(const UniValue& params, bool fHelp);
+extern UniValue loadtxoutset(const UniValue& params, bool fHelp);
 extern UniValue gettxoutsetinfo(const UniValue& params, bool fHelp);
 extern UniValue gettxout(const UniValue& params, bool fHelp);
 extern UniValue verifychain(const UniValue& params, bool fHelp);
@@ -278,6 +298,10 @@ extern UniValue spork(const UniValue& params, bool fHelp);
 extern UniValue validateaddress(const UniValue& params, bool fHelp);
 extern UniValue createmultisig(const UniValue& params, bool fHelp);
 extern UniValue verifymessage(const UniValue& params, bool fHelp);
+extern UniValue getaddressbalance(const UniValue& params, bool fHelp);
+extern UniValue getaddressutxos(const UniValue& params, bool fHelp);
+extern UniValue getaddresstxids(const UniValue& params, bool fHelp);
+extern UniValue getspentinfo(const UniValue& params, bool fHelp);
 extern UniValue setmocktime(const UniValue& params, bool fHelp);
 extern UniValue getstakingstatus(const UniValue& params, bool fHelp);
 
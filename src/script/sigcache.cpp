@@ -5,13 +5,16 @@
 
 #include "sigcache.h"
 
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <atomic>
+
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
 namespace {
 
@@ -23,68 +26,91 @@ namespace {
 class CSignatureCache
 {
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    //! Entries are SHA256(nonce || padding || signature hash || public key || signature):
+    CSHA256 saltedHasher;
+    CCuckooCache setValid;
+    //! Serializes writers; lookups take no lock.
+    boost::mutex cs_sigcache;
 
 public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    CSignatureCache()
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        // The nonce is padded to a full block, so copying saltedHasher
+        // reuses its compressed state instead of hashing the nonce again.
+        uint256 nonce = GetRandHash();
+        static const unsigned char PADDING[32] = {0};
+        saltedHasher.Write(nonce.begin(), 32);
+        saltedHasher.Write(PADDING, 32);
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+    void ComputeEntry(uint256& entry, const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
+    {
+        CSHA256(saltedHasher).Write(hash.begin(), 32).Write(pubkey.begin(), pubkey.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry.begin());
+    }
+
+    bool Get(const uint256& entry, bool fErase)
+    {
+        return setValid.Contains(entry, fErase);
+    }
+
+    void Set(const uint256& entry)
+    {
+        boost::unique_lock<boost::mutex> lock(cs_sigcache);
+        setValid.Insert(entry);
     }
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    uint32_t Setup(size_t nBytes)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
-        }
-
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+        boost::unique_lock<boost::mutex> lock(cs_sigcache);
+        return setValid.Setup(nBytes);
     }
 };
 
+/* In previous versions of this code, signatureCache was a local static variable
+ * in CachingTransactionSignatureChecker::VerifySignature. It is sized once by
+ * InitSignatureCache() before any script verification thread starts.
+ */
+CSignatureCache signatureCache;
+
+std::atomic<uint64_t> nSigCacheHits(0);
+std::atomic<uint64_t> nSigCacheMisses(0);
+std::atomic<uint32_t> nSigCacheEntries(0);
+}
+
+void InitSignatureCache()
+{
+    // -maxsigcachesize is split evenly between this cache and the script
+    // execution cache (see InitScriptExecutionCache).
+    int64_t nMaxSizeMiB = std::max((int64_t)0, std::min(GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE), MAX_MAX_SIG_CACHE_SIZE));
+    size_t nMaxCacheSize = ((size_t)nMaxSizeMiB << 20) / 2;
+    uint32_t nEntries = signatureCache.Setup(nMaxCacheSize);
+    nSigCacheEntries = nEntries;
+    LogPrintf("Using %u MiB for signature cache, able to store %u elements\n", nMaxCacheSize >> 20, nEntries);
+}
+
+void GetSignatureCacheStats(SignatureCacheStats& stats)
+{
+    stats.nEntries = nSigCacheEntries;
+    stats.nHits = nSigCacheHits;
+    stats.nMisses = nSigCacheMisses;
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    // A signature found while connecting a block will not be needed again.
+    if (signatureCache.Get(entry, !store)) {
+        nSigCacheHits.fetch_add(1, std::memory_order_relaxed);
         return true;
+    }
+    nSigCacheMisses.fetch_add(1, std::memory_order_relaxed);
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
 
     if (store)
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Set(entry);
     return true;
 }
@@ -8,10 +8,25 @@
 
 #include "script/interpreter.h"
 
+#include <stdint.h>
 #include <vector>
 
+/** Default for -maxsigcachesize, in MiB. */
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+/** Largest accepted -maxsigcachesize, in MiB. */
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+
 class CPubKey;
 
+struct SignatureCacheStats {
+    //! number of entries the cache can hold
+    uint32_t nEntries;
+    //! lookups answered from the cache since startup
+    uint64_t nHits;
+    //! lookups that had to verify the signature
+    uint64_t nMisses;
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -23,4 +38,9 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Size the signature cache from -maxsigcachesize. Call before verifying any script. */
+void InitSignatureCache();
+
+void GetSignatureCacheStats(SignatureCacheStats& stats);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
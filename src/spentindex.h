@@ -0,0 +1,65 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SPENTINDEX_H
+#define BITCOIN_SPENTINDEX_H
+
+#include "amount.h"
+#include "serialize.h"
+#include "uint256.h"
+
+/** Default for -spentindex */
+static const bool DEFAULT_SPENTINDEX = false;
+
+/**
+ * A spent output.
+ * Value: CSpentIndexValue, the input that spent it
+ */
+struct CSpentIndexKey {
+    uint256 txid;
+    unsigned int outputIndex;
+
+    CSpentIndexKey() : outputIndex(0) {}
+    CSpentIndexKey(const uint256& txidIn, unsigned int outputIndexIn) : txid(txidIn), outputIndex(outputIndexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(txid);
+        READWRITE(outputIndex);
+    }
+};
+
+struct CSpentIndexValue {
+    uint256 txid;
+    unsigned int inputIndex;
+    int blockHeight;
+    CAmount satoshis;
+    unsigned char addressType; //!< ADDRESS_TYPE_*, or 0 if the output did not pay to an address
+    uint160 addressHash;
+
+    //! A null value erases the entry when the index is updated
+    CSpentIndexValue() : inputIndex(0), blockHeight(0), satoshis(0), addressType(0) {}
+    CSpentIndexValue(const uint256& txidIn, unsigned int inputIndexIn, int blockHeightIn, CAmount satoshisIn, unsigned char addressTypeIn, const uint160& addressHashIn)
+        : txid(txidIn), inputIndex(inputIndexIn), blockHeight(blockHeightIn), satoshis(satoshisIn), addressType(addressTypeIn), addressHash(addressHashIn) {}
+
+    bool IsNull() const { return txid.IsNull(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(txid);
+        READWRITE(inputIndex);
+        READWRITE(blockHeight);
+        READWRITE(satoshis);
+        READWRITE(addressType);
+        READWRITE(addressHash);
+    }
+};
+
+#endif // BITCOIN_SPENTINDEX_H
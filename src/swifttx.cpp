@@ -178,6 +178,16 @@ bool IsIXTXValid(const CTransaction& txCollateral)
         nValueOut += o.nValue;
 
     BOOST_FOREACH (const CTxIn i, txCollateral.vin) {
+        // Take the value of unspent inputs from the coins view, which works with pruned blocks
+        {
+            LOCK(cs_main);
+            const Coin& coin = pcoinsTip->AccessCoin(i.prevout);
+            if (!coin.IsSpent()) {
+                nValueIn += coin.out.nValue;
+                continue;
+            }
+        }
+
         CTransaction tx2;
         uint256 hash;
         if (GetTransaction(i.prevout.hash, tx2, hash, true)) {
@@ -0,0 +1,124 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "main.h"
+#include "script/standard.h"
+#include "test_unitedstatedollarcrypto.h"
+#include "txdb.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+static CAmount GetIndexedBalance(unsigned char type, const uint160& hashBytes, size_t& nEntries)
+{
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(type, hashBytes, vAddressIndex));
+    nEntries = vAddressIndex.size();
+    CAmount nBalance = 0;
+    for (unsigned int i = 0; i < vAddressIndex.size(); i++)
+        nBalance += vAddressIndex[i].second;
+    return nBalance;
+}
+
+static size_t GetIndexedUnspentCount(unsigned char type, const uint160& hashBytes)
+{
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(pblocktree->ReadAddressUnspentIndex(type, hashBytes, vUnspent));
+    return vUnspent.size();
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_connect_disconnect)
+{
+    fAddressIndex = fSpentIndex = fTimestampIndex = true;
+
+    // Fund a pay-to-script-hash address, and let the coinbase mature
+    CScript redeemScript = CScript() << OP_TRUE;
+    CScriptID scriptID(redeemScript);
+    CScript scriptFunding = GetScriptForDestination(scriptID);
+    CScript scriptOther = CScript() << OP_TRUE;
+    std::vector<CMutableTransaction> noTxns;
+    CBlock blockFunding = CreateAndProcessBlock(noTxns, scriptFunding);
+    int nHeightFunding = chainActive.Height();
+    for (int i = 0; i < Params().COINBASE_MATURITY(); i++)
+        CreateAndProcessBlock(noTxns, scriptOther);
+
+    const CTxOut& txoutFunding = blockFunding.vtx[0].vout[0];
+    size_t nEntries;
+    BOOST_CHECK_EQUAL(GetIndexedBalance(ADDRESS_TYPE_SCRIPTHASH, scriptID, nEntries), txoutFunding.nValue);
+    BOOST_CHECK_EQUAL(nEntries, 1U);
+    BOOST_CHECK_EQUAL(GetIndexedUnspentCount(ADDRESS_TYPE_SCRIPTHASH, scriptID), 1U);
+
+    // Spend it to a key hash address
+    CKeyID keyID(uint160(0x1234));
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(blockFunding.vtx[0].GetHash(), 0);
+    spend.vin[0].scriptSig = CScript() << std::vector<unsigned char>(redeemScript.begin(), redeemScript.end());
+    spend.vout.resize(1);
+    spend.vout[0].nValue = txoutFunding.nValue;
+    spend.vout[0].scriptPubKey = GetScriptForDestination(keyID);
+    CBlock blockSpend = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptOther);
+    uint256 hashSpend = CTransaction(spend).GetHash();
+    BOOST_REQUIRE(chainActive.Tip()->GetBlockHash() == blockSpend.GetHash());
+    CBlockIndex* pindexSpend = chainActive.Tip();
+
+    BOOST_CHECK_EQUAL(GetIndexedBalance(ADDRESS_TYPE_SCRIPTHASH, scriptID, nEntries), 0);
+    BOOST_CHECK_EQUAL(nEntries, 2U);
+    BOOST_CHECK_EQUAL(GetIndexedUnspentCount(ADDRESS_TYPE_SCRIPTHASH, scriptID), 0U);
+    BOOST_CHECK_EQUAL(GetIndexedBalance(ADDRESS_TYPE_PUBKEYHASH, keyID, nEntries), txoutFunding.nValue);
+    BOOST_CHECK_EQUAL(nEntries, 1U);
+    BOOST_CHECK_EQUAL(GetIndexedUnspentCount(ADDRESS_TYPE_PUBKEYHASH, keyID), 1U);
+
+    CSpentIndexValue spentValue;
+    BOOST_CHECK(pblocktree->ReadSpentIndex(CSpentIndexKey(blockFunding.vtx[0].GetHash(), 0), spentValue));
+    BOOST_CHECK(spentValue.txid == hashSpend);
+    BOOST_CHECK_EQUAL(spentValue.inputIndex, 0U);
+    BOOST_CHECK_EQUAL(spentValue.blockHeight, pindexSpend->nHeight);
+    BOOST_CHECK_EQUAL(spentValue.satoshis, txoutFunding.nValue);
+    BOOST_CHECK(spentValue.addressHash == scriptID);
+    BOOST_CHECK(nHeightFunding < spentValue.blockHeight);
+
+    std::vector<uint256> vHashes;
+    BOOST_CHECK(pblocktree->ReadTimestampIndex(pindexSpend->nTime, pindexSpend->nTime, vHashes));
+    BOOST_CHECK(std::find(vHashes.begin(), vHashes.end(), blockSpend.GetHash()) != vHashes.end());
+
+    // Disconnecting the spend restores the funding output and drops the rest
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, pindexSpend));
+        BOOST_CHECK(ActivateBestChain(state));
+        BOOST_CHECK(chainActive.Tip() == pindexSpend->pprev);
+    }
+    BOOST_CHECK_EQUAL(GetIndexedBalance(ADDRESS_TYPE_SCRIPTHASH, scriptID, nEntries), txoutFunding.nValue);
+    BOOST_CHECK_EQUAL(nEntries, 1U);
+    BOOST_CHECK_EQUAL(GetIndexedUnspentCount(ADDRESS_TYPE_SCRIPTHASH, scriptID), 1U);
+    BOOST_CHECK_EQUAL(GetIndexedBalance(ADDRESS_TYPE_PUBKEYHASH, keyID, nEntries), 0);
+    BOOST_CHECK_EQUAL(nEntries, 0U);
+    BOOST_CHECK_EQUAL(GetIndexedUnspentCount(ADDRESS_TYPE_PUBKEYHASH, keyID), 0U);
+    BOOST_CHECK(!pblocktree->ReadSpentIndex(CSpentIndexKey(blockFunding.vtx[0].GetHash(), 0), spentValue));
+
+    // Reconnecting it brings the entries back
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(ReconsiderBlock(state, pindexSpend));
+        BOOST_CHECK(ActivateBestChain(state));
+        BOOST_CHECK(chainActive.Tip() == pindexSpend);
+    }
+    BOOST_CHECK_EQUAL(GetIndexedBalance(ADDRESS_TYPE_PUBKEYHASH, keyID, nEntries), txoutFunding.nValue);
+    BOOST_CHECK(pblocktree->ReadSpentIndex(CSpentIndexKey(blockFunding.vtx[0].GetHash(), 0), spentValue));
+    BOOST_CHECK(spentValue.txid == hashSpend);
+
+    fAddressIndex = DEFAULT_ADDRESSINDEX;
+    fSpentIndex = DEFAULT_SPENTINDEX;
+    fTimestampIndex = DEFAULT_TIMESTAMPINDEX;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,156 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockindex_tests)
+
+static std::vector<char> ReadFileBytes(const boost::filesystem::path& path)
+{
+    std::vector<char> vch(boost::filesystem::file_size(path));
+    FILE* file = fopen(path.string().c_str(), "rb");
+    BOOST_REQUIRE(file);
+    BOOST_CHECK_EQUAL(fread(vch.data(), 1, vch.size(), file), vch.size());
+    fclose(file);
+    return vch;
+}
+
+static void WriteFileBytes(const boost::filesystem::path& path, const std::vector<char>& vch)
+{
+    FILE* file = fopen(path.string().c_str(), "wb");
+    BOOST_REQUIRE(file);
+    BOOST_CHECK_EQUAL(fwrite(vch.data(), 1, vch.size(), file), vch.size());
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_compact_roundtrip)
+{
+    LOCK(cs_main);
+    if (sizeof(void*) == 8)
+        BOOST_CHECK(sizeof(CBlockIndex) <= 168);
+
+    // Every header is served from memory
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex; pindex = pindex->pprev)
+        BOOST_CHECK(pindex->GetBlockHeader().GetHash() == pindex->GetBlockHash());
+
+    // A proof-of-work entry survives a write and read back
+    CBlockIndex* pindexTip = chainActive.Tip();
+    BOOST_REQUIRE(pindexTip);
+    BOOST_REQUIRE(!pindexTip->IsProofOfStake());
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CDiskBlockIndex(pindexTip);
+    CDiskBlockIndex diskindex;
+    ss >> diskindex;
+    BOOST_CHECK(diskindex.GetBlockHash() == pindexTip->GetBlockHash());
+    BOOST_CHECK(diskindex.hashMerkleRoot == pindexTip->hashMerkleRoot);
+    BOOST_CHECK_EQUAL(diskindex.nHeight, pindexTip->nHeight);
+    BOOST_CHECK_EQUAL(diskindex.nStatus, pindexTip->nStatus);
+    BOOST_CHECK_EQUAL(diskindex.nTx, pindexTip->nTx);
+    BOOST_CHECK_EQUAL(diskindex.nDataPos, pindexTip->nDataPos);
+    BOOST_CHECK(diskindex.prevoutStake.IsNull());
+
+    uint256 hashMerkleRoot = pindexTip->hashMerkleRoot;
+    pindexTip->hashMerkleRoot = uint256();
+    BOOST_CHECK(InsertDiskBlockIndex(pindexTip->GetBlockHash(), diskindex) == pindexTip);
+    BOOST_CHECK(pindexTip->hashMerkleRoot == hashMerkleRoot);
+    BOOST_CHECK(pindexTip->GetBlockHeader().GetHash() == pindexTip->GetBlockHash());
+
+    // A proof-of-stake entry takes its stake fields from the side table
+    // until it is written
+    CBlockIndex indexStake(*pindexTip);
+    indexStake.SetProofOfStake();
+    CBlockIndexCold& cold = mapBlockIndexCold[&indexStake];
+    cold.prevoutStake = COutPoint(hashMerkleRoot, 1);
+    cold.nStakeTime = pindexTip->nTime;
+    CDataStream ssStake(SER_DISK, CLIENT_VERSION);
+    ssStake << CDiskBlockIndex(&indexStake);
+    mapBlockIndexCold.erase(&indexStake);
+    CDiskBlockIndex diskindexStake;
+    ssStake >> diskindexStake;
+    BOOST_CHECK(diskindexStake.IsProofOfStake());
+    BOOST_CHECK(diskindexStake.prevoutStake == COutPoint(hashMerkleRoot, 1));
+    BOOST_CHECK_EQUAL(diskindexStake.nStakeTime, pindexTip->nTime);
+    BOOST_CHECK(diskindexStake.hashMerkleRoot == hashMerkleRoot);
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_snapshot_roundtrip)
+{
+    LOCK(cs_main);
+    FlushStateToDisk();
+    CBlockIndex* pindexTip = chainActive.Tip();
+    BOOST_REQUIRE(pindexTip);
+    size_t nEntries = mapBlockIndex.size();
+    uint256 nChainWork = pindexTip->nChainWork;
+    unsigned int nTx = pindexTip->nTx;
+
+    boost::filesystem::path path = GetDataDir() / "blocks" / "index.snapshot";
+    BOOST_CHECK(pblocktree->WriteBlockIndexSnapshot());
+    BOOST_CHECK(boost::filesystem::exists(path));
+
+    // Loading the snapshot restores the entries in place
+    pindexTip->nTx = 0;
+    pindexTip->nChainWork = 0;
+    BOOST_CHECK(pblocktree->LoadBlockIndexSnapshot());
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), nEntries);
+    BOOST_CHECK(mapBlockIndex[pindexTip->GetBlockHash()] == pindexTip);
+    BOOST_CHECK_EQUAL(pindexTip->nTx, nTx);
+    BOOST_CHECK(pindexTip->nChainWork == nChainWork);
+    BOOST_CHECK(pindexTip->pprev == NULL || pindexTip->pprev == chainActive[pindexTip->nHeight - 1]);
+
+    // So does the whole load, which applies later database changes on top
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    BOOST_CHECK(pblocktree->LoadBlockIndexGuts());
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), nEntries);
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_snapshot_reject_corrupt)
+{
+    LOCK(cs_main);
+    FlushStateToDisk();
+    size_t nEntries = mapBlockIndex.size();
+
+    boost::filesystem::path path = GetDataDir() / "blocks" / "index.snapshot";
+    BOOST_REQUIRE(pblocktree->WriteBlockIndexSnapshot());
+    std::vector<char> vchGood = ReadFileBytes(path);
+    BOOST_REQUIRE(vchGood.size() > 64);
+
+    // A flipped bit fails the checksum
+    std::vector<char> vch = vchGood;
+    vch[vch.size() / 2] ^= 1;
+    WriteFileBytes(path, vch);
+    BOOST_CHECK(!pblocktree->LoadBlockIndexSnapshot());
+
+    // So does a truncated file, down to less than the checksum itself
+    vch.assign(vchGood.begin(), vchGood.end() - 1);
+    WriteFileBytes(path, vch);
+    BOOST_CHECK(!pblocktree->LoadBlockIndexSnapshot());
+    vch.assign(vchGood.begin(), vchGood.begin() + 16);
+    WriteFileBytes(path, vch);
+    BOOST_CHECK(!pblocktree->LoadBlockIndexSnapshot());
+
+    // An intact snapshot of an older state of the database is ignored
+    BOOST_REQUIRE(pblocktree->WriteBlockIndexSnapshot());
+    WriteFileBytes(path, vchGood);
+    BOOST_CHECK(!pblocktree->LoadBlockIndexSnapshot());
+
+    // Without a snapshot the index still loads from the database
+    boost::filesystem::remove(path);
+    BOOST_CHECK(!pblocktree->LoadBlockIndexSnapshot());
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    BOOST_CHECK(pblocktree->LoadBlockIndexGuts());
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), nEntries);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,162 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstore.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "main.h"
+#include "streams.h"
+#include "version.h"
+
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockstore_tests)
+
+static void AppendToFile(const CDiskBlockPos& pos, const CDataStream& ss)
+{
+    CAutoFile file(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!file.IsNull());
+    BOOST_REQUIRE(fseek(file.Get(), 0, SEEK_END) == 0);
+    file << ss;
+}
+
+BOOST_AUTO_TEST_CASE(blockstore_read_mapped_and_unmapped)
+{
+    const int nFile = 9000;
+    CDiskBlockPos posStart(nFile, 0);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    for (uint32_t i = 0; i < 1000; i++)
+        ss << i;
+    AppendToFile(posStart, ss);
+
+    // The file is past the active one, so it is read without a mapping
+    blockfilecache.SetActiveFile(nFile);
+    CBlockFileCacheStats statsBefore = blockfilecache.GetStats();
+    {
+        CBlockFileReader reader(CDiskBlockPos(nFile, 400), "blk", SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!reader.IsNull());
+        uint32_t n;
+        reader >> n;
+        BOOST_CHECK_EQUAL(n, 100U);
+    }
+    BOOST_CHECK_EQUAL(blockfilecache.GetStats().nFileOpens, statsBefore.nFileOpens + 1);
+
+    // Once another file is active, it is mapped and reused
+    blockfilecache.SetActiveFile(nFile + 1);
+    for (int i = 0; i < 2; i++) {
+        CBlockFileReader reader(posStart, "blk", SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!reader.IsNull());
+        uint32_t n;
+        reader.ignore(4 * 10);
+        reader >> n;
+        BOOST_CHECK_EQUAL(n, 10U);
+    }
+    CBlockFileCacheStats stats = blockfilecache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nFileOpens, statsBefore.nFileOpens + 1);
+    BOOST_CHECK_EQUAL(stats.nMaps, statsBefore.nMaps + 1);
+    BOOST_CHECK_EQUAL(stats.nHits, statsBefore.nHits + 1);
+
+    // Data appended after the file was mapped is still found
+    CDataStream ssMore(SER_DISK, CLIENT_VERSION);
+    ssMore << (uint32_t)1000;
+    AppendToFile(posStart, ssMore);
+    {
+        CBlockFileReader reader(CDiskBlockPos(nFile, 4 * 999), "blk", SER_DISK, CLIENT_VERSION);
+        uint32_t n1, n2;
+        reader >> n1 >> n2;
+        BOOST_CHECK_EQUAL(n1, 999U);
+        BOOST_CHECK_EQUAL(n2, 1000U);
+        BOOST_CHECK_THROW(reader >> n1, std::ios_base::failure);
+    }
+    BOOST_CHECK_EQUAL(blockfilecache.GetStats().nMaps, statsBefore.nMaps + 2);
+
+    blockfilecache.Invalidate(nFile);
+    blockfilecache.SetActiveFile(0);
+    boost::filesystem::remove(GetBlockPosFilename(posStart, "blk"));
+}
+
+static CDataStream SerializeBlock(const CBlock& block)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    return ss;
+}
+
+BOOST_AUTO_TEST_CASE(blockstore_read_raw_block)
+{
+    const int nFile = 9001;
+
+    // Two blocks back to back, as WriteBlockToDisk stores them
+    CBlock block1 = Params().GenesisBlock();
+    CBlock block2 = block1;
+    block2.vtx.push_back(block1.vtx[0]);
+    block2.vtx.push_back(block1.vtx[0]);
+    block2.nTime++;
+    block2.hashMerkleRoot = block2.BuildMerkleTree();
+    CDataStream ss1 = SerializeBlock(block1);
+    CDataStream ss2 = SerializeBlock(block2);
+
+    CDiskBlockPos pos1(nFile, 0);
+    boost::filesystem::remove(GetBlockPosFilename(pos1, "blk"));
+    BOOST_REQUIRE(WriteBlockToDisk(block1, pos1));
+    CDiskBlockPos pos2(nFile, pos1.nPos + ss1.size());
+    BOOST_REQUIRE(WriteBlockToDisk(block2, pos2));
+    BOOST_CHECK_EQUAL(pos2.nPos, pos1.nPos + ss1.size() + 8);
+
+    // A record that claims more bytes than the file holds
+    CDataStream ssTruncated(SER_DISK, CLIENT_VERSION);
+    ssTruncated << FLATDATA(Params().MessageStart()) << (unsigned int)ss2.size();
+    ssTruncated.write(&ss2[0], ss2.size() / 2);
+    CDiskBlockPos posTruncated(nFile, pos2.nPos + ss2.size());
+    AppendToFile(posTruncated, ssTruncated);
+
+    CBlockIndex index1(block1);
+    uint256 hash1 = block1.GetHash();
+    index1.phashBlock = &hash1;
+    index1.nFile = nFile;
+    index1.nDataPos = pos1.nPos;
+    index1.nStatus |= BLOCK_HAVE_DATA;
+    CBlockIndex index2(block2);
+    uint256 hash2 = block2.GetHash();
+    index2.phashBlock = &hash2;
+    index2.nFile = nFile;
+    index2.nDataPos = pos2.nPos;
+    index2.nStatus |= BLOCK_HAVE_DATA;
+
+    // Read without a mapping while the file is active, then mapped
+    for (int nActive = nFile; nActive <= nFile + 1; nActive++) {
+        blockfilecache.SetActiveFile(nActive);
+        std::vector<unsigned char> vBlock;
+
+        // The raw bytes are the block's network serialization
+        BOOST_CHECK(ReadRawBlockFromDisk(vBlock, &index1));
+        BOOST_CHECK(vBlock == std::vector<unsigned char>(ss1.begin(), ss1.end()));
+        BOOST_CHECK(ReadRawBlockFromDisk(vBlock, &index2));
+        BOOST_CHECK(vBlock == std::vector<unsigned char>(ss2.begin(), ss2.end()));
+        BOOST_CHECK(ReadRawBlockFromDisk(vBlock, pos2));
+        BOOST_CHECK(vBlock == std::vector<unsigned char>(ss2.begin(), ss2.end()));
+
+        // A record cut short is not served
+        BOOST_CHECK(!ReadRawBlockFromDisk(vBlock, CDiskBlockPos(nFile, posTruncated.nPos + 8)));
+
+        // Neither is a position that does not start a record
+        BOOST_CHECK(!ReadRawBlockFromDisk(vBlock, CDiskBlockPos(nFile, pos2.nPos + 1)));
+        BOOST_CHECK(!ReadRawBlockFromDisk(vBlock, CDiskBlockPos(nFile, 4)));
+
+        // Nor a block other than the one the index entry expects
+        CBlockIndex indexMismatch(index2);
+        indexMismatch.nDataPos = pos1.nPos;
+        BOOST_CHECK(!ReadRawBlockFromDisk(vBlock, &indexMismatch));
+    }
+
+    blockfilecache.Invalidate(nFile);
+    blockfilecache.SetActiveFile(0);
+    boost::filesystem::remove(GetBlockPosFilename(pos1, "blk"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
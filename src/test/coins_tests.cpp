@@ -2,9 +2,14 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
 #include "coins.h"
 #include "random.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "txdb.h"
 #include "uint256.h"
+#include "undo.h"
 
 #include <vector>
 #include <map>
@@ -16,48 +21,70 @@ namespace
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
-    {
-        CCoins coins;
-        return GetCoins(txid, coins);
-    }
-
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const CTxOutSetDigest& digest)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
-            map_[it->first] = it->second.coins;
-            if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
-                // Randomly delete empty entries on write.
-                map_.erase(it->first);
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                // Same optimization used in CCoinsViewDB is to only write dirty entries.
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
+                    // Randomly delete empty entries on write.
+                    map_.erase(it->first);
+                }
             }
             mapCoins.erase(it++);
         }
-        mapCoins.clear();
         hashBestBlock_ = hashBlock;
         return true;
     }
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += it->second.coin.DynamicMemoryUsage();
+        }
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
+
+bool CoinsEqual(const Coin& a, const Coin& b)
+{
+    // Empty Coin objects are always equal.
+    if (a.IsSpent() && b.IsSpent()) return true;
+    return a.fCoinBase == b.fCoinBase &&
+           a.fCoinStake == b.fCoinStake &&
+           a.nHeight == b.nHeight &&
+           a.out == b.out;
+}
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -85,12 +112,12 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool missed_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -102,41 +129,54 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     for (unsigned int i = 0; i < NUM_SIMULATION_ITERATIONS; i++) {
         // Do a random modification.
         {
-            uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
+            COutPoint outpoint(txids[insecure_rand() % txids.size()], insecure_rand() % 2); // outpoint we're going to modify in this iteration.
+            Coin& coin = result[outpoint];
+            const Coin& entry = stack.back()->AccessCoin(outpoint);
+            BOOST_CHECK(CoinsEqual(coin, entry));
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                if (coin.IsSpent()) {
                     added_an_entry = true;
                 } else {
                     updated_an_entry = true;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                Coin newcoin;
+                newcoin.out.nValue = insecure_rand();
+                newcoin.out.scriptPubKey.assign(insecure_rand() & 0x3F, 0);
+                newcoin.nHeight = 1;
+                stack.back()->AddCoin(outpoint, Coin(newcoin), !coin.IsSpent() || insecure_rand() & 1);
+                coin = newcoin;
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(outpoint);
             }
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(CoinsEqual(coin, it->second));
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    found_an_entry = true;
                 }
             }
+            BOOST_FOREACH (const CCoinsViewCacheTest* test, stack) {
+                test->SelfTest();
+            }
         }
 
+        if (insecure_rand() % 100 == 0) {
+            // Every 100 iterations, flush an intermediate cache
+            if (stack.size() > 1 && insecure_rand() % 2 == 0) {
+                unsigned int flushIndex = insecure_rand() % (stack.size() - 1);
+                stack[flushIndex]->Flush();
+            }
+        }
         if (insecure_rand() % 100 == 0) {
             // Every 100 iterations, change the cache stack.
             if (stack.size() > 0 && insecure_rand() % 2 == 0) {
@@ -151,7 +191,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -175,4 +215,152 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+BOOST_AUTO_TEST_CASE(coins_prime_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    COutPoint outpoint(GetRandHash(), 0);
+    Coin coin;
+    coin.out.nValue = 1000;
+    coin.out.scriptPubKey.assign(10, 0);
+    coin.nHeight = 5;
+
+    cache.PrimeCoin(outpoint, Coin(coin));
+    BOOST_CHECK(cache.HaveCoinInCache(outpoint));
+    BOOST_CHECK(CoinsEqual(cache.AccessCoin(outpoint), coin));
+    cache.SelfTest();
+
+    // Primed entries are not dirty, so flushing does not write them back.
+    BOOST_CHECK(cache.Flush());
+    Coin written;
+    BOOST_CHECK(!base.GetCoin(outpoint, written));
+
+    // An entry that is already cached is left alone.
+    cache.PrimeCoin(outpoint, Coin(coin));
+    BOOST_CHECK(cache.SpendCoin(outpoint));
+    cache.PrimeCoin(outpoint, Coin(coin));
+    BOOST_CHECK(!cache.HaveCoin(outpoint));
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(coins_undo_serialization)
+{
+    CTxOut txout;
+    txout.nValue = 110397;
+    txout.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x42) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Round trip through the undo format, with and without metadata.
+    for (int nHeight = 0; nHeight < 2; nHeight++) {
+        Coin coin(txout, nHeight * 203998, nHeight > 0, false);
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << TxInUndoSerializer(&coin);
+        BOOST_CHECK_EQUAL(ss.size(), ::GetSerializeSize(TxInUndoSerializer(&coin), SER_DISK, CLIENT_VERSION));
+        Coin coin2;
+        TxInUndoDeserializer deserializer(&coin2);
+        ss >> deserializer;
+        BOOST_CHECK(ss.empty());
+        BOOST_CHECK(CoinsEqual(coin, coin2));
+    }
+
+    // Undo records written by older versions carry a transaction version after the height.
+    CDataStream ssOld(SER_DISK, CLIENT_VERSION);
+    unsigned int nCode = 203998 * 4 + 2;
+    int nVersion = 1;
+    ssOld << VARINT(nCode) << VARINT(nVersion) << CTxOutCompressor(txout);
+    Coin coinOld;
+    TxInUndoDeserializer deserializerOld(&coinOld);
+    ssOld >> deserializerOld;
+    BOOST_CHECK(ssOld.empty());
+    BOOST_CHECK_EQUAL(coinOld.nHeight, 203998U);
+    BOOST_CHECK(coinOld.IsCoinBase());
+    BOOST_CHECK(!coinOld.IsCoinStake());
+    BOOST_CHECK(coinOld.out == txout);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_cursor)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewCache cache(&db);
+
+    std::map<COutPoint, Coin> expected;
+    for (int i = 0; i < 100; i++) {
+        COutPoint outpoint(GetRandHash(), insecure_rand() % 4);
+        Coin coin;
+        coin.out.nValue = 1000 + i;
+        coin.out.scriptPubKey.assign(1 + i % 20, 0);
+        coin.nHeight = i;
+        expected[outpoint] = coin;
+        cache.AddCoin(outpoint, std::move(coin), false);
+    }
+    uint256 hashBlock = GetRandHash();
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK(cache.Flush());
+
+    // Every coin is returned once
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(cache.Cursor());
+    BOOST_REQUIRE(pcursor);
+    BOOST_CHECK(pcursor->GetBestBlock() == hashBlock);
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint outpoint;
+        Coin coin;
+        BOOST_REQUIRE(pcursor->GetKey(outpoint) && pcursor->GetValue(coin));
+        std::map<COutPoint, Coin>::iterator it = expected.find(outpoint);
+        BOOST_REQUIRE(it != expected.end());
+        BOOST_CHECK(CoinsEqual(coin, it->second));
+        expected.erase(it);
+    }
+    BOOST_CHECK(expected.empty());
+}
+
+BOOST_AUTO_TEST_CASE(coins_txoutset_digest)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewCache cache(&db);
+
+    std::vector<std::pair<COutPoint, Coin> > coins;
+    for (int i = 0; i < 20; i++) {
+        Coin coin;
+        coin.out.nValue = 1000 + i;
+        coin.out.scriptPubKey.assign(1 + i % 20, 0);
+        coin.nHeight = i;
+        coins.push_back(std::make_pair(COutPoint(GetRandHash(), i % 3), coin));
+    }
+
+    // The set hash does not depend on the order of additions and removals
+    CTxOutSetDigest digest, digestReverse;
+    for (unsigned int i = 0; i < coins.size(); i++) {
+        digest.Add(coins[i].first, coins[i].second);
+        digestReverse.Add(coins[coins.size() - 1 - i].first, coins[coins.size() - 1 - i].second);
+    }
+    BOOST_CHECK(digest.GetHash() == digestReverse.GetHash());
+    digestReverse.Remove(coins[0].first, coins[0].second);
+    BOOST_CHECK(digest.GetHash() != digestReverse.GetHash());
+    digestReverse.Add(coins[0].first, coins[0].second);
+    BOOST_CHECK(digest.GetHash() == digestReverse.GetHash());
+
+    // The totals are written with the best block they are for
+    uint256 hashBlock = GetRandHash();
+    for (unsigned int i = 0; i < coins.size(); i++)
+        cache.AddCoin(coins[i].first, Coin(coins[i].second), false);
+    digest.hashBlock = hashBlock;
+    cache.SetTxOutSetDigest(digest);
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK(cache.Flush());
+
+    CTxOutSetDigest digestRead;
+    BOOST_CHECK(db.GetTxOutSetDigest(digestRead));
+    BOOST_CHECK(digestRead.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(digestRead.nTransactionOutputs, coins.size());
+    BOOST_CHECK_EQUAL(digestRead.nTotalAmount, digest.nTotalAmount);
+    BOOST_CHECK(digestRead.GetHash() == digest.GetHash());
+
+    // They are not known for a block they were not updated for
+    cache.SpendCoin(coins[0].first);
+    cache.SetBestBlock(GetRandHash());
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!cache.GetTxOutSetDigest(digestRead));
+    BOOST_CHECK(!db.GetTxOutSetDigest(digestRead));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
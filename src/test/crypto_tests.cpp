@@ -2,6 +2,7 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "crypto/quark.h"
 #include "crypto/rfc6979_hmac_sha256.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
@@ -63,6 +64,25 @@ void TestHMACSHA512(const std::string &hexkey, const std::string &hexin, const s
     TestVector(CHMAC_SHA512(&key[0], key.size()), ParseHex(hexin), ParseHex(hexout));
 }
 
+void TestQuark(const std::string &in, const std::string &hexout) {
+    std::vector<unsigned char> out = ParseHex(hexout);
+    std::vector<unsigned char> hash(QUARK_OUTPUT_SIZE);
+    QuarkHash((const unsigned char*)in.data(), in.size(), &hash[0]);
+    BOOST_CHECK(hash == out);
+
+    // The same message in every lane must give the same digest in every lane.
+    std::vector<unsigned char> lanes(QUARK_MAX_LANES * QUARK_OUTPUT_SIZE);
+    const unsigned char* pin[QUARK_MAX_LANES];
+    unsigned char* pout[QUARK_MAX_LANES];
+    for (size_t i = 0; i < QUARK_MAX_LANES; i++) {
+        pin[i] = (const unsigned char*)in.data();
+        pout[i] = &lanes[i * QUARK_OUTPUT_SIZE];
+    }
+    QuarkHashLanes(pin, in.size(), pout, QUARK_MAX_LANES);
+    for (size_t i = 0; i < QUARK_MAX_LANES; i++)
+        BOOST_CHECK(std::vector<unsigned char>(pout[i], pout[i] + QUARK_OUTPUT_SIZE) == out);
+}
+
 std::string LongTestString(void) {
     std::string ret;
     for (int i=0; i<200000; i++) {
@@ -110,6 +130,7 @@ BOOST_AUTO_TEST_CASE(sha1_testvectors) {
 }
 
 BOOST_AUTO_TEST_CASE(sha256_testvectors) {
+    SHA256AutoDetect();
     TestSHA256("", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
     TestSHA256("abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
     TestSHA256("message digest",
@@ -131,6 +152,24 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64) {
+    SHA256AutoDetect();
+    // Block counts that leave every mix of 8-way, 4-way and single remainders.
+    for (size_t blocks = 0; blocks <= 34; blocks++) {
+        std::vector<unsigned char> in(64 * blocks);
+        for (size_t i = 0; i < in.size(); i++)
+            in[i] = insecure_rand();
+        std::vector<unsigned char> out(32 * blocks + 1), ref(32 * blocks + 1);
+        for (size_t i = 0; i < blocks; i++) {
+            unsigned char hash[CSHA256::OUTPUT_SIZE];
+            CSHA256().Write(&in[64 * i], 64).Finalize(hash);
+            CSHA256().Write(hash, sizeof(hash)).Finalize(&ref[32 * i]);
+        }
+        SHA256D64(&out[0], blocks ? &in[0] : NULL, blocks);
+        BOOST_CHECK(out == ref);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -168,6 +207,45 @@ BOOST_AUTO_TEST_CASE(sha512_testvectors) {
                "37de8c3ef5459d76a52cedc02dc499a3c9ed9dedbfb3281afd9653b8a112fafc");
 }
 
+BOOST_AUTO_TEST_CASE(quark_testvectors) {
+    QuarkAutoDetect();
+    TestQuark("", "0800f13b5af35b8363864de22b7bedeca369e2a7c6c77b4f69441cb03a517d9c");
+    TestQuark("abc", "a54b64292dd6aade02bea66228cd721e637cd5a2c1c7dee320b08ae60349d9d0");
+    TestQuark("The quick brown fox jumps over the lazy dog",
+              "70ecce6fe9c9e2041cc90324a570b9ed1329c7ebe9397c5cef3de815c46113a5");
+    TestQuark("0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef",
+              "6ca59a579d19391108093508df98d32f1d8860c25dfe14391f5c78d58c8930a7");
+    TestQuark("Quark Quark Quark Quark Quark Quark Quark Quark Quark Quark Quark Quark Quark Qu",
+              "62e60170ff3bad999489a046fc9cc1e63caa7d6a448f7e7cd9321f06df7fa8f2");
+}
+
+BOOST_AUTO_TEST_CASE(quark_lanes) {
+    QuarkAutoDetect();
+    // Header-sized, digest-sized and multi-block inputs; lane counts that
+    // leave partially filled vector groups and take different branches.
+    const size_t lens[] = {64, 80, 111, 112, 200};
+    for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        for (size_t nLanes = 1; nLanes <= 2 * QUARK_MAX_LANES + 1; nLanes++) {
+            std::vector<unsigned char> in(nLanes * lens[l]);
+            for (size_t i = 0; i < in.size(); i++)
+                in[i] = insecure_rand();
+            std::vector<unsigned char> out(nLanes * QUARK_OUTPUT_SIZE);
+            std::vector<const unsigned char*> pin(nLanes);
+            std::vector<unsigned char*> pout(nLanes);
+            for (size_t i = 0; i < nLanes; i++) {
+                pin[i] = &in[i * lens[l]];
+                pout[i] = &out[i * QUARK_OUTPUT_SIZE];
+            }
+            QuarkHashLanes(&pin[0], lens[l], &pout[0], nLanes);
+            for (size_t i = 0; i < nLanes; i++) {
+                unsigned char hash[QUARK_OUTPUT_SIZE];
+                QuarkHash(pin[i], lens[l], hash);
+                BOOST_CHECK(memcmp(hash, pout[i], QUARK_OUTPUT_SIZE) == 0);
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(hmac_sha256_testvectors) {
     // test cases 1, 2, 3, 4, 6 and 7 of RFC 4231
     TestHMACSHA256("0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b",
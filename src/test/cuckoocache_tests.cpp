@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+
+#include "random.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+static uint256 RandomKey()
+{
+    uint256 key;
+    for (unsigned char* p = key.begin(); p != key.end(); p++)
+        *p = insecure_rand();
+    return key;
+}
+
+BOOST_AUTO_TEST_SUITE(cuckoocache_tests)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_disabled)
+{
+    CCuckooCache cache;
+    BOOST_CHECK_EQUAL(cache.Setup(0), 0U);
+    uint256 key = RandomKey();
+    cache.Insert(key);
+    BOOST_CHECK(!cache.Contains(key, false));
+}
+
+// Well below capacity, everything inserted must be found and nothing else.
+BOOST_AUTO_TEST_CASE(cuckoocache_no_false_positives)
+{
+    CCuckooCache cache;
+    uint32_t nSize = cache.Setup(1 << 20);
+    BOOST_CHECK_EQUAL(nSize, (1U << 20) / 32);
+
+    std::vector<uint256> keys;
+    for (uint32_t i = 0; i < nSize / 4; i++) {
+        keys.push_back(RandomKey());
+        cache.Insert(keys.back());
+    }
+    for (size_t i = 0; i < keys.size(); i++)
+        BOOST_CHECK(cache.Contains(keys[i], false));
+    for (int i = 0; i < 1000; i++)
+        BOOST_CHECK(!cache.Contains(RandomKey(), false));
+}
+
+// Erased keys stay visible until their slot is reused.
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    CCuckooCache cache;
+    cache.Setup(1 << 16);
+    uint256 key = RandomKey();
+    cache.Insert(key);
+    BOOST_CHECK(cache.Contains(key, true));
+    BOOST_CHECK(cache.Contains(key, false));
+}
+
+// Filling the cache many times over keeps the most recent generation.
+BOOST_AUTO_TEST_CASE(cuckoocache_generations)
+{
+    CCuckooCache cache;
+    uint32_t nSize = cache.Setup(1 << 16);
+
+    std::vector<uint256> keys;
+    for (uint32_t i = 0; i < 4 * nSize; i++) {
+        keys.push_back(RandomKey());
+        cache.Insert(keys.back());
+    }
+
+    // The newest quarter of a table's worth of keys should nearly all be there.
+    size_t nRecent = nSize / 4, nFound = 0;
+    for (size_t i = keys.size() - nRecent; i < keys.size(); i++)
+        nFound += cache.Contains(keys[i], false);
+    BOOST_CHECK(nFound >= nRecent * 95 / 100);
+
+    // The oldest keys must have made room.
+    size_t nOld = 0;
+    for (size_t i = 0; i < nRecent; i++)
+        nOld += cache.Contains(keys[i], false);
+    BOOST_CHECK(nOld <= nRecent / 10);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,228 @@
+// Copyright (c) 2015-2017 The PIVX developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "kernel.h"
+#include "main.h"
+#include "random.h"
+#include "utiltime.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#define KERNEL_CHAIN_LENGTH 100000
+
+BOOST_AUTO_TEST_SUITE(kernel_tests)
+
+struct KernelModifier {
+    uint64_t nStakeModifier;
+    int nHeight;
+    int64_t nTime;
+};
+
+static bool operator==(const KernelModifier& a, const KernelModifier& b)
+{
+    return a.nStakeModifier == b.nStakeModifier && a.nHeight == b.nHeight && a.nTime == b.nTime;
+}
+
+// Build a synthetic chain with slightly jittered, mostly increasing
+// timestamps and a new modifier whenever a modifier interval elapses.
+static void BuildKernelChain(std::vector<CBlockIndex>& vIndex)
+{
+    int64_t nTimeLastModifier = 0;
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = (i == 0) ? NULL : &vIndex[i - 1];
+        vIndex[i].nTime = (i == 0) ? 1500000000 : vIndex[i - 1].nTime + (insecure_rand() % 120) - 20;
+        bool fGenerated = i == 0 || vIndex[i].GetBlockTime() / MODIFIER_INTERVAL > nTimeLastModifier / MODIFIER_INTERVAL;
+        if (fGenerated)
+            nTimeLastModifier = vIndex[i].GetBlockTime();
+        vIndex[i].SetStakeModifier(((uint64_t)insecure_rand() << 32) | insecure_rand(), fGenerated);
+        vIndex[i].BuildSkip();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stake_modifier_cache_test)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexOldTip = chainActive.Tip();
+    seed_insecure_rand(true);
+
+    std::vector<CBlockIndex> vIndex(KERNEL_CHAIN_LENGTH);
+    BuildKernelChain(vIndex);
+    chainActive.SetTip(&vIndex.back());
+
+    // Reference: walk the chain forward for every height that has a modifier.
+    int nHeightLast = KERNEL_CHAIN_LENGTH - 100;
+    std::vector<KernelModifier> vExpected(nHeightLast);
+    int64_t nTimeStart = GetTimeMicros();
+    for (int i = 0; i < nHeightLast; i++) {
+        KernelModifier& km = vExpected[i];
+        BOOST_REQUIRE(FindKernelStakeModifier(&vIndex[i], km.nStakeModifier, km.nHeight, km.nTime));
+    }
+    int64_t nTimeWalk = GetTimeMicros() - nTimeStart;
+
+    // Fill the cache by connecting every block in order.
+    stakeModifierCache.Clear();
+    for (int i = 0; i < KERNEL_CHAIN_LENGTH; i++)
+        stakeModifierCache.BlockConnected(&vIndex[i]);
+
+    nTimeStart = GetTimeMicros();
+    for (int i = 0; i < nHeightLast; i++) {
+        KernelModifier km;
+        BOOST_REQUIRE(stakeModifierCache.Get(i, km.nStakeModifier, km.nHeight, km.nTime));
+        BOOST_CHECK(km == vExpected[i]);
+    }
+    int64_t nTimeCache = GetTimeMicros() - nTimeStart;
+    BOOST_TEST_MESSAGE(strprintf("stake modifier lookup over %d blocks: walk %.2fms, cache %.2fms",
+        nHeightLast, nTimeWalk * 0.001, nTimeCache * 0.001));
+
+    // Lookups answer from the cache alone, without reading chainActive.
+    chainActive.SetTip(NULL);
+    for (int i = 0; i < nHeightLast; i += 1000) {
+        KernelModifier km;
+        BOOST_REQUIRE(stakeModifierCache.Get(i, km.nStakeModifier, km.nHeight, km.nTime));
+        BOOST_CHECK(km == vExpected[i]);
+    }
+    chainActive.SetTip(&vIndex.back());
+
+    // Disconnecting and reconnecting the tip must leave the same results.
+    for (int i = KERNEL_CHAIN_LENGTH - 1; i >= nHeightLast - 200; i--) {
+        chainActive.SetTip(vIndex[i].pprev);
+        stakeModifierCache.BlockDisconnected(&vIndex[i]);
+    }
+    for (int i = nHeightLast - 200; i < KERNEL_CHAIN_LENGTH; i++) {
+        chainActive.SetTip(&vIndex[i]);
+        stakeModifierCache.BlockConnected(&vIndex[i]);
+    }
+    for (int i = nHeightLast - 1000; i < nHeightLast; i++) {
+        KernelModifier km;
+        BOOST_REQUIRE(stakeModifierCache.Get(i, km.nStakeModifier, km.nHeight, km.nTime));
+        BOOST_CHECK(km == vExpected[i]);
+    }
+
+    // A cold cache is filled lazily by GetKernelStakeModifier.
+    stakeModifierCache.Clear();
+    for (int n = 0; n < 1000; n++) {
+        int i = insecure_rand() % nHeightLast;
+        KernelModifier km;
+        BOOST_CHECK(GetKernelStakeModifier(&vIndex[i], km.nStakeModifier, km.nHeight, km.nTime, false));
+        BOOST_CHECK(km == vExpected[i]);
+        BOOST_CHECK(stakeModifierCache.Get(i, km.nStakeModifier, km.nHeight, km.nTime));
+        BOOST_CHECK(km == vExpected[i]);
+    }
+
+    stakeModifierCache.Clear();
+    chainActive.SetTip(pindexOldTip);
+}
+
+struct KernelHit {
+    size_t nCandidate;
+    unsigned int nTime;
+    uint256 hashProofOfStake;
+};
+
+// The first nMisses misses, with the hit inserted at nPos
+static std::vector<CStakeCandidate> CandidatesWithHit(const std::vector<CStakeCandidate>& vMisses, const CStakeCandidate& hit, size_t nPos, size_t nMisses)
+{
+    std::vector<CStakeCandidate> vCandidates(vMisses.begin(), vMisses.begin() + nMisses);
+    vCandidates.insert(vCandidates.begin() + nPos, hit);
+    return vCandidates;
+}
+
+static void CheckFindStakeKernel(unsigned int nBits, std::vector<CStakeCandidate> vCandidates, unsigned int nTimeTx, unsigned int nHashDrift, const KernelHit* pexpected)
+{
+    size_t nFound = 0;
+    unsigned int nTimeFound = 0;
+    uint256 hashProofOfStake;
+    bool fFound = FindStakeKernel(nBits, vCandidates, nTimeTx, nHashDrift, 0, nFound, nTimeFound, hashProofOfStake);
+    BOOST_CHECK_EQUAL(fFound, pexpected != NULL);
+    if (fFound && pexpected) {
+        BOOST_CHECK_EQUAL(nFound, pexpected->nCandidate);
+        BOOST_CHECK_EQUAL(nTimeFound, pexpected->nTime);
+        BOOST_CHECK(hashProofOfStake == pexpected->hashProofOfStake);
+    }
+    BOOST_FOREACH (const CStakeCandidate& candidate, vCandidates)
+        BOOST_CHECK(candidate.fStakeModifier);
+}
+
+BOOST_AUTO_TEST_CASE(find_stake_kernel_test)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexOldTip = chainActive.Tip();
+    seed_insecure_rand(true);
+
+    std::vector<CBlockIndex> vIndex(2000);
+    BuildKernelChain(vIndex);
+    chainActive.SetTip(&vIndex.back());
+    stakeModifierCache.Clear();
+
+    // With a weight of one, about one hash in 600 meets the target
+    uint256 bnTarget = (~uint256(0)) / uint256(600);
+    unsigned int nBits = bnTarget.GetCompact();
+    const int64_t nValueIn = 100;
+    const unsigned int nHashDrift = 60;
+    const int nHeightLast = vIndex.size() - 100;
+    const unsigned int nTimeTx = vIndex[nHeightLast / 2].GetBlockTime();
+
+    // Reference: search every candidate on its own with CheckStakeKernelHash.
+    // Outputs confirmed after the timestamps tried never stake. The serial
+    // check rejects a whole window that starts before the output, the
+    // parallel one only the timestamps before it, so those are left out.
+    std::vector<CStakeCandidate> vHits, vMisses;
+    std::vector<KernelHit> vExpected;
+    for (int n = 0; n < 100000 && (vHits.size() < 10 || vMisses.size() < 2000); n++) {
+        const CBlockIndex* pindexFrom = &vIndex[insecure_rand() % nHeightLast];
+        unsigned int nTimeBlockFrom = pindexFrom->GetBlockTime();
+        if (nTimeBlockFrom > nTimeTx && nTimeBlockFrom <= nTimeTx + nHashDrift)
+            continue;
+        CStakeCandidate candidate(COutPoint(GetRandHash(), insecure_rand() % 4), pindexFrom, nValueIn);
+        unsigned int nTime = nTimeTx;
+        uint256 hashProofOfStake;
+        if (CheckStakeKernelHash(nBits, pindexFrom, nValueIn, candidate.prevout, nTime, nHashDrift, false, hashProofOfStake)) {
+            KernelHit hit = {0, nTime, hashProofOfStake};
+            vHits.push_back(candidate);
+            vExpected.push_back(hit);
+        } else {
+            vMisses.push_back(candidate);
+        }
+    }
+    BOOST_REQUIRE(vHits.size() >= 10);
+    BOOST_REQUIRE(vMisses.size() >= 2000);
+
+    // Serially, then across the stake kernel threads, the search finds the
+    // one hit among the misses, wherever it is
+    boost::thread_group threadGroup;
+    for (int nThreads = 0; nThreads <= 3; nThreads += 3) {
+        nStakeKernelThreads = nThreads;
+        for (int i = 0; i < nThreads - 1; i++)
+            threadGroup.create_thread(&ThreadStakeKernelCheck);
+
+        CheckFindStakeKernel(nBits, std::vector<CStakeCandidate>(vMisses.begin(), vMisses.begin() + 200), nTimeTx, nHashDrift, NULL);
+        for (size_t i = 0; i < vHits.size(); i++) {
+            KernelHit expected = vExpected[i];
+            expected.nCandidate = insecure_rand() % 201;
+            CheckFindStakeKernel(nBits, CandidatesWithHit(vMisses, vHits[i], expected.nCandidate, 200), nTimeTx, nHashDrift, &expected);
+        }
+
+        // A hit first stops the workers before they get through the misses
+        KernelHit expected = vExpected[0];
+        CheckFindStakeKernel(nBits, CandidatesWithHit(vMisses, vHits[0], 0, 2000), nTimeTx, nHashDrift, &expected);
+        unsigned int nHashesToHit = nTimeTx + nHashDrift - expected.nTime + 1;
+        if (nThreads == 0)
+            BOOST_CHECK_EQUAL(nStakeHashesLast, nHashesToHit);
+        else
+            BOOST_CHECK(nStakeHashesLast < 100 * nHashDrift);
+
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+    nStakeKernelThreads = 0;
+
+    stakeModifierCache.Clear();
+    chainActive.SetTip(pindexOldTip);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,130 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "init.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "miner.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "test_unitedstatedollarcrypto.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(mempool_persist_tests)
+
+//! Mine nBlocks blocks with whatever the mempool holds. Runs on its own thread, so it reports through pfOk.
+static void MineBlocks(int nBlocks, bool* pfOk)
+{
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockTemplate* pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false);
+        if (!pblocktemplate) {
+            *pfOk = false;
+            return;
+        }
+        CBlock block = pblocktemplate->block;
+        delete pblocktemplate;
+        unsigned int nExtraNonce = 0;
+        {
+            LOCK(cs_main);
+            IncrementExtraNonce(&block, chainActive.Tip(), nExtraNonce);
+        }
+        CValidationState state;
+        if (!ProcessNewBlock(state, NULL, &block)) {
+            *pfOk = false;
+            return;
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(mempool_dump_load_while_connecting)
+{
+    const unsigned int nTxns = 300;
+    const int nBlocks = 10;
+
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // Mature a coinbase and split it into confirmed outputs, so that the
+    // mempool transactions spending them do not depend on each other
+    std::vector<CMutableTransaction> noTxns;
+    CBlock blockFunding = CreateAndProcessBlock(noTxns, scriptPubKey);
+    for (int i = 0; i < Params().COINBASE_MATURITY(); i++)
+        CreateAndProcessBlock(noTxns, CScript() << OP_TRUE);
+
+    CMutableTransaction split;
+    split.vin.resize(1);
+    split.vin[0].prevout = COutPoint(blockFunding.vtx[0].GetHash(), 0);
+    CAmount nValue = blockFunding.vtx[0].vout[0].nValue / (nTxns + 1);
+    split.vout.resize(nTxns, CTxOut(nValue, scriptPubKey));
+    BOOST_REQUIRE(SignSignature(keystore, blockFunding.vtx[0], split, 0));
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, split), CScript() << OP_TRUE);
+
+    std::vector<CTransaction> vtx;
+    for (unsigned int i = 0; i < nTxns; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(split.GetHash(), i);
+        tx.vout.resize(1, CTxOut(nValue - COIN / 100, scriptPubKey));
+        BOOST_REQUIRE(SignSignature(keystore, split, tx, 0));
+        vtx.push_back(tx);
+        CValidationState state;
+        LOCK(cs_main);
+        BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, vtx.back(), false, NULL));
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), nTxns);
+    mempool.PrioritiseTransaction(vtx[0].GetHash(), vtx[0].GetHash().ToString(), 0, COIN);
+
+    DumpMempool();
+    BOOST_CHECK(boost::filesystem::exists(GetDataDir() / "mempool.dat"));
+    mempool.clear();
+    {
+        LOCK(mempool.cs);
+        mempool.mapDeltas.clear();
+    }
+
+    // Reload, in more than one batch with the script check threads, while
+    // another thread connects blocks that take transactions out of the pool
+    int nHeight = chainActive.Height();
+    bool fMined = true;
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    boost::thread threadMine(MineBlocks, nBlocks, &fMined);
+    BOOST_CHECK(LoadMempool());
+    threadMine.join();
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    BOOST_CHECK(fMined);
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeight + nBlocks);
+
+    // Every transaction is back in the pool or in one of the new blocks
+    {
+        LOCK(cs_main);
+        BOOST_FOREACH (const CTransaction& tx, vtx)
+            BOOST_CHECK(mempool.exists(tx.GetHash()) || pcoinsTip->HaveCoin(COutPoint(tx.GetHash(), 0)));
+    }
+    // The fee delta came back with it, unless it was mined and cleared
+    {
+        LOCK(mempool.cs);
+        if (mempool.mapTx.count(vtx[0].GetHash())) {
+            BOOST_CHECK(mempool.mapDeltas.count(vtx[0].GetHash()));
+            BOOST_CHECK_EQUAL(mempool.mapDeltas[vtx[0].GetHash()].second, COIN);
+        }
+    }
+
+    mempool.clear();
+    boost::filesystem::remove(GetDataDir() / "mempool.dat");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
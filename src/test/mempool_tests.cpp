@@ -99,4 +99,225 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorTest)
+{
+    // Parent with two children, one of which has a child of its own
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    CMutableTransaction txChild[2];
+    for (int i = 0; i < 2; i++)
+    {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout.hash = txParent.GetHash();
+        txChild[i].vin[0].prevout.n = i;
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 11000LL;
+    }
+    CMutableTransaction txGrandChild;
+    txGrandChild.vin.resize(1);
+    txGrandChild.vin[0].scriptSig = CScript() << OP_11;
+    txGrandChild.vin[0].prevout.hash = txChild[0].GetHash();
+    txGrandChild.vin[0].prevout.n = 0;
+    txGrandChild.vout.resize(1);
+    txGrandChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txGrandChild.vout[0].nValue = 11000LL;
+
+    CTxMemPool testPool(CFeeRate(0));
+    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 0, 0.0, 1));
+    testPool.addUnchecked(txChild[0].GetHash(), CTxMemPoolEntry(txChild[0], 2000, 0, 0.0, 1));
+    testPool.addUnchecked(txChild[1].GetHash(), CTxMemPoolEntry(txChild[1], 3000, 0, 0.0, 1));
+    testPool.addUnchecked(txGrandChild.GetHash(), CTxMemPoolEntry(txGrandChild, 4000, 0, 0.0, 1));
+
+    CTxMemPool::txiter parentIt = testPool.mapTx.find(txParent.GetHash());
+    CTxMemPool::txiter child0It = testPool.mapTx.find(txChild[0].GetHash());
+    CTxMemPool::txiter grandChildIt = testPool.mapTx.find(txGrandChild.GetHash());
+    uint64_t nParentSize = parentIt->GetTxSize();
+    uint64_t nChildSize = child0It->GetTxSize();
+
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 4);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 10000);
+    BOOST_CHECK_EQUAL(child0It->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(child0It->GetModFeesWithDescendants(), 6000);
+    BOOST_CHECK_EQUAL(grandChildIt->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(grandChildIt->GetModFeesWithAncestors(), 7000);
+    BOOST_CHECK_EQUAL(child0It->GetSizeWithAncestors(), nParentSize + nChildSize);
+
+    // Fee deltas count towards the ancestors and descendants too
+    testPool.PrioritiseTransaction(txChild[0].GetHash(), txChild[0].GetHash().ToString(), 0.0, 500);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 10500);
+    BOOST_CHECK_EQUAL(grandChildIt->GetModFeesWithAncestors(), 7500);
+    testPool.ClearPrioritisation(txChild[0].GetHash());
+
+    // Limits on the chain of unconfirmed transactions
+    CTxMemPool::setEntries setAncestors;
+    std::string errString;
+    BOOST_CHECK(!testPool.CalculateMemPoolAncestors(*grandChildIt, setAncestors, 2, 1000000, 100, 1000000, errString, false));
+    setAncestors.clear();
+    BOOST_CHECK(testPool.CalculateMemPoolAncestors(*grandChildIt, setAncestors, 3, 1000000, 100, 1000000, errString, false));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 2);
+
+    // Removing the child leaves the parent with only the other child
+    std::list<CTransaction> removed;
+    testPool.remove(txChild[0], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 4000);
+    removed.clear();
+
+    // A parent added back after its children, as on a reorg, links to them
+    testPool.remove(txParent, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    CTxMemPool::txiter child1It = testPool.mapTx.find(txChild[1].GetHash());
+    BOOST_CHECK_EQUAL(child1It->GetCountWithAncestors(), 1);
+    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 0, 0.0, 1));
+    parentIt = testPool.mapTx.find(txParent.GetHash());
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(child1It->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(child1It->GetModFeesWithAncestors(), 4000);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // Three independent transactions of the same size with different fees
+    CMutableTransaction tx[3];
+    CAmount nFees[3] = {20000, 10000, 30000};
+    for (int i = 0; i < 3; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = (i + 1) * COIN;
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], nFees[i], 100 - i, 0.0, 1));
+    }
+
+    // A low fee child of the lowest fee transaction is mined with it,
+    // its high fee child pulls the package up
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout.hash = tx[1].GetHash();
+    txChild.vin[0].prevout.n = 0;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = COIN;
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 100000, 0, 0.0, 1));
+
+    // Ancestor score: child package (110000 over two) first, then by own fee
+    std::vector<uint256> sortedOrder;
+    sortedOrder.push_back(txChild.GetHash());
+    sortedOrder.push_back(tx[2].GetHash());
+    sortedOrder.push_back(tx[0].GetHash());
+    sortedOrder.push_back(tx[1].GetHash());
+    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator it = pool.mapTx.get<ancestor_score>().begin();
+    for (unsigned int i = 0; it != pool.mapTx.get<ancestor_score>().end(); ++it, ++i)
+        BOOST_CHECK_EQUAL(it->GetTx().GetHash().ToString(), sortedOrder[i].ToString());
+
+    // Descendant score: lowest first, so tx[1] sorts with its child's fees
+    sortedOrder.clear();
+    sortedOrder.push_back(tx[0].GetHash());
+    sortedOrder.push_back(tx[2].GetHash());
+    sortedOrder.push_back(tx[1].GetHash());
+    sortedOrder.push_back(txChild.GetHash());
+    CTxMemPool::indexed_transaction_set::index<descendant_score>::type::iterator dit = pool.mapTx.get<descendant_score>().begin();
+    for (unsigned int i = 0; dit != pool.mapTx.get<descendant_score>().end(); ++dit, ++i)
+        BOOST_CHECK_EQUAL(dit->GetTx().GetHash().ToString(), sortedOrder[i].ToString());
+
+    // Entry time: oldest first
+    CTxMemPool::indexed_transaction_set::index<entry_time>::type::iterator tit = pool.mapTx.get<entry_time>().begin();
+    BOOST_CHECK_EQUAL(tit->GetTx().GetHash().ToString(), txChild.GetHash().ToString());
+    BOOST_CHECK_EQUAL((++tit)->GetTx().GetHash().ToString(), tx[2].GetHash().ToString());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    SetMockTime(42);
+
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000, GetTime(), 0.0, 1));
+
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 5000, GetTime(), 0.0, 1));
+
+    // A high fee child makes the package of tx2 better than tx1
+    CMutableTransaction tx3;
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_2;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 20000, GetTime(), 0.0, 1));
+
+    // Nothing to do while the pool fits
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    BOOST_CHECK(pool.exists(tx3.GetHash()));
+
+    // The minimum fee is the fee rate of the evicted transaction plus the relay fee
+    CFeeRate minFee(CFeeRate(10000, ::GetSerializeSize(tx1, SER_NETWORK, PROTOCOL_VERSION)).GetFeePerK() + 1000);
+    BOOST_CHECK(pool.GetMinFee(1) == minFee);
+
+    // The package is evicted as a whole
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+    BOOST_CHECK(pool.GetMinFee(1) > minFee);
+    CAmount nMinFeeRate = pool.GetMinFee(1).GetFeePerK();
+
+    // The minimum fee only starts to decay after a block
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFeeRate);
+
+    std::vector<CTransaction> vtx;
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts);
+    SetMockTime(42 + 2 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nMinFeeRate / 2);
+
+    // ... faster while the pool is far below its limit, until it drops to zero
+    SetMockTime(42 + 2 * CTxMemPool::ROLLING_FEE_HALFLIFE + CTxMemPool::ROLLING_FEE_HALFLIFE / 4);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(10000000).GetFeePerK(), nMinFeeRate / 4);
+    SetMockTime(42 + 100 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+
+    // Expiry removes old transactions together with their descendants
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000, 100, 0.0, 1));
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 5000, 200, 0.0, 1));
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 20000, 50, 0.0, 1));
+    BOOST_CHECK_EQUAL(pool.Expire(150), 2);
+    BOOST_CHECK(!pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    BOOST_CHECK(!pool.exists(tx3.GetHash()));
+
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,52 +2,30 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
+#include "checkpoints.h"
 #include "init.h"
+#include "key.h"
+#include "keystore.h"
 #include "main.h"
 #include "miner.h"
 #include "pubkey.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "test_unitedstatedollarcrypto.h"
+#include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <limits>
+#include <list>
+#include <map>
+#include <vector>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_AUTO_TEST_SUITE(miner_tests)
 
-static
-struct {
-    unsigned char extranonce;
-    unsigned int nonce;
-} blockinfo[] = {
-    {4, 0xa4a3e223}, {2, 0x15c32f9e}, {1, 0x0375b547}, {1, 0x7004a8a5},
-    {2, 0xce440296}, {2, 0x52cfe198}, {1, 0x77a72cd0}, {2, 0xbb5d6f84},
-    {2, 0x83f30c2c}, {1, 0x48a73d5b}, {1, 0xef7dcd01}, {2, 0x6809c6c4},
-    {2, 0x0883ab3c}, {1, 0x087bbbe2}, {2, 0x2104a814}, {2, 0xdffb6daa},
-    {1, 0xee8a0a08}, {2, 0xba4237c1}, {1, 0xa70349dc}, {1, 0x344722bb},
-    {3, 0xd6294733}, {2, 0xec9f5c94}, {2, 0xca2fbc28}, {1, 0x6ba4f406},
-    {2, 0x015d4532}, {1, 0x6e119b7c}, {2, 0x43e8f314}, {2, 0x27962f38},
-    {2, 0xb571b51b}, {2, 0xb36bee23}, {2, 0xd17924a8}, {2, 0x6bc212d9},
-    {1, 0x630d4948}, {2, 0x9a4c4ebb}, {2, 0x554be537}, {1, 0xd63ddfc7},
-    {2, 0xa10acc11}, {1, 0x759a8363}, {2, 0xfb73090d}, {1, 0xe82c6a34},
-    {1, 0xe33e92d7}, {3, 0x658ef5cb}, {2, 0xba32ff22}, {5, 0x0227a10c},
-    {1, 0xa9a70155}, {5, 0xd096d809}, {1, 0x37176174}, {1, 0x830b8d0f},
-    {1, 0xc6e3910e}, {2, 0x823f3ca8}, {1, 0x99850849}, {1, 0x7521fb81},
-    {1, 0xaacaabab}, {1, 0xd645a2eb}, {5, 0x7aea1781}, {5, 0x9d6e4b78},
-    {1, 0x4ce90fd8}, {1, 0xabdc832d}, {6, 0x4a34f32a}, {2, 0xf2524c1c},
-    {2, 0x1bbeb08a}, {1, 0xad47f480}, {1, 0x9f026aeb}, {1, 0x15a95049},
-    {2, 0xd1cb95b2}, {2, 0xf84bbda5}, {1, 0x0fa62cd1}, {1, 0xe05f9169},
-    {1, 0x78d194a9}, {5, 0x3e38147b}, {5, 0x737ba0d4}, {1, 0x63378e10},
-    {1, 0x6d5f91cf}, {2, 0x88612eb8}, {2, 0xe9639484}, {1, 0xb7fabc9d},
-    {2, 0x19b01592}, {1, 0x5a90dd31}, {2, 0x5bd7e028}, {2, 0x94d00323},
-    {1, 0xa9b9c01a}, {1, 0x3a40de61}, {1, 0x56e7eec7}, {5, 0x859f7ef6},
-    {1, 0xfd8e5630}, {1, 0x2b0c9f7f}, {1, 0xba700e26}, {1, 0x7170a408},
-    {1, 0x70de86a8}, {1, 0x74d64cd5}, {1, 0x49e738a1}, {2, 0x6910b602},
-    {0, 0x643c565f}, {1, 0x54264b3f}, {2, 0x97ea6396}, {2, 0x55174459},
-    {2, 0x03e8779a}, {1, 0x98f34d8f}, {1, 0xc07b2b07}, {1, 0xdfe29668},
-    {1, 0x3141c7c1}, {1, 0xb3b595f4}, {1, 0x735abf08}, {5, 0x623bfbce},
-    {2, 0xd351e722}, {1, 0xf4ca48c9}, {1, 0x5b19c670}, {1, 0xa164bf0e},
-    {2, 0xbbbeb305}, {2, 0xfe1c810a},
-};
-
 // NOTE: These tests rely on CreateNewBlock doing its own self-validation!
 BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 {
@@ -63,28 +41,15 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     // Simple block creation, nothing special yet:
     BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
 
-    // We can't make transactions until we have inputs
-    // Therefore, load 100 blocks :)
+    // We can't make transactions until we have inputs. Mine blocks paying
+    // to an empty script and let the first two coinbases mature
     std::vector<CTransaction*>txFirst;
-    for (unsigned int i = 0; i < sizeof(blockinfo)/sizeof(*blockinfo); ++i)
+    std::vector<CMutableTransaction> noTxns;
+    for (int i = 0; i < Params().COINBASE_MATURITY() + 2; ++i)
     {
-        CBlock *pblock = &pblocktemplate->block; // pointer for convenience
-        pblock->nVersion = 4;
-        pblock->nTime = chainActive.Tip()->GetMedianTimePast()+1;
-        CMutableTransaction txCoinbase(pblock->vtx[0]);
-        txCoinbase.vin[0].scriptSig = CScript();
-        txCoinbase.vin[0].scriptSig.push_back(blockinfo[i].extranonce);
-        txCoinbase.vin[0].scriptSig.push_back(chainActive.Height());
-        txCoinbase.vout[0].scriptPubKey = CScript();
-        pblock->vtx[0] = CTransaction(txCoinbase);
+        CBlock block = CreateAndProcessBlock(noTxns, CScript());
         if (txFirst.size() < 2)
-            txFirst.push_back(new CTransaction(pblock->vtx[0]));
-        pblock->hashMerkleRoot = pblock->BuildMerkleTree();
-        pblock->nNonce = blockinfo[i].nonce;
-        CValidationState state;
-        BOOST_CHECK(ProcessNewBlock(state, NULL, pblock));
-        BOOST_CHECK(state.IsValid());
-        pblock->hashPrevBlock = pblock->GetHash();
+            txFirst.push_back(new CTransaction(block.vtx[0]));
     }
     delete pblocktemplate;
 
@@ -209,7 +174,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     delete pblocktemplate;
     chainActive.Tip()->nHeight = nHeight;
 
-    // non-final txs in mempool
+    // non-final txs in mempool, paying enough to be picked once final
     SetMockTime(chainActive.Tip()->GetMedianTimePast()+1);
 
     // height locked
@@ -220,7 +185,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx.vout[0].scriptPubKey = CScript() << OP_1;
     tx.nLockTime = chainActive.Tip()->nHeight+1;
     hash = tx.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx, COIN / 100, GetTime(), 111.0, 11));
     BOOST_CHECK(!IsFinalTx(tx, chainActive.Tip()->nHeight + 1));
 
     // time locked
@@ -234,7 +199,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx2.vout[0].scriptPubKey = CScript() << OP_1;
     tx2.nLockTime = chainActive.Tip()->GetMedianTimePast()+1;
     hash = tx2.GetHash();
-    mempool.addUnchecked(hash, CTxMemPoolEntry(tx2, 11, GetTime(), 111.0, 11));
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx2, COIN / 100, GetTime(), 111.0, 11));
     BOOST_CHECK(!IsFinalTx(tx2));
 
     BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
@@ -264,4 +229,163 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     Checkpoints::fEnabled = true;
 }
 
+
+//! Spend output n of txFrom back to the same key, paying nFee
+static CTransaction SpendOutput(const CKeyStore& keystore, const CTransaction& txFrom, unsigned int n, CAmount nFee)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txFrom.GetHash(), n);
+    tx.vout.resize(1, CTxOut(txFrom.vout[n].nValue - nFee, txFrom.vout[n].scriptPubKey));
+    BOOST_REQUIRE(SignSignature(keystore, txFrom, tx, 0));
+    return tx;
+}
+
+static bool AcceptTx(const CTransaction& tx)
+{
+    CValidationState state;
+    LOCK(cs_main);
+    return AcceptToMemoryPool(mempool, state, tx, false, NULL);
+}
+
+BOOST_AUTO_TEST_CASE(UpdateNewBlock_incremental)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    CScript scriptCoinbase = CScript() << OP_TRUE;
+
+    // Confirmed outputs that the transactions below spend independently
+    std::vector<CMutableTransaction> noTxns;
+    CBlock blockFunding = CreateAndProcessBlock(noTxns, scriptPubKey);
+    for (int i = 0; i < Params().COINBASE_MATURITY(); i++)
+        CreateAndProcessBlock(noTxns, scriptCoinbase);
+    CMutableTransaction split;
+    split.vin.resize(1);
+    split.vin[0].prevout = COutPoint(blockFunding.vtx[0].GetHash(), 0);
+    split.vout.resize(3, CTxOut(blockFunding.vtx[0].vout[0].nValue / 4, scriptPubKey));
+    BOOST_REQUIRE(SignSignature(keystore, blockFunding.vtx[0], split, 0));
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, split), scriptCoinbase);
+    mempool.clear();
+
+    const CAmount nFee = COIN / 100;
+    CTransaction txA = SpendOutput(keystore, split, 0, nFee);
+    BOOST_REQUIRE(AcceptTx(txA));
+    CBlockTemplate* pblocktemplate = CreateNewBlock(scriptCoinbase, pwalletMain, false);
+    BOOST_REQUIRE(pblocktemplate);
+    CBlock& block = pblocktemplate->block;
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), 2U);
+    BOOST_CHECK(block.vtx[1].GetHash() == txA.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -nFee);
+
+    // Nothing new in the mempool, nothing to patch
+    BOOST_CHECK(!UpdateNewBlock(pblocktemplate));
+    BOOST_CHECK_EQUAL(block.vtx.size(), 2U);
+
+    // A new transaction is appended behind the ones already there
+    CTransaction txB = SpendOutput(keystore, split, 1, 2 * nFee);
+    BOOST_REQUIRE(AcceptTx(txB));
+    BOOST_CHECK(UpdateNewBlock(pblocktemplate));
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), 3U);
+    BOOST_CHECK(block.vtx[1].GetHash() == txA.GetHash());
+    BOOST_CHECK(block.vtx[2].GetHash() == txB.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees.size(), block.vtx.size());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxSigOps.size(), block.vtx.size());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -3 * nFee);
+
+    // txA is evicted while in the template, and a spend of the same output
+    // enters the mempool. txA stays in the block and the conflict is left out.
+    std::list<CTransaction> removed;
+    mempool.remove(txA, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 1U);
+    CTransaction txConflict = SpendOutput(keystore, split, 0, 3 * nFee);
+    BOOST_REQUIRE(AcceptTx(txConflict));
+    BOOST_CHECK(!UpdateNewBlock(pblocktemplate));
+    CTransaction txC = SpendOutput(keystore, split, 2, nFee);
+    BOOST_REQUIRE(AcceptTx(txC));
+    BOOST_CHECK(UpdateNewBlock(pblocktemplate));
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), 4U);
+    BOOST_CHECK(block.vtx[1].GetHash() == txA.GetHash());
+    BOOST_CHECK(block.vtx[3].GetHash() == txC.GetHash());
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        BOOST_CHECK(block.vtx[i].GetHash() != txConflict.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -4 * nFee);
+
+    // The patched block connects, and takes the conflict out of the mempool
+    {
+        LOCK(cs_main);
+        unsigned int nExtraNonce = 0;
+        IncrementExtraNonce(&block, chainActive.Tip(), nExtraNonce);
+    }
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlock(state, NULL, &block));
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    BOOST_CHECK(!mempool.exists(txConflict.GetHash()));
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+
+    // Once the tip has moved the template is stale
+    CTransaction txD = SpendOutput(keystore, txC, 0, nFee);
+    BOOST_REQUIRE(AcceptTx(txD));
+    BOOST_CHECK(!UpdateNewBlock(pblocktemplate));
+
+    delete pblocktemplate;
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(stake_search_window)
+{
+    const int64_t nHashDrift = 45;
+    const int64_t nStart = 1500000000;
+    CBlockIndex indexTip, indexOther;
+    CStakeSearchWindow window;
+
+    // Successive searches on one tip, hashing what CreateCoinStake hashes for
+    // the interval: the newest nInterval timestamps up to nSearchTime + nHashDrift
+    const int64_t vOffsets[] = {0, 0, 1, 2, 2, 7, 30, 31, 200, 201};
+    std::map<int64_t, int> mapHashed;
+    BOOST_FOREACH (int64_t nOffset, vOffsets) {
+        int64_t nSearchTime = nStart + nOffset;
+        int64_t nInterval = window.GetInterval(&indexTip, nSearchTime, nHashDrift);
+        BOOST_CHECK(nInterval >= 0 && nInterval <= nHashDrift);
+        for (int64_t nTime = nSearchTime + nHashDrift - nInterval + 1; nTime <= nSearchTime + nHashDrift; nTime++)
+            mapHashed[nTime]++;
+        if (nInterval > 0)
+            window.Searched(&indexTip, nSearchTime);
+    }
+    // Each timestamp is hashed once, and every search covers its whole window
+    for (std::map<int64_t, int>::const_iterator it = mapHashed.begin(); it != mapHashed.end(); it++)
+        BOOST_CHECK_EQUAL(it->second, 1);
+    BOOST_FOREACH (int64_t nOffset, vOffsets) {
+        for (int64_t nTime = nStart + nOffset + 1; nTime <= nStart + nOffset + nHashDrift; nTime++)
+            BOOST_CHECK(mapHashed.count(nTime));
+    }
+
+    // A search that returned early is not recorded, so the next one hashes its timestamps too
+    int64_t nLast = nStart + 201;
+    BOOST_CHECK_EQUAL(window.GetInterval(&indexTip, nLast + 5, nHashDrift), 5);
+    BOOST_CHECK_EQUAL(window.GetInterval(&indexTip, nLast + 6, nHashDrift), 6);
+    BOOST_CHECK_EQUAL(window.GetInterval(&indexTip, nLast - 1, nHashDrift), 0);
+
+    // A new tip, or a reset when coins came in, hashes the whole window
+    BOOST_CHECK_EQUAL(window.GetInterval(&indexOther, nLast, nHashDrift), nHashDrift);
+    window.Reset();
+    BOOST_CHECK_EQUAL(window.GetInterval(&indexTip, nLast, nHashDrift), nHashDrift);
+}
+
+BOOST_AUTO_TEST_CASE(stake_latency_buckets)
+{
+    BOOST_CHECK_EQUAL(GetStakeLatencyBucket(-1), 0);
+    BOOST_CHECK_EQUAL(GetStakeLatencyBucket(0), 0);
+    for (int i = 0; i < STAKE_LATENCY_NUM_BUCKETS - 1; i++) {
+        BOOST_CHECK_EQUAL(GetStakeLatencyBucket(STAKE_LATENCY_BUCKETS_MS[i] - 1), i);
+        BOOST_CHECK_EQUAL(GetStakeLatencyBucket(STAKE_LATENCY_BUCKETS_MS[i]), i + 1);
+    }
+    BOOST_CHECK_EQUAL(GetStakeLatencyBucket(std::numeric_limits<int64_t>::max()), STAKE_LATENCY_NUM_BUCKETS - 1);
+    BOOST_CHECK_EQUAL(GetStakeLatencyHistogram().size(), (size_t)STAKE_LATENCY_NUM_BUCKETS);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
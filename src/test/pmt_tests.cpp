@@ -48,6 +48,9 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
         std::vector<uint256> vTxid(nTx, 0);
         for (unsigned int j=0; j<nTx; j++)
             vTxid[j] = block.vtx[j].GetHash();
+        bool mutated;
+        BOOST_CHECK(ComputeMerkleRoot(vTxid, &mutated) == merkleRoot1);
+        BOOST_CHECK(!mutated);
         int nHeight = 1, nTx_ = nTx;
         while (nTx_ > 1) {
             nTx_ = (nTx_+1)/2;
@@ -0,0 +1,88 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "kernel.h"
+#include "main.h"
+#include "test_unitedstatedollarcrypto.h"
+#include "util.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(prune_tests)
+
+BOOST_AUTO_TEST_CASE(prune_margin)
+{
+    mapArgs.erase("-maxreorg");
+    unsigned int nMargin = GetPruneMargin();
+    BOOST_CHECK(nMargin >= MIN_BLOCKS_TO_KEEP);
+    BOOST_CHECK(nMargin > (unsigned int)Params().MaxReorganizationDepth());
+    BOOST_CHECK(nMargin > (unsigned int)Params().COINBASE_MATURITY());
+    BOOST_CHECK_EQUAL(nMargin, std::max(MIN_BLOCKS_TO_KEEP, (unsigned int)std::max(Params().MaxReorganizationDepth(), Params().COINBASE_MATURITY()) + 1));
+
+    // Accepting deeper reorganisations keeps more undo data
+    mapArgs["-maxreorg"] = "1000";
+    BOOST_CHECK_EQUAL(GetPruneMargin(), 1001U);
+    mapArgs["-maxreorg"] = "1";
+    BOOST_CHECK_EQUAL(GetPruneMargin(), nMargin);
+    mapArgs.erase("-maxreorg");
+}
+
+BOOST_AUTO_TEST_CASE(kernel_spent_after_fork)
+{
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    std::vector<CMutableTransaction> noTxns;
+
+    // A mature output to spend
+    CBlock blockFunding = CreateAndProcessBlock(noTxns, scriptPubKey);
+    const CBlockIndex* pindexFunding = chainActive.Tip();
+    for (int i = 0; i < Params().COINBASE_MATURITY(); i++)
+        CreateAndProcessBlock(noTxns, scriptPubKey);
+    const CBlockIndex* pindexFork = chainActive.Tip();
+
+    COutPoint prevout(blockFunding.vtx[0].GetHash(), 0);
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = prevout;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = blockFunding.vtx[0].vout[0].nValue;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptPubKey);
+    const CBlockIndex* pindexSpend = chainActive.Tip();
+    CreateAndProcessBlock(noTxns, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->pprev == pindexSpend);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(!pcoinsTip->HaveCoin(prevout));
+    }
+
+    // A block on a fork from before the spend may stake the output; it is
+    // found among the outputs spent near the tip
+    Coin coin;
+    BOOST_CHECK(GetCoinSpentAfterFork(prevout, pindexFork, coin));
+    BOOST_CHECK(coin.out == blockFunding.vtx[0].vout[0]);
+    BOOST_CHECK_EQUAL((int)coin.nHeight, pindexFunding->nHeight);
+    BOOST_CHECK(coin.IsCoinBase());
+
+    CTxOut txoutPrev;
+    const CBlockIndex* pindexFrom = NULL;
+    BOOST_CHECK(GetKernelInput(prevout, pindexFork, txoutPrev, pindexFrom));
+    BOOST_CHECK(txoutPrev == blockFunding.vtx[0].vout[0]);
+    BOOST_CHECK(pindexFrom == pindexFunding);
+
+    // After a restart they are read back from the undo data
+    BOOST_CHECK(LoadRecentlySpentCoins());
+    BOOST_CHECK(GetCoinSpentAfterFork(prevout, pindexFork, coin));
+    BOOST_CHECK(coin.out == blockFunding.vtx[0].vout[0]);
+    BOOST_CHECK_EQUAL((int)coin.nHeight, pindexFunding->nHeight);
+
+    // Forks from after the spend do not see it
+    BOOST_CHECK(!GetCoinSpentAfterFork(prevout, pindexSpend, coin));
+    BOOST_CHECK(!GetCoinSpentAfterFork(prevout, chainActive.Tip(), coin));
+    BOOST_CHECK(!GetCoinSpentAfterFork(prevout, NULL, coin));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,121 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "test_unitedstatedollarcrypto.h"
+#include "txmempool.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(scriptcache_tests)
+
+/**
+ * Run CheckInputs the way ConnectBlock does with script check threads, and
+ * return whether the script execution cache answered instead of queueing
+ * the script checks.
+ */
+static bool CheckInputsCached(const CTransaction& tx, unsigned int flags, bool cacheStore)
+{
+    LOCK(cs_main);
+    CCoinsViewCache view(pcoinsTip);
+    CValidationState state;
+    std::vector<CScriptCheck> vChecks;
+    BOOST_CHECK(CheckInputs(tx, state, view, true, flags, cacheStore, &vChecks));
+    BOOST_FOREACH (CScriptCheck& check, vChecks)
+        BOOST_CHECK(check());
+    return vChecks.empty();
+}
+
+//! Whether the cache holds tx under flags, leaving the entry in place
+static bool IsCached(const CTransaction& tx, unsigned int flags)
+{
+    return CheckInputsCached(tx, flags, true);
+}
+
+BOOST_AUTO_TEST_CASE(script_execution_cache)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // Confirmed outputs for the transactions below
+    std::vector<CMutableTransaction> noTxns;
+    CBlock blockFunding = CreateAndProcessBlock(noTxns, scriptPubKey);
+    for (int i = 0; i < Params().COINBASE_MATURITY(); i++)
+        CreateAndProcessBlock(noTxns, CScript() << OP_TRUE);
+    CMutableTransaction split;
+    split.vin.resize(1);
+    split.vin[0].prevout = COutPoint(blockFunding.vtx[0].GetHash(), 0);
+    split.vout.resize(2, CTxOut(blockFunding.vtx[0].vout[0].nValue / 4, scriptPubKey));
+    BOOST_REQUIRE(SignSignature(keystore, blockFunding.vtx[0], split, 0));
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, split), CScript() << OP_TRUE);
+
+    std::vector<CTransaction> vtx;
+    for (unsigned int i = 0; i < split.vout.size(); i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(split.GetHash(), i);
+        tx.vout.resize(1, CTxOut(split.vout[i].nValue - COIN / 100, scriptPubKey));
+        BOOST_REQUIRE(SignSignature(keystore, split, tx, 0));
+        vtx.push_back(tx);
+    }
+
+    unsigned int nBlockFlags;
+    {
+        LOCK(cs_main);
+        nBlockFlags = MANDATORY_SCRIPT_VERIFY_FLAGS | GetBlockScriptFlags(chainActive.Tip());
+    }
+    const unsigned int nOtherFlags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC;
+    BOOST_REQUIRE(nOtherFlags != nBlockFlags && nOtherFlags != STANDARD_SCRIPT_VERIFY_FLAGS);
+
+    // Accepting a transaction to the mempool stores it under the flags the
+    // next block is connected with
+    {
+        CValidationState state;
+        LOCK(cs_main);
+        BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, vtx[0], false, NULL));
+    }
+    BOOST_CHECK(IsCached(vtx[0], nBlockFlags));
+    BOOST_CHECK(IsCached(vtx[0], STANDARD_SCRIPT_VERIFY_FLAGS));
+
+    // Other flags miss, and the miss does not store anything
+    BOOST_CHECK(!IsCached(vtx[0], nOtherFlags));
+    BOOST_CHECK(!IsCached(vtx[0], nOtherFlags));
+
+    // ConnectBlock with fJustCheck, as TestBlockValidity does, hits and keeps the entry
+    BOOST_CHECK(CheckInputsCached(vtx[0], nBlockFlags, true));
+    BOOST_CHECK(IsCached(vtx[0], nBlockFlags));
+
+    // A real ConnectBlock hits and frees the entry
+    BOOST_CHECK(CheckInputsCached(vtx[0], nBlockFlags, false));
+    BOOST_CHECK(!IsCached(vtx[0], nBlockFlags));
+
+    // Scripts handed to the check queue through pvChecks have not run yet, so
+    // the transaction is not stored, even with cacheStore
+    BOOST_CHECK(!CheckInputsCached(vtx[1], nBlockFlags, true));
+    BOOST_CHECK(!IsCached(vtx[1], nBlockFlags));
+
+    // Checked inline, it is
+    {
+        LOCK(cs_main);
+        CCoinsViewCache view(pcoinsTip);
+        CValidationState state;
+        BOOST_CHECK(CheckInputs(vtx[1], state, view, true, nBlockFlags, true));
+    }
+    BOOST_CHECK(IsCached(vtx[1], nBlockFlags));
+    BOOST_CHECK(!IsCached(vtx[1], nOtherFlags));
+
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
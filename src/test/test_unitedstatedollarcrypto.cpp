@@ -4,8 +4,13 @@
 
 #define BOOST_TEST_MODULE USD Coin Test Suite
 
+#include "test_unitedstatedollarcrypto.h"
+
+#include "chainparams.h"
 #include "main.h"
+#include "miner.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -35,6 +40,8 @@ struct TestingSetup {
         fCheckBlockIndex = true;
         SelectParams(CBaseChainParams::UNITTEST);
         noui_connect();
+        InitSignatureCache();
+        InitScriptExecutionCache();
 #ifdef ENABLE_WALLET
         bitdb.MakeMock();
 #endif
@@ -91,3 +98,24 @@ bool ShutdownRequested()
 {
   return false;
 }
+
+CBlock CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns, const CScript& scriptPubKey)
+{
+    CBlockTemplate* pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false);
+    BOOST_REQUIRE(pblocktemplate);
+    CBlock block = pblocktemplate->block;
+    delete pblocktemplate;
+
+    // Replace whatever the mempool contributed with txns
+    block.vtx.resize(1);
+    BOOST_FOREACH (const CMutableTransaction& tx, txns)
+        block.vtx.push_back(tx);
+    unsigned int nExtraNonce = 0;
+    IncrementExtraNonce(&block, chainActive.Tip(), nExtraNonce);
+
+    ModifiableParams()->setSkipProofOfWorkCheck(true);
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlock(state, NULL, &block));
+    ModifiableParams()->setSkipProofOfWorkCheck(false);
+    return block;
+}
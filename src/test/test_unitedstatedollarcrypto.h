@@ -0,0 +1,21 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TEST_TEST_UNITEDSTATEDOLLARCRYPTO_H
+#define BITCOIN_TEST_TEST_UNITEDSTATEDOLLARCRYPTO_H
+
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+
+#include <vector>
+
+/**
+ * Create a proof-of-work block on top of the active chain that holds txns
+ * after its coinbase, and process it. The proof-of-work check is skipped, so
+ * this only works below the last proof-of-work height. Returns the block.
+ */
+CBlock CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns, const CScript& scriptPubKey);
+
+#endif // BITCOIN_TEST_TEST_UNITEDSTATEDOLLARCRYPTO_H
@@ -0,0 +1,49 @@
+// Copyright (c) 2017-2019 The USD Coin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TIMESTAMPINDEX_H
+#define BITCOIN_TIMESTAMPINDEX_H
+
+#include "crypto/common.h"
+#include "serialize.h"
+#include "uint256.h"
+
+/** Default for -timestampindex */
+static const bool DEFAULT_TIMESTAMPINDEX = false;
+
+/**
+ * A block by its timestamp, serialized big-endian so that blocks are iterated
+ * in time order. Block timestamps are not monotonic along the chain, and blocks
+ * that were disconnected keep their entry, so lookups check the active chain.
+ * Value: none
+ */
+struct CTimestampIndexKey {
+    unsigned int timestamp;
+    uint256 blockHash;
+
+    CTimestampIndexKey() : timestamp(0) {}
+    CTimestampIndexKey(unsigned int timestampIn, const uint256& blockHashIn) : timestamp(timestampIn), blockHash(blockHashIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const { return 36; }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        unsigned char buf[4];
+        WriteBE32(buf, timestamp);
+        s.write((const char*)buf, 4);
+        ::Serialize(s, blockHash, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        unsigned char buf[4];
+        s.read((char*)buf, 4);
+        timestamp = ReadBE32(buf);
+        ::Unserialize(s, blockHash, nType, nVersion);
+    }
+};
+
+#endif // BITCOIN_TIMESTAMPINDEX_H
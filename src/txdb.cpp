@@ -6,22 +6,105 @@
 
 #include "txdb.h"
 
+#include "blockstore.h"
+#include "chainparams.h"
+#include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
+#include "protocol.h"
+#include "random.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
 
+#include <limits>
 #include <stdint.h>
+#include <string.h>
 
+#include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
 
-void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
+namespace
 {
-    if (coins.IsPruned())
-        batch.Erase(make_pair('c', hash));
-    else
-        batch.Write(make_pair('c', hash), coins);
+/** Key of a single unspent output in the chainstate: 'C' || txid || VARINT(n). */
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key('C') {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(key);
+        READWRITE(outpoint->hash);
+        READWRITE(VARINT(outpoint->n));
+    }
+};
+
+/**
+ * Legacy per-transaction chainstate record ('c' || txid), only kept to
+ * convert old databases. See CCoinsViewDB::Upgrade.
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode): bit 1 coinbase, bit 2 coinstake, bits 4 and 8 vout[0] and
+ *   vout[1] unspent, higher bits the number of non-zero bytes in the
+ *   following bitvector (minus one if neither vout[0] nor vout[1] is unspent)
+ * - unspentness bitvector, for vout[2] and further; least significant byte first
+ * - the non-spent CTxOuts (via CTxOutCompressor)
+ * - VARINT(nHeight)
+ */
+class CCoins
+{
+public:
+    bool fCoinBase;
+    bool fCoinStake;
+    std::vector<CTxOut> vout;
+    int nHeight;
+
+    CCoins() : fCoinBase(false), fCoinStake(false), nHeight(0) {}
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy), nType, nVersion);
+        // header code
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        fCoinBase = nCode & 1;
+        fCoinStake = (nCode & 2) != 0;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 4) != 0;
+        vAvail[1] = (nCode & 8) != 0;
+        unsigned int nMaskCode = (nCode / 16) + ((nCode & 12) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail, nType, nVersion);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion);
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+    }
+};
 }
 
 void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
@@ -33,14 +116,14 @@ CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(Get
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
+bool CCoinsViewDB::GetCoin(const COutPoint& outpoint, Coin& coin) const
 {
-    return db.Read(make_pair('c', txid), coins);
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256& txid) const
+bool CCoinsViewDB::HaveCoin(const COutPoint& outpoint) const
 {
-    return db.Exists(make_pair('c', txid));
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
@@ -51,14 +134,25 @@ uint256 CCoinsViewDB::GetBestBlock() const
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+bool CCoinsViewDB::GetTxOutSetDigest(CTxOutSetDigest& digest) const
+{
+    if (!db.Read('D', digest))
+        return false;
+    return digest.hashBlock == GetBestBlock();
+}
+
+bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const CTxOutSetDigest& digest)
 {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
+            else
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
@@ -67,18 +161,158 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     }
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
+    // Totals for any other block are stale; a digest already stored for an
+    // earlier block is harmless, as it is only used at that block.
+    if (hashBlock != uint256(0) && digest.hashBlock == hashBlock)
+        batch.Write('D', digest);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
+CCoinsViewCursor* CCoinsViewDB::Cursor() const
+{
+    /* It seems that there are no "const iterators" for LevelDB.  Since we
+       only need read operations on it, use a const-cast to get around
+       that restriction.  */
+    CCoinsViewDBCursor* i = new CCoinsViewDBCursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator(), GetBestBlock());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'C';
+    i->pcursor->Seek(ssKeySet.str());
+    i->ReadKey();
+    return i;
+}
+
+void CCoinsViewDBCursor::ReadKey()
+{
+    if (!Valid())
+        return;
+    leveldb::Slice slKey = pcursor->key();
+    CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+    CoinEntry entry(&keyTmp);
+    ssKey >> entry;
+}
+
+bool CCoinsViewDBCursor::GetKey(COutPoint& key) const
+{
+    if (!Valid())
+        return false;
+    key = keyTmp;
+    return true;
+}
+
+bool CCoinsViewDBCursor::GetValue(Coin& coin) const
+{
+    if (!Valid())
+        return false;
+    leveldb::Slice slValue = pcursor->value();
+    try {
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> coin;
+    } catch (const std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CCoinsViewDBCursor::Valid() const
+{
+    return pcursor->Valid() && pcursor->key().size() > 0 && pcursor->key()[0] == 'C';
+}
+
+void CCoinsViewDBCursor::Next()
+{
+    pcursor->Next();
+    ReadKey();
+}
+
+bool CCoinsViewDB::Upgrade()
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('c', uint256(0));
+    pcursor->Seek(ssKeySet.str());
+    if (!pcursor->Valid() || pcursor->key()[0] != 'c')
+        return true;
+
+    int64_t count = 0;
+    LogPrintf("Upgrading chainstate database to per-output records...\n");
+    LogPrintf("[0%%]...");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    size_t batch_size = 1 << 24;
+    CLevelDBBatch batch;
+    int reportDone = 0;
+    uint256 txidPrev(0), txid(0);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            break;
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() == 0 || slKey[0] != 'c')
+            break;
+        try {
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            ssKey >> txid;
+            if (count++ % 256 == 0) {
+                uint32_t high = 0x100 * *txid.begin() + *(txid.begin() + 1);
+                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone);
+                if (reportDone < percentageDone / 10) {
+                    // report max. every 10% step
+                    LogPrintf("[%d%%]...", percentageDone);
+                    reportDone = percentageDone / 10;
+                }
+            }
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoins old_coins;
+            ssValue >> old_coins;
+            COutPoint outpoint(txid, 0);
+            for (size_t i = 0; i < old_coins.vout.size(); ++i) {
+                if (!old_coins.vout[i].IsNull() && !old_coins.vout[i].scriptPubKey.IsUnspendable()) {
+                    Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase, old_coins.fCoinStake);
+                    outpoint.n = i;
+                    batch.Write(CoinEntry(&outpoint), newcoin);
+                }
+            }
+            batch.Erase(make_pair('c', txid));
+        } catch (std::exception& e) {
+            return error("%s : cannot parse CCoins record - %s", __func__, e.what());
+        }
+        if (batch.SizeEstimate() > batch_size) {
+            db.WriteBatch(batch);
+            batch.Clear();
+            db.CompactRange(make_pair('c', txidPrev), make_pair('c', txid));
+            txidPrev = txid;
+        }
+        pcursor->Next();
+    }
+    db.WriteBatch(batch);
+    db.CompactRange(make_pair('c', uint256(0)), make_pair('c', txid));
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    return !ShutdownRequested();
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
 {
 }
 
 bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
 {
-    return Write(make_pair('b', blockindex.GetBlockHash()), blockindex);
+    uint256 hash = blockindex.GetBlockHash();
+    CLevelDBBatch batch;
+    batch.Write(make_pair('b', hash), blockindex);
+    // Mark the entry as changed since the last block index snapshot
+    batch.Write(make_pair('d', hash), '1');
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadBlockIndex(const uint256& hash, CDiskBlockIndex& blockindex)
+{
+    return Read(make_pair('b', hash), blockindex);
 }
 
 bool CBlockTreeDB::WriteBlockFileInfo(int nFile, const CBlockFileInfo& info)
@@ -115,57 +349,74 @@ bool CBlockTreeDB::ReadLastBlockFile(int& nFile)
     return Read('l', nFile);
 }
 
+/** Hash the unspent outputs of one transaction into the UTXO set digest. */
+static void ApplyStats(CCoinsStats& stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    ss << hash;
+    ss << (outputs.begin()->second.fCoinBase ? 'c' : 'n');
+    uint32_t nHeight = outputs.begin()->second.nHeight;
+    ss << VARINT(nHeight);
+    stats.nTransactions++;
+    for (std::map<uint32_t, Coin>::const_iterator it = outputs.begin(); it != outputs.end(); ++it) {
+        stats.nTransactionOutputs++;
+        ss << VARINT(it->first + 1);
+        ss << it->second.out;
+        stats.nTotalAmount += it->second.out.nValue;
+    }
+    ss << VARINT(0);
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
 {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('C', uint256(0));
+    pcursor->Seek(ssKeySet.str());
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
+    stats.nTotalAmount = 0;
+    stats.digest = CTxOutSetDigest();
+    stats.digest.hashBlock = stats.hashBlock;
+    uint256 prevkey(0);
+    std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() == 0 || slKey[0] != 'C')
+                break;
             CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i = 0; i < coins.vout.size(); i++) {
-                    const CTxOut& out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i + 1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+            COutPoint key;
+            CoinEntry entry(&key);
+            ssKey >> entry;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            Coin coin;
+            ssValue >> coin;
+            // Outputs of one transaction are adjacent in the database.
+            if (!outputs.empty() && key.hash != prevkey) {
+                ApplyStats(stats, ss, prevkey, outputs);
+                outputs.clear();
             }
+            prevkey = key.hash;
+            stats.digest.Add(key, coin);
+            outputs[key.n] = coin;
+            stats.nSerializedSize += 32 + slValue.size();
             pcursor->Next();
         } catch (std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
+    if (!outputs.empty())
+        ApplyStats(stats, ss, prevkey, outputs);
     stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
@@ -182,6 +433,146 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::WriteChainIndexes(const CChainIndexUpdate& update)
+{
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = update.vAddressIndex.begin(); it != update.vAddressIndex.end(); it++)
+        batch.Write(make_pair('a', it->first), it->second);
+    for (std::vector<CAddressIndexKey>::const_iterator it = update.vAddressIndexErase.begin(); it != update.vAddressIndexErase.end(); it++)
+        batch.Erase(make_pair('a', *it));
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = update.vAddressUnspentIndex.begin(); it != update.vAddressUnspentIndex.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair('u', it->first));
+        else
+            batch.Write(make_pair('u', it->first), it->second);
+    }
+    for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator it = update.vSpentIndex.begin(); it != update.vSpentIndex.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair('p', it->first));
+        else
+            batch.Write(make_pair('p', it->first), it->second);
+    }
+    for (std::vector<CTimestampIndexKey>::const_iterator it = update.vTimestampIndex.begin(); it != update.vTimestampIndex.end(); it++)
+        batch.Write(make_pair('s', *it), '\0');
+    for (std::vector<std::pair<uint256, CBlockStats> >::const_iterator it = update.vBlockStats.begin(); it != update.vBlockStats.end(); it++)
+        batch.Write(make_pair('x', it->first), it->second);
+    for (std::vector<std::pair<uint256, CTransaction> >::const_iterator it = update.vBudgetCollateral.begin(); it != update.vBudgetCollateral.end(); it++)
+        batch.Write(make_pair('k', it->second.GetHash()), *it);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressIndex(unsigned char type, const uint160& addressHash, std::vector<std::pair<CAddressIndexKey, CAmount> >& vAddressIndex, int nStart, int nEnd)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    if (nStart > 0)
+        ssKeySet << make_pair('a', CAddressIndexIteratorKey(type, addressHash, nStart));
+    else
+        ssKeySet << make_pair('a', CAddressIndexIteratorKey(type, addressHash));
+    pcursor->Seek(ssKeySet.str());
+
+    for (; pcursor->Valid(); pcursor->Next()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'a')
+                break;
+            CAddressIndexKey key;
+            ssKey >> key;
+            if (key.type != type || key.hashBytes != addressHash || (nEnd > 0 && key.blockHeight > nEnd))
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAmount nValue;
+            ssValue >> nValue;
+            vAddressIndex.push_back(std::make_pair(key, nValue));
+        } catch (const std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressUnspentIndex(unsigned char type, const uint160& addressHash, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspentOutputs)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('u', CAddressIndexIteratorKey(type, addressHash));
+    pcursor->Seek(ssKeySet.str());
+
+    for (; pcursor->Valid(); pcursor->Next()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'u')
+                break;
+            CAddressUnspentKey key;
+            ssKey >> key;
+            if (key.type != type || key.hashBytes != addressHash)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddressUnspentValue value;
+            ssValue >> value;
+            vUnspentOutputs.push_back(std::make_pair(key, value));
+        } catch (const std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value)
+{
+    return Read(make_pair('p', key), value);
+}
+
+bool CBlockTreeDB::ReadTimestampIndex(unsigned int nHigh, unsigned int nLow, std::vector<uint256>& vHashes)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('s', CTimestampIndexKey(nLow, uint256(0)));
+    pcursor->Seek(ssKeySet.str());
+
+    for (; pcursor->Valid(); pcursor->Next()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 's')
+                break;
+            CTimestampIndexKey key;
+            ssKey >> key;
+            if (key.timestamp > nHigh)
+                break;
+            vHashes.push_back(key.blockHash);
+        } catch (const std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+bool CBlockTreeDB::ReadBlockStats(const uint256& hashBlock, CBlockStats& stats)
+{
+    return Read(make_pair('x', hashBlock), stats);
+}
+
+bool CBlockTreeDB::ReadBudgetCollateral(const uint256& txid, CTransaction& tx, uint256& hashBlock)
+{
+    std::pair<uint256, CTransaction> value;
+    if (!Read(make_pair('k', txid), value))
+        return false;
+    hashBlock = value.first;
+    tx = value.second;
+    return true;
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string& name, bool fValue)
 {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
@@ -206,8 +597,318 @@ bool CBlockTreeDB::ReadInt(const std::string& name, int& nValue)
     return Read(std::make_pair('I', name), nValue);
 }
 
+/** Fill in the in-memory entry of a block index record read from disk. */
+CBlockIndex* InsertDiskBlockIndex(const uint256& hash, const CDiskBlockIndex& diskindex)
+{
+    // Construct block index object
+    CBlockIndex* pindexNew = InsertBlockIndex(hash);
+    pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
+    pindexNew->nHeight = diskindex.nHeight;
+    pindexNew->nFile = diskindex.nFile;
+    pindexNew->nDataPos = diskindex.nDataPos;
+    pindexNew->nUndoPos = diskindex.nUndoPos;
+    pindexNew->nVersion = diskindex.nVersion;
+    pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+    pindexNew->nTime = diskindex.nTime;
+    pindexNew->nBits = diskindex.nBits;
+    pindexNew->nNonce = diskindex.nNonce;
+    pindexNew->nStatus = diskindex.nStatus;
+    pindexNew->nTx = diskindex.nTx;
+
+    //Proof Of Stake
+    pindexNew->nMint = diskindex.nMint;
+    pindexNew->nMoneySupply = diskindex.nMoneySupply;
+    pindexNew->nFlags = diskindex.nFlags;
+    pindexNew->nStakeModifier = diskindex.nStakeModifier;
+
+    // ppcoin: build setStakeSeen
+    if (pindexNew->IsProofOfStake())
+        setStakeSeen.insert(make_pair(diskindex.prevoutStake, diskindex.nStakeTime));
+
+    return pindexNew;
+}
+
+/** Load a block index record from the database, checking its proof of work. */
+static bool LoadDiskBlockIndex(const uint256& hash, const CDiskBlockIndex& diskindex)
+{
+    CBlockIndex* pindexNew = InsertDiskBlockIndex(hash, diskindex);
+    if (IsProofOfWorkPeriod(pindexNew->nHeight)) {
+        if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
+            return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
+    }
+    return true;
+}
+
+namespace
+{
+static const char BLOCK_INDEX_SNAPSHOT_MAGIC[4] = {'b', 'i', 'd', 'x'};
+
+/** Write-only stream to the snapshot file that hashes everything written. */
+class CSnapshotWriter
+{
+private:
+    FILE* file;
+    CHash256 hasher;
+
+public:
+    int nType;
+    int nVersion;
+
+    CSnapshotWriter(FILE* fileIn, int nTypeIn, int nVersionIn) : file(fileIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+
+    CSnapshotWriter& write(const char* pch, size_t nSize)
+    {
+        if (fwrite(pch, 1, nSize, file) != nSize)
+            throw std::ios_base::failure("CSnapshotWriter::write : write failed");
+        hasher.Write((const unsigned char*)pch, nSize);
+        return (*this);
+    }
+
+    template <typename T>
+    CSnapshotWriter& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+
+    //! Append the hash of everything written so far.
+    void WriteChecksum()
+    {
+        uint256 hash;
+        hasher.Finalize(hash.begin());
+        *this << hash;
+    }
+};
+
+/** Read-only stream over a snapshot held in memory, which reads it in place. */
+class CSnapshotReader
+{
+private:
+    const char* pcur;
+    const char* pend;
+
+public:
+    int nType;
+    int nVersion;
+
+    CSnapshotReader(const char* pbegin, const char* pendIn, int nTypeIn, int nVersionIn) : pcur(pbegin), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+    bool empty() const { return pcur == pend; }
+
+    CSnapshotReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pcur))
+            throw std::ios_base::failure("CSnapshotReader::read : end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    template <typename T>
+    CSnapshotReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+/** Drop a partially loaded block index before loading it again from the database. */
+void ClearBlockIndex()
+{
+    mapBlockIndex.clear();
+    blockindexarena.Clear();
+    setStakeSeen.clear();
+}
+} // anon namespace
+
+static boost::filesystem::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blocks" / "index.snapshot";
+}
+
+bool CBlockTreeDB::WriteBlockIndexSnapshot()
+{
+    int64_t nStart = GetTimeMillis();
+    uint64_t nSnapshotId = GetRand(std::numeric_limits<uint64_t>::max());
+    boost::filesystem::path path = GetBlockIndexSnapshotPath();
+    boost::filesystem::path pathTmp = GetDataDir() / "blocks" / "index.snapshot.new";
+
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("%s : failed to open %s", __func__, pathTmp.string());
+    unsigned int nEntries = 0;
+    try {
+        CSnapshotWriter writer(file, SER_DISK, CLIENT_VERSION);
+        writer.write(BLOCK_INDEX_SNAPSHOT_MAGIC, sizeof(BLOCK_INDEX_SNAPSHOT_MAGIC));
+        writer << BLOCK_INDEX_SNAPSHOT_VERSION;
+        writer.write((const char*)Params().MessageStart(), MESSAGE_START_SIZE);
+        writer << nSnapshotId;
+
+        // Entries are copied as stored in the database, which holds all of
+        // them once the index has been flushed, with their hash so that
+        // loading does not have to recompute it.
+        boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+        CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+        ssKeySet << make_pair('b', uint256(0));
+        for (pcursor->Seek(ssKeySet.str()); pcursor->Valid() && pcursor->key()[0] == 'b'; pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            uint256 hash;
+            ssKey >> chType >> hash;
+            BlockMap::const_iterator mi = mapBlockIndex.find(hash);
+            if (mi == mapBlockIndex.end())
+                throw std::runtime_error("entry " + hash.ToString() + " is not loaded");
+            leveldb::Slice slValue = pcursor->value();
+            writer << hash << mi->second->nChainWork;
+            writer.write(slValue.data(), slValue.size());
+            nEntries++;
+        }
+        writer.WriteChecksum();
+    } catch (const std::exception& e) {
+        fclose(file);
+        boost::filesystem::remove(pathTmp);
+        return error("%s : failed to write %s - %s", __func__, pathTmp.string(), e.what());
+    }
+    FileCommit(file);
+    fclose(file);
+    if (!RenameOver(pathTmp, path))
+        return error("%s : failed to rename %s", __func__, pathTmp.string());
+
+    // Only now that the snapshot is on disk does it replace the record of
+    // changes made since the previous one.
+    CLevelDBBatch batch;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('d', uint256(0));
+    for (pcursor->Seek(ssKeySet.str()); pcursor->Valid() && pcursor->key()[0] == 'd'; pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+        char chType;
+        uint256 hash;
+        ssKey >> chType >> hash;
+        batch.Erase(make_pair('d', hash));
+    }
+    batch.Write('S', nSnapshotId);
+    if (!WriteBatch(batch, true))
+        return error("%s : failed to record the snapshot", __func__);
+
+    LogPrintf("Wrote block index snapshot of %u entries in %dms\n", nEntries, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CBlockTreeDB::LoadBlockIndexSnapshot()
+{
+    uint64_t nSnapshotId;
+    if (!Read('S', nSnapshotId))
+        return false;
+    boost::filesystem::path path = GetBlockIndexSnapshotPath();
+    if (!boost::filesystem::exists(path))
+        return false;
+
+    // Map the file where possible; otherwise read it into memory.
+    CMappedFile mapped;
+    std::vector<char> vData;
+    const char* pbegin;
+    size_t nSize;
+    if (mapped.Map(path)) {
+        pbegin = mapped.data();
+        nSize = mapped.size();
+    } else {
+        CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            return error("%s : failed to open %s", __func__, path.string());
+        vData.resize(boost::filesystem::file_size(path));
+        try {
+            file.read(vData.data(), vData.size());
+        } catch (const std::exception& e) {
+            return error("%s : failed to read %s - %s", __func__, path.string(), e.what());
+        }
+        pbegin = vData.data();
+        nSize = vData.size();
+    }
+
+    uint256 hashChecksum;
+    if (nSize < sizeof(hashChecksum))
+        return error("%s : %s is truncated", __func__, path.string());
+    nSize -= sizeof(hashChecksum);
+    memcpy(hashChecksum.begin(), pbegin + nSize, sizeof(hashChecksum));
+    if (Hash(pbegin, pbegin + nSize) != hashChecksum)
+        return error("%s : checksum mismatch in %s", __func__, path.string());
+
+    try {
+        CSnapshotReader reader(pbegin, pbegin + nSize, SER_DISK, CLIENT_VERSION);
+        char pchMagic[sizeof(BLOCK_INDEX_SNAPSHOT_MAGIC)];
+        unsigned char pchMessageStart[MESSAGE_START_SIZE];
+        int nSnapshotVersion;
+        uint64_t nSnapshotIdFile;
+        reader.read(pchMagic, sizeof(pchMagic));
+        reader >> nSnapshotVersion;
+        reader.read((char*)pchMessageStart, sizeof(pchMessageStart));
+        reader >> nSnapshotIdFile;
+        if (memcmp(pchMagic, BLOCK_INDEX_SNAPSHOT_MAGIC, sizeof(pchMagic)) || nSnapshotVersion != BLOCK_INDEX_SNAPSHOT_VERSION ||
+            memcmp(pchMessageStart, Params().MessageStart(), sizeof(pchMessageStart)))
+            return error("%s : %s is not a block index snapshot of this version and network", __func__, path.string());
+        if (nSnapshotIdFile != nSnapshotId) {
+            LogPrintf("%s : %s does not match the block index database, ignoring it\n", __func__, path.string());
+            return false;
+        }
+
+        while (!reader.empty()) {
+            uint256 hash, nChainWork;
+            CDiskBlockIndex diskindex;
+            reader >> hash >> nChainWork >> diskindex;
+            InsertDiskBlockIndex(hash, diskindex)->nChainWork = nChainWork;
+        }
+    } catch (const std::exception& e) {
+        ClearBlockIndex();
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
+    int64_t nStart = GetTimeMillis();
+    if (LoadBlockIndexSnapshot()) {
+        size_t nSnapshotEntries = mapBlockIndex.size();
+        int64_t nSnapshotTime = GetTimeMillis() - nStart;
+
+        // Apply the entries written to the database after the snapshot
+        boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+        CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+        ssKeySet << make_pair('d', uint256(0));
+        unsigned int nChanged = 0;
+        bool fOk = true;
+        for (pcursor->Seek(ssKeySet.str()); fOk && pcursor->Valid() && pcursor->key()[0] == 'd'; pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            try {
+                leveldb::Slice slKey = pcursor->key();
+                CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chType;
+                uint256 hash;
+                ssKey >> chType >> hash;
+                CDiskBlockIndex diskindex;
+                fOk = ReadBlockIndex(hash, diskindex) && LoadDiskBlockIndex(hash, diskindex);
+                nChanged++;
+            } catch (std::exception& e) {
+                fOk = error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            }
+        }
+        if (fOk) {
+            LogPrintf("Loaded %u block index entries from snapshot in %dms, %u changed since then from the database in %dms\n",
+                nSnapshotEntries, nSnapshotTime, nChanged, GetTimeMillis() - nStart - nSnapshotTime);
+            return true;
+        }
+        ClearBlockIndex();
+        LogPrintf("Block index snapshot is inconsistent with the database, loading from the database\n");
+    }
+
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
 
     CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
@@ -215,7 +916,6 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
     pcursor->Seek(ssKeySet.str());
 
     // Load mapBlockIndex
-    uint256 nPreviousCheckpoint;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -229,38 +929,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 CDiskBlockIndex diskindex;
                 ssValue >> diskindex;
 
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
-                pindexNew->nHeight = diskindex.nHeight;
-                pindexNew->nFile = diskindex.nFile;
-                pindexNew->nDataPos = diskindex.nDataPos;
-                pindexNew->nUndoPos = diskindex.nUndoPos;
-                pindexNew->nVersion = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime = diskindex.nTime;
-                pindexNew->nBits = diskindex.nBits;
-                pindexNew->nNonce = diskindex.nNonce;
-                pindexNew->nStatus = diskindex.nStatus;
-                pindexNew->nTx = diskindex.nTx;
-
-                //Proof Of Stake
-                pindexNew->nMint = diskindex.nMint;
-                pindexNew->nMoneySupply = diskindex.nMoneySupply;
-                pindexNew->nFlags = diskindex.nFlags;
-                pindexNew->nStakeModifier = diskindex.nStakeModifier;
-                pindexNew->prevoutStake = diskindex.prevoutStake;
-                pindexNew->nStakeTime = diskindex.nStakeTime;
-                pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-
-                if (IsProofOfWorkPeriod(pindexNew->nHeight)) {
-                    if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
-                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
-                }
-                // ppcoin: build setStakeSeen
-                if (pindexNew->IsProofOfStake())
-                    setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+                if (!LoadDiskBlockIndex(diskindex.GetBlockHash(), diskindex))
+                    return false;
 
                 pcursor->Next();
             } else {
@@ -271,5 +941,6 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
         }
     }
 
+    LogPrintf("Loaded %u block index entries from the database in %dms\n", mapBlockIndex.size(), GetTimeMillis() - nStart);
     return true;
 }
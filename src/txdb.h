@@ -7,15 +7,20 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "addressindex.h"
+#include "blockstats.h"
 #include "leveldbwrapper.h"
 #include "main.h"
+#include "spentindex.h"
+#include "timestampindex.h"
 
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
-class CCoins;
+#include <boost/scoped_ptr.hpp>
+
 class uint256;
 
 //! -dbcache default (MiB)
@@ -24,6 +29,8 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! Format version of the block index snapshot (blocks/index.snapshot)
+static const int BLOCK_INDEX_SNAPSHOT_VERSION = 2;
 
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
@@ -34,14 +41,70 @@ protected:
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
     uint256 GetBestBlock() const;
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const CTxOutSetDigest& digest);
+    bool GetTxOutSetDigest(CTxOutSetDigest& digest) const;
     bool GetStats(CCoinsStats& stats) const;
+    CCoinsViewCursor* Cursor() const;
+
+    //! Convert a chainstate with one record per transaction to one record per output.
+    bool Upgrade();
+};
+
+/** Cursor over a consistent snapshot of the coin database, taken when it is created. */
+class CCoinsViewDBCursor : public CCoinsViewCursor
+{
+public:
+    ~CCoinsViewDBCursor() {}
+
+    bool GetKey(COutPoint& key) const;
+    bool GetValue(Coin& coin) const;
+
+    bool Valid() const;
+    void Next();
+
+private:
+    CCoinsViewDBCursor(leveldb::Iterator* pcursorIn, const uint256& hashBlockIn) : CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+    boost::scoped_ptr<leveldb::Iterator> pcursor;
+    COutPoint keyTmp; //!< key of the current entry, valid when Valid() is true
+
+    void ReadKey();
+
+    friend class CCoinsViewDB;
 };
 
-/** Access to the block database (blocks/index/) */
+/**
+ * The changes connecting or disconnecting a block makes to the optional
+ * address, spent and timestamp indexes, written to the block database in one
+ * batch. Null unspent and spent index values erase their entry.
+ */
+struct CChainIndexUpdate {
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<CAddressIndexKey> vAddressIndexErase;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpentIndex;
+    std::vector<CTimestampIndexKey> vTimestampIndex;
+    std::vector<std::pair<uint256, CBlockStats> > vBlockStats;
+    //! Budget collateral transactions with the hash of their block
+    std::vector<std::pair<uint256, CTransaction> > vBudgetCollateral;
+
+    bool IsEmpty() const
+    {
+        return vAddressIndex.empty() && vAddressIndexErase.empty() && vAddressUnspentIndex.empty() &&
+               vSpentIndex.empty() && vTimestampIndex.empty() && vBlockStats.empty() && vBudgetCollateral.empty();
+    }
+};
+
+/**
+ * Access to the block database (blocks/index/)
+ *
+ * At a clean shutdown the whole block index is also written to a flat,
+ * checksummed snapshot (blocks/index.snapshot), which is loaded in place of
+ * iterating the database at the next start. Entries written to the database
+ * after the snapshot are marked, and loaded from the database on top of it.
+ */
 class CBlockTreeDB : public CLevelDBWrapper
 {
 public:
@@ -53,6 +116,7 @@ private:
 
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
+    bool ReadBlockIndex(const uint256& hash, CDiskBlockIndex& blockindex);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo& fileinfo);
     bool WriteBlockFileInfo(int nFile, const CBlockFileInfo& fileinfo);
     bool ReadLastBlockFile(int& nFile);
@@ -61,11 +125,27 @@ public:
     bool ReadReindexing(bool& fReindex);
     bool ReadTxIndex(const uint256& txid, CDiskTxPos& pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >& list);
+    bool WriteChainIndexes(const CChainIndexUpdate& update);
+    //! Read the credits and debits of an address, optionally only between two heights (inclusive)
+    bool ReadAddressIndex(unsigned char type, const uint160& addressHash, std::vector<std::pair<CAddressIndexKey, CAmount> >& vAddressIndex, int nStart = 0, int nEnd = 0);
+    bool ReadAddressUnspentIndex(unsigned char type, const uint160& addressHash, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspentOutputs);
+    bool ReadSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value);
+    //! Read the hashes of the blocks with timestamps from nLow to nHigh (inclusive), in time order
+    bool ReadTimestampIndex(unsigned int nHigh, unsigned int nLow, std::vector<uint256>& vHashes);
+    bool ReadBlockStats(const uint256& hashBlock, CBlockStats& stats);
+    bool ReadBudgetCollateral(const uint256& txid, CTransaction& tx, uint256& hashBlock);
     bool WriteFlag(const std::string& name, bool fValue);
     bool ReadFlag(const std::string& name, bool& fValue);
     bool WriteInt(const std::string& name, int nValue);
     bool ReadInt(const std::string& name, int& nValue);
     bool LoadBlockIndexGuts();
+    //! Load the entries of the block index snapshot, if there is one and it matches the database
+    bool LoadBlockIndexSnapshot();
+    //! Write the block index to the snapshot. The index must have been flushed to the database first.
+    bool WriteBlockIndexSnapshot();
 };
 
+/** Fill in the in-memory entry of a block index record read from disk or a snapshot. */
+CBlockIndex* InsertDiskBlockIndex(const uint256& hash, const CDiskBlockIndex& diskindex);
+
 #endif // BITCOIN_TXDB_H
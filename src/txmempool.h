@@ -8,12 +8,17 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index_container.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -29,11 +34,19 @@ inline bool AllowFree(double dPriority)
 }
 
 
-/** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
-static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
+/** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
+static const unsigned int MEMPOOL_HEIGHT = 0x3FFFFFFF;
 
 /**
  * CTxMemPool stores these:
+ *
+ * Besides the transaction itself, an entry keeps running totals over its
+ * in-mempool ancestors and descendants (each including the entry itself),
+ * which the pool updates as transactions are added and removed:
+ * - count, total size and total modified fee of the entry and its descendants,
+ *   used to evict whole packages and to limit chains of unconfirmed transactions
+ * - the same over the entry and its ancestors, used to select packages for
+ *   blocks by ancestor fee rate
  */
 class CTxMemPoolEntry
 {
@@ -42,9 +55,19 @@ private:
     CAmount nFee;         //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize;       //! ... and avoid recomputing tx size
     size_t nModSize;      //! ... and modified size for priority
+    size_t nUsageSize;    //! ... and total memory usage
     int64_t nTime;        //! Local time when entering the mempool
     double dPriority;     //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    CAmount feeDelta;     //! Fee delta set with prioritisetransaction
+
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
@@ -56,9 +79,135 @@ public:
     CAmount GetFee() const { return nFee; }
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
     unsigned int GetHeight() const { return nHeight; }
+    //! The fee including the prioritisetransaction delta, which block assembly and eviction go by
+    CAmount GetModifiedFee() const { return nFee + feeDelta; }
+
+    void UpdateFeeDelta(CAmount newFeeDelta);
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+};
+
+//! Modifiers for the entries of CTxMemPool::mapTx, which are const in the container
+struct update_descendant_state {
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) : modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount) {}
+    void operator()(CTxMemPoolEntry& e) { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_ancestor_state {
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) : modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount) {}
+    void operator()(CTxMemPoolEntry& e) { e.UpdateAncestorState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_fee_delta {
+    update_fee_delta(CAmount _feeDelta) : feeDelta(_feeDelta) {}
+    void operator()(CTxMemPoolEntry& e) { e.UpdateFeeDelta(feeDelta); }
+
+private:
+    CAmount feeDelta;
+};
+
+//! Extracts the transaction hash from a CTxMemPoolEntry, the key of the primary index of mapTx
+struct mempoolentry_txid {
+    typedef uint256 result_type;
+    result_type operator()(const CTxMemPoolEntry& entry) const
+    {
+        return entry.GetTx().GetHash();
+    }
+};
+
+/**
+ * Sort an entry by the higher of its own fee rate and the fee rate of it with
+ * its descendants, lowest first, so that the first entry is the package that
+ * is cheapest to evict.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aModFee = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+        double bModFee = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b)
+        double f1 = aModFee * bSize;
+        double f2 = aSize * bModFee;
+        // Of equal scores, the newer entry goes first
+        if (f1 == f2)
+            return a.GetTime() > b.GetTime();
+        return f1 < f2;
+    }
+
+    //! Whether the fee rate with descendants is the higher one
+    bool UseDescendantScore(const CTxMemPoolEntry& a) const
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+/** Sort by the time the entry entered the pool, oldest first. */
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        if (a.GetTime() == b.GetTime())
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return a.GetTime() < b.GetTime();
+    }
+};
+
+/** Sort by the fee rate of the entry together with its ancestors, highest first. */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double aFees = a.GetModFeesWithAncestors();
+        double aSize = a.GetSizeWithAncestors();
+        double bFees = b.GetModFeesWithAncestors();
+        double bSize = b.GetSizeWithAncestors();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b)
+        double f1 = aFees * bSize;
+        double f2 = aSize * bFees;
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 > f2;
+    }
 };
 
+//! Tags of the secondary indexes of CTxMemPool::mapTx
+struct descendant_score {};
+struct entry_time {};
+struct ancestor_score {};
+
 class CMinerPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -91,6 +240,19 @@ public:
  * are added to the pool: if a new transaction double-spends
  * an input of a transaction in the pool, it is dropped,
  * as are non-standard transactions.
+ *
+ * mapTx is a boost::multi_index container of the entries with four indexes:
+ * - by txid (the primary index)
+ * - by descendant score, see CompareTxMemPoolEntryByDescendantScore
+ * - by entry time
+ * - by ancestor fee rate, see CompareTxMemPoolEntryByAncestorFee
+ *
+ * mapLinks records the in-mempool parents and children of every entry, so that
+ * ancestors and descendants are found without looking at inputs. Both links
+ * and the ancestor and descendant totals of the entries are kept up to date by
+ * addUnchecked and the remove functions. A transaction added back from a
+ * disconnected block can already have children in the pool; the totals of
+ * everything connected to it are then recalculated.
  */
 class CTxMemPool
 {
@@ -101,36 +263,134 @@ private:
 
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
+
+    void trackPackageRemoved(const CFeeRate& rate);
 
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
+    typedef boost::multi_index_container<
+        CTxMemPoolEntry,
+        boost::multi_index::indexed_by<
+            // sorted by txid
+            boost::multi_index::ordered_unique<mempoolentry_txid>,
+            // sorted by fee rate, taking descendants into account
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByDescendantScore>,
+            // sorted by entry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<entry_time>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByEntryTime>,
+            // sorted by fee rate with ancestors
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFee> > >
+        indexed_transaction_set;
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
+    indexed_transaction_set mapTx;
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+
+    struct CompareIteratorByHash {
+        bool operator()(const txiter& a, const txiter& b) const
+        {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
+private:
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    txlinksMap mapLinks;
+
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+    //! Recalculate the ancestor and descendant totals of an entry from the links
+    void UpdateStateFromLinks(txiter it);
+    void removeUnchecked(txiter it);
+
+public:
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
 
     /**
      * If sanity-checking is turned on, check makes sure the pool is
      * consistent (does not contain two transactions that spend the same inputs,
-     * all inputs are in the mapNextTx array). If sanity-checking is turned off,
+     * all inputs are in the mapNextTx array, links and ancestor and descendant
+     * totals match the transactions). If sanity-checking is turned off,
      * check does nothing.
      */
     void check(const CCoinsViewCache* pcoins) const;
     void setSanityCheck(bool _fSanityCheck) { fSanityCheck = _fSanityCheck; }
 
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry);
+    //! Add an entry whose in-mempool ancestors were already calculated, as AcceptToMemoryPool does to check the chain limits
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry, const setEntries& setAncestors);
     void remove(const CTransaction& tx, std::list<CTransaction>& removed, bool fRecursive = false);
     void removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight);
     void removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed);
     void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight, std::list<CTransaction>& conflicts);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
-    void pruneSpent(const uint256& hash, CCoins& coins);
+    bool isSpent(const COutPoint& outpoint);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
 
+    /**
+     * Remove a set of entries from the pool, updating the totals of the
+     * ancestors and descendants that stay. If an entry is removed, all its
+     * descendants must be removed too, unless it was confirmed in a block.
+     */
+    void RemoveStaged(const setEntries& stage);
+
+    /**
+     * Find all in-mempool ancestors of an entry, failing if any of the limits
+     * on the entry with its ancestors, or on the descendants of any of them,
+     * would be exceeded.
+     * With fSearchForParents the parents are looked up from the inputs, for an
+     * entry that is not in the pool yet; otherwise the links are used.
+     */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents = true) const;
+
+    /** Add an entry and all its in-mempool descendants to setDescendants. */
+    void CalculateDescendants(txiter it, setEntries& setDescendants) const;
+
+    const setEntries& GetMemPoolParents(txiter entry) const;
+    const setEntries& GetMemPoolChildren(txiter entry) const;
+
+    /**
+     * The minimum fee to get into the mempool, which may itself not be enough
+     * for larger-sized transactions. After transactions were evicted by
+     * TrimToSize it is their fee rate plus the relay fee, and it decays back
+     * to zero with a half-life of ROLLING_FEE_HALFLIFE once blocks come in.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /**
+     * Remove transactions from the mempool until its dynamic size is <= sizelimit,
+     * taking the packages with the lowest fee rate including descendants first.
+     */
+    void TrimToSize(size_t sizelimit);
+
+    /** Expire all transaction (and their dependencies) in the mempool older than time. Return the number of removed transactions. */
+    int Expire(int64_t time);
+
     /** Affect CreateNewBlock prioritisation of transactions */
     void PrioritiseTransaction(const uint256 hash, const std::string strHash, double dPriorityDelta, const CAmount& nFeeDelta);
     void ApplyDeltas(const uint256 hash, double& dPriorityDelta, CAmount& nFeeDelta);
@@ -155,6 +415,8 @@ public:
 
     bool lookup(uint256 hash, CTransaction& result) const;
 
+    size_t DynamicMemoryUsage() const;
+
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
 
@@ -177,8 +439,8 @@ protected:
 
 public:
     CCoinsViewMemPool(CCoinsView* baseIn, CTxMemPool& mempoolIn);
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
 };
 
 #endif // BITCOIN_TXMEMPOOL_H
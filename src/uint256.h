@@ -360,6 +360,8 @@ public:
     uint256& SetCompact(uint32_t nCompact, bool* pfNegative = NULL, bool* pfOverflow = NULL);
     uint32_t GetCompact(bool fNegative = false) const;
     uint64_t GetHash(const uint256& salt) const;
+    //! Salted hash of this value and a 32-bit extra word, e.g. an output index.
+    uint64_t GetHash(const uint256& salt, uint32_t extra) const;
 };
 
 /* uint256 from const char *.
@@ -6,71 +6,114 @@
 #ifndef BITCOIN_UNDO_H
 #define BITCOIN_UNDO_H
 
+#include "coins.h"
 #include "compressor.h"
+#include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "serialize.h"
 
+#include <boost/foreach.hpp>
+
 /** Undo information for a CTxIn
  *
- *  Contains the prevout's CTxOut being spent, and if this was the
- *  last output of the affected transaction, its metadata as well
- *  (coinbase or not, height, transaction version)
+ *  Contains the prevout's CTxOut being spent, and its metadata as well
+ *  (coinbase or not, coinstake or not, height). The serialization contains a
+ *  dummy value of zero. This is to be compatible with older versions which
+ *  expect to see the transaction version there.
  */
-class CTxInUndo
+class TxInUndoSerializer
 {
-public:
-    CTxOut txout;   // the txout data before being spent
-    bool fCoinBase; // if the outpoint was the last unspent: whether it belonged to a coinbase
-    bool fCoinStake;
-    unsigned int nHeight; // if the outpoint was the last unspent: its height
-    int nVersion;         // if the outpoint was the last unspent: its version
+    const Coin* txout;
 
-    CTxInUndo() : txout(), fCoinBase(false), fCoinStake(false), nHeight(0), nVersion(0) {}
-    CTxInUndo(const CTxOut& txoutIn, bool fCoinBaseIn = false, bool fCoinStakeIn = false, unsigned int nHeightIn = 0, int nVersionIn = 0) : txout(txoutIn), fCoinBase(fCoinBaseIn), fCoinStake(fCoinStakeIn), nHeight(nHeightIn), nVersion(nVersionIn) {}
+public:
+    explicit TxInUndoSerializer(const Coin* coin) : txout(coin) {}
 
     unsigned int GetSerializeSize(int nType, int nVersion) const
     {
-        return ::GetSerializeSize(VARINT(nHeight * 4 + (fCoinBase ? 2 : 0) + (fCoinStake ? 1 : 0)), nType, nVersion) +
-               (nHeight > 0 ? ::GetSerializeSize(VARINT(this->nVersion), nType, nVersion) : 0) +
-               ::GetSerializeSize(CTxOutCompressor(REF(txout)), nType, nVersion);
+        return ::GetSerializeSize(VARINT(txout->nHeight * 4 + (txout->fCoinBase ? 2 : 0) + (txout->fCoinStake ? 1 : 0)), nType, nVersion) +
+               (txout->nHeight > 0 ? 1 : 0) +
+               ::GetSerializeSize(CTxOutCompressor(REF(txout->out)), nType, nVersion);
     }
 
     template <typename Stream>
     void Serialize(Stream& s, int nType, int nVersion) const
     {
-        ::Serialize(s, VARINT(nHeight * 4 + (fCoinBase ? 2 : 0) + (fCoinStake ? 1 : 0)), nType, nVersion);
-        if (nHeight > 0)
-            ::Serialize(s, VARINT(this->nVersion), nType, nVersion);
-        ::Serialize(s, CTxOutCompressor(REF(txout)), nType, nVersion);
+        ::Serialize(s, VARINT(txout->nHeight * 4 + (txout->fCoinBase ? 2 : 0) + (txout->fCoinStake ? 1 : 0)), nType, nVersion);
+        if (txout->nHeight > 0) {
+            // Required to maintain compatibility with older undo format.
+            ::Serialize(s, (unsigned char)0, nType, nVersion);
+        }
+        ::Serialize(s, CTxOutCompressor(REF(txout->out)), nType, nVersion);
     }
+};
+
+/**
+ * Reads a spent output back from the undo data. Undo records written before
+ * the per-output chainstate only carry metadata for the last output spent of
+ * each transaction; the others come back with nHeight == 0.
+ */
+class TxInUndoDeserializer
+{
+    Coin* txout;
+
+public:
+    explicit TxInUndoDeserializer(Coin* coin) : txout(coin) {}
 
     template <typename Stream>
     void Unserialize(Stream& s, int nType, int nVersion)
     {
         unsigned int nCode = 0;
         ::Unserialize(s, VARINT(nCode), nType, nVersion);
-        nHeight = nCode >> 2;
-        fCoinBase = nCode & 2;
-        fCoinStake = nCode & 1;
-        if (nHeight > 0)
-            ::Unserialize(s, VARINT(this->nVersion), nType, nVersion);
-        ::Unserialize(s, REF(CTxOutCompressor(REF(txout))), nType, nVersion);
+        txout->nHeight = nCode >> 2;
+        txout->fCoinBase = (nCode & 2) != 0;
+        txout->fCoinStake = nCode & 1;
+        if (txout->nHeight > 0) {
+            // Old versions stored the version number for the last spend of
+            // a transaction's outputs. Non-final spends were indicated with
+            // height = 0.
+            int nVersionDummy;
+            ::Unserialize(s, VARINT(nVersionDummy), nType, nVersion);
+        }
+        ::Unserialize(s, REF(CTxOutCompressor(txout->out)), nType, nVersion);
     }
 };
 
+static const size_t MAX_INPUTS_PER_BLOCK = MAX_BLOCK_SIZE / 41; // 41 bytes is the serialized size of an empty CTxIn
+
 /** Undo information for a CTransaction */
 class CTxUndo
 {
 public:
     // undo information for all txins
-    std::vector<CTxInUndo> vprevout;
+    std::vector<Coin> vprevout;
 
-    ADD_SERIALIZE_METHODS;
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        unsigned int nSize = GetSizeOfCompactSize(vprevout.size());
+        BOOST_FOREACH (const Coin& prevout, vprevout)
+            nSize += TxInUndoSerializer(&prevout).GetSerializeSize(nType, nVersion);
+        return nSize;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, vprevout.size());
+        BOOST_FOREACH (const Coin& prevout, vprevout)
+            ::Serialize(s, TxInUndoSerializer(&prevout), nType, nVersion);
+    }
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
     {
-        READWRITE(vprevout);
+        uint64_t count = ReadCompactSize(s);
+        if (count > MAX_INPUTS_PER_BLOCK)
+            throw std::ios_base::failure("Too many input undo records");
+        vprevout.resize(count);
+        BOOST_FOREACH (Coin& prevout, vprevout) {
+            TxInUndoDeserializer deserializer(&prevout);
+            ::Unserialize(s, deserializer, nType, nVersion);
+        }
     }
 };
 